@@ -0,0 +1,872 @@
+#include <benchmark/benchmark.h>
+#include "expressions/expression.hpp"
+#include "expressions/flat_expression.hpp"
+#include "expressions/batch_evaluator.hpp"
+#include "expressions/egraph.hpp"
+#include "expressions/complex_batch_evaluator.hpp"
+#include "expressions/cost_model.hpp"
+#include "expressions/interval.hpp"
+#include "expressions/solver.hpp"
+#include "expressions/stream_evaluator.hpp"
+#include "expressions/vector_math.hpp"
+
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+// sum_{k=1..n} sin(k*x) * exp(y / k) + x ^ 2 * ln(y)
+Expression<long double> make_expression(int terms) {
+    Expression<long double> x("x"), y("y");
+    Expression<long double> result = (x ^ Expression<long double>(2.0L)) * y.ln();
+    for (int k = 1; k <= terms; ++k) {
+        Expression<long double> c(static_cast<long double>(k));
+        result += (c * x).sin() * (y / c).exp();
+    }
+    return result;
+}
+
+const Bindings<long double> context{{"x", 0.75L}, {"y", 1.25L}};
+
+}
+
+// Сравнение виртуальной иерархии и плоского представления
+static void BM_VirtualEvalWith(benchmark::State& state) {
+    auto expr = make_expression(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.eval_with(context));
+    }
+}
+BENCHMARK(BM_VirtualEvalWith)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_VirtualEvalBound(benchmark::State& state) {
+    auto expr = make_expression(static_cast<int>(state.range(0))).with_context(context);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.eval());
+    }
+}
+BENCHMARK(BM_VirtualEvalBound)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_FlatEval(benchmark::State& state) {
+    FlatExpression<long double> flat(make_expression(static_cast<int>(state.range(0))));
+    std::vector<long double> workspace;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(flat.eval(context, workspace));
+    }
+}
+BENCHMARK(BM_FlatEval)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_VirtualDiff(benchmark::State& state) {
+    auto expr = make_expression(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.diff("x"));
+    }
+}
+BENCHMARK(BM_VirtualDiff)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_FlatDiff(benchmark::State& state) {
+    FlatExpression<long double> flat(make_expression(static_cast<int>(state.range(0))));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(flat.diff("x"));
+    }
+}
+BENCHMARK(BM_FlatDiff)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_VirtualWithContext(benchmark::State& state) {
+    auto expr = make_expression(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.with_context(context));
+    }
+}
+BENCHMARK(BM_VirtualWithContext)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_FlatWithContext(benchmark::State& state) {
+    FlatExpression<long double> flat(make_expression(static_cast<int>(state.range(0))));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(flat.with_context(context));
+    }
+}
+BENCHMARK(BM_FlatWithContext)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_VirtualToString(benchmark::State& state) {
+    auto expr = make_expression(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.to_string());
+    }
+}
+BENCHMARK(BM_VirtualToString)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_FlatToString(benchmark::State& state) {
+    FlatExpression<long double> flat(make_expression(static_cast<int>(state.range(0))));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(flat.to_string());
+    }
+}
+BENCHMARK(BM_FlatToString)->Arg(8)->Arg(64)->Arg(512);
+
+// Построение и дифференцирование длинных сумм
+static void BM_LongSumBuildAndDiff(benchmark::State& state) {
+    Expression<long double> x("x");
+    for (auto _ : state) {
+        Expression<long double> sum(0.0L);
+        for (int k = 1; k <= state.range(0); ++k) {
+            sum += Expression<long double>(static_cast<long double>(k)) * x.sin();
+        }
+        benchmark::DoNotOptimize(sum.diff("x"));
+    }
+    state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_LongSumBuildAndDiff)->RangeMultiplier(10)->Range(100, 100000)->Complexity();
+
+// Полиномы: дерево с OperationPow против узла Polynomial (схема Горнера)
+namespace {
+
+Expression<long double> make_polynomial_expression(int degree) {
+    Expression<long double> x("x");
+    Expression<long double> result(1.0L);
+    for (int k = 1; k <= degree; ++k) {
+        result += Expression<long double>(1.0L / k) * (x ^ Expression<long double>(static_cast<long double>(k)));
+    }
+    return result;
+}
+
+}
+
+static void BM_PolynomialPowTreeEval(benchmark::State& state) {
+    auto expr = make_polynomial_expression(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.eval_with(context));
+    }
+}
+BENCHMARK(BM_PolynomialPowTreeEval)->Arg(4)->Arg(16)->Arg(64);
+
+static void BM_PolynomialHornerEval(benchmark::State& state) {
+    auto expr = make_polynomial_expression(static_cast<int>(state.range(0))).detect_polynomials();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.eval_with(context));
+    }
+}
+BENCHMARK(BM_PolynomialHornerEval)->Arg(4)->Arg(16)->Arg(64);
+
+// Степени с постоянным показателем: значение и производная
+static void BM_ConstantPowerEval(benchmark::State& state) {
+    auto expr = make_polynomial_expression(static_cast<int>(state.range(0))).with_context(context);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.eval());
+    }
+}
+BENCHMARK(BM_ConstantPowerEval)->Arg(4)->Arg(16)->Arg(64);
+
+static void BM_ConstantPowerDiffEval(benchmark::State& state) {
+    auto derivative = make_polynomial_expression(static_cast<int>(state.range(0))).diff("x");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(derivative.eval_with(context));
+    }
+}
+BENCHMARK(BM_ConstantPowerDiffEval)->Arg(4)->Arg(16)->Arg(64);
+
+// Градиент: один обратный проход против N вызовов diff
+namespace {
+
+std::pair<Expression<long double>, std::vector<Symbol>> make_many_variables(int count) {
+    std::vector<Symbol> vars;
+    Expression<long double> result(0.0L);
+    Expression<long double> previous("v0");
+    vars.emplace_back("v0");
+    for (int i = 1; i < count; ++i) {
+        std::string name = "v";
+        name += std::to_string(i);
+        Expression<long double> current(name);
+        vars.emplace_back(name);
+        result += (previous * current).sin() * current.exp();
+        previous = current;
+    }
+    return {result, vars};
+}
+
+}
+
+static void BM_GradientReverseSweep(benchmark::State& state) {
+    auto [expr, vars] = make_many_variables(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.gradient(vars));
+    }
+}
+BENCHMARK(BM_GradientReverseSweep)->Arg(16)->Arg(128)->Arg(1024);
+
+static void BM_GradientRepeatedDiff(benchmark::State& state) {
+    auto [expr, vars] = make_many_variables(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        for (const auto &var : vars) {
+            benchmark::DoNotOptimize(expr.diff(var));
+        }
+    }
+}
+BENCHMARK(BM_GradientRepeatedDiff)->Arg(16)->Arg(128)->Arg(1024);
+
+// Функция и градиент в точке: отдельные ленты против одной общей
+namespace {
+
+std::vector<Expression<long double>> with_gradient(const Expression<long double>& f, const std::vector<Symbol>& vars) {
+    std::vector<Expression<long double>> outputs{f};
+    for (const auto& partial : f.gradient(vars))
+        outputs.push_back(partial);
+    return outputs;
+}
+
+Bindings<long double> bind_many(const std::vector<Symbol>& vars) {
+    Bindings<long double> bindings;
+    for (std::size_t i = 0; i < vars.size(); ++i)
+        bindings.bind(vars[i], 0.5L + 0.01L * i);
+    return bindings;
+}
+
+}
+
+static void BM_SeparateTapesEval(benchmark::State& state) {
+    auto [expr, vars] = make_many_variables(static_cast<int>(state.range(0)));
+    std::vector<FlatExpression<long double>> tapes;
+    std::size_t nodes = 0;
+    for (const auto& output : with_gradient(expr, vars)) {
+        tapes.emplace_back(output);
+        nodes += tapes.back().size();
+    }
+    auto bindings = bind_many(vars);
+    std::vector<long double> workspace, out(tapes.size());
+    for (auto _ : state) {
+        for (std::size_t k = 0; k < tapes.size(); ++k)
+            out[k] = tapes[k].eval(bindings, workspace);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.counters["nodes"] = static_cast<double>(nodes);
+}
+BENCHMARK(BM_SeparateTapesEval)->Arg(16)->Arg(128)->Arg(1024);
+
+static void BM_CompiledBundleEval(benchmark::State& state) {
+    auto [expr, vars] = make_many_variables(static_cast<int>(state.range(0)));
+    CompiledBundle<long double> bundle(with_gradient(expr, vars));
+    auto bindings = bind_many(vars);
+    std::vector<long double> workspace, out(bundle.outputs());
+    for (auto _ : state) {
+        bundle.eval(bindings, out.data(), workspace);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.counters["nodes"] = static_cast<double>(bundle.size());
+}
+BENCHMARK(BM_CompiledBundleEval)->Arg(16)->Arg(128)->Arg(1024);
+
+// Матрица Гессе: верхний треугольник против вложенных diff
+static void BM_HessianSymbolic(benchmark::State& state) {
+    auto [expr, vars] = make_many_variables(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.hessian(vars));
+    }
+}
+BENCHMARK(BM_HessianSymbolic)->Arg(8)->Arg(32);
+
+static void BM_HessianNestedDiff(benchmark::State& state) {
+    auto [expr, vars] = make_many_variables(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        for (const auto &first : vars) {
+            auto derivative = expr.diff(first);
+            for (const auto &second : vars) {
+                benchmark::DoNotOptimize(derivative.diff(second));
+            }
+        }
+    }
+}
+BENCHMARK(BM_HessianNestedDiff)->Arg(8)->Arg(32);
+
+static void BM_HessianVectorProduct(benchmark::State& state) {
+    auto [expr, vars] = make_many_variables(static_cast<int>(state.range(0)));
+    FlatExpression<long double> flat(expr);
+    Bindings<long double> point;
+    for (const auto &var : vars) {
+        point.bind(var, 0.5L);
+    }
+    std::vector<long double> direction(vars.size(), 1.0L);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(flat.hessian_vector_product(point, vars, direction));
+    }
+}
+BENCHMARK(BM_HessianVectorProduct)->Arg(8)->Arg(32)->Arg(1024);
+
+// k-я производная в точке: ряды Тейлора против символьного diff(by, k)
+static void BM_TaylorCoefficients(benchmark::State& state) {
+    FlatExpression<long double> flat(make_expression(8));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(flat.taylor_coefficients(context, "x", static_cast<std::size_t>(state.range(0))));
+    }
+}
+BENCHMARK(BM_TaylorCoefficients)->Arg(2)->Arg(4)->Arg(8)->Arg(16);
+
+static void BM_SymbolicHighOrderDiff(benchmark::State& state) {
+    auto expr = make_expression(8);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.diff("x", static_cast<std::size_t>(state.range(0))).eval_with(context));
+    }
+}
+BENCHMARK(BM_SymbolicHighOrderDiff)->Arg(2)->Arg(4)->Arg(8);
+
+// Ленивые производные: построение и полное раскрытие
+static void BM_LazyDiff(benchmark::State& state) {
+    auto expr = make_expression(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.lazy_diff("x"));
+    }
+}
+BENCHMARK(BM_LazyDiff)->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_LazyDiffEval(benchmark::State& state) {
+    auto expr = make_expression(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(expr.lazy_diff("x").eval_with(context));
+    }
+}
+BENCHMARK(BM_LazyDiffEval)->Arg(8)->Arg(64)->Arg(512);
+
+// Векторные трансцендентные функции и скалярный libm
+static std::vector<double> sample_points(std::size_t count, double low, double high) {
+    std::vector<double> points(count);
+    for (std::size_t i = 0; i < count; ++i)
+        points[i] = low + (high - low) * static_cast<double>(i) / static_cast<double>(count);
+    return points;
+}
+
+static void BM_LibmSin(benchmark::State& state) {
+    auto x = sample_points(4096, -100, 100);
+    std::vector<double> out(x.size());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(x.data());
+        for (std::size_t i = 0; i < x.size(); ++i)
+            out[i] = std::sin(x[i]);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * x.size());
+}
+BENCHMARK(BM_LibmSin);
+
+static void BM_VectorSin(benchmark::State& state) {
+    auto x = sample_points(4096, -100, 100);
+    std::vector<double> out(x.size());
+    for (auto _ : state) {
+        vector_sin(x.data(), out.data(), x.size(), static_cast<Accuracy>(state.range(0)));
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * x.size());
+}
+BENCHMARK(BM_VectorSin)->Arg(0)->Arg(1)->Arg(2);
+
+static void BM_LibmExp(benchmark::State& state) {
+    auto x = sample_points(4096, -50, 50);
+    std::vector<double> out(x.size());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(x.data());
+        for (std::size_t i = 0; i < x.size(); ++i)
+            out[i] = std::exp(x[i]);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * x.size());
+}
+BENCHMARK(BM_LibmExp);
+
+static void BM_VectorExp(benchmark::State& state) {
+    auto x = sample_points(4096, -50, 50);
+    std::vector<double> out(x.size());
+    for (auto _ : state) {
+        vector_exp(x.data(), out.data(), x.size(), static_cast<Accuracy>(state.range(0)));
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * x.size());
+}
+BENCHMARK(BM_VectorExp)->Arg(0)->Arg(1)->Arg(2);
+
+static void BM_LibmLog(benchmark::State& state) {
+    auto x = sample_points(4096, 1e-3, 1e3);
+    std::vector<double> out(x.size());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(x.data());
+        for (std::size_t i = 0; i < x.size(); ++i)
+            out[i] = std::log(x[i]);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * x.size());
+}
+BENCHMARK(BM_LibmLog);
+
+static void BM_VectorLog(benchmark::State& state) {
+    auto x = sample_points(4096, 1e-3, 1e3);
+    std::vector<double> out(x.size());
+    for (auto _ : state) {
+        vector_log(x.data(), out.data(), x.size(), static_cast<Accuracy>(state.range(0)));
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * x.size());
+}
+BENCHMARK(BM_VectorLog)->Arg(0)->Arg(1)->Arg(2);
+
+// Пакетное вычисление: поточечный eval и блочный BatchEvaluator
+static void BM_PointwiseEval(benchmark::State& state) {
+    FlatExpression<long double> flat(make_expression(8));
+    auto xs = sample_points(4096, 0.1, 2.0), ys = sample_points(4096, 0.5, 3.0);
+    std::vector<long double> workspace;
+    for (auto _ : state) {
+        long double total = 0;
+        for (std::size_t i = 0; i < xs.size(); ++i)
+            total += flat.eval({{"x", xs[i]}, {"y", ys[i]}}, workspace);
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * xs.size());
+}
+BENCHMARK(BM_PointwiseEval);
+
+static void BM_BatchEval(benchmark::State& state) {
+    BatchEvaluator batch(FlatExpression<long double>(make_expression(8)), static_cast<Accuracy>(state.range(0)));
+    auto xs = sample_points(4096, 0.1, 2.0), ys = sample_points(4096, 0.5, 3.0);
+    std::vector<double> out(xs.size());
+    for (auto _ : state) {
+        batch.eval({{"x", xs.data()}, {"y", ys.data()}}, xs.size(), out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * xs.size());
+}
+BENCHMARK(BM_BatchEval)->Arg(0)->Arg(1)->Arg(2);
+
+// Точки с ошибками: исключения поточечно и флаги состояния в пакете
+static std::vector<double> points_with_errors(std::size_t count) {
+    auto xs = sample_points(count, -1.0, 2.0);
+    for (std::size_t i = 0; i < count; i += 64)
+        xs[i] = 0.0;
+    return xs;
+}
+
+static void BM_PointwiseEvalCatching(benchmark::State& state) {
+    FlatExpression<long double> flat(Expression<long double>::from_string("1 / x + ln(x + 1) * sin(x)", true));
+    auto xs = points_with_errors(4096);
+    std::vector<long double> workspace;
+    for (auto _ : state) {
+        std::size_t bad = 0;
+        for (double x : xs) {
+            try {
+                benchmark::DoNotOptimize(flat.eval({{"x", x}}, workspace));
+            } catch (const std::runtime_error&) {
+                ++bad;
+            }
+        }
+        benchmark::DoNotOptimize(bad);
+    }
+    state.SetItemsProcessed(state.iterations() * xs.size());
+}
+BENCHMARK(BM_PointwiseEvalCatching);
+
+static void BM_BatchEvalChecked(benchmark::State& state) {
+    BatchEvaluator batch(FlatExpression<long double>(Expression<long double>::from_string("1 / x + ln(x + 1) * sin(x)", true)));
+    auto xs = points_with_errors(4096);
+    std::vector<double> out(xs.size());
+    std::vector<std::uint8_t> status(xs.size());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(batch.eval_checked({{"x", xs.data()}}, xs.size(), out.data(), status.data()));
+    }
+    state.SetItemsProcessed(state.iterations() * xs.size());
+}
+BENCHMARK(BM_BatchEvalChecked);
+
+static void BM_BatchEvalUnchecked(benchmark::State& state) {
+    BatchEvaluator batch(FlatExpression<long double>(Expression<long double>::from_string("1 / x + ln(x + 1) * sin(x)", true)));
+    auto xs = points_with_errors(4096);
+    std::vector<double> out(xs.size());
+    for (auto _ : state) {
+        batch.eval({{"x", xs.data()}}, xs.size(), out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * xs.size());
+}
+BENCHMARK(BM_BatchEvalUnchecked);
+
+// Комплексная сетка 64x64, как при раскраске области
+static Expression<std::complex<long double>> make_complex_expression() {
+    return Expression<std::complex<long double>>::from_string(
+        "(z ^ 3 - 1) / (3 * z ^ 2) + sin(z) * exp(z) / (z * z + (0.5 + 1i))", true);
+}
+
+static void complex_grid(std::vector<double>& re, std::vector<double>& im) {
+    for (int row = 0; row < 64; ++row) {
+        for (int column = 0; column < 64; ++column) {
+            re.push_back(-2.0 + 4.0 * (column + 0.5) / 64);
+            im.push_back(-2.0 + 4.0 * (row + 0.5) / 64);
+        }
+    }
+}
+
+static void BM_ComplexPointwiseEval(benchmark::State& state) {
+    using C = std::complex<long double>;
+    FlatExpression<C> flat(make_complex_expression());
+    std::vector<double> re, im;
+    complex_grid(re, im);
+    std::vector<C> workspace;
+    for (auto _ : state) {
+        C total = 0;
+        for (std::size_t i = 0; i < re.size(); ++i)
+            total += flat.eval({{"z", C(re[i], im[i])}}, workspace);
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * re.size());
+}
+BENCHMARK(BM_ComplexPointwiseEval);
+
+static void BM_ComplexBatchEval(benchmark::State& state) {
+    auto mode = state.range(0) ? ComplexBatchEvaluator::NanMode::Relaxed : ComplexBatchEvaluator::NanMode::Strict;
+    ComplexBatchEvaluator batch(FlatExpression<std::complex<long double>>(make_complex_expression()), mode);
+    std::vector<double> re, im;
+    complex_grid(re, im);
+    std::vector<double> out_re(re.size()), out_im(re.size());
+    for (auto _ : state) {
+        batch.eval({{"z", {re.data(), im.data()}}}, re.size(), out_re.data(), out_im.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * re.size());
+}
+BENCHMARK(BM_ComplexBatchEval)->Arg(0)->Arg(1);
+
+// Смешанная точность: double с оценкой ошибки и пересчёт в long double
+static void BM_BatchEvalMixed(benchmark::State& state) {
+    BatchEvaluator batch(FlatExpression<long double>(make_expression(8)));
+    auto xs = sample_points(4096, 0.1, 2.0), ys = sample_points(4096, 0.5, 3.0);
+    std::vector<double> out(xs.size());
+    std::size_t refined = 0;
+    for (auto _ : state) {
+        refined = batch.eval_mixed({{"x", xs.data()}, {"y", ys.data()}}, xs.size(), out.data(), std::pow(10.0, -static_cast<double>(state.range(0))));
+        benchmark::ClobberMemory();
+    }
+    state.counters["refined"] = static_cast<double>(refined);
+    state.SetItemsProcessed(state.iterations() * xs.size());
+}
+BENCHMARK(BM_BatchEvalMixed)->Arg(10)->Arg(12)->Arg(14);
+
+// Глобальный минимум: плотная выборка и метод ветвей и границ
+static Expression<long double> make_landscape() {
+    return Expression<long double>::from_string("sin(3 * x) * cos(2 * y) + (x ^ 2 + y ^ 2) / 10", true);
+}
+
+static void BM_DenseSamplingMinimum(benchmark::State& state) {
+    FlatExpression<long double> flat(make_landscape());
+    const int side = static_cast<int>(state.range(0));
+    std::vector<long double> workspace;
+    for (auto _ : state) {
+        long double best = std::numeric_limits<long double>::infinity();
+        for (int i = 0; i <= side; ++i) {
+            for (int j = 0; j <= side; ++j) {
+                long double x = -5.0L + 10.0L * i / side, y = -5.0L + 10.0L * j / side;
+                best = std::min(best, flat.eval({{"x", x}, {"y", y}}, workspace));
+            }
+        }
+        benchmark::DoNotOptimize(best);
+    }
+}
+BENCHMARK(BM_DenseSamplingMinimum)->Arg(64)->Arg(256)->Arg(1024)->Unit(benchmark::kMillisecond);
+
+static void BM_BranchAndBoundMinimum(benchmark::State& state) {
+    auto f = make_landscape();
+    const long double tolerance = std::pow(10.0L, -static_cast<long double>(state.range(0)));
+    GlobalMinimum minimum{};
+    for (auto _ : state) {
+        minimum = global_minimum(f, {{"x", {-5.0L, 5.0L}}, {"y", {-5.0L, 5.0L}}}, tolerance);
+        benchmark::DoNotOptimize(minimum.lower);
+    }
+    state.counters["boxes"] = static_cast<double>(minimum.boxes);
+}
+BENCHMARK(BM_BranchAndBoundMinimum)->Arg(3)->Arg(6)->Arg(9)->Unit(benchmark::kMillisecond);
+
+// Оптимизатор на e-графе: вычисление производной до и после, цена насыщения
+static Expression<long double> make_derivative(int order) {
+    auto f = Expression<long double>::from_string("exp(x ^ 2) * sin(x) / (1 + x ^ 2) + sin(x) * cos(x)", true);
+    return f.diff("x", static_cast<std::size_t>(order));
+}
+
+static void BM_DerivativeEval(benchmark::State& state) {
+    FlatExpression<long double> flat(make_derivative(static_cast<int>(state.range(0))));
+    std::vector<long double> workspace;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(flat.eval(context, workspace));
+    }
+    state.counters["nodes"] = static_cast<double>(flat.size());
+}
+BENCHMARK(BM_DerivativeEval)->Arg(1)->Arg(2);
+
+static void BM_OptimizedDerivativeEval(benchmark::State& state) {
+    FlatExpression<long double> flat(optimize(make_derivative(static_cast<int>(state.range(0)))));
+    std::vector<long double> workspace;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(flat.eval(context, workspace));
+    }
+    state.counters["nodes"] = static_cast<double>(flat.size());
+}
+BENCHMARK(BM_OptimizedDerivativeEval)->Arg(1)->Arg(2);
+
+static void BM_EGraphSaturate(benchmark::State& state) {
+    auto derivative = make_derivative(static_cast<int>(state.range(0)));
+    SaturationReport report{};
+    for (auto _ : state) {
+        EGraph<long double> graph(derivative);
+        report = graph.saturate();
+        benchmark::DoNotOptimize(graph.extract().size());
+    }
+    state.counters["enodes"] = static_cast<double>(report.nodes);
+    state.counters["saturated"] = report.saturated;
+}
+BENCHMARK(BM_EGraphSaturate)->Arg(1)->Arg(2)->Unit(benchmark::kMillisecond);
+
+// Модель стоимости: предсказанное время вычисления ленты (счётчик
+// predicted_ns, модель калибруется на этой машине) против измеренного
+static void BM_CostModelPrediction(benchmark::State& state) {
+    static const CostModel model = CostModel::calibrate();
+    auto expr = state.range(0) == 0 ? make_expression(16) : make_derivative(static_cast<int>(state.range(0)));
+    FlatExpression<long double> flat(expr);
+    std::vector<long double> workspace;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(flat.eval(context, workspace));
+    }
+    state.counters["predicted_ns"] = model.estimate(flat).nanoseconds;
+    state.counters["nodes"] = static_cast<double>(flat.size());
+}
+BENCHMARK(BM_CostModelPrediction)->Arg(0)->Arg(1)->Arg(2);
+
+static void BM_CostModelCalibrate(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CostModel::calibrate());
+    }
+}
+BENCHMARK(BM_CostModelCalibrate)->Unit(benchmark::kMillisecond);
+
+// Решатели: итерации в секунду. Ручной цикл дифференцирует и обходит дерево
+// на каждой итерации, SystemSolver и Minimizer компилируют всё один раз
+static std::vector<Expression<long double>> make_circle_system() {
+    return {
+        Expression<long double>::from_string("x ^ 2 + y ^ 2 - 4 + sin(x * y) / 10", true),
+        Expression<long double>::from_string("exp(x - y) - 1", true)
+    };
+}
+
+static void BM_HandRolledNewton(benchmark::State& state) {
+    auto system = make_circle_system();
+    std::size_t iterations = 0;
+    for (auto _ : state) {
+        long double x = 1.0L, y = 0.5L;
+        for (int k = 0; k < 100; ++k, ++iterations) {
+            Bindings<long double> context{{"x", x}, {"y", y}};
+            long double f0 = system[0].eval_with(context), f1 = system[1].eval_with(context);
+            if (std::hypot(f0, f1) <= 1e-12L)
+                break;
+            long double a = system[0].diff("x").eval_with(context), b = system[0].diff("y").eval_with(context);
+            long double c = system[1].diff("x").eval_with(context), d = system[1].diff("y").eval_with(context);
+            long double det = a * d - b * c;
+            x -= (d * f0 - b * f1) / det;
+            y -= (a * f1 - c * f0) / det;
+        }
+        benchmark::DoNotOptimize(x);
+        benchmark::DoNotOptimize(y);
+    }
+    state.counters["iterations"] = benchmark::Counter(static_cast<double>(iterations), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_HandRolledNewton);
+
+static void BM_SystemSolverNewton(benchmark::State& state) {
+    SystemSolver solver(make_circle_system(), {"x", "y"});
+    std::size_t iterations = 0;
+    for (auto _ : state) {
+        auto result = solver.newton({1.0L, 0.5L});
+        iterations += result.iterations;
+        benchmark::DoNotOptimize(result.x.data());
+    }
+    state.counters["iterations"] = benchmark::Counter(static_cast<double>(iterations), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_SystemSolverNewton);
+
+static void BM_LevenbergMarquardtFit(benchmark::State& state) {
+    std::vector<Expression<long double>> residuals;
+    for (int i = 0; i < state.range(0); ++i) {
+        long double t = 5.0L * i / state.range(0);
+        residuals.push_back(
+            Expression<long double>("a") * (Expression<long double>("b") * Expression<long double>(t)).exp()
+            + Expression<long double>("c") - Expression<long double>(2.0L * std::exp(0.3L * t) + std::sin(7.0L * t) / 100)
+        );
+    }
+    SystemSolver solver(residuals, {"a", "b", "c"});
+    std::size_t iterations = 0;
+    for (auto _ : state) {
+        auto result = solver.levenberg_marquardt({1.0L, 0.0L, 0.0L});
+        iterations += result.iterations;
+        benchmark::DoNotOptimize(result.x.data());
+    }
+    state.counters["iterations"] = benchmark::Counter(static_cast<double>(iterations), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_LevenbergMarquardtFit)->Arg(16)->Arg(256);
+
+static void BM_MinimizeRosenbrock(benchmark::State& state) {
+    Minimizer minimizer(Expression<long double>::from_string("(1 - x) ^ 2 + 100 * (y - x ^ 2) ^ 2", true), {"x", "y"});
+    std::size_t iterations = 0;
+    for (auto _ : state) {
+        auto result = state.range(0) ? minimizer.newton({-1.2L, 1.0L}) : minimizer.bfgs({-1.2L, 1.0L});
+        iterations += result.iterations;
+        benchmark::DoNotOptimize(result.x.data());
+    }
+    state.counters["iterations"] = benchmark::Counter(static_cast<double>(iterations), benchmark::Counter::kIsRate);
+}
+// 0 - BFGS, 1 - Ньютон
+BENCHMARK(BM_MinimizeRosenbrock)->Arg(0)->Arg(1);
+
+// Композиция f(f(...f(x))): подстановка строк и повторный разбор растут как
+// 3^n, подстановка в DAG линейна
+static void BM_ComposeByReparse(benchmark::State& state) {
+    const std::string f = "x * x + x / 2";
+    for (auto _ : state) {
+        std::string text = "x";
+        for (int k = 0; k < state.range(0); ++k) {
+            std::string next;
+            for (char c : f)
+                next += c == 'x' ? "(" + text + ")" : std::string(1, c);
+            text = std::move(next);
+        }
+        benchmark::DoNotOptimize(Expression<long double>::from_string(text, true));
+    }
+}
+BENCHMARK(BM_ComposeByReparse)->Arg(4)->Arg(8);
+
+static void BM_ComposeSubstitute(benchmark::State& state) {
+    auto f = Expression<long double>::from_string("x * x + x / 2", true);
+    for (auto _ : state) {
+        Expression<long double> g("x");
+        for (int k = 0; k < state.range(0); ++k)
+            g = f.substitute("x", g);
+        benchmark::DoNotOptimize(g);
+    }
+}
+BENCHMARK(BM_ComposeSubstitute)->Arg(4)->Arg(8)->Arg(64);
+
+// Обход цепочки cos(cos(...cos(x))): глубина ограничена только памятью кучи,
+// время на узел не должно расти с глубиной
+static void BM_DeepChainEval(benchmark::State& state) {
+    Expression<long double> v("x");
+    for (int k = 0; k < state.range(0); ++k)
+        v = v.cos();
+    const Bindings<long double> context{{"x", 0.5L}};
+    for (auto _ : state)
+        benchmark::DoNotOptimize(v.eval_with(context));
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DeepChainEval)->Arg(1 << 10)->Arg(1 << 20);
+
+// Построение выражений: каждый оператор копирует дескрипторы узлов, так что
+// время зависит от стоимости счётчика ссылок
+static void BM_BuildExpression(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(make_expression(static_cast<int>(state.range(0))));
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BuildExpression)->Arg(64)->Arg(512);
+
+static void BM_BuildAndDiff(benchmark::State& state) {
+    for (auto _ : state) {
+        auto expr = make_expression(static_cast<int>(state.range(0)));
+        benchmark::DoNotOptimize(expr.diff("x").diff("y"));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BuildAndDiff)->Arg(64)->Arg(512);
+
+// Сумма n слагаемых с разными переменными: цикл += дописывает их в конец
+// узла (номера переменных растут), sum() собирает узел за один проход
+std::vector<Expression<long double>> make_terms(int n) {
+    std::vector<Expression<long double>> terms;
+    for (int k = 0; k < n; ++k) {
+        Expression<long double> v("v_" + std::to_string(k));
+        terms.push_back(k % 2 ? v.sin() : v);
+    }
+    return terms;
+}
+
+static void BM_SumByOperator(benchmark::State& state) {
+    const auto terms = make_terms(static_cast<int>(state.range(0)));
+    for (auto _ : state) {
+        Expression<long double> sum(0.0L);
+        for (const auto& term : terms)
+            sum += term;
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SumByOperator)->Arg(1000)->Arg(100000);
+
+static void BM_SumBuilder(benchmark::State& state) {
+    const auto terms = make_terms(static_cast<int>(state.range(0)));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Expression<long double>::sum(terms));
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SumBuilder)->Arg(1000)->Arg(100000);
+
+// Разбор длинной формулы: лексер читает строку на месте, без копии и
+// приведения регистра всей строки
+static void BM_ParseExpression(benchmark::State& state) {
+    std::string text;
+    for (int k = 1; k <= state.range(0); ++k) {
+        if (k > 1)
+            text += " + ";
+        text += std::to_string(k) + ".5*X^" + std::to_string(k % 5 + 1) + "*sin(y/" + std::to_string(k % 7 + 1) + ") - cos(X*y)";
+    }
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Expression<long double>::from_string(text, false));
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_ParseExpression)->Arg(100)->Arg(10000);
+
+// Потоковое вычисление по файлу из 10^6 строк (x, id, y): CSV разбирается
+// кусками, бинарные столбцы читаются прямо из отображения. Результаты
+// уходят в /dev/null, так что измеряются разбор, вычисление и форматирование
+static void BM_StreamCsv(benchmark::State& state) {
+    const std::size_t rows = 1000000;
+    const std::string path = "/tmp/bm_stream.csv";
+    {
+        std::ofstream out(path);
+        out << "x,id,y\n";
+        for (std::size_t i = 0; i < rows; ++i)
+            out << i * 1e-6 << "," << i << "," << 1.0 + i * 1e-6 << "\n";
+    }
+    StreamEvaluator stream(FlatExpression<long double>(Expression<long double>::from_string("sin(x) * y + x / y", true)));
+    std::ofstream sink("/dev/null");
+    for (auto _ : state)
+        benchmark::DoNotOptimize(stream.eval_csv(path, sink));
+    state.SetItemsProcessed(state.iterations() * rows);
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_StreamCsv)->Unit(benchmark::kMillisecond);
+
+static void BM_StreamBinary(benchmark::State& state) {
+    const std::size_t rows = 1000000;
+    const std::string path = "/tmp/bm_stream.bin";
+    {
+        std::vector<double> data(2 * rows);
+        for (std::size_t i = 0; i < rows; ++i) {
+            data[i] = i * 1e-6;
+            data[rows + i] = 1.0 + i * 1e-6;
+        }
+        std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(double));
+    }
+    StreamEvaluator stream(FlatExpression<long double>(Expression<long double>::from_string("sin(x) * y + x / y", true)));
+    std::ofstream sink("/dev/null", std::ios::binary);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(stream.eval_binary(path, {"x", "y"}, sink));
+    state.SetItemsProcessed(state.iterations() * rows);
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_StreamBinary)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
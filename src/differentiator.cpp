@@ -1,18 +1,26 @@
 #include "expressions/expression.hpp"
+#include "expressions/solver.hpp"
+#include "expressions/cost_model.hpp"
+#include "expressions/stream_evaluator.hpp"
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <regex>
 #include <stdexcept>
 #include <unordered_map>
 #include <complex>
+#include <vector>
 
 using VariableType = std::unordered_map<std::string, long double>;
 using ComplexVariableType = std::unordered_map<std::string, std::complex<long double>>;
 
+// With a cost model the report is for the expression printed last: the
+// derivative when differentiating.
 template <typename T, typename VarMap>
 std::string run_task(
     Expression<T> expr, bool to_diff, bool to_eval,
-    const std::string &diff_by, VarMap &values
+    const std::string &diff_by, VarMap &values, const CostModel *cost_model = nullptr
 ) {
     std::stringstream oss;
 
@@ -23,18 +31,122 @@ std::string run_task(
         if (to_eval) {
             oss << "Evaluated derivative: " << diff_expr.eval_with(values) << "\n";
         }
+        expr = diff_expr;
     }
 
     if (to_eval && !to_diff) {
         oss << "Evaluated: " << expr.eval_with(values) << "\n";
     }
 
+    if (cost_model)
+        oss << cost_model->estimate(expr).to_string();
+
+    return oss.str();
+}
+
+std::vector<std::string> split(const std::string &list, char separator) {
+    std::vector<std::string> parts;
+    std::stringstream stream(list);
+    for (std::string part; std::getline(stream, part, separator);)
+        if (part.find_first_not_of(' ') != std::string::npos)
+            parts.push_back(part);
+    return parts;
+}
+
+// Evaluates the expression, or its derivative with --diff, over every row of
+// a CSV or binary columnar file. Returns the number of rows.
+std::size_t run_stream(
+    const Expression<long double> &expr, bool to_diff, const std::string &diff_by,
+    const std::string &data_path, bool binary, const std::string &columns, const std::string &output_path
+) {
+    StreamEvaluator evaluator(FlatExpression<long double>(to_diff ? expr.diff(diff_by) : expr));
+
+    std::ofstream file;
+    if (!output_path.empty()) {
+        file.open(output_path, std::ios::binary);
+        if (!file)
+            throw std::runtime_error("Cannot open " + output_path);
+    }
+    std::ostream &out = output_path.empty() ? std::cout : file;
+
+    if (!binary)
+        return evaluator.eval_csv(data_path, out);
+    std::vector<Symbol> names;
+    for (auto name : split(columns, ',')) {
+        name.erase(std::remove(name.begin(), name.end(), ' '), name.end());
+        names.emplace_back(name);
+    }
+    return evaluator.eval_binary(data_path, names, out);
+}
+
+// Equations are separated by ';', unknowns by ',' in --by. Without --by the
+// unknowns are the assigned variables in alphabetical order; unassigned
+// unknowns start at zero.
+std::string run_solver(
+    const std::string &problem, bool minimize, const std::string &method,
+    const std::string &unknowns, const VariableType &values
+) {
+    std::vector<std::string> names = split(unknowns, ',');
+    for (auto &name : names)
+        name.erase(std::remove(name.begin(), name.end(), ' '), name.end());
+    if (names.empty()) {
+        for (const auto &[name, value] : values)
+            names.push_back(name);
+        std::sort(names.begin(), names.end());
+    }
+    if (names.empty())
+        throw std::invalid_argument("No unknowns specified, use --by x,y");
+
+    std::vector<Symbol> vars;
+    std::vector<long double> start;
+    for (const auto &name : names) {
+        vars.emplace_back(name);
+        auto it = values.find(name);
+        start.push_back(it == values.end() ? 0.0L : it->second);
+    }
+
+    SolverResult result;
+    if (minimize) {
+        Minimizer minimizer(Expression<long double>::from_string(problem, true), vars);
+        if (method.empty() || method == "bfgs")
+            result = minimizer.bfgs(start);
+        else if (method == "newton")
+            result = minimizer.newton(start);
+        else
+            throw std::invalid_argument("Unknown method for --minimize: " + method);
+    } else {
+        std::vector<Expression<long double>> equations;
+        for (const auto &equation : split(problem, ';'))
+            equations.push_back(Expression<long double>::from_string(equation, true));
+        SystemSolver solver(equations, vars);
+        if (method.empty())
+            result = equations.size() == vars.size() ? solver.damped_newton(start) : solver.levenberg_marquardt(start);
+        else if (method == "newton")
+            result = solver.newton(start);
+        else if (method == "damped")
+            result = solver.damped_newton(start);
+        else if (method == "lm")
+            result = solver.levenberg_marquardt(start);
+        else
+            throw std::invalid_argument("Unknown method for --solve: " + method);
+    }
+
+    std::stringstream oss;
+    oss.precision(15);
+    oss << (result.converged ? "Converged" : "Did not converge") << " after " << result.iterations << " iterations\n";
+    for (std::size_t j = 0; j < names.size(); ++j)
+        oss << names[j] << " = " << result.x[j] << "\n";
+    oss << (minimize ? "Gradient norm: " : "Residual norm: ") << result.residual << "\n";
     return oss.str();
 }
 
 int main(int argc, char* argv[]) {
-    std::string expression_string, diff_by;
+    std::string expression_string, expression_path, diff_by, method;
     bool eval_expr = false, diff_expr = false, use_complex = false;
+    bool solve = false, minimize = false, cost = false;
+    std::string model_path, calibrate_path;
+    std::string data_path, columns, output_path;
+    bool binary = false;
     VariableType variables;
     ComplexVariableType complex_variables;
 
@@ -46,10 +158,42 @@ int main(int argc, char* argv[]) {
             expression_string = argv[i];
             diff_expr |= (arg == "--diff");
             eval_expr |= (arg == "--eval");
+        } else if (arg == "--eval-file" || arg == "--diff-file") {
+            // The file is mapped and parsed in place, never read into a string.
+            if (++i >= argc)
+                throw std::invalid_argument("No value specified for " + arg);
+            expression_path = argv[i];
+            diff_expr |= (arg == "--diff-file");
+            eval_expr |= (arg == "--eval-file");
+        } else if (arg == "--solve" || arg == "--minimize") {
+            if (++i >= argc)
+                throw std::invalid_argument("No value specified for " + arg);
+            expression_string = argv[i];
+            solve |= (arg == "--solve");
+            minimize |= (arg == "--minimize");
+        } else if (arg == "--method") {
+            if (++i >= argc)
+                throw std::invalid_argument("No value specified for --method");
+            method = argv[i];
         } else if (arg == "--by") {
             if (++i >= argc)
                 throw std::invalid_argument("No value specified for --by");
             diff_by = argv[i];
+        } else if (arg == "--csv" || arg == "--binary") {
+            if (++i >= argc)
+                throw std::invalid_argument("No value specified for " + arg);
+            data_path = argv[i];
+            binary = (arg == "--binary");
+        } else if (arg == "--columns" || arg == "--output") {
+            if (++i >= argc)
+                throw std::invalid_argument("No value specified for " + arg);
+            (arg == "--columns" ? columns : output_path) = argv[i];
+        } else if (arg == "--cost") {
+            cost = true;
+        } else if (arg == "--model" || arg == "--calibrate") {
+            if (++i >= argc)
+                throw std::invalid_argument("No value specified for " + arg);
+            (arg == "--model" ? model_path : calibrate_path) = argv[i];
         } else if (arg == "--complex") {
             use_complex = true;
         } else if (arg.find("=") != std::string::npos) {
@@ -76,15 +220,51 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    if (use_complex) {
-        auto expression = Expression<std::complex<long double>>::from_string(expression_string, true);
+    // --calibrate measures this machine and takes precedence over --model.
+    CostModel cost_model = CostModel::defaults();
+    if (!model_path.empty() && calibrate_path.empty())
+        cost_model = CostModel::load(model_path);
+    if (!calibrate_path.empty()) {
+        cost_model = CostModel::calibrate();
+        cost_model.save(calibrate_path);
+        std::cout << "Calibrated cost model, ns per operation:\n";
+        for (std::size_t op = 0; op < CostModel::opcode_count; ++op)
+            std::cout << CostModel::name(OpCode(op)) << " " << cost_model.cost(OpCode(op), 1) << "\n";
+        if (expression_string.empty() && expression_path.empty())
+            return 0;
+        std::cout << "\n";
+    }
+    const CostModel *model = cost ? &cost_model : nullptr;
+
+    if ((solve || minimize) && !expression_path.empty())
+        throw std::invalid_argument("--solve and --minimize take their problem from the command line");
+    if (!data_path.empty()) {
+        if (solve || minimize || use_complex)
+            throw std::invalid_argument("--csv and --binary stream a real --eval or --diff expression");
+        if (binary && columns.empty())
+            throw std::invalid_argument("--binary needs the column names, use --columns x,y");
+        auto expression = expression_path.empty()
+            ? Expression<long double>::from_string(expression_string, true)
+            : Expression<long double>::from_file(expression_path, true);
+        std::size_t rows = run_stream(expression, diff_expr, diff_by, data_path, binary, columns, output_path);
+        std::cerr << "Evaluated " << rows << " rows\n";
+    } else if (solve || minimize) {
+        if (use_complex)
+            throw std::invalid_argument("--solve and --minimize work over the reals only");
+        std::cout << run_solver(expression_string, minimize, method, diff_by, variables) << "\n";
+    } else if (use_complex) {
+        auto expression = expression_path.empty()
+            ? Expression<std::complex<long double>>::from_string(expression_string, true)
+            : Expression<std::complex<long double>>::from_file(expression_path, true);
         std::cout << run_task(
-            expression, diff_expr, eval_expr, diff_by, complex_variables
+            expression, diff_expr, eval_expr, diff_by, complex_variables, model
         ) << "\n";
     } else {
-        auto expression = Expression<long double>::from_string(expression_string, true);
+        auto expression = expression_path.empty()
+            ? Expression<long double>::from_string(expression_string, true)
+            : Expression<long double>::from_file(expression_path, true);
         std::cout << run_task(
-            expression, diff_expr, eval_expr, diff_by, variables
+            expression, diff_expr, eval_expr, diff_by, variables, model
         ) << "\n";
     }
 
@@ -0,0 +1,299 @@
+#include "adjoint.hpp"
+#include "polynomial.hpp"
+
+#include <algorithm>
+#include <complex>
+#include <stdexcept>
+
+namespace {
+
+template <typename T>
+bool is_value(const Ref<ExpressionImpl<T>> &node, T number)
+{
+	const auto *value = dynamic_cast<const Value<T> *>(node.get());
+	return value != nullptr && value->get_value() == number;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> constant(T number)
+{
+	return make_ref<Value<T>>(number);
+}
+
+// adjoint * partial without the trivial unit factors.
+template <typename T>
+Ref<ExpressionImpl<T>> scaled(
+	const Ref<ExpressionImpl<T>> &adjoint,
+	const Ref<ExpressionImpl<T>> &partial
+)
+{
+	if (is_value(adjoint, T(1)))
+		return partial;
+	if (is_value(partial, T(1)))
+		return adjoint;
+	return make_ref<OperationMult<T>>(adjoint, partial);
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> combine(std::vector<Ref<ExpressionImpl<T>>> contributions)
+{
+	if (contributions.empty())
+		return constant(T(0));
+	if (contributions.size() == 1)
+		return std::move(contributions.front());
+	return make_ref<OperationSum<T>>(std::move(contributions));
+}
+
+} // namespace
+
+template <typename T>
+AdjointSweep<T>::AdjointSweep(std::vector<Node> roots_) :
+	roots(std::move(roots_))
+{
+	// Iterative post-order walk over all roots; shared nodes are visited once.
+	std::vector<std::pair<Node, bool>> stack;
+	for (auto root = roots.rbegin(); root != roots.rend(); ++root)
+		stack.emplace_back(*root, false);
+
+	while (!stack.empty()) {
+		auto [node, expanded] = std::move(stack.back());
+		stack.pop_back();
+		if (position_of.contains(node.get()))
+			continue;
+		if (!expanded) {
+			stack.emplace_back(node, true);
+			for (std::size_t i = node->arity(); i-- > 0;) {
+				if (!position_of.contains(node->operand(i).get()))
+					stack.emplace_back(node->operand(i), false);
+			}
+			continue;
+		}
+		position_of.emplace(node.get(), order.size());
+		order.push_back(std::move(node));
+	}
+	cache.resize(order.size());
+}
+
+template <typename T>
+std::vector<bool> AdjointSweep<T>::active_nodes(const std::vector<Symbol> &vars) const
+{
+	auto requested = [&](Symbol symbol) {
+		return std::find(vars.begin(), vars.end(), symbol) != vars.end();
+	};
+
+	std::vector<bool> active(order.size(), false);
+	for (std::size_t position = 0; position < order.size(); ++position) {
+		const auto &node = order[position];
+		switch (node->kind()) {
+			case NodeKind::Variable:
+				active[position] = requested(static_cast<const Variable<T> *>(node.get())->get_symbol());
+				break;
+			case NodeKind::Polynomial: {
+				const auto &variables = static_cast<const Polynomial<T> *>(node.get())->get_variables();
+				active[position] = std::any_of(variables.begin(), variables.end(), requested);
+				break;
+			}
+			default:
+				for (std::size_t i = 0; i < node->arity() && !active[position]; ++i)
+					active[position] = active[position_of.at(node->operand(i).get())];
+				break;
+		}
+	}
+	return active;
+}
+
+template <typename T>
+LocalPartials<T> local_partials(const Ref<ExpressionImpl<T>> &node)
+{
+	using Node = Ref<ExpressionImpl<T>>;
+	LocalPartials<T> local;
+	auto &d = local.operands;
+	switch (node->kind()) {
+		case NodeKind::Value:
+		case NodeKind::Variable:
+			break;
+		case NodeKind::Polynomial: {
+			const auto *polynomial = static_cast<const Polynomial<T> *>(node.get());
+			for (Symbol symbol : polynomial->get_variables())
+				local.symbols.emplace_back(symbol, polynomial->diff(symbol));
+			break;
+		}
+		case NodeKind::Add:
+			d = {constant(T(1)), constant(T(1))};
+			break;
+		case NodeKind::Sub:
+			d = {constant(T(1)), constant(T(-1))};
+			break;
+		case NodeKind::Sum:
+			d.assign(node->arity(), constant(T(1)));
+			break;
+		case NodeKind::Mult:
+			d = {node->operand(1), node->operand(0)};
+			break;
+		case NodeKind::Div: {
+			// d/dl = 1 / r, d/dr = -(l / r) / r
+			const Node &right = node->operand(1);
+			d = {
+				make_ref<OperationDiv<T>>(constant(T(1)), right),
+				make_ref<OperationMult<T>>(make_ref<OperationDiv<T>>(node, right), constant(T(-1)))
+			};
+			break;
+		}
+		case NodeKind::Product: {
+			// Each factor's partial is the product of the others, built from
+			// shared prefix and suffix chains.
+			const std::size_t n = node->arity();
+			std::vector<Node> prefix(n + 1), suffix(n + 1);
+			for (std::size_t i = 1; i < n; ++i)
+				prefix[i] = i == 1 ? node->operand(0)
+				                   : make_ref<OperationMult<T>>(prefix[i - 1], node->operand(i - 1));
+			for (std::size_t i = n - 1; i > 0; --i)
+				suffix[i] = i == n - 1 ? node->operand(i)
+				                       : make_ref<OperationMult<T>>(node->operand(i), suffix[i + 1]);
+			d.resize(n);
+			for (std::size_t i = 0; i < n; ++i) {
+				const Node &before = prefix[i];
+				const Node &after = suffix[i + 1];
+				if (before && after)
+					d[i] = make_ref<OperationMult<T>>(before, after);
+				else
+					d[i] = before ? before : after ? after : constant(T(1));
+			}
+			break;
+		}
+		case NodeKind::Pow: {
+			const auto *pow = static_cast<const OperationPow<T> *>(node.get());
+			const Node &left = node->operand(0), &right = node->operand(1);
+			if (pow->get_exponent_class() != ExponentClass::General) {
+				// c * left^(c - 1)
+				if (pow->get_exponent_class() == ExponentClass::Integer && pow->get_integer_exponent() == 0) {
+					d = {constant(T(0)), constant(T(0))};
+					break;
+				}
+				const T exponent = static_cast<const Value<T> *>(right.get())->get_value();
+				Node lowered = left;
+				if (exponent != T(2))
+					lowered = make_ref<OperationPow<T>>(left, constant(exponent - T(1)));
+				d = {make_ref<OperationMult<T>>(right, lowered), constant(T(0))};
+				break;
+			}
+			// d/dl = (left^right * right) / left, d/dr = left^right * ln(left)
+			d = {
+				make_ref<OperationDiv<T>>(make_ref<OperationMult<T>>(node, right), left),
+				make_ref<OperationMult<T>>(node, make_ref<LnFunc<T>>(left))
+			};
+			break;
+		}
+		case NodeKind::Sin:
+			d = {make_ref<CosFunc<T>>(node->operand(0))};
+			break;
+		case NodeKind::Cos:
+			d = {make_ref<OperationMult<T>>(make_ref<SinFunc<T>>(node->operand(0)), constant(T(-1)))};
+			break;
+		case NodeKind::Ln:
+			d = {make_ref<OperationDiv<T>>(constant(T(1)), node->operand(0))};
+			break;
+		case NodeKind::Exp:
+			d = {node};
+			break;
+		case NodeKind::Derivative:
+			d = {constant(T(1))};
+			break;
+		default:
+			throw std::logic_error("Unknown node kind -> local_partials");
+	}
+	return local;
+}
+
+template <typename T>
+const LocalPartials<T> &AdjointSweep<T>::partials(std::size_t position)
+{
+	if (!cache[position])
+		cache[position] = local_partials(order[position]);
+	return *cache[position];
+}
+
+template <typename T>
+std::vector<typename AdjointSweep<T>::Node> AdjointSweep<T>::gradient(
+	std::size_t output, const std::vector<Symbol> &vars
+)
+{
+	const std::vector<bool> active = active_nodes(vars);
+	const std::size_t root = position_of.at(roots.at(output).get());
+
+	// Every node's adjoint is complete once all of its users (which come
+	// later in the order) have been processed.
+	std::vector<std::vector<Node>> incoming(root + 1);
+	std::unordered_map<SymbolId, std::vector<Node>> by_symbol;
+	incoming[root].push_back(constant(T(1)));
+
+	for (std::size_t position = root + 1; position-- > 0;) {
+		if (!active[position] || incoming[position].empty())
+			continue;
+		const Node adjoint = combine(std::move(incoming[position]));
+		const Node &node = order[position];
+
+		if (node->kind() == NodeKind::Variable) {
+			by_symbol[static_cast<const Variable<T> *>(node.get())->get_symbol().id()].push_back(adjoint);
+			continue;
+		}
+		const LocalPartials<T> &local = partials(position);
+		for (std::size_t i = 0; i < local.operands.size(); ++i) {
+			const std::size_t target = position_of.at(node->operand(i).get());
+			if (active[target] && !is_value(local.operands[i], T(0)))
+				incoming[target].push_back(scaled(adjoint, local.operands[i]));
+		}
+		for (const auto &[symbol, partial] : local.symbols) {
+			if (!is_value(partial, T(0)))
+				by_symbol[symbol.id()].push_back(scaled(adjoint, partial));
+		}
+	}
+
+	std::vector<Node> result;
+	result.reserve(vars.size());
+	for (Symbol symbol : vars) {
+		auto found = by_symbol.find(symbol.id());
+		result.push_back(found == by_symbol.end() ? constant(T(0)) : combine(found->second));
+	}
+	return result;
+}
+
+template <typename T>
+typename AdjointSweep<T>::Node AdjointSweep<T>::tangent(std::size_t output, Symbol by)
+{
+	const std::vector<bool> active = active_nodes({by});
+	const std::size_t root = position_of.at(roots.at(output).get());
+
+	// Inactive nodes keep a null tangent and are skipped by their users.
+	std::vector<Node> d(root + 1);
+	for (std::size_t position = 0; position <= root; ++position) {
+		if (!active[position])
+			continue;
+		const Node &node = order[position];
+		if (node->kind() == NodeKind::Variable) {
+			d[position] = constant(T(1));
+			continue;
+		}
+		const LocalPartials<T> &local = partials(position);
+		std::vector<Node> contributions;
+		for (std::size_t i = 0; i < local.operands.size(); ++i) {
+			const Node &operand_tangent = d[position_of.at(node->operand(i).get())];
+			if (operand_tangent && !is_value(local.operands[i], T(0)))
+				contributions.push_back(scaled(operand_tangent, local.operands[i]));
+		}
+		for (const auto &[symbol, partial] : local.symbols) {
+			if (symbol == by)
+				contributions.push_back(partial);
+		}
+		d[position] = combine(std::move(contributions));
+	}
+	return d[root] ? d[root] : constant(T(0));
+}
+
+template LocalPartials<long double> local_partials(const Ref<ExpressionImpl<long double>> &);
+template LocalPartials<std::complex<long double>> local_partials(
+	const Ref<ExpressionImpl<std::complex<long double>>> &
+);
+
+template class AdjointSweep<long double>;
+template class AdjointSweep<std::complex<long double>>;
@@ -0,0 +1,52 @@
+#ifndef ADJOINT_HPP
+#define ADJOINT_HPP
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "expression.hpp"
+#include "symbol.hpp"
+
+// Partial derivatives of a node with respect to each of its operands,
+// built from the node's own subexpressions. Leaves have none; polynomials
+// report theirs per variable instead.
+template <typename T> struct LocalPartials {
+	std::vector<Ref<ExpressionImpl<T>>> operands;
+	std::vector<std::pair<Symbol, Ref<ExpressionImpl<T>>>> symbols;
+};
+
+template <typename T>
+LocalPartials<T> local_partials(const Ref<ExpressionImpl<T>> &node);
+
+// Symbolic reverse-mode differentiation over the DAG shared by a set of
+// outputs. Local partial derivatives of every node are built once and
+// reused by all outputs, and each adjoint is a single node referenced by
+// every consumer, so the derivatives of all outputs form one DAG whose
+// size stays within a constant factor of the original.
+template <typename T> class AdjointSweep {
+  public:
+	using Node = Ref<ExpressionImpl<T>>;
+
+	explicit AdjointSweep(std::vector<Node> roots_);
+
+	// d roots[output] / d vars[j] for every j, from one reverse pass.
+	std::vector<Node> gradient(std::size_t output, const std::vector<Symbol> &vars);
+	// d roots[output] / d by from one forward pass over the same partials.
+	Node tangent(std::size_t output, Symbol by);
+
+  private:
+	const LocalPartials<T> &partials(std::size_t position);
+	std::vector<bool> active_nodes(const std::vector<Symbol> &vars) const;
+
+	std::vector<Node> roots;
+	// Topological order, operands before their users.
+	std::vector<Node> order;
+	std::unordered_map<const ExpressionImpl<T> *, std::size_t> position_of;
+	std::vector<std::optional<LocalPartials<T>>> cache;
+};
+
+#endif
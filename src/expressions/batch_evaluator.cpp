@@ -0,0 +1,291 @@
+#include "batch_evaluator.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+template <typename F> void unary(const double *x, double *out, std::size_t n, F f)
+{
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = f(x[i]);
+}
+
+template <typename F> void binary(const double *x, const double *y, double *out, std::size_t n, F f)
+{
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = f(x[i], y[i]);
+}
+
+// Repeated squaring as in numeric.hpp, one pass over the block per bit.
+void integer_power(const double *x, std::int32_t exponent, double *out, std::size_t n)
+{
+	std::array<double, BatchEvaluator::block_size> base;
+	std::copy(x, x + n, base.begin());
+	std::fill(out, out + n, 1.0);
+	std::uint32_t e = exponent < 0 ? -static_cast<std::uint32_t>(exponent) : static_cast<std::uint32_t>(exponent);
+	while (e > 0) {
+		if (e & 1u)
+			binary(out, base.data(), out, n, [](double a, double b) { return a * b; });
+		e >>= 1;
+		if (e > 0)
+			binary(base.data(), base.data(), base.data(), n, [](double a, double b) { return a * b; });
+	}
+	if (exponent < 0)
+		unary(out, out, n, [](double a) { return 1.0 / a; });
+}
+
+// status[i] |= bit wherever fails(x[i], y[i]); NaN inputs never fail, so a
+// bad point is reported once, where it went wrong.
+template <typename F>
+void flag(const double *x, const double *y, std::uint8_t *status, std::size_t n, std::uint8_t bit, F fails)
+{
+	for (std::size_t i = 0; i < n; ++i)
+		status[i] |= fails(x[i], y[i]) ? bit : 0;
+}
+
+const double not_a_number = std::numeric_limits<double>::quiet_NaN();
+
+// Unit roundoff of double.
+constexpr double unit = 0x1p-53;
+
+// Relative error of one kernel call, in units of `unit`.
+double kernel_error(Accuracy accuracy)
+{
+	switch (accuracy) {
+		case Accuracy::Ulp1: return 2.0;
+		case Accuracy::Ulp4: return 8.0;
+		case Accuracy::Fast: return 1e-7 / unit;
+	}
+	return 0.0;
+}
+
+// First-order bound on the error of `value` from the operand bounds `el`,
+// `er` (scaled by the local derivative) and the node's own rounding.
+void propagate_error(
+	const FlatNode &node, const double *l, const double *r, const double *value, const double *el, const double *er,
+	double *error, std::size_t n, Accuracy accuracy
+)
+{
+	const double kernel = kernel_error(accuracy) * unit;
+	switch (node.op) {
+		case OpCode::Const:
+		case OpCode::Var: break;
+		case OpCode::Add:
+		case OpCode::Sub:
+			for (std::size_t i = 0; i < n; ++i)
+				error[i] = el[i] + er[i] + unit * std::abs(value[i]);
+			break;
+		case OpCode::Mult:
+			for (std::size_t i = 0; i < n; ++i)
+				error[i] = std::abs(r[i]) * el[i] + std::abs(l[i]) * er[i] + unit * std::abs(value[i]);
+			break;
+		case OpCode::Div:
+			for (std::size_t i = 0; i < n; ++i)
+				error[i] = (el[i] + std::abs(value[i]) * er[i]) / std::abs(r[i]) + unit * std::abs(value[i]);
+			break;
+		case OpCode::Pow: {
+			std::array<double, BatchEvaluator::block_size> log;
+			vector_log(l, log.data(), n, Accuracy::Fast);
+			for (std::size_t i = 0; i < n; ++i)
+				error[i] = std::abs(value[i]) * (std::abs(r[i] / l[i]) * el[i] + std::abs(log[i]) * er[i] + kernel);
+			break;
+		}
+		case OpCode::PowInt: {
+			// one rounding per multiplication of the repeated squaring
+			const std::int32_t exponent = static_cast<std::int32_t>(node.rhs);
+			const double power = std::abs(static_cast<double>(exponent));
+			const double roundings = 2.0 * std::bit_width(static_cast<std::uint32_t>(power)) + (exponent < 0);
+			for (std::size_t i = 0; i < n; ++i)
+				error[i] = std::abs(value[i]) * (power * el[i] / std::abs(l[i]) + roundings * unit);
+			break;
+		}
+		case OpCode::Sqrt:
+			for (std::size_t i = 0; i < n; ++i)
+				error[i] = el[i] / (2.0 * value[i]) + unit * value[i];
+			break;
+		case OpCode::Sin:
+		case OpCode::Cos:
+			for (std::size_t i = 0; i < n; ++i)
+				error[i] = el[i] + kernel * std::abs(value[i]);
+			break;
+		case OpCode::Ln:
+			for (std::size_t i = 0; i < n; ++i)
+				error[i] = el[i] / l[i] + kernel * std::abs(value[i]);
+			break;
+		case OpCode::Exp:
+			for (std::size_t i = 0; i < n; ++i)
+				error[i] = value[i] * (el[i] + kernel);
+			break;
+	}
+}
+
+} // namespace
+
+BatchEvaluator::BatchEvaluator(const FlatExpression<long double> &expression, Accuracy accuracy_)
+	: source(expression), tape(expression.nodes()), accuracy(accuracy_)
+{
+	pool.reserve(expression.constants().size());
+	for (long double constant : expression.constants()) {
+		pool.push_back(static_cast<double>(constant));
+		pool_error.push_back(static_cast<double>(std::abs(constant - static_cast<long double>(pool.back()))));
+	}
+}
+
+std::size_t BatchEvaluator::size(void) const
+{
+	return tape.size();
+}
+
+void BatchEvaluator::eval(const Columns &columns, std::size_t count, double *out) const
+{
+	run<Mode::Plain, void>(columns, count, out, nullptr);
+}
+
+std::size_t BatchEvaluator::eval_checked(const Columns &columns, std::size_t count, double *out, std::uint8_t *status) const
+{
+	run<Mode::Checked>(columns, count, out, status);
+	std::size_t bad = 0;
+	for (std::size_t i = 0; i < count; ++i)
+		bad += status[i] != Ok;
+	return bad;
+}
+
+std::size_t BatchEvaluator::eval_mixed(const Columns &columns, std::size_t count, double *out, double tolerance) const
+{
+	std::vector<double> bounds(count);
+	run<Mode::Bounded>(columns, count, out, bounds.data());
+
+	Bindings<long double> context;
+	std::vector<long double> workspace;
+	std::size_t refined = 0;
+	for (std::size_t i = 0; i < count; ++i) {
+		if (bounds[i] <= tolerance * std::abs(out[i]))
+			continue;
+		for (const auto &[symbol, column] : columns)
+			context.bind(symbol, column[i]);
+		try {
+			out[i] = static_cast<double>(source.eval(context, workspace));
+		} catch (const std::runtime_error &) {
+			// a zero divisor or ln(x <= 0): the IEEE result in double stays
+		}
+		++refined;
+	}
+	return refined;
+}
+
+template <BatchEvaluator::Mode M, typename Extra>
+void BatchEvaluator::run(const Columns &columns, std::size_t count, double *out, Extra *extra) const
+{
+	constexpr bool checked = M == Mode::Checked, bounded = M == Mode::Bounded;
+	// Variables are resolved once per call rather than once per point.
+	// Unbound ones read a row of NaN in checked mode.
+	const std::vector<double> unbound(checked ? block_size : 0, not_a_number);
+	std::uint8_t missing = Ok;
+	std::vector<const double *> inputs(tape.size(), nullptr);
+	for (std::size_t i = 0; i < tape.size(); ++i) {
+		if (tape[i].op != OpCode::Var)
+			continue;
+		auto found = std::find_if(columns.begin(), columns.end(), [&](const auto &column) {
+			return column.first.id() == tape[i].lhs;
+		});
+		if (found != columns.end()) {
+			inputs[i] = found->second;
+		} else if constexpr (checked) {
+			missing = UnboundVariable;
+		} else {
+			throw std::runtime_error("Variable " + Symbol(tape[i].lhs).name() + " cannot be resolved without context");
+		}
+	}
+
+	std::vector<double> workspace(tape.size() * block_size);
+	// Variables are read in place from their columns.
+	std::vector<const double *> rows(tape.size());
+	// Error bounds, rows aligned with `workspace`; inputs are exact.
+	std::vector<double> errors(bounded ? tape.size() * block_size : 0);
+	const std::vector<double> exact(bounded ? block_size : 0, 0.0);
+	std::vector<const double *> error_rows(bounded ? tape.size() : 0);
+	for (std::size_t start = 0; start < count; start += block_size) {
+		const std::size_t n = std::min(block_size, count - start);
+		std::uint8_t *flags = nullptr;
+		if constexpr (checked) {
+			flags = extra + start;
+			std::fill(flags, flags + n, missing);
+		}
+		for (std::size_t i = 0; i < tape.size(); ++i) {
+			const FlatNode &node = tape[i];
+			double *row = workspace.data() + i * block_size;
+			rows[i] = row;
+			// Leaves and PowInt use lhs/rhs for other things than operands.
+			const bool leaf = node.op == OpCode::Const || node.op == OpCode::Var;
+			const double *l = leaf ? nullptr : rows[node.lhs];
+			const double *r = leaf || node.op == OpCode::PowInt ? nullptr : rows[node.rhs];
+			switch (node.op) {
+				case OpCode::Const:
+					if (start == 0)
+						std::fill(row, row + block_size, pool[node.lhs]);
+					break;
+				case OpCode::Var: rows[i] = inputs[i] ? inputs[i] + start : unbound.data(); break;
+				case OpCode::Add: binary(l, r, row, n, [](double a, double b) { return a + b; }); break;
+				case OpCode::Sub: binary(l, r, row, n, [](double a, double b) { return a - b; }); break;
+				case OpCode::Mult: binary(l, r, row, n, [](double a, double b) { return a * b; }); break;
+				case OpCode::Div:
+					binary(l, r, row, n, [](double a, double b) { return a / b; });
+					if constexpr (checked)
+						flag(r, r, flags, n, DivisionByZero, [](double b, double) { return b == 0.0; });
+					break;
+				case OpCode::Pow:
+					vector_pow(l, r, row, n, accuracy);
+					if constexpr (checked)
+						flag(l, r, flags, n, DomainError, [](double a, double b) { return a < 0.0 && std::trunc(b) != b; });
+					break;
+				case OpCode::PowInt: integer_power(l, static_cast<std::int32_t>(node.rhs), row, n); break;
+				case OpCode::Sqrt:
+					unary(l, row, n, [](double a) { return std::sqrt(a); });
+					if constexpr (checked)
+						flag(l, l, flags, n, DomainError, [](double a, double) { return a < 0.0; });
+					break;
+				case OpCode::Sin: vector_sin(l, row, n, accuracy); break;
+				case OpCode::Cos: vector_cos(l, row, n, accuracy); break;
+				case OpCode::Ln:
+					vector_log(l, row, n, accuracy);
+					if constexpr (checked)
+						flag(l, l, flags, n, DomainError, [](double a, double) { return a <= 0.0; });
+					break;
+				case OpCode::Exp: vector_exp(l, row, n, accuracy); break;
+			}
+			if constexpr (bounded) {
+				double *error = errors.data() + i * block_size;
+				error_rows[i] = error;
+				const double *el = leaf ? nullptr : error_rows[node.lhs];
+				const double *er = leaf || node.op == OpCode::PowInt ? nullptr : error_rows[node.rhs];
+				propagate_error(node, l, r, row, el, er, error, n, accuracy);
+				if (node.op == OpCode::Const && start == 0)
+					std::fill(error, error + block_size, pool_error[node.lhs]);
+				if (node.op == OpCode::Var)
+					error_rows[i] = exact.data();
+			}
+		}
+		const double *result = rows.back();
+		if constexpr (checked) {
+			for (std::size_t k = 0; k < n; ++k)
+				out[start + k] = flags[k] != Ok ? not_a_number : result[k];
+		} else {
+			std::copy(result, result + n, out + start);
+		}
+		if constexpr (bounded)
+			std::copy(error_rows.back(), error_rows.back() + n, extra + start);
+	}
+}
+
+std::vector<double> BatchEvaluator::eval(const Columns &columns, std::size_t count) const
+{
+	std::vector<double> out(count);
+	eval(columns, count, out.data());
+	return out;
+}
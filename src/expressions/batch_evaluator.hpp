@@ -0,0 +1,69 @@
+#ifndef BATCH_EVALUATOR_HPP
+#define BATCH_EVALUATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "flat_expression.hpp"
+#include "symbol.hpp"
+#include "vector_math.hpp"
+
+// Evaluates a tape over many points at once in double precision. Points are
+// processed in blocks, and every tape instruction runs as one loop over the
+// block, so arithmetic vectorizes and transcendentals go through the array
+// kernels of vector_math.hpp instead of one libm call per node and point.
+// Results follow IEEE semantics: x / 0 is an infinity and log of a negative
+// number is NaN rather than an exception.
+class BatchEvaluator {
+  public:
+	// Input column of one variable, `count` values long.
+	using Columns = std::vector<std::pair<Symbol, const double *>>;
+
+	// Per-point bits reported by eval_checked.
+	enum Status : std::uint8_t {
+	    Ok = 0,
+	    DivisionByZero = 1 << 0,
+	    DomainError = 1 << 1,  // ln(x <= 0), sqrt(x < 0), negative base to a fractional power
+	    UnboundVariable = 1 << 2
+	};
+
+	static constexpr std::size_t block_size = 256;
+
+	explicit BatchEvaluator(const FlatExpression<long double> &expression, Accuracy accuracy_ = Accuracy::Ulp1);
+
+	void eval(const Columns &columns, std::size_t count, double *out) const;
+	std::vector<double> eval(const Columns &columns, std::size_t count) const;
+	// Never throws: every point that hit one of the Status conditions gets
+	// NaN in `out` and its bits in `status`. The checks are branch-free
+	// passes next to the arithmetic, so bad points cost nothing extra and
+	// are reported in bulk. Returns the number of bad points.
+	std::size_t eval_checked(const Columns &columns, std::size_t count, double *out, std::uint8_t *status) const;
+	// Runs in double next to a first-order running bound on the rounding
+	// error of every node (operand bounds scaled by the local condition
+	// number, plus the node's own rounding and kernel error), then
+	// re-evaluates in long double only the points whose bound exceeds
+	// `tolerance` relative to the result, e.g. after catastrophic
+	// cancellation. Returns the number of re-evaluated points.
+	std::size_t eval_mixed(const Columns &columns, std::size_t count, double *out, double tolerance = 1e-12) const;
+
+	std::size_t size(void) const;
+
+  private:
+	enum class Mode { Plain, Checked, Bounded };
+
+	// `extra` receives the status bits in Checked mode and the error bound
+	// in Bounded mode.
+	template <Mode M, typename Extra>
+	void run(const Columns &columns, std::size_t count, double *out, Extra *extra) const;
+
+	FlatExpression<long double> source;
+	std::vector<FlatNode> tape;
+	std::vector<double> pool;
+	// |constant - double(constant)|
+	std::vector<double> pool_error;
+	Accuracy accuracy;
+};
+
+#endif
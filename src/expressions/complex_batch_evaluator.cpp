@@ -0,0 +1,333 @@
+#include "complex_batch_evaluator.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+
+using Complex = std::complex<double>;
+using NanMode = ComplexBatchEvaluator::NanMode;
+constexpr std::size_t block_size = ComplexBatchEvaluator::block_size;
+
+struct Row {
+	const double *re;
+	const double *im;
+};
+
+struct OutRow {
+	double *re;
+	double *im;
+
+	operator Row() const { return {re, im}; }
+};
+
+// Recomputes the points selected by `redo` with std::complex, which follows
+// Annex G for infinities and NaN. The scan is cheap next to the kernels.
+template <typename Redo, typename Exact> void fix_up(OutRow out, std::size_t n, Redo redo, Exact exact)
+{
+	for (std::size_t i = 0; i < n; ++i) {
+		if (redo(i)) {
+			const Complex value = exact(i);
+			out.re[i] = value.real();
+			out.im[i] = value.imag();
+		}
+	}
+}
+
+bool finite(OutRow out, std::size_t i)
+{
+	return std::isfinite(out.re[i]) && std::isfinite(out.im[i]);
+}
+
+void multiply(Row a, Row b, OutRow out, std::size_t n, NanMode mode)
+{
+	for (std::size_t i = 0; i < n; ++i) {
+		const double re = a.re[i] * b.re[i] - a.im[i] * b.im[i];
+		const double im = a.re[i] * b.im[i] + a.im[i] * b.re[i];
+		out.re[i] = re;
+		out.im[i] = im;
+	}
+	if (mode == NanMode::Strict) {
+		fix_up(
+			out, n, [&](std::size_t i) { return std::isnan(out.re[i]) && std::isnan(out.im[i]); },
+			[&](std::size_t i) { return Complex(a.re[i], a.im[i]) * Complex(b.re[i], b.im[i]); }
+		);
+	}
+}
+
+void divide(Row a, Row b, OutRow out, std::size_t n, NanMode mode)
+{
+	if (mode == NanMode::Relaxed) {
+		for (std::size_t i = 0; i < n; ++i) {
+			const double scale = 1.0 / (b.re[i] * b.re[i] + b.im[i] * b.im[i]);
+			const double re = (a.re[i] * b.re[i] + a.im[i] * b.im[i]) * scale;
+			const double im = (a.im[i] * b.re[i] - a.re[i] * b.im[i]) * scale;
+			out.re[i] = re;
+			out.im[i] = im;
+		}
+		return;
+	}
+	// Smith's algorithm with both branches computed and selected, which
+	// keeps the loop vectorizable and never squares the divisor.
+	for (std::size_t i = 0; i < n; ++i) {
+		const bool real_major = std::abs(b.re[i]) >= std::abs(b.im[i]);
+		const double big = real_major ? b.re[i] : b.im[i];
+		const double small = real_major ? b.im[i] : b.re[i];
+		const double ratio = small / big;
+		const double scale = 1.0 / (big + small * ratio);
+		const double p = real_major ? a.re[i] : a.im[i];
+		const double q = real_major ? a.im[i] : a.re[i];
+		const double re = (p + q * ratio) * scale;
+		const double im = (q - p * ratio) * scale;
+		out.re[i] = re;
+		out.im[i] = real_major ? im : -im;
+	}
+	fix_up(
+		out, n, [&](std::size_t i) { return std::isnan(out.re[i]) && std::isnan(out.im[i]); },
+		[&](std::size_t i) { return Complex(a.re[i], a.im[i]) / Complex(b.re[i], b.im[i]); }
+	);
+}
+
+// Repeated squaring; products go through a scratch row because the Strict
+// fix-up rereads the operands.
+void integer_power(Row a, std::int32_t exponent, OutRow out, std::size_t n, NanMode mode)
+{
+	std::array<double, block_size> base_re, base_im, scratch_re, scratch_im;
+	const OutRow base{base_re.data(), base_im.data()}, scratch{scratch_re.data(), scratch_im.data()};
+	std::copy(a.re, a.re + n, base.re);
+	std::copy(a.im, a.im + n, base.im);
+	std::fill(out.re, out.re + n, 1.0);
+	std::fill(out.im, out.im + n, 0.0);
+	auto multiply_into = [&](OutRow target, Row factor) {
+		multiply(target, factor, scratch, n, mode);
+		std::copy(scratch.re, scratch.re + n, target.re);
+		std::copy(scratch.im, scratch.im + n, target.im);
+	};
+	std::uint32_t e = exponent < 0 ? -static_cast<std::uint32_t>(exponent) : static_cast<std::uint32_t>(exponent);
+	while (e > 0) {
+		if (e & 1u)
+			multiply_into(out, base);
+		e >>= 1;
+		if (e > 0)
+			multiply_into(base, base);
+	}
+	if (exponent < 0) {
+		std::fill(base.re, base.re + n, 1.0);
+		std::fill(base.im, base.im + n, 0.0);
+		divide(base, out, scratch, n, mode);
+		std::copy(scratch.re, scratch.re + n, out.re);
+		std::copy(scratch.im, scratch.im + n, out.im);
+	}
+}
+
+// 1 / (2k + 1)! for k = 0..7: the sinh series x * (1 + x^2/3! + ...) is
+// accurate to well below an ulp for |x| < 1/2.
+constexpr std::array<double, 8> sinh_coefficients = [] {
+	std::array<double, 8> c{};
+	double factorial = 1.0;
+	for (int k = 0; k < 8; ++k) {
+		if (k > 0)
+			factorial *= (2 * k) * (2 * k + 1);
+		c[k] = 1.0 / factorial;
+	}
+	return c;
+}();
+
+// sinh and cosh from one exp; sinh switches to its series near zero, where
+// e^x - e^-x cancels.
+void sinh_cosh(const double *x, double *sinh, double *cosh, std::size_t n, Accuracy accuracy)
+{
+	std::array<double, block_size> e;
+	vector_exp(x, e.data(), n, accuracy);
+	for (std::size_t i = 0; i < n; ++i) {
+		const double inverse = 1.0 / e[i];
+		const double z = x[i] * x[i];
+		double series = sinh_coefficients[7];
+		for (std::size_t k = 7; k-- > 0;)
+			series = series * z + sinh_coefficients[k];
+		cosh[i] = 0.5 * (e[i] + inverse);
+		sinh[i] = std::abs(x[i]) < 0.5 ? x[i] * series : 0.5 * (e[i] - inverse);
+	}
+}
+
+// sin(a + bi) = sin a cosh b + i cos a sinh b, and cos(a + bi) =
+// cos a cosh b - i sin a sinh b.
+void sine(Row a, OutRow out, std::size_t n, bool cosine, NanMode mode, Accuracy accuracy)
+{
+	std::array<double, block_size> sin_re, cos_re, sinh_im, cosh_im;
+	vector_sin(a.re, sin_re.data(), n, accuracy);
+	vector_cos(a.re, cos_re.data(), n, accuracy);
+	sinh_cosh(a.im, sinh_im.data(), cosh_im.data(), n, accuracy);
+	for (std::size_t i = 0; i < n; ++i) {
+		const double re = (cosine ? cos_re[i] : sin_re[i]) * cosh_im[i];
+		const double im = (cosine ? -sin_re[i] : cos_re[i]) * sinh_im[i];
+		out.re[i] = re;
+		out.im[i] = im;
+	}
+	if (mode == NanMode::Strict) {
+		fix_up(out, n, [&](std::size_t i) { return !finite(out, i); }, [&](std::size_t i) {
+			const Complex z(a.re[i], a.im[i]);
+			return cosine ? std::cos(z) : std::sin(z);
+		});
+	}
+}
+
+// exp(a + bi) = e^a (cos b + i sin b)
+void exponential(Row a, OutRow out, std::size_t n, NanMode mode, Accuracy accuracy)
+{
+	std::array<double, block_size> magnitude, cos_im, sin_im;
+	vector_exp(a.re, magnitude.data(), n, accuracy);
+	vector_cos(a.im, cos_im.data(), n, accuracy);
+	vector_sin(a.im, sin_im.data(), n, accuracy);
+	for (std::size_t i = 0; i < n; ++i) {
+		out.re[i] = magnitude[i] * cos_im[i];
+		out.im[i] = magnitude[i] * sin_im[i];
+	}
+	if (mode == NanMode::Strict)
+		fix_up(out, n, [&](std::size_t i) { return !finite(out, i); }, [&](std::size_t i) { return std::exp(Complex(a.re[i], a.im[i])); });
+}
+
+// Principal logarithm: ln|z| + i atan2(b, a). |z|^2 loses ln|z| to
+// cancellation near the unit circle and to overflow far from it, so those
+// points go through std::log in both modes.
+void logarithm(Row a, OutRow out, std::size_t n, Accuracy accuracy)
+{
+	// Zeroed so the compiler can see that fix_up never reads past `n`.
+	std::array<double, block_size> norm{};
+	for (std::size_t i = 0; i < n; ++i)
+		norm[i] = a.re[i] * a.re[i] + a.im[i] * a.im[i];
+	vector_log(norm.data(), out.re, n, accuracy);
+	for (std::size_t i = 0; i < n; ++i) {
+		out.re[i] *= 0.5;
+		out.im[i] = std::atan2(a.im[i], a.re[i]);
+	}
+	fix_up(
+		out, n, [&](std::size_t i) { return !(norm[i] >= DBL_MIN && norm[i] <= DBL_MAX) || std::abs(norm[i] - 1.0) < 0.25; },
+		[&](std::size_t i) { return std::log(Complex(a.re[i], a.im[i])); }
+	);
+}
+
+// Principal square root: t = sqrt((|z| + |a|) / 2) is the component of
+// larger magnitude and b / 2t the other, so nothing cancels. Zero and the
+// points where |z|^2 under- or overflows go through std::sqrt in both modes.
+void square_root(Row a, OutRow out, std::size_t n)
+{
+	// Zeroed so the compiler can see that fix_up never reads past `n`.
+	std::array<double, block_size> norm{};
+	for (std::size_t i = 0; i < n; ++i) {
+		norm[i] = a.re[i] * a.re[i] + a.im[i] * a.im[i];
+		const double t = std::sqrt(0.5 * (std::sqrt(norm[i]) + std::abs(a.re[i])));
+		const double other = a.im[i] / (2.0 * t);
+		out.re[i] = a.re[i] >= 0.0 ? t : std::abs(other);
+		out.im[i] = a.re[i] >= 0.0 ? other : std::copysign(t, a.im[i]);
+	}
+	fix_up(
+		out, n, [&](std::size_t i) { return !(norm[i] >= DBL_MIN && norm[i] <= DBL_MAX); },
+		[&](std::size_t i) { return std::sqrt(Complex(a.re[i], a.im[i])); }
+	);
+}
+
+// Principal z^w = exp(w ln z), with 0^w = 0 as std::pow.
+void power(Row a, Row b, OutRow out, std::size_t n, NanMode mode, Accuracy accuracy)
+{
+	std::array<double, block_size> log_re, log_im, product_re, product_im;
+	const OutRow log{log_re.data(), log_im.data()}, product{product_re.data(), product_im.data()};
+	logarithm(a, log, n, accuracy);
+	multiply(b, log, product, n, NanMode::Relaxed);
+	exponential(product, out, n, NanMode::Relaxed, accuracy);
+	for (std::size_t i = 0; i < n; ++i) {
+		const bool zero = a.re[i] == 0.0 && a.im[i] == 0.0;
+		out.re[i] = zero ? 0.0 : out.re[i];
+		out.im[i] = zero ? 0.0 : out.im[i];
+	}
+	if (mode == NanMode::Strict) {
+		fix_up(out, n, [&](std::size_t i) { return !finite(out, i); }, [&](std::size_t i) {
+			return std::pow(Complex(a.re[i], a.im[i]), Complex(b.re[i], b.im[i]));
+		});
+	}
+}
+
+} // namespace
+
+ComplexBatchEvaluator::ComplexBatchEvaluator(
+	const FlatExpression<std::complex<long double>> &expression, NanMode mode_, Accuracy accuracy_
+)
+	: tape(expression.nodes()), mode(mode_), accuracy(accuracy_)
+{
+	pool.reserve(expression.constants().size());
+	for (const auto &constant : expression.constants())
+		pool.emplace_back(static_cast<double>(constant.real()), static_cast<double>(constant.imag()));
+}
+
+std::size_t ComplexBatchEvaluator::size(void) const
+{
+	return tape.size();
+}
+
+void ComplexBatchEvaluator::eval(const Columns &columns, std::size_t count, double *re, double *im) const
+{
+	// Variables are resolved once per call rather than once per point.
+	std::vector<ComplexColumn> inputs(tape.size(), ComplexColumn{nullptr, nullptr});
+	for (std::size_t i = 0; i < tape.size(); ++i) {
+		if (tape[i].op != OpCode::Var)
+			continue;
+		auto found = std::find_if(columns.begin(), columns.end(), [&](const auto &column) {
+			return column.first.id() == tape[i].lhs;
+		});
+		if (found == columns.end())
+			throw std::runtime_error("Variable " + Symbol(tape[i].lhs).name() + " cannot be resolved without context");
+		inputs[i] = found->second;
+	}
+
+	// Two rows per node: real parts, then imaginary parts.
+	std::vector<double> workspace(2 * tape.size() * block_size);
+	std::vector<Row> rows(tape.size());
+	for (std::size_t start = 0; start < count; start += block_size) {
+		const std::size_t n = std::min(block_size, count - start);
+		for (std::size_t i = 0; i < tape.size(); ++i) {
+			const FlatNode &node = tape[i];
+			const OutRow row{workspace.data() + 2 * i * block_size, workspace.data() + (2 * i + 1) * block_size};
+			rows[i] = row;
+			// Leaves and PowInt use lhs/rhs for other things than operands.
+			const bool leaf = node.op == OpCode::Const || node.op == OpCode::Var;
+			const Row l = leaf ? Row{} : rows[node.lhs];
+			const Row r = leaf || node.op == OpCode::PowInt ? Row{} : rows[node.rhs];
+			switch (node.op) {
+				case OpCode::Const:
+					if (start == 0) {
+						std::fill(row.re, row.re + block_size, pool[node.lhs].real());
+						std::fill(row.im, row.im + block_size, pool[node.lhs].imag());
+					}
+					break;
+				case OpCode::Var: rows[i] = {inputs[i].re + start, inputs[i].im + start}; break;
+				case OpCode::Add:
+					for (std::size_t k = 0; k < n; ++k) {
+						row.re[k] = l.re[k] + r.re[k];
+						row.im[k] = l.im[k] + r.im[k];
+					}
+					break;
+				case OpCode::Sub:
+					for (std::size_t k = 0; k < n; ++k) {
+						row.re[k] = l.re[k] - r.re[k];
+						row.im[k] = l.im[k] - r.im[k];
+					}
+					break;
+				case OpCode::Mult: multiply(l, r, row, n, mode); break;
+				case OpCode::Div: divide(l, r, row, n, mode); break;
+				case OpCode::Pow: power(l, r, row, n, mode, accuracy); break;
+				case OpCode::PowInt: integer_power(l, static_cast<std::int32_t>(node.rhs), row, n, mode); break;
+				case OpCode::Sqrt: square_root(l, row, n); break;
+				case OpCode::Sin: sine(l, row, n, false, mode, accuracy); break;
+				case OpCode::Cos: sine(l, row, n, true, mode, accuracy); break;
+				case OpCode::Ln: logarithm(l, row, n, accuracy); break;
+				case OpCode::Exp: exponential(l, row, n, mode, accuracy); break;
+			}
+		}
+		std::copy(rows.back().re, rows.back().re + n, re + start);
+		std::copy(rows.back().im, rows.back().im + n, im + start);
+	}
+}
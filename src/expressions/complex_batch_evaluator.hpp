@@ -0,0 +1,53 @@
+#ifndef COMPLEX_BATCH_EVALUATOR_HPP
+#define COMPLEX_BATCH_EVALUATOR_HPP
+
+#include <complex>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "flat_expression.hpp"
+#include "symbol.hpp"
+#include "vector_math.hpp"
+
+// Real and imaginary parts of one variable, `count` values each.
+struct ComplexColumn {
+	const double *re;
+	const double *im;
+};
+
+// Block evaluation of a complex tape in double precision, the complex
+// counterpart of BatchEvaluator. Real and imaginary parts live in separate
+// rows, so multiply and divide are plain vectorizable loops instead of
+// calls into the fully IEEE std::complex<long double> routines, and
+// exp/sin/cos/ln go through the array kernels of vector_math.hpp. ln and
+// pow take the principal branch, arg in (-pi, pi].
+class ComplexBatchEvaluator {
+  public:
+	using Columns = std::vector<std::pair<Symbol, ComplexColumn>>;
+
+	// Strict recovers infinities the way std::complex does (C99 Annex G)
+	// and divides without intermediate overflow. Relaxed uses textbook
+	// formulas: e.g. (inf + NaN i) * (1 + i) stays NaN and |divisor| above
+	// 1e154 overflows, but products and quotients need no fix-up pass.
+	enum class NanMode { Strict, Relaxed };
+
+	static constexpr std::size_t block_size = 256;
+
+	explicit ComplexBatchEvaluator(
+		const FlatExpression<std::complex<long double>> &expression, NanMode mode_ = NanMode::Strict,
+		Accuracy accuracy_ = Accuracy::Ulp1
+	);
+
+	void eval(const Columns &columns, std::size_t count, double *re, double *im) const;
+
+	std::size_t size(void) const;
+
+  private:
+	std::vector<FlatNode> tape;
+	std::vector<std::complex<double>> pool;
+	NanMode mode;
+	Accuracy accuracy;
+};
+
+#endif
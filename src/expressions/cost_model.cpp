@@ -0,0 +1,246 @@
+#include "cost_model.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <complex>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+constexpr const char *names[] = {
+	"const", "var", "add", "sub", "mult", "div", "pow", "powint", "sqrt", "sin", "cos", "ln", "exp"
+};
+
+std::size_t index_of(OpCode op)
+{
+	return static_cast<std::size_t>(op);
+}
+
+std::int32_t exponent_of(std::uint32_t rhs)
+{
+	return static_cast<std::int32_t>(rhs);
+}
+
+// Multiplications of repeated squaring for x^n.
+std::size_t multiplications(std::uint32_t rhs)
+{
+	const std::int32_t n = exponent_of(rhs);
+	const std::uint32_t m = n < 0 ? -static_cast<std::uint32_t>(n) : static_cast<std::uint32_t>(n);
+	return m < 2 ? 1 : std::bit_width(m) + std::popcount(m) - 2;
+}
+
+bool is_transcendental(OpCode op)
+{
+	return op == OpCode::Sin || op == OpCode::Cos || op == OpCode::Ln || op == OpCode::Exp || op == OpCode::Pow;
+}
+
+// Length of the calibration chains: long enough to hide the loop around
+// the tape, short enough to stay in L1.
+constexpr int chain_length = 256;
+
+// Best time of one evaluation of `tape`, in nanoseconds per chain step.
+double time_per_step(const Expression<long double> &expression, const Bindings<long double> &context)
+{
+	FlatExpression<long double> tape(expression);
+	std::vector<long double> workspace;
+	volatile long double sink = tape.eval(context, workspace);
+
+	double best = std::numeric_limits<double>::infinity();
+	for (int round = 0; round < 7; ++round) {
+		constexpr int repetitions = 200;
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < repetitions; ++i)
+			sink = sink + tape.eval(context, workspace);
+		const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count() / repetitions / chain_length);
+	}
+	return best;
+}
+
+// v <- step(v), chain_length times, starting from x.
+Expression<long double> chain(const std::function<Expression<long double>(const Expression<long double> &)> &step)
+{
+	Expression<long double> v("x");
+	for (int k = 0; k < chain_length; ++k)
+		v = step(v);
+	return v;
+}
+
+} // namespace
+
+std::string CostReport::to_string() const
+{
+	std::ostringstream out;
+	out << "Nodes: " << nodes << "\n"
+	    << "Flops: " << flops << "\n"
+	    << "Transcendental calls: " << transcendental << "\n"
+	    << "Memory traffic: " << memory_bytes << " bytes\n"
+	    << "Critical path: " << depth << "\n"
+	    << "Predicted time: " << nanoseconds << " ns\n";
+	return out.str();
+}
+
+CostModel CostModel::defaults()
+{
+	// calibrate() on an x86-64 desktop, rounded.
+	CostModel model;
+	model[OpCode::Const] = model[OpCode::Var] = 6.0;
+	model[OpCode::Add] = model[OpCode::Sub] = model[OpCode::Mult] = model[OpCode::PowInt] = 5.0;
+	model[OpCode::Div] = 17.0;
+	model[OpCode::Sqrt] = 15.0;
+	model[OpCode::Ln] = 45.0;
+	model[OpCode::Exp] = 105.0;
+	model[OpCode::Sin] = model[OpCode::Cos] = 65.0;
+	model[OpCode::Pow] = 410.0;
+	return model;
+}
+
+CostModel CostModel::calibrate()
+{
+	// Every chain step depends on the previous one, as the critical path of
+	// a real tape does, and stays in a range where libm takes its common
+	// path. Unary functions need an offset to get there, whose time is
+	// measured separately and subtracted.
+	const Bindings<long double> context{{"x", 1.5L}, {"y", 1.0001L}, {"z", 0.001L}};
+	const Expression<long double> y("y"), z("z");
+	auto unary = [](Expression<long double> (Expression<long double>::*f)(void) const &, long double offset) {
+		return chain([=](const Expression<long double> &v) { return (v.*f)() + Expression<long double>(offset); });
+	};
+
+	CostModel model;
+	model[OpCode::Add] = time_per_step(chain([&](const auto &v) { return v + z; }), context);
+	model[OpCode::Sub] = time_per_step(chain([&](const auto &v) { return v - z; }), context);
+	model[OpCode::Mult] = time_per_step(chain([&](const auto &v) { return v * y; }), context);
+	model[OpCode::Div] = time_per_step(chain([&](const auto &v) { return v / y; }), context);
+	model[OpCode::Pow] = time_per_step(chain([&](const auto &v) { return v ^ y; }), context);
+	model[OpCode::PowInt] = model[OpCode::Mult];
+
+	const double offset = model[OpCode::Add];
+	auto measure = [&](const Expression<long double> &expression) {
+		return std::max(time_per_step(expression, context) - offset, 0.0);
+	};
+	model[OpCode::Sqrt] = measure(chain([&](const auto &v) {
+		return (v ^ Expression<long double>(0.5L)) + Expression<long double>(1.0L);
+	}));
+	// sin(v) + 0.02 settles near 0.49 and cos(v) - 0.4 near 0.49, inside the
+	// |v| < pi/4 range where sinl and cosl skip argument reduction and run
+	// about three times faster; ln(v) + 2 settles near 3.15, exp(v) * 0.1
+	// near 0.11.
+	model[OpCode::Sin] = measure(unary(&Expression<long double>::sin, 0.02L));
+	model[OpCode::Cos] = measure(unary(&Expression<long double>::cos, -0.4L));
+	model[OpCode::Ln] = measure(unary(&Expression<long double>::ln, 2.0L));
+	model[OpCode::Exp] = std::max(
+		time_per_step(chain([](const auto &v) { return v.exp() * Expression<long double>(0.1L); }), context) -
+			model[OpCode::Mult],
+		0.0
+	);
+	// A sum of distinct variables: one load and one addition per term.
+	Expression<long double> loads(0.0L);
+	Bindings<long double> many;
+	for (int k = 0; k < chain_length; ++k) {
+		const std::string name = "load_" + std::to_string(k);
+		loads += Expression<long double>(name);
+		many.bind(name, 1.0L);
+	}
+	model[OpCode::Var] = std::max(time_per_step(loads, many) - offset, 0.0);
+	model[OpCode::Const] = model[OpCode::Var];
+	return model;
+}
+
+CostModel CostModel::load(const std::string &path)
+{
+	std::ifstream in(path);
+	if (!in)
+		throw std::runtime_error("Cannot open cost model " + path);
+	CostModel model = defaults();
+	std::string name;
+	double value;
+	while (in >> name >> value) {
+		auto it = std::find_if(std::begin(names), std::end(names), [&](const char *known) { return name == known; });
+		if (it == std::end(names))
+			throw std::runtime_error("Unknown opcode in cost model: " + name);
+		model.nanoseconds[it - std::begin(names)] = value;
+	}
+	return model;
+}
+
+void CostModel::save(const std::string &path) const
+{
+	std::ofstream out(path);
+	if (!out)
+		throw std::runtime_error("Cannot write cost model " + path);
+	for (std::size_t i = 0; i < opcode_count; ++i)
+		out << names[i] << " " << nanoseconds[i] << "\n";
+}
+
+double CostModel::cost(OpCode op, std::uint32_t rhs) const
+{
+	if (op == OpCode::PowInt) {
+		const double power = multiplications(rhs) * nanoseconds[index_of(OpCode::PowInt)];
+		return exponent_of(rhs) < 0 ? power + nanoseconds[index_of(OpCode::Div)] : power;
+	}
+	return nanoseconds[index_of(op)];
+}
+
+double &CostModel::operator[](OpCode op)
+{
+	return nanoseconds[index_of(op)];
+}
+
+template <typename T> CostReport CostModel::estimate(const FlatExpression<T> &expression) const
+{
+	CostReport report{expression.size(), 0, 0, 0, 0, 0.0};
+	const auto &tape = expression.nodes();
+	std::vector<std::size_t> depth(tape.size(), 0);
+	for (std::size_t i = 0; i < tape.size(); ++i) {
+		const FlatNode &node = tape[i];
+		report.nanoseconds += cost(node.op, node.rhs);
+		// The node itself, and the value it writes.
+		report.memory_bytes += sizeof(FlatNode) + sizeof(T);
+		switch (node.op) {
+			case OpCode::Const: case OpCode::Var:
+				report.memory_bytes += sizeof(T);
+				break;
+			case OpCode::PowInt: {
+				const std::size_t steps = multiplications(node.rhs) + (exponent_of(node.rhs) < 0);
+				report.flops += steps;
+				report.memory_bytes += sizeof(T);
+				depth[i] = depth[node.lhs] + steps;
+				break;
+			}
+			case OpCode::Sqrt: case OpCode::Sin: case OpCode::Cos: case OpCode::Ln: case OpCode::Exp:
+				(is_transcendental(node.op) ? report.transcendental : report.flops) += 1;
+				report.memory_bytes += sizeof(T);
+				depth[i] = depth[node.lhs] + 1;
+				break;
+			default:
+				(is_transcendental(node.op) ? report.transcendental : report.flops) += 1;
+				report.memory_bytes += 2 * sizeof(T);
+				depth[i] = std::max(depth[node.lhs], depth[node.rhs]) + 1;
+				break;
+		}
+	}
+	report.depth = tape.empty() ? 0 : depth.back();
+	return report;
+}
+
+template <typename T> CostReport CostModel::estimate(const Expression<T> &expression) const
+{
+	return estimate(FlatExpression<T>(expression));
+}
+
+const char *CostModel::name(OpCode op)
+{
+	return names[index_of(op)];
+}
+
+template CostReport CostModel::estimate(const FlatExpression<long double> &) const;
+template CostReport CostModel::estimate(const FlatExpression<std::complex<long double>> &) const;
+template CostReport CostModel::estimate(const Expression<long double> &) const;
+template CostReport CostModel::estimate(const Expression<std::complex<long double>> &) const;
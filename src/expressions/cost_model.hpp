@@ -0,0 +1,58 @@
+#ifndef COST_MODEL_HPP
+#define COST_MODEL_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "expression.hpp"
+#include "flat_expression.hpp"
+
+// Static cost of evaluating an expression once through its compiled tape,
+// i.e. after shared subtrees are merged and Sum, Product, Polynomial and
+// integer powers are lowered to binary operations.
+struct CostReport {
+	std::size_t nodes;
+	// + - * / sqrt, including the multiplications of integer powers.
+	std::size_t flops;
+	// sin, cos, ln, exp and general pow calls.
+	std::size_t transcendental;
+	// Tape nodes and constants read, operands read and results written.
+	std::size_t memory_bytes;
+	// Longest chain of dependent operations.
+	std::size_t depth;
+	// Sum of the per-operation times of the model.
+	double nanoseconds;
+
+	std::string to_string(void) const;
+};
+
+// Time of one tape operation per opcode, in nanoseconds. The defaults were
+// measured on one machine; calibrate() measures this one with chains of
+// dependent operations, and the result can be stored with save().
+class CostModel {
+  public:
+	static constexpr std::size_t opcode_count = static_cast<std::size_t>(OpCode::Exp) + 1;
+
+	static CostModel defaults(void);
+	static CostModel calibrate(void);
+	// Lines of "<opcode> <nanoseconds>", as written by save(); opcodes not
+	// listed keep their default.
+	static CostModel load(const std::string &path);
+	void save(const std::string &path) const;
+
+	// PowInt is charged per multiplication of repeated squaring.
+	double cost(OpCode op, std::uint32_t rhs = 0) const;
+	double &operator[](OpCode op);
+
+	template <typename T> CostReport estimate(const FlatExpression<T> &expression) const;
+	template <typename T> CostReport estimate(const Expression<T> &expression) const;
+
+	static const char *name(OpCode op);
+
+  private:
+	std::array<double, opcode_count> nanoseconds{};
+};
+
+#endif
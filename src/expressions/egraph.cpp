@@ -0,0 +1,557 @@
+#include "egraph.hpp"
+#include "numeric.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace {
+
+constexpr std::uint32_t NONE = std::numeric_limits<std::uint32_t>::max();
+constexpr double infinite_cost = std::numeric_limits<double>::infinity();
+// Larger integer powers are not produced by the power rules.
+constexpr std::int32_t max_exponent = 64;
+
+template <typename T> constexpr bool is_complex = std::is_same_v<T, std::complex<long double>>;
+
+std::size_t arity(OpCode op)
+{
+	switch (op) {
+		case OpCode::Const: case OpCode::Var:
+			return 0;
+		case OpCode::PowInt: case OpCode::Sqrt: case OpCode::Sin: case OpCode::Cos: case OpCode::Ln: case OpCode::Exp:
+			return 1;
+		default:
+			return 2;
+	}
+}
+
+std::int32_t exponent_of(std::uint32_t rhs)
+{
+	return static_cast<std::int32_t>(rhs);
+}
+
+// Value of an operation on constants, none where evaluation would fail.
+template <typename T> std::optional<T> fold(OpCode op, T a, T b, std::uint32_t rhs)
+{
+	switch (op) {
+		case OpCode::Add: return a + b;
+		case OpCode::Sub: return a - b;
+		case OpCode::Mult: return a * b;
+		case OpCode::Div:
+			if (b == T(0))
+				return std::nullopt;
+			return a / b;
+		case OpCode::Pow: return std::pow(a, b);
+		case OpCode::PowInt: return integer_power(a, exponent_of(rhs));
+		case OpCode::Sqrt: return std::sqrt(a);
+		case OpCode::Sin: return std::sin(a);
+		case OpCode::Cos: return std::cos(a);
+		case OpCode::Exp: return std::exp(a);
+		case OpCode::Ln:
+			if constexpr (is_complex<T>) {
+				if (a == T(0))
+					return std::nullopt;
+			} else {
+				if (!(a > T(0)))
+					return std::nullopt;
+			}
+			return std::log(a);
+		default:
+			return std::nullopt;
+	}
+}
+
+bool within(std::int64_t exponent)
+{
+	return exponent != 0 && exponent >= -max_exponent && exponent <= max_exponent;
+}
+
+} // namespace
+
+template <typename T> struct EGraph<T>::Match {
+	enum class Rule {
+		Node,       // op(a, b)
+		Nested,     // op(a, inner(b, c))
+		Outer,      // op(inner(a, b), c)
+		Wrap,       // op(inner(a, b)), op unary
+		FactorOne,  // a * (1 + b)
+		Twice,      // 2 * a
+		Power,      // a ^ n
+		Half,       // sin(2 * a) / 2
+		Same,       // a
+		Constant    // value
+	};
+
+	Rule rule;
+	std::uint32_t id = 0;
+	OpCode op = OpCode::Const, inner = OpCode::Const;
+	std::uint32_t a = 0, b = 0, c = 0;
+	std::int32_t n = 0;
+	T value = T(0);
+};
+
+template <typename T>
+std::size_t EGraph<T>::ENodeHash::operator()(const ENode &node) const
+{
+	std::size_t hash = static_cast<std::size_t>(node.op);
+	hash = hash * 0x9E3779B97F4A7C15ull + node.lhs;
+	hash = hash * 0x9E3779B97F4A7C15ull + node.rhs;
+	return hash ^ (hash >> 29);
+}
+
+template <typename T>
+EGraph<T>::EGraph(const Expression<T> &expression)
+{
+	FlatExpression<T> flat(expression);
+	std::vector<std::uint32_t> ids(flat.size());
+	for (std::size_t i = 0; i < flat.size(); ++i) {
+		const FlatNode &node = flat.nodes()[i];
+		switch (arity(node.op)) {
+			case 0:
+				ids[i] = node.op == OpCode::Const ? add_constant(flat.constants()[node.lhs]) : add({node.op, node.lhs, 0});
+				break;
+			case 1:
+				ids[i] = add({node.op, ids[node.lhs], node.op == OpCode::PowInt ? node.rhs : 0});
+				break;
+			default:
+				ids[i] = add({node.op, ids[node.lhs], ids[node.rhs]});
+				break;
+		}
+	}
+	root = ids.back();
+	rebuild();
+}
+
+template <typename T>
+std::uint32_t EGraph<T>::find(std::uint32_t id) const
+{
+	while (parent[id] != id)
+		id = parent[id];
+	return id;
+}
+
+template <typename T>
+typename EGraph<T>::ENode EGraph<T>::canonical(ENode node) const
+{
+	const std::size_t n = arity(node.op);
+	if (n >= 1)
+		node.lhs = find(node.lhs);
+	if (n == 2)
+		node.rhs = find(node.rhs);
+	return node;
+}
+
+template <typename T>
+std::uint32_t EGraph<T>::add(ENode node)
+{
+	node = canonical(node);
+	if (auto it = memo.find(node); it != memo.end())
+		return find(it->second);
+
+	const auto id = static_cast<std::uint32_t>(classes.size());
+	classes.push_back(EClass{{node}, std::nullopt});
+	parent.push_back(id);
+	memo.emplace(node, id);
+
+	if (node.op == OpCode::Const) {
+		classes[id].constant = pool[node.lhs];
+	} else if (const std::size_t n = arity(node.op); n > 0) {
+		const auto &a = classes[find(node.lhs)].constant;
+		const auto &b = n == 2 ? classes[find(node.rhs)].constant : a;
+		if (a && b) {
+			if (auto value = fold(node.op, *a, *b, node.rhs))
+				merge(id, add_constant(*value));
+		}
+	}
+	return find(id);
+}
+
+template <typename T>
+std::uint32_t EGraph<T>::add_constant(T value)
+{
+	std::size_t index = 0;
+	while (index < pool.size() && !same_constant(pool[index], value))
+		++index;
+	if (index == pool.size())
+		pool.push_back(value);
+	return add({OpCode::Const, static_cast<std::uint32_t>(index), 0});
+}
+
+template <typename T>
+bool EGraph<T>::merge(std::uint32_t a, std::uint32_t b)
+{
+	a = find(a);
+	b = find(b);
+	if (a == b)
+		return false;
+	if (classes[a].nodes.size() < classes[b].nodes.size())
+		std::swap(a, b);
+	parent[b] = a;
+	EClass &into = classes[a], &from = classes[b];
+	into.nodes.insert(into.nodes.end(), from.nodes.begin(), from.nodes.end());
+	from.nodes = {};
+	if (!into.constant)
+		into.constant = from.constant;
+	return true;
+}
+
+template <typename T>
+void EGraph<T>::rebuild()
+{
+	// Re-canonicalize every node; two classes holding the same node are
+	// congruent and merged, which may expose further congruences.
+	auto order = [](const ENode &x, const ENode &y) {
+		return std::tie(x.op, x.lhs, x.rhs) < std::tie(y.op, y.lhs, y.rhs);
+	};
+	while (true) {
+		memo.clear();
+		std::vector<std::pair<std::uint32_t, std::uint32_t>> pending;
+		for (std::uint32_t id = 0; id < classes.size(); ++id) {
+			if (parent[id] != id)
+				continue;
+			auto &nodes = classes[id].nodes;
+			for (auto &node : nodes)
+				node = canonical(node);
+			std::sort(nodes.begin(), nodes.end(), order);
+			nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+			for (const auto &node : nodes) {
+				auto [it, inserted] = memo.try_emplace(node, id);
+				if (!inserted)
+					pending.emplace_back(it->second, id);
+			}
+		}
+		bool merged = false;
+		for (auto [a, b] : pending)
+			merged = merge(a, b) || merged;
+		if (!merged)
+			break;
+	}
+}
+
+template <typename T>
+void EGraph<T>::collect(std::uint32_t id, const ENode &node, std::vector<Match> &matches) const
+{
+	using Rule = typename Match::Rule;
+	auto nodes = [&](std::uint32_t cls) -> const std::vector<ENode> & { return classes[find(cls)].nodes; };
+	auto is = [&](std::uint32_t cls, T value) {
+		const auto &constant = classes[find(cls)].constant;
+		return constant && *constant == value;
+	};
+	auto same = [&](std::uint32_t x, std::uint32_t y) { return find(x) == find(y); };
+	auto push = [&](Match match) {
+		match.id = id;
+		matches.push_back(match);
+	};
+	const std::uint32_t l = node.lhs, r = node.rhs;
+
+	if (!classes[id].constant && arity(node.op) > 0) {
+		const auto &a = classes[find(l)].constant;
+		const auto &b = arity(node.op) == 2 ? classes[find(r)].constant : a;
+		if (a && b) {
+			if (auto value = fold(node.op, *a, *b, r))
+				push({.rule = Rule::Constant, .value = *value});
+		}
+	}
+
+	// The common factor of two products, in any operand order.
+	auto factor = [&](OpCode combine) {
+		for (const auto &p : nodes(l)) {
+			if (p.op != OpCode::Mult)
+				continue;
+			for (const auto &q : nodes(r)) {
+				if (q.op != OpCode::Mult)
+					continue;
+				const std::uint32_t pp[] = {p.lhs, p.rhs}, qq[] = {q.lhs, q.rhs};
+				for (int i = 0; i < 2; ++i)
+					for (int j = 0; j < 2; ++j)
+						if (same(pp[i], qq[j]))
+							push({.rule = Rule::Nested, .op = OpCode::Mult, .inner = combine, .a = pp[i], .b = pp[1 - i], .c = qq[1 - j]});
+			}
+		}
+	};
+	// Two quotients over the same denominator.
+	auto common_denominator = [&](OpCode combine) {
+		for (const auto &p : nodes(l))
+			if (p.op == OpCode::Div)
+				for (const auto &q : nodes(r))
+					if (q.op == OpCode::Div && same(p.rhs, q.rhs))
+						push({.rule = Rule::Outer, .op = OpCode::Div, .inner = combine, .a = p.lhs, .b = q.lhs, .c = p.rhs});
+	};
+	// Class of the argument of sin or cos under a square, if any.
+	auto squared = [&](std::uint32_t cls, OpCode function, auto &&each) {
+		for (const auto &p : nodes(cls))
+			if (p.op == OpCode::PowInt && exponent_of(p.rhs) == 2)
+				for (const auto &q : nodes(p.lhs))
+					if (q.op == function)
+						each(q.lhs);
+	};
+
+	switch (node.op) {
+		case OpCode::Add:
+			push({.rule = Rule::Node, .op = OpCode::Add, .a = r, .b = l});
+			for (const auto &p : nodes(l))
+				if (p.op == OpCode::Add)
+					push({.rule = Rule::Nested, .op = OpCode::Add, .inner = OpCode::Add, .a = p.lhs, .b = p.rhs, .c = r});
+			if (is(r, T(0)))
+				push({.rule = Rule::Same, .a = l});
+			if (same(l, r))
+				push({.rule = Rule::Twice, .a = l});
+			factor(OpCode::Add);
+			for (const auto &q : nodes(r)) {
+				if (q.op != OpCode::Mult)
+					continue;
+				if (same(q.lhs, l))
+					push({.rule = Rule::FactorOne, .a = l, .b = q.rhs});
+				if (same(q.rhs, l))
+					push({.rule = Rule::FactorOne, .a = l, .b = q.lhs});
+			}
+			common_denominator(OpCode::Add);
+			squared(l, OpCode::Sin, [&](std::uint32_t x) {
+				squared(r, OpCode::Cos, [&](std::uint32_t y) {
+					if (same(x, y))
+						push({.rule = Rule::Constant, .value = T(1)});
+				});
+			});
+			if constexpr (!is_complex<T>) {
+				for (const auto &p : nodes(l))
+					if (p.op == OpCode::Ln)
+						for (const auto &q : nodes(r))
+							if (q.op == OpCode::Ln)
+								push({.rule = Rule::Wrap, .op = OpCode::Ln, .inner = OpCode::Mult, .a = p.lhs, .b = q.lhs});
+			}
+			break;
+		case OpCode::Sub:
+			if (is(r, T(0)))
+				push({.rule = Rule::Same, .a = l});
+			if (same(l, r))
+				push({.rule = Rule::Constant, .value = T(0)});
+			factor(OpCode::Sub);
+			common_denominator(OpCode::Sub);
+			break;
+		case OpCode::Mult:
+			push({.rule = Rule::Node, .op = OpCode::Mult, .a = r, .b = l});
+			for (const auto &p : nodes(l))
+				if (p.op == OpCode::Mult)
+					push({.rule = Rule::Nested, .op = OpCode::Mult, .inner = OpCode::Mult, .a = p.lhs, .b = p.rhs, .c = r});
+			if (is(r, T(1)))
+				push({.rule = Rule::Same, .a = l});
+			if (is(r, T(0)))
+				push({.rule = Rule::Constant, .value = T(0)});
+			if (same(l, r))
+				push({.rule = Rule::Power, .a = l, .n = 2});
+			for (const auto &p : nodes(l)) {
+				if (p.op == OpCode::PowInt) {
+					if (same(p.lhs, r) && within(std::int64_t{exponent_of(p.rhs)} + 1))
+						push({.rule = Rule::Power, .a = r, .n = exponent_of(p.rhs) + 1});
+					for (const auto &q : nodes(r)) {
+						const std::int64_t sum = std::int64_t{exponent_of(p.rhs)} + exponent_of(q.rhs);
+						if (q.op == OpCode::PowInt && same(p.lhs, q.lhs) && within(sum))
+							push({.rule = Rule::Power, .a = p.lhs, .n = static_cast<std::int32_t>(sum)});
+					}
+				}
+				if (p.op == OpCode::Sin)
+					for (const auto &q : nodes(r))
+						if (q.op == OpCode::Cos && same(p.lhs, q.lhs))
+							push({.rule = Rule::Half, .a = p.lhs});
+				if (p.op == OpCode::Exp)
+					for (const auto &q : nodes(r))
+						if (q.op == OpCode::Exp)
+							push({.rule = Rule::Wrap, .op = OpCode::Exp, .inner = OpCode::Add, .a = p.lhs, .b = q.lhs});
+			}
+			for (const auto &q : nodes(r))
+				if (q.op == OpCode::Div)
+					push({.rule = Rule::Outer, .op = OpCode::Div, .inner = OpCode::Mult, .a = l, .b = q.lhs, .c = q.rhs});
+			break;
+		case OpCode::Div:
+			if (is(r, T(1)))
+				push({.rule = Rule::Same, .a = l});
+			break;
+		case OpCode::PowInt:
+			if (exponent_of(r) == 1)
+				push({.rule = Rule::Same, .a = l});
+			if (exponent_of(r) == 2)
+				for (const auto &p : nodes(l))
+					if (p.op == OpCode::Sqrt)
+						push({.rule = Rule::Same, .a = p.lhs});
+			break;
+		case OpCode::Exp:
+			for (const auto &p : nodes(l))
+				if (p.op == OpCode::Ln)
+					push({.rule = Rule::Same, .a = p.lhs});
+			break;
+		case OpCode::Ln:
+			if constexpr (!is_complex<T>) {
+				for (const auto &p : nodes(l))
+					if (p.op == OpCode::Exp)
+						push({.rule = Rule::Same, .a = p.lhs});
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+template <typename T>
+std::uint32_t EGraph<T>::apply(const Match &match)
+{
+	using Rule = typename Match::Rule;
+	switch (match.rule) {
+		case Rule::Node:
+			return add({match.op, match.a, match.b});
+		case Rule::Nested:
+			return add({match.op, match.a, add({match.inner, match.b, match.c})});
+		case Rule::Outer:
+			return add({match.op, add({match.inner, match.a, match.b}), match.c});
+		case Rule::Wrap:
+			return add({match.op, add({match.inner, match.a, match.b}), 0});
+		case Rule::FactorOne:
+			return add({OpCode::Mult, match.a, add({OpCode::Add, add_constant(T(1)), match.b})});
+		case Rule::Twice:
+			return add({OpCode::Mult, add_constant(T(2)), match.a});
+		case Rule::Power:
+			return add({OpCode::PowInt, match.a, static_cast<std::uint32_t>(match.n)});
+		case Rule::Half: {
+			const std::uint32_t doubled = add({OpCode::Mult, add_constant(T(2)), match.a});
+			return add({OpCode::Div, add({OpCode::Sin, doubled, 0}), add_constant(T(2))});
+		}
+		case Rule::Same:
+			return match.a;
+		case Rule::Constant:
+			return add_constant(match.value);
+	}
+	return match.a;
+}
+
+template <typename T>
+SaturationReport EGraph<T>::saturate(const SaturationLimits &limits)
+{
+	const auto start = std::chrono::steady_clock::now();
+	auto out_of_budget = [&] {
+		return memo.size() >= limits.max_nodes || std::chrono::steady_clock::now() - start >= limits.time_limit;
+	};
+
+	SaturationReport report{0, 0, 0, false};
+	std::vector<Match> matches;
+	bool stopped = false;
+	while (!stopped && report.iterations < limits.max_iterations && !out_of_budget()) {
+		matches.clear();
+		for (std::uint32_t id = 0; id < classes.size(); ++id)
+			if (parent[id] == id)
+				for (const auto &node : classes[id].nodes)
+					collect(id, node, matches);
+		++report.iterations;
+
+		const std::size_t before = memo.size();
+		bool changed = false;
+		for (std::size_t k = 0; k < matches.size(); ++k) {
+			changed = merge(matches[k].id, apply(matches[k])) || changed;
+			if (k % 256 == 255 && out_of_budget()) {
+				stopped = true;
+				break;
+			}
+		}
+		changed = changed || memo.size() != before;
+		rebuild();
+		if (!changed && !stopped) {
+			report.saturated = true;
+			break;
+		}
+	}
+
+	report.nodes = size();
+	for (std::uint32_t id = 0; id < classes.size(); ++id)
+		report.classes += parent[id] == id;
+	return report;
+}
+
+template <typename T>
+FlatExpression<T> EGraph<T>::extract(const CostModel &model) const
+{
+	// Cheapest node per class by tree cost, to a fixed point: costs only
+	// decrease, so cycles in the graph cannot be chosen.
+	std::vector<double> best(classes.size(), infinite_cost);
+	std::vector<ENode> choice(classes.size());
+	for (bool improved = true; improved;) {
+		improved = false;
+		for (std::uint32_t id = 0; id < classes.size(); ++id) {
+			if (parent[id] != id)
+				continue;
+			for (const auto &node : classes[id].nodes) {
+				double cost = model.cost(node.op, node.rhs);
+				const std::size_t n = arity(node.op);
+				if (n >= 1)
+					cost += best[find(node.lhs)];
+				if (n == 2)
+					cost += best[find(node.rhs)];
+				if (cost < best[id]) {
+					best[id] = cost;
+					choice[id] = node;
+					improved = true;
+				}
+			}
+		}
+	}
+
+	FlatExpression<T> result;
+	std::vector<std::uint32_t> index(classes.size(), NONE);
+	std::vector<std::pair<std::uint32_t, bool>> stack{{find(root), false}};
+	while (!stack.empty()) {
+		auto [id, expanded] = stack.back();
+		stack.pop_back();
+		if (index[id] != NONE)
+			continue;
+		const ENode &node = choice[id];
+		const std::size_t n = arity(node.op);
+		if (!expanded) {
+			stack.emplace_back(id, true);
+			if (n == 2)
+				stack.emplace_back(find(node.rhs), false);
+			if (n >= 1)
+				stack.emplace_back(find(node.lhs), false);
+			continue;
+		}
+		switch (n) {
+			case 0:
+				index[id] = node.op == OpCode::Const ? result.push(OpCode::Const, result.push_constant(pool[node.lhs]))
+				                                     : result.push(OpCode::Var, node.lhs);
+				break;
+			case 1:
+				index[id] = result.push(node.op, index[find(node.lhs)], node.rhs);
+				break;
+			default:
+				index[id] = result.push(node.op, index[find(node.lhs)], index[find(node.rhs)]);
+				break;
+		}
+	}
+	return result;
+}
+
+template <typename T>
+std::size_t EGraph<T>::size() const
+{
+	std::size_t count = 0;
+	for (std::uint32_t id = 0; id < classes.size(); ++id)
+		if (parent[id] == id)
+			count += classes[id].nodes.size();
+	return count;
+}
+
+template <typename T>
+Expression<T> optimize(const Expression<T> &expression, const SaturationLimits &limits, const CostModel &model)
+{
+	EGraph<T> graph(expression);
+	graph.saturate(limits);
+	return graph.extract(model).to_expression();
+}
+
+template class EGraph<long double>;
+template class EGraph<std::complex<long double>>;
+template Expression<long double> optimize(const Expression<long double> &, const SaturationLimits &, const CostModel &);
+template Expression<std::complex<long double>> optimize(
+	const Expression<std::complex<long double>> &, const SaturationLimits &, const CostModel &
+);
@@ -0,0 +1,98 @@
+#ifndef EGRAPH_HPP
+#define EGRAPH_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "cost_model.hpp"
+#include "expression.hpp"
+#include "flat_expression.hpp"
+
+struct SaturationLimits {
+	std::size_t max_iterations = 30;
+	std::size_t max_nodes = 20000;
+	std::chrono::milliseconds time_limit{200};
+};
+
+struct SaturationReport {
+	std::size_t iterations;
+	std::size_t nodes;
+	std::size_t classes;
+	// No rule added anything in the last iteration: every form reachable
+	// with the rule library is represented.
+	bool saturated;
+};
+
+// Equality saturation over the tape language of FlatExpression. Each
+// e-class holds every form of one value found so far; rules only ever add
+// forms, so no rewrite order can lose a better one, and extraction picks
+// the cheapest form of every class by evaluation cost.
+//
+// Rules (x, y, z are classes; m, n integers):
+//   x + y = y + x, x * y = y * x, (x + y) + z = x + (y + z), (x * y) * z = x * (y * z)
+//   x * y + x * z = x * (y + z), x * y - x * z = x * (y - z), x + x * y = x * (1 + y), x + x = 2 * x
+//   x / z + y / z = (x + y) / z, x / z - y / z = (x - y) / z, x * (y / z) = (x * y) / z
+//   x * x = x^2, x^m * x = x^(m+1), x^m * x^n = x^(m+n), x^1 = x, sqrt(x)^2 = x
+//   sin(x)^2 + cos(x)^2 = 1, sin(x) * cos(x) = sin(2 * x) / 2
+//   exp(x) * exp(y) = exp(x + y), exp(ln(x)) = x
+//   ln(x) + ln(y) = ln(x * y), ln(exp(x)) = x    (real only)
+//   x + 0 = x, x - 0 = x, x - x = 0, x * 1 = x, x * 0 = 0, x / 1 = x
+// and constant folding. Rewrites keep the value wherever the original
+// expression evaluates without error; they may remove errors, e.g. a
+// division by zero inside x * 0.
+template <typename T> class EGraph {
+  public:
+	explicit EGraph(const Expression<T> &expression);
+
+	SaturationReport saturate(const SaturationLimits &limits = {});
+	// Cheapest known form of the expression under `model`.
+	FlatExpression<T> extract(const CostModel &model = CostModel::defaults()) const;
+
+	std::size_t size(void) const;
+
+  private:
+	struct ENode {
+		OpCode op;
+		// As in FlatNode, but operands are class ids.
+		std::uint32_t lhs;
+		std::uint32_t rhs;
+
+		bool operator==(const ENode &other) const = default;
+	};
+	struct ENodeHash {
+		std::size_t operator()(const ENode &node) const;
+	};
+	struct EClass {
+		std::vector<ENode> nodes;
+		std::optional<T> constant;
+	};
+	struct Match;
+
+	std::uint32_t find(std::uint32_t id) const;
+	ENode canonical(ENode node) const;
+	std::uint32_t add(ENode node);
+	std::uint32_t add_constant(T value);
+	bool merge(std::uint32_t a, std::uint32_t b);
+	void rebuild(void);
+	void collect(std::uint32_t id, const ENode &node, std::vector<Match> &matches) const;
+	std::uint32_t apply(const Match &match);
+
+	std::vector<std::uint32_t> parent;
+	std::vector<EClass> classes;
+	std::unordered_map<ENode, std::uint32_t, ENodeHash> memo;
+	std::vector<T> pool;
+	std::uint32_t root;
+};
+
+// Saturates within `limits` and returns the cheapest form found.
+template <typename T>
+Expression<T> optimize(
+	const Expression<T> &expression, const SaturationLimits &limits = {},
+	const CostModel &model = CostModel::defaults()
+);
+
+#endif
@@ -1,25 +1,348 @@
 #include <expression.hpp>
 #include "../parser/parser.hpp"
+#include "adjoint.hpp"
+#include "mapped_file.hpp"
+#include "numeric.hpp"
+#include "polynomial.hpp"
+#include "simplify.hpp"
+#include "substitute.hpp"
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
+#include <string_view>
+#include <unordered_map>
 #include <complex>
 
+namespace {
+
+template <typename T>
+const Value<T> *as_value(const Ref<ExpressionImpl<T>> &node)
+{
+	return dynamic_cast<const Value<T> *>(node.get());
+}
+
+template <typename T>
+bool is_value(const Ref<ExpressionImpl<T>> &node, T number)
+{
+	const Value<T> *value = as_value(node);
+	return value != nullptr && value->get_value() == number;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> share(const ExpressionImpl<T> *node)
+{
+	return Ref<ExpressionImpl<T>>(const_cast<ExpressionImpl<T> *>(node));
+}
+
+// Constants are folded into one leading Value, variables follow ordered by
+// name and every other operand keeps its order of appearance.
+template <typename T>
+Symbol symbol_of(const Ref<ExpressionImpl<T>> &node)
+{
+	return static_cast<const Variable<T> *>(node.get())->get_symbol();
+}
+
+// Names compare with their digit runs read as numbers, so x2 goes before x10
+// and variables numbered in the order they are added stay appended. Names
+// that tie, such as x01 and x1, fall back to plain comparison.
+bool name_less(std::string_view a, std::string_view b)
+{
+	auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+	std::size_t i = 0, j = 0;
+	while (i < a.size() && j < b.size()) {
+		if (!is_digit(a[i]) || !is_digit(b[j])) {
+			if (a[i] != b[j])
+				return a[i] < b[j];
+			++i;
+			++j;
+			continue;
+		}
+		auto number = [&](std::string_view s, std::size_t &k) {
+			while (k + 1 < s.size() && s[k] == '0' && is_digit(s[k + 1]))
+				++k;
+			const std::size_t begin = k;
+			while (k < s.size() && is_digit(s[k]))
+				++k;
+			return s.substr(begin, k - begin);
+		};
+		const std::string_view x = number(a, i), y = number(b, j);
+		if (x.size() != y.size())
+			return x.size() < y.size();
+		if (x != y)
+			return x < y;
+	}
+	if (i != a.size() || j != b.size())
+		return i == a.size();
+	return a < b;
+}
+
+template <typename T>
+bool name_less(const Ref<ExpressionImpl<T>> &a, const Ref<ExpressionImpl<T>> &b)
+{
+	const Symbol x = symbol_of(a), y = symbol_of(b);
+	return x != y && name_less(x.name(), y.name());
+}
+
+// All operands of an n-ary node of `kind` at once in canonical order, the
+// variables sorted once. Operands of the same kind are spliced in.
+template <typename T, typename Combine>
+std::vector<Ref<ExpressionImpl<T>>> canonical_operands(
+	NodeKind kind, std::vector<Ref<ExpressionImpl<T>>> operands, Combine combine
+)
+{
+	Ref<ExpressionImpl<T>> constant;
+	// Each name is looked up once, not at every comparison.
+	std::vector<std::pair<std::string_view, Ref<ExpressionImpl<T>>>> variables;
+	std::vector<Ref<ExpressionImpl<T>>> rest;
+	auto add = [&](Ref<ExpressionImpl<T>> operand) {
+		if (const Value<T> *value = as_value(operand)) {
+			constant = constant ? make_ref<Value<T>>(combine(as_value(constant)->get_value(), value->get_value()))
+			                    : std::move(operand);
+		} else if (operand->kind() == NodeKind::Variable) {
+			std::string_view name = symbol_of(operand).name();
+			variables.emplace_back(name, std::move(operand));
+		} else {
+			rest.push_back(std::move(operand));
+		}
+	};
+	for (auto &operand : operands) {
+		if (operand->kind() != kind) {
+			add(std::move(operand));
+			continue;
+		}
+		for (std::size_t i = 0; i < operand->arity(); ++i)
+			add(operand->operand(i));
+	}
+	std::stable_sort(variables.begin(), variables.end(), [](const auto &a, const auto &b) {
+		return name_less(a.first, b.first);
+	});
+
+	std::vector<Ref<ExpressionImpl<T>>> result;
+	result.reserve(variables.size() + rest.size() + 1);
+	if (constant)
+		result.push_back(std::move(constant));
+	for (auto &variable : variables)
+		result.push_back(std::move(variable.second));
+	std::move(rest.begin(), rest.end(), std::back_inserter(result));
+	return result;
+}
+
+// Splits operands of an n-ary node into its two blocks: a leading constant
+// and the variables right after it, then everything else. Any order is
+// accepted and kept.
+template <typename T>
+void split_operands(
+	std::vector<Ref<ExpressionImpl<T>>> operands,
+	std::vector<Ref<ExpressionImpl<T>>> &leaves, std::vector<Ref<ExpressionImpl<T>>> &others
+)
+{
+	auto end = operands.begin();
+	if (end != operands.end() && as_value(*end))
+		++end;
+	end = std::find_if(end, operands.end(), [](const auto &node) {
+		return node->kind() != NodeKind::Variable;
+	});
+	others.assign(std::make_move_iterator(end), std::make_move_iterator(operands.end()));
+	operands.erase(end, operands.end());
+	leaves = std::move(operands);
+}
+
+// Adds operands in canonical order, as canonical_operands returns them, to
+// the blocks of a node: the constant is folded into the leading one, the
+// variables are merged into theirs and the rest is appended. Variables that
+// all sort after the ones present are appended as well, so only one that
+// goes in front of others moves anything, and then only the variables.
+template <typename T, typename Combine>
+void append_operands(
+	std::vector<Ref<ExpressionImpl<T>>> &leaves, std::vector<Ref<ExpressionImpl<T>>> &others,
+	std::vector<Ref<ExpressionImpl<T>>> operands, Combine combine
+)
+{
+	auto it = operands.begin();
+	if (it != operands.end() && as_value(*it)) {
+		if (!leaves.empty() && as_value(leaves.front()))
+			leaves.front() = make_ref<Value<T>>(
+				combine(as_value(leaves.front())->get_value(), as_value(*it)->get_value()));
+		else
+			leaves.insert(leaves.begin(), std::move(*it));
+		++it;
+	}
+
+	const std::size_t first_variable = !leaves.empty() && as_value(leaves.front()) ? 1 : 0;
+	const std::size_t present = leaves.size();
+	for (; it != operands.end() && (*it)->kind() == NodeKind::Variable; ++it)
+		leaves.push_back(std::move(*it));
+	if (present > first_variable && present < leaves.size()
+	    && name_less(leaves[present], leaves[present - 1]))
+		std::inplace_merge(leaves.begin() + first_variable, leaves.begin() + present, leaves.end(),
+			[](const auto &a, const auto &b) { return name_less(a, b); });
+
+	others.insert(others.end(), std::make_move_iterator(it), std::make_move_iterator(operands.end()));
+}
+
+// Post-order fold over the DAG below `root` with explicit stacks: `step`
+// gets a node and the results for its operands. Results of nodes with
+// several owners are kept and reused; a uniquely owned node can be reached
+// only once, so it is not recorded.
+template <typename T, typename R, typename Step>
+R fold(const ExpressionImpl<T> &root, Step step)
+{
+	struct Frame {
+		const ExpressionImpl<T> *node;
+		// nullptr for the root
+		const Ref<ExpressionImpl<T>> *owner;
+		std::size_t next;
+		std::size_t base;
+	};
+	std::vector<Frame> stack{{&root, nullptr, 0, 0}};
+	std::vector<R> results;
+	std::unordered_map<const ExpressionImpl<T> *, R> shared;
+	while (true) {
+		Frame &frame = stack.back();
+		if (frame.next < frame.node->arity()) {
+			const auto &operand = frame.node->operand(frame.next++);
+			if (operand.use_count() > 1) {
+				if (auto it = shared.find(operand.get()); it != shared.end()) {
+					results.push_back(it->second);
+					continue;
+				}
+			}
+			stack.push_back({operand.get(), &operand, 0, results.size()});
+			continue;
+		}
+
+		R result = step(*frame.node, results.data() + frame.base);
+		results.erase(results.begin() + frame.base, results.end());
+		if (frame.owner != nullptr && frame.owner->use_count() > 1)
+			shared.emplace(frame.node, result);
+		stack.pop_back();
+		if (stack.empty())
+			return result;
+		results.push_back(std::move(result));
+	}
+}
+
+} // namespace
+
+// ================
+// |ExpressionImpl|
+// ================
+
+template <typename T>
+Ref<ExpressionImpl<T>> ExpressionImpl<T>::diff(Symbol by) const
+{
+	return fold<T, Ref<ExpressionImpl<T>>>(*this, [by](const ExpressionImpl<T> &node, const auto *derivatives) {
+		return node.diff_step(by, derivatives);
+	});
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> ExpressionImpl<T>::with_context(const Bindings<T> &context) const
+{
+	return fold<T, Ref<ExpressionImpl<T>>>(*this, [&](const ExpressionImpl<T> &node, const auto *operands) {
+		return node.with_context_step(context, operands);
+	});
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> ExpressionImpl<T>::specialize(const Bindings<T> &context) const
+{
+	return fold<T, Ref<ExpressionImpl<T>>>(*this, [&](const ExpressionImpl<T> &node, const auto *operands) {
+		return node.specialize_step(context, operands);
+	});
+}
+
+template <typename T>
+T ExpressionImpl<T>::eval() const
+{
+	return fold<T, T>(*this, [](const ExpressionImpl<T> &node, const T *operands) {
+		return node.eval_step(operands);
+	});
+}
+
+template <typename T>
+T ExpressionImpl<T>::eval(const Bindings<T> &context) const
+{
+	return fold<T, T>(*this, [&](const ExpressionImpl<T> &node, const T *operands) {
+		switch (node.kind()) {
+			case NodeKind::Variable:
+				if (const T *value = context.find(static_cast<const Variable<T> &>(node).get_symbol()))
+					return *value;
+				break;
+			case NodeKind::Polynomial:
+				return node.with_context_step(context, nullptr)->eval();
+			case NodeKind::Pow: {
+				// A bound exponent is a constant, as it would be after with_context.
+				const NodeKind exponent = node.operand(1)->kind();
+				if (exponent == NodeKind::Variable || exponent == NodeKind::Polynomial)
+					return OperationPow<T>::power(operands[0], operands[1]);
+				break;
+			}
+			default:
+				break;
+		}
+		return node.eval_step(operands);
+	});
+}
+
+template <typename T>
+std::string ExpressionImpl<T>::to_string() const
+{
+	std::string out;
+	std::vector<std::pair<const ExpressionImpl<T> *, std::size_t>> stack{{this, 0}};
+	while (!stack.empty()) {
+		auto [node, position] = stack.back();
+		node->to_string_step(out, position);
+		if (position < node->arity()) {
+			++stack.back().second;
+			stack.emplace_back(node->operand(position).get(), 0);
+		} else {
+			stack.pop_back();
+		}
+	}
+	return out;
+}
+
+template <typename T>
+void ExpressionImpl<T>::release(Ref<ExpressionImpl<T>> &operand)
+{
+	thread_local std::vector<Ref<ExpressionImpl<T>>> pending;
+	thread_local bool releasing = false;
+	if (operand.use_count() != 1)
+		return;
+	pending.push_back(std::move(operand));
+	if (releasing)
+		return;
+	releasing = true;
+	while (!pending.empty()) {
+		// Destroying this node may append its own operands.
+		auto node = std::move(pending.back());
+		pending.pop_back();
+		node.reset();
+	}
+	releasing = false;
+}
+
+template class ExpressionImpl<long double>;
+template class ExpressionImpl<std::complex<long double>>;
+
 // ============
 // |Expression|
 // ============
 
 template <typename T>
-Expression<T>::Expression(std::shared_ptr<ExpressionImpl<T>> impl_) :
+Expression<T>::Expression(Ref<ExpressionImpl<T>> impl_) :
     impl(impl_)
 {}
 
 template <typename T>
 Expression<T>::Expression(T number) :
-    impl(std::make_shared<Value<T>>(number))
+    impl(make_ref<Value<T>>(number))
 {}
 
 template <typename T>
 Expression<T>::Expression(const std::string &variable) :
-    impl(std::make_shared<Variable<T>>(variable))
+    impl(make_ref<Variable<T>>(variable))
 {}
 
 template <typename T>
@@ -28,7 +351,12 @@ Expression<T>::Expression(const Expression<T> &other) :
 {}
 
 template <typename T>
-Expression<T> &Expression<T>::operator=(Expression &&other) 
+Expression<T>::Expression(Expression<T> &&other) noexcept :
+    impl(std::move(other.impl))
+{}
+
+template <typename T>
+Expression<T> &Expression<T>::operator=(Expression &&other) noexcept
 {
 	if (this != &other) {
 		impl = std::move(other.impl);
@@ -47,101 +375,288 @@ Expression<T> &Expression<T>::operator=(const Expression &other)
 
 
 template <typename T>
-Expression<T> Expression<T>::operator+(const Expression &other) const
+Expression<T> Expression<T>::operator+(Expression other) const &
+{
+    return Expression<T>(OperationSum<T>::build(impl, std::move(other.impl)));
+}
+
+template <typename T>
+Expression<T> Expression<T>::operator+(Expression other) &&
 {
-    return Expression<T>(std::make_shared<OperationAdd<T>>(impl, other.impl));
+    return Expression<T>(OperationSum<T>::build(std::move(impl), std::move(other.impl)));
 }
 
 template <typename T>
-Expression<T> &Expression<T>::operator+=(const Expression &other) 
+Expression<T> &Expression<T>::operator+=(Expression other) 
 {
-    *this = *this + other;
+    impl = OperationSum<T>::build(std::move(impl), std::move(other.impl));
     return *this;
 }
 
 template <typename T>
-Expression<T> Expression<T>::operator-(const Expression &other) const
+Expression<T> Expression<T>::operator-(Expression other) const &
+{
+    return Expression<T>(make_ref<OperationSub<T>>(impl, std::move(other.impl)));
+}
+
+template <typename T>
+Expression<T> Expression<T>::operator-(Expression other) &&
 {
-    return Expression<T>(std::make_shared<OperationSub<T>>(impl, other.impl));
+    return Expression<T>(make_ref<OperationSub<T>>(std::move(impl), std::move(other.impl)));
 }
 
 template <typename T>
-Expression<T> &Expression<T>::operator-=(const Expression &other) 
+Expression<T> &Expression<T>::operator-=(Expression other) 
 {
-    *this = *this - other;
+    impl = make_ref<OperationSub<T>>(std::move(impl), std::move(other.impl));
     return *this;
 }
 
 template <typename T>
-Expression<T> Expression<T>::operator*(const Expression &other) const 
+Expression<T> Expression<T>::operator*(Expression other) const &
+{
+    return Expression<T>(OperationProduct<T>::build(impl, std::move(other.impl)));
+}
+
+template <typename T>
+Expression<T> Expression<T>::operator*(Expression other) &&
 {
-    return Expression<T>(std::make_shared<OperationMult<T>>(impl, other.impl));
+    return Expression<T>(OperationProduct<T>::build(std::move(impl), std::move(other.impl)));
 }
 
 template <typename T>
-Expression<T> &Expression<T>::operator*=(const Expression &other) 
+Expression<T> &Expression<T>::operator*=(Expression other) 
 {
-    *this = *this * other;
+    impl = OperationProduct<T>::build(std::move(impl), std::move(other.impl));
     return *this;
 }
 
 template <typename T>
-Expression<T> Expression<T>::operator/(const Expression &other) const 
+Expression<T> Expression<T>::operator/(Expression other) const &
+{
+    return Expression<T>(make_ref<OperationDiv<T>>(impl, std::move(other.impl)));
+}
+
+template <typename T>
+Expression<T> Expression<T>::operator/(Expression other) &&
 {
-    return Expression<T>(std::make_shared<OperationDiv<T>>(impl, other.impl));
+    return Expression<T>(make_ref<OperationDiv<T>>(std::move(impl), std::move(other.impl)));
 }
 
 template <typename T>
-Expression<T> &Expression<T>::operator/=(const Expression &other) 
+Expression<T> &Expression<T>::operator/=(Expression other) 
 {
-    *this = *this / other;
+    impl = make_ref<OperationDiv<T>>(std::move(impl), std::move(other.impl));
     return *this;
 }
 
 template <typename T>
-Expression<T> Expression<T>::operator^(const Expression &other) const
+Expression<T> Expression<T>::operator^(Expression other) const &
+{
+    return Expression<T>(make_ref<OperationPow<T>>(impl, std::move(other.impl)));
+}
+
+template <typename T>
+Expression<T> Expression<T>::operator^(Expression other) &&
 {
-    return Expression<T>(std::make_shared<OperationPow<T>>(impl, other.impl));
+    return Expression<T>(make_ref<OperationPow<T>>(std::move(impl), std::move(other.impl)));
 }
 
 template <typename T>
-Expression<T> &Expression<T>::operator^=(const Expression &other) 
+Expression<T> &Expression<T>::operator^=(Expression other) 
 {
-    *this = *this ^ other;
+    impl = make_ref<OperationPow<T>>(std::move(impl), std::move(other.impl));
     return *this;
 }
 
-template <typename T> Expression<T> Expression<T>::sin(void) const 
+template <typename T> Expression<T> Expression<T>::sin(void) const &
 {
-	return Expression<T>(std::make_shared<SinFunc<T>>(impl));
-};
+	return Expression<T>(make_ref<SinFunc<T>>(impl));
+}
 
-template <typename T> Expression<T> Expression<T>::cos(void) const 
+template <typename T> Expression<T> Expression<T>::sin(void) &&
 {
-	return Expression<T>(std::make_shared<CosFunc<T>>(impl));
-};
+	return Expression<T>(make_ref<SinFunc<T>>(std::move(impl)));
+}
 
-template <typename T> Expression<T> Expression<T>::ln(void) const {
-	return Expression<T>(std::make_shared<LnFunc<T>>(impl));
-};
+template <typename T> Expression<T> Expression<T>::cos(void) const &
+{
+	return Expression<T>(make_ref<CosFunc<T>>(impl));
+}
 
-template <typename T> Expression<T> Expression<T>::exp(void) const 
+template <typename T> Expression<T> Expression<T>::cos(void) &&
 {
-	return Expression<T>(std::make_shared<ExpFunc<T>>(impl));
-};
+	return Expression<T>(make_ref<CosFunc<T>>(std::move(impl)));
+}
+
+template <typename T> Expression<T> Expression<T>::ln(void) const &
+{
+	return Expression<T>(make_ref<LnFunc<T>>(impl));
+}
+
+template <typename T> Expression<T> Expression<T>::ln(void) &&
+{
+	return Expression<T>(make_ref<LnFunc<T>>(std::move(impl)));
+}
+
+template <typename T> Expression<T> Expression<T>::exp(void) const &
+{
+	return Expression<T>(make_ref<ExpFunc<T>>(impl));
+}
+
+template <typename T> Expression<T> Expression<T>::exp(void) &&
+{
+	return Expression<T>(make_ref<ExpFunc<T>>(std::move(impl)));
+}
 
 template <typename T>
-Expression<T> Expression<T>::diff(const std::string &by) const 
+Expression<T> Expression<T>::diff(Symbol by) const 
 {
 	return Expression<T>(impl->diff(by));
 }
 
 template <typename T>
-Expression<T> Expression<T>::with_context(const std::unordered_map<std::string, T> &context) const 
+Expression<T> Expression<T>::diff(Symbol by, std::size_t order) const
+{
+	Simplifier<T> simplify;
+	Ref<ExpressionImpl<T>> result = impl;
+	for (std::size_t k = 0; k < order; ++k)
+		result = simplify(AdjointSweep<T>({result}).tangent(0, by));
+	return Expression<T>(result);
+}
+
+template <typename T>
+Expression<T> Expression<T>::lazy_diff(Symbol by) const
+{
+	auto scope = std::make_shared<typename LazyDerivative<T>::Scope>(by);
+	return Expression<T>(LazyDerivative<T>::of(impl, scope));
+}
+
+template <typename T>
+Expression<T> Expression<T>::with_context(const Bindings<T> &context) const 
 {
 	return Expression<T>(impl->with_context(context));
 }
 
+template <typename T>
+Expression<T> Expression<T>::specialize(const Bindings<T> &context) const 
+{
+	return Expression<T>(impl->specialize(context));
+}
+
+template <typename T>
+Expression<T> Expression<T>::substitute(Symbol var, const Expression<T> &replacement) const
+{
+	return substitute({{var, replacement}});
+}
+
+template <typename T>
+Expression<T> Expression<T>::substitute(const std::vector<std::pair<Symbol, Expression<T>>> &replacements) const
+{
+	Substitution<T> substitution;
+	for (const auto &[var, replacement] : replacements)
+		substitution.bind(var, replacement.impl);
+	return Expression<T>(substitution(impl));
+}
+
+template <typename T>
+std::vector<Expression<T>> Expression<T>::compose(
+	const std::vector<Expression<T>> &outer, const std::vector<Symbol> &vars,
+	const std::vector<Expression<T>> &inner
+)
+{
+	if (vars.size() != inner.size())
+		throw std::invalid_argument("compose needs one inner expression per variable");
+	Substitution<T> substitution;
+	for (std::size_t i = 0; i < vars.size(); ++i)
+		substitution.bind(vars[i], inner[i].impl);
+	std::vector<Expression<T>> result;
+	for (const auto &expression : outer)
+		result.push_back(Expression<T>(substitution(expression.impl)));
+	return result;
+}
+
+template <typename T>
+Expression<T> Expression<T>::detect_polynomials() const 
+{
+	return Expression<T>(Polynomial<T>::detect(impl));
+}
+
+template <typename T>
+Expression<T> Expression<T>::simplify() const
+{
+	return Expression<T>(Simplifier<T>()(impl));
+}
+
+template <typename T>
+Expression<T> Expression<T>::sum(std::vector<Expression<T>> terms)
+{
+	std::vector<Ref<ExpressionImpl<T>>> nodes;
+	nodes.reserve(terms.size());
+	for (auto &term : terms)
+		nodes.push_back(std::move(term.impl));
+	return Expression<T>(OperationSum<T>::build(std::move(nodes)));
+}
+
+template <typename T>
+Expression<T> Expression<T>::product(std::vector<Expression<T>> factors)
+{
+	std::vector<Ref<ExpressionImpl<T>>> nodes;
+	nodes.reserve(factors.size());
+	for (auto &factor : factors)
+		nodes.push_back(std::move(factor.impl));
+	return Expression<T>(OperationProduct<T>::build(std::move(nodes)));
+}
+
+template <typename T>
+std::vector<Expression<T>> Expression<T>::gradient(const std::vector<Symbol> &vars) const
+{
+	return jacobian({*this}, vars).front();
+}
+
+template <typename T>
+std::vector<std::vector<Expression<T>>> Expression<T>::jacobian(
+	const std::vector<Expression<T>> &expressions, const std::vector<Symbol> &vars
+)
+{
+	std::vector<Ref<ExpressionImpl<T>>> roots;
+	for (const auto &expression : expressions)
+		roots.push_back(expression.impl);
+
+	AdjointSweep<T> sweep(std::move(roots));
+	std::vector<std::vector<Expression<T>>> result;
+	for (std::size_t row = 0; row < expressions.size(); ++row) {
+		std::vector<Expression<T>> partials;
+		for (auto &partial : sweep.gradient(row, vars))
+			partials.push_back(Expression<T>(std::move(partial)));
+		result.push_back(std::move(partials));
+	}
+	return result;
+}
+
+template <typename T>
+std::vector<std::vector<Expression<T>>> Expression<T>::hessian(const std::vector<Symbol> &vars) const
+{
+	Simplifier<T> simplify;
+	std::vector<Ref<ExpressionImpl<T>>> gradient = AdjointSweep<T>({impl}).gradient(0, vars);
+	for (auto &partial : gradient)
+		partial = simplify(partial);
+
+	// Row i only needs d g_i / d x_j for j >= i; the second sweep shares the
+	// local partials of the whole gradient DAG between rows.
+	AdjointSweep<T> second(gradient);
+	const std::size_t n = vars.size();
+	std::vector<std::vector<Expression<T>>> result(n, std::vector<Expression<T>>(n, Expression<T>(T(0))));
+	for (std::size_t i = 0; i < n; ++i) {
+		auto row = second.gradient(i, std::vector<Symbol>(vars.begin() + i, vars.end()));
+		for (std::size_t j = i; j < n; ++j) {
+			result[i][j] = Expression<T>(simplify(row[j - i]));
+			result[j][i] = result[i][j];
+		}
+	}
+	return result;
+}
+
 template <typename T>
 T Expression<T>::eval(void) const 
 {
@@ -149,9 +664,9 @@ T Expression<T>::eval(void) const
 }
 
 template <typename T>
-T Expression<T>::eval_with(const std::unordered_map<std::string, T> &context) const 
+T Expression<T>::eval_with(const Bindings<T> &context) const 
 {
-	return impl->with_context(context)->eval();
+	return impl->eval(context);
 }
 
 template <typename T>
@@ -162,7 +677,15 @@ std::string Expression<T>::to_string() const
 
 template<typename T>
 Expression<T> Expression<T>::from_string(const std::string& expression_str, bool ignore_case) {
-    return Parser<T>(expression_str, ignore_case).parse();
+    // The string outlives the parser, so it is scanned without a copy.
+    return Parser<T>(std::string_view(expression_str), ignore_case).parse();
+}
+
+template<typename T>
+Expression<T> Expression<T>::from_file(const std::string& path, bool ignore_case) {
+    MappedFile file(path);
+    file.advise_sequential();
+    return Parser<T>(file.view(), ignore_case).parse();
 }
 
 template class Expression<long double>;
@@ -178,38 +701,52 @@ Value<T>::Value(T number) :
 {}
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> Value<T>::diff(const std::string &by) const 
+Ref<ExpressionImpl<T>> Value<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *) const
 {
-	return std::make_shared<Value<T>>(Value<T>(0));
+	return make_ref<Value<T>>(Value<T>(0));
 }
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> Value<T>::with_context( const std::unordered_map<std::string, T> &context) const 
+Ref<ExpressionImpl<T>> Value<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *) const
 {
-	return std::make_shared<Value<T>>(Value<T>(value));
+	return make_ref<Value<T>>(Value<T>(value));
 };
 
 template <typename T>
-T Value<T>::eval() const 
+Ref<ExpressionImpl<T>> Value<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *) const
+{
+	return share(this);
+}
+
+template <typename T>
+T Value<T>::get_value() const 
+{
+    return value;
+}
+
+template <typename T>
+T Value<T>::eval_step(const T *) const
 {
     return value;
 }
 
 template <typename T>
-std::string Value<T>::to_string(void) const 
+void Value<T>::to_string_step(std::string &out, std::size_t) const
 {
     std::ostringstream oss;
 	oss << value;
-	return oss.str();
+	out += oss.str();
 }
 
 template <>
-std::string Value<std::complex<long double>>::to_string(void) const 
+void Value<std::complex<long double>>::to_string_step(std::string &out, std::size_t) const
 {
 	std::ostringstream oss;
 	bool with_both_parts = false;
-	if (value.imag() == 0 && value.real() == 0)
-		return "0";
+	if (value.imag() == 0 && value.real() == 0) {
+		out += "0";
+		return;
+	}
 	else if (value.imag() != 0 && value.real() != 0) {
 		with_both_parts = true;
 		oss << "(";
@@ -227,7 +764,31 @@ std::string Value<std::complex<long double>>::to_string(void) const
 	}
 
 	if (with_both_parts) oss << ")";
-	return oss.str();
+	out += oss.str();
+}
+
+template <typename T>
+NodeKind Value<T>::kind() const
+{
+    return NodeKind::Value;
+}
+
+template <typename T>
+std::size_t Value<T>::arity() const
+{
+    return 0;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &Value<T>::operand(std::size_t) const
+{
+    throw std::out_of_range("Value has no operands -> Value::operand");
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> Value<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>>) const
+{
+    return share(this);
 }
 
 template class Value<long double>;
@@ -237,172 +798,677 @@ template class Value<std::complex<long double>>;
 // ================
 
 template <typename T>
-Variable<T>::Variable(std::string var) : name(var)
+Variable<T>::Variable(Symbol symbol_) : symbol(symbol_)
 {}
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> Variable<T>::diff(const std::string &by) const 
+Symbol Variable<T>::get_symbol() const
+{
+	return symbol;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> Variable<T>::diff_step(Symbol by, const Ref<ExpressionImpl<T>> *) const
 {
-	if (by == name) {
-		return std::make_shared<Value<T>>(Value<T>(1));
+	if (by == symbol) {
+		return make_ref<Value<T>>(Value<T>(1));
 	}
-	return std::make_shared<Value<T>>(Value<T>(0));
+	return make_ref<Value<T>>(Value<T>(0));
 }
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> Variable<T>::with_context(const std::unordered_map<std::string, T> &context) const 
+Ref<ExpressionImpl<T>> Variable<T>::with_context_step(const Bindings<T> &context, const Ref<ExpressionImpl<T>> *) const
 {
-	if (context.find(name) == context.end())
-		return std::make_shared<Variable<T>>(Variable<T>(name));
-	return std::make_shared<Value<T>>(Value<T>(context.at(name)));
+	const T *value = context.find(symbol);
+	if (value == nullptr)
+		return make_ref<Variable<T>>(Variable<T>(symbol));
+	return make_ref<Value<T>>(Value<T>(*value));
 };
 
 template <typename T>
-T Variable<T>::eval() const 
+Ref<ExpressionImpl<T>> Variable<T>::specialize_step(const Bindings<T> &context, const Ref<ExpressionImpl<T>> *) const
 {
-    throw std::runtime_error("Varriable " + name +  " cannot be resolved without context");
+	const T *value = context.find(symbol);
+	if (value == nullptr)
+		return share(this);
+	return make_ref<Value<T>>(*value);
 }
 
 template <typename T>
-std::string Variable<T>::to_string() const 
+T Variable<T>::eval_step(const T *) const
 {
-    return name;
+    throw std::runtime_error("Varriable " + symbol.name() +  " cannot be resolved without context");
 }
 
-template class Variable<long double>;
-template class Variable<std::complex<long double>>;
-
-// ====================
-// |class OperationAdd|
-// ====================
-
 template <typename T>
-OperationAdd<T>::OperationAdd(
-	const std::shared_ptr<ExpressionImpl<T>> &left_,
-	const std::shared_ptr<ExpressionImpl<T>> &right_
-):
-    left(left_),
-    right(right_)
-{}
+void Variable<T>::to_string_step(std::string &out, std::size_t) const
+{
+    out += symbol.name();
+}
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> OperationAdd<T>::diff(const std::string &by) const 
+NodeKind Variable<T>::kind() const
 {
-	return std::make_shared<OperationAdd<T>>(left->diff(by), right->diff(by));
+    return NodeKind::Variable;
 }
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> OperationAdd<T>::with_context(const std::unordered_map<std::string, T> &context) const 
+std::size_t Variable<T>::arity() const
 {
-	return std::make_shared<OperationAdd<T>>(left->with_context(context), right->with_context(context));
+    return 0;
 }
 
 template <typename T>
-T OperationAdd<T>::eval() const
+const Ref<ExpressionImpl<T>> &Variable<T>::operand(std::size_t) const
 {
-    return left->eval() + right->eval();
+    throw std::out_of_range("Variable has no operands -> Variable::operand");
 }
 
 template <typename T>
-std::string OperationAdd<T>::to_string() const
+Ref<ExpressionImpl<T>> Variable<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>>) const
 {
-    return std::string("(")   + left->to_string()  +
-           std::string(" + ") + right->to_string() +
-           std::string(")");
+    return share(this);
 }
 
-template class OperationAdd<long double>;
-template class OperationAdd<std::complex<long double>>;
-// =====================
-// |class OperationMult|
-// =====================
+template class Variable<long double>;
+template class Variable<std::complex<long double>>;
 
+// ====================
+// |class OperationAdd|
+// ====================
 
 template <typename T>
-OperationMult<T>::OperationMult(
-	const std::shared_ptr<ExpressionImpl<T>> &left_,
-	const std::shared_ptr<ExpressionImpl<T>> &right_
+OperationAdd<T>::OperationAdd(
+	Ref<ExpressionImpl<T>> left_,
+	Ref<ExpressionImpl<T>> right_
 ):
-    left(left_),
-    right(right_)
+    left(std::move(left_)),
+    right(std::move(right_))
 {}
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> OperationMult<T>::diff(const std::string &by) const 
+Ref<ExpressionImpl<T>> OperationAdd<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
 {
-	return std::make_shared<OperationAdd<T>>(
-		std::make_shared<OperationMult<T>>(left->diff(by), right),
-		std::make_shared<OperationMult<T>>(left, right->diff(by))
-	);
+	return make_ref<OperationAdd<T>>(derivatives[0], derivatives[1]);
 }
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> OperationMult<T>::with_context(const std::unordered_map<std::string, T> &context) const
+Ref<ExpressionImpl<T>> OperationAdd<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
 {
-	return std::make_shared<OperationMult<T>>(
-		left->with_context(context), right->with_context(context)
-	);
-};
+	return make_ref<OperationAdd<T>>(operands[0], operands[1]);
+}
 
 template <typename T>
-T OperationMult<T>::eval() const
+Ref<ExpressionImpl<T>> OperationAdd<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
 {
-    return left->eval() * right->eval();
+	const auto &l = operands[0];
+	const auto &r = operands[1];
+	if (as_value(l) && as_value(r))
+		return make_ref<Value<T>>(OperationAdd<T>(l, r).eval());
+	if (is_value(l, T(0))) return r;
+	if (is_value(r, T(0))) return l;
+	if (l == left && r == right)
+		return share(this);
+	return make_ref<OperationAdd<T>>(l, r);
 }
 
 template <typename T>
-std::string OperationMult<T>::to_string() const
+T OperationAdd<T>::eval_step(const T *operands) const
 {
-    return std::string("(")   + left->to_string()  +
-           std::string(" * ") + right->to_string() +
-           std::string(")");
+    return operands[0] + operands[1];
 }
 
-template class OperationMult<long double>;
-template class OperationMult<std::complex<long double>>;
-
-
-// =====================
-// |class OperationSub|
-// =====================
+template <typename T>
+void OperationAdd<T>::to_string_step(std::string &out, std::size_t position) const
+{
+    static constexpr const char *parts[] = {"(", " + ", ")"};
+    out += parts[position];
+}
 
 template <typename T>
-OperationSub<T>::OperationSub(
-	const std::shared_ptr<ExpressionImpl<T>> &left_,
-	const std::shared_ptr<ExpressionImpl<T>> &right_
-):
-    left(left_),
-    right(right_)
-{}
+NodeKind OperationAdd<T>::kind() const
+{
+    return NodeKind::Add;
+}
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> OperationSub<T>::diff(const std::string &by) const 
+std::size_t OperationAdd<T>::arity() const
 {
-	return std::make_shared<OperationSub<T>>(left->diff(by), right->diff(by));
+    return 2;
 }
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> OperationSub<T>::with_context(const std::unordered_map<std::string, T> &context) const 
+const Ref<ExpressionImpl<T>> &OperationAdd<T>::operand(std::size_t index) const
 {
-	return std::make_shared<OperationSub<T>>(left->with_context(context), right->with_context(context));
+    if (index > 1)
+        throw std::out_of_range("Operand index out of range -> OperationAdd::operand");
+    return index == 0 ? left : right;
 }
 
 template <typename T>
-T OperationSub<T>::eval() const
+Ref<ExpressionImpl<T>> OperationAdd<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
 {
-    return left->eval() - right->eval();
+    return make_ref<OperationAdd<T>>(operands.at(0), operands.at(1));
 }
 
 template <typename T>
-std::string OperationSub<T>::to_string() const
+OperationAdd<T>::~OperationAdd()
 {
-    return std::string("(")   + left->to_string()  +
-           std::string(" - ") + right->to_string() +
-           std::string(")");
+	this->release(left);
+	this->release(right);
 }
 
-template class OperationSub<long double>;
-template class OperationSub<std::complex<long double>>;
+template class OperationAdd<long double>;
+template class OperationAdd<std::complex<long double>>;
+// =====================
+// |class OperationMult|
+// =====================
+
+
+template <typename T>
+OperationMult<T>::OperationMult(
+	Ref<ExpressionImpl<T>> left_,
+	Ref<ExpressionImpl<T>> right_
+):
+    left(std::move(left_)),
+    right(std::move(right_))
+{}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationMult<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
+{
+	return make_ref<OperationAdd<T>>(
+		make_ref<OperationMult<T>>(derivatives[0], right),
+		make_ref<OperationMult<T>>(left, derivatives[1])
+	);
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationMult<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	return make_ref<OperationMult<T>>(
+		operands[0], operands[1]
+	);
+};
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationMult<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	const auto &l = operands[0];
+	const auto &r = operands[1];
+	if (as_value(l) && as_value(r))
+		return make_ref<Value<T>>(OperationMult<T>(l, r).eval());
+	if (is_value(l, T(0)) || is_value(r, T(0)))
+		return make_ref<Value<T>>(T(0));
+	if (is_value(l, T(1))) return r;
+	if (is_value(r, T(1))) return l;
+	if (l == left && r == right)
+		return share(this);
+	return make_ref<OperationMult<T>>(l, r);
+}
+
+template <typename T>
+T OperationMult<T>::eval_step(const T *operands) const
+{
+    return operands[0] * operands[1];
+}
+
+template <typename T>
+void OperationMult<T>::to_string_step(std::string &out, std::size_t position) const
+{
+    static constexpr const char *parts[] = {"(", " * ", ")"};
+    out += parts[position];
+}
+
+template <typename T>
+NodeKind OperationMult<T>::kind() const
+{
+    return NodeKind::Mult;
+}
+
+template <typename T>
+std::size_t OperationMult<T>::arity() const
+{
+    return 2;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &OperationMult<T>::operand(std::size_t index) const
+{
+    if (index > 1)
+        throw std::out_of_range("Operand index out of range -> OperationMult::operand");
+    return index == 0 ? left : right;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationMult<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
+{
+    return make_ref<OperationMult<T>>(operands.at(0), operands.at(1));
+}
+
+template <typename T>
+OperationMult<T>::~OperationMult()
+{
+	this->release(left);
+	this->release(right);
+}
+
+template class OperationMult<long double>;
+template class OperationMult<std::complex<long double>>;
+
+
+// ======================
+// |class OperationSum|
+// ======================
+
+template <typename T>
+OperationSum<T>::OperationSum(std::vector<Ref<ExpressionImpl<T>>> terms_)
+{
+	split_operands(std::move(terms_), leaves, others);
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationSum<T>::build(
+	Ref<ExpressionImpl<T>> left,
+	Ref<ExpressionImpl<T>> right
+)
+{
+	auto combine = [](T a, T b) { return a + b; };
+	Ref<OperationSum<T>> result;
+	std::vector<Ref<ExpressionImpl<T>>> added;
+	if (left->kind() == NodeKind::Sum && left.use_count() == 1) {
+		result = static_ref_cast<OperationSum<T>>(std::move(left));
+	} else {
+		result = make_ref<OperationSum<T>>(std::vector<Ref<ExpressionImpl<T>>>{});
+		added.push_back(std::move(left));
+	}
+	added.push_back(std::move(right));
+	append_operands(result->leaves, result->others,
+		canonical_operands<T>(NodeKind::Sum, std::move(added), combine), combine);
+
+	if (result->arity() == 1)
+		return result->operand(0);
+	return result;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationSum<T>::build(std::vector<Ref<ExpressionImpl<T>>> operands)
+{
+	auto canonical = canonical_operands<T>(NodeKind::Sum, std::move(operands), [](T a, T b) { return a + b; });
+	if (canonical.empty())
+		return make_ref<Value<T>>(T(0));
+	if (canonical.size() == 1)
+		return std::move(canonical.front());
+	return make_ref<OperationSum<T>>(std::move(canonical));
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationSum<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
+{
+	std::vector<Ref<ExpressionImpl<T>>> nonzero;
+	for (std::size_t i = 0; i < arity(); ++i) {
+		if (!is_value(derivatives[i], T(0)))
+			nonzero.push_back(derivatives[i]);
+	}
+	if (nonzero.empty())
+		return make_ref<Value<T>>(T(0));
+	if (nonzero.size() == 1)
+		return nonzero.front();
+	return make_ref<OperationSum<T>>(std::move(nonzero));
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationSum<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	std::vector<Ref<ExpressionImpl<T>>> bound(operands, operands + arity());
+	return make_ref<OperationSum<T>>(std::move(bound));
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationSum<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	std::vector<Ref<ExpressionImpl<T>>> rest;
+	T constant = T(0);
+	bool changed = false;
+	for (std::size_t i = 0; i < arity(); ++i) {
+		const auto &special = operands[i];
+		changed |= special != operand(i);
+		if (const Value<T> *value = as_value(special))
+			constant = constant + value->get_value();
+		else
+			rest.push_back(special);
+	}
+	if (rest.empty())
+		return make_ref<Value<T>>(constant);
+	if (!changed)
+		return share(this);
+	if (constant != T(0))
+		rest.insert(rest.begin(), make_ref<Value<T>>(constant));
+	if (rest.size() == 1)
+		return rest.front();
+	return make_ref<OperationSum<T>>(std::move(rest));
+}
+
+template <typename T>
+T OperationSum<T>::eval_step(const T *operands) const
+{
+    T result = T(0);
+    const std::size_t n = arity();
+    for (std::size_t i = 0; i < n; ++i)
+        result = result + operands[i];
+    return result;
+}
+
+template <typename T>
+void OperationSum<T>::to_string_step(std::string &out, std::size_t position) const
+{
+    if (arity() == 0)
+        out += "()";
+    else
+        out += position == 0 ? "(" : position == arity() ? ")" : " + ";
+}
+
+template <typename T>
+NodeKind OperationSum<T>::kind() const
+{
+    return NodeKind::Sum;
+}
+
+template <typename T>
+std::size_t OperationSum<T>::arity() const
+{
+    return leaves.size() + others.size();
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &OperationSum<T>::operand(std::size_t index) const
+{
+    if (index < leaves.size())
+        return leaves[index];
+    if (index - leaves.size() >= others.size())
+        throw std::out_of_range("Operand index out of range -> OperationSum::operand");
+    return others[index - leaves.size()];
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationSum<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
+{
+    return make_ref<OperationSum<T>>(std::move(operands));
+}
+
+template <typename T>
+OperationSum<T>::~OperationSum()
+{
+	for (auto &operand : leaves)
+		this->release(operand);
+	for (auto &operand : others)
+		this->release(operand);
+}
+
+template class OperationSum<long double>;
+template class OperationSum<std::complex<long double>>;
+
+// ==========================
+// |class OperationProduct|
+// ==========================
+
+template <typename T>
+OperationProduct<T>::OperationProduct(std::vector<Ref<ExpressionImpl<T>>> factors_)
+{
+	split_operands(std::move(factors_), leaves, others);
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationProduct<T>::build(
+	Ref<ExpressionImpl<T>> left,
+	Ref<ExpressionImpl<T>> right
+)
+{
+	auto combine = [](T a, T b) { return a * b; };
+	Ref<OperationProduct<T>> result;
+	std::vector<Ref<ExpressionImpl<T>>> added;
+	if (left->kind() == NodeKind::Product && left.use_count() == 1) {
+		result = static_ref_cast<OperationProduct<T>>(std::move(left));
+	} else {
+		result = make_ref<OperationProduct<T>>(std::vector<Ref<ExpressionImpl<T>>>{});
+		added.push_back(std::move(left));
+	}
+	added.push_back(std::move(right));
+	append_operands(result->leaves, result->others,
+		canonical_operands<T>(NodeKind::Product, std::move(added), combine), combine);
+
+	if (result->arity() == 1)
+		return result->operand(0);
+	return result;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationProduct<T>::build(std::vector<Ref<ExpressionImpl<T>>> operands)
+{
+	auto canonical = canonical_operands<T>(NodeKind::Product, std::move(operands), [](T a, T b) { return a * b; });
+	if (canonical.empty())
+		return make_ref<Value<T>>(T(1));
+	if (canonical.size() == 1)
+		return std::move(canonical.front());
+	return make_ref<OperationProduct<T>>(std::move(canonical));
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationProduct<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
+{
+	// sum_i (f_0 * ... * f_{i-1}) * f_i' * (f_{i+1} * ... * f_{n-1}), with the
+	// prefix and suffix products built once and shared between the terms.
+	const std::size_t n = arity();
+	std::size_t first = n, last = 0;
+	for (std::size_t i = 0; i < n; ++i) {
+		if (!is_value(derivatives[i], T(0))) {
+			first = std::min(first, i);
+			last = i;
+		}
+	}
+	if (first == n)
+		return make_ref<Value<T>>(T(0));
+
+	std::vector<Ref<ExpressionImpl<T>>> prefix(n + 1), suffix(n + 1);
+	for (std::size_t i = 1; i <= last; ++i)
+		prefix[i] = i == 1 ? operand(0) : make_ref<OperationMult<T>>(prefix[i - 1], operand(i - 1));
+	for (std::size_t i = n - 1; i > first; --i)
+		suffix[i] = i == n - 1 ? operand(i) : make_ref<OperationMult<T>>(operand(i), suffix[i + 1]);
+
+	std::vector<Ref<ExpressionImpl<T>>> terms;
+	for (std::size_t i = first; i <= last; ++i) {
+		if (is_value(derivatives[i], T(0)))
+			continue;
+		std::vector<Ref<ExpressionImpl<T>>> term;
+		if (prefix[i]) term.push_back(prefix[i]);
+		term.push_back(derivatives[i]);
+		if (suffix[i + 1]) term.push_back(suffix[i + 1]);
+		terms.push_back(term.size() == 1 ? term.front() : make_ref<OperationProduct<T>>(std::move(term)));
+	}
+	if (terms.size() == 1)
+		return terms.front();
+	return make_ref<OperationSum<T>>(std::move(terms));
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationProduct<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	std::vector<Ref<ExpressionImpl<T>>> bound(operands, operands + arity());
+	return make_ref<OperationProduct<T>>(std::move(bound));
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationProduct<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	std::vector<Ref<ExpressionImpl<T>>> rest;
+	T constant = T(1);
+	bool changed = false;
+	for (std::size_t i = 0; i < arity(); ++i) {
+		const auto &special = operands[i];
+		changed |= special != operand(i);
+		if (const Value<T> *value = as_value(special))
+			constant = constant * value->get_value();
+		else
+			rest.push_back(special);
+	}
+	if (constant == T(0))
+		return make_ref<Value<T>>(T(0));
+	if (rest.empty())
+		return make_ref<Value<T>>(constant);
+	if (!changed)
+		return share(this);
+	if (constant != T(1))
+		rest.insert(rest.begin(), make_ref<Value<T>>(constant));
+	if (rest.size() == 1)
+		return rest.front();
+	return make_ref<OperationProduct<T>>(std::move(rest));
+}
+
+template <typename T>
+T OperationProduct<T>::eval_step(const T *operands) const
+{
+    T result = T(1);
+    const std::size_t n = arity();
+    for (std::size_t i = 0; i < n; ++i)
+        result = result * operands[i];
+    return result;
+}
+
+template <typename T>
+void OperationProduct<T>::to_string_step(std::string &out, std::size_t position) const
+{
+    if (arity() == 0)
+        out += "()";
+    else
+        out += position == 0 ? "(" : position == arity() ? ")" : " * ";
+}
+
+template <typename T>
+NodeKind OperationProduct<T>::kind() const
+{
+    return NodeKind::Product;
+}
+
+template <typename T>
+std::size_t OperationProduct<T>::arity() const
+{
+    return leaves.size() + others.size();
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &OperationProduct<T>::operand(std::size_t index) const
+{
+    if (index < leaves.size())
+        return leaves[index];
+    if (index - leaves.size() >= others.size())
+        throw std::out_of_range("Operand index out of range -> OperationProduct::operand");
+    return others[index - leaves.size()];
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationProduct<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
+{
+    return make_ref<OperationProduct<T>>(std::move(operands));
+}
+
+template <typename T>
+OperationProduct<T>::~OperationProduct()
+{
+	for (auto &operand : leaves)
+		this->release(operand);
+	for (auto &operand : others)
+		this->release(operand);
+}
+
+template class OperationProduct<long double>;
+template class OperationProduct<std::complex<long double>>;
+
+// =====================
+// |class OperationSub|
+// =====================
+
+template <typename T>
+OperationSub<T>::OperationSub(
+	Ref<ExpressionImpl<T>> left_,
+	Ref<ExpressionImpl<T>> right_
+):
+    left(std::move(left_)),
+    right(std::move(right_))
+{}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationSub<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
+{
+	return make_ref<OperationSub<T>>(derivatives[0], derivatives[1]);
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationSub<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	return make_ref<OperationSub<T>>(operands[0], operands[1]);
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationSub<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	const auto &l = operands[0];
+	const auto &r = operands[1];
+	if (as_value(l) && as_value(r))
+		return make_ref<Value<T>>(OperationSub<T>(l, r).eval());
+	if (is_value(r, T(0))) return l;
+	if (l == left && r == right)
+		return share(this);
+	return make_ref<OperationSub<T>>(l, r);
+}
+
+template <typename T>
+T OperationSub<T>::eval_step(const T *operands) const
+{
+    return operands[0] - operands[1];
+}
+
+template <typename T>
+void OperationSub<T>::to_string_step(std::string &out, std::size_t position) const
+{
+    static constexpr const char *parts[] = {"(", " - ", ")"};
+    out += parts[position];
+}
+
+template <typename T>
+NodeKind OperationSub<T>::kind() const
+{
+    return NodeKind::Sub;
+}
+
+template <typename T>
+std::size_t OperationSub<T>::arity() const
+{
+    return 2;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &OperationSub<T>::operand(std::size_t index) const
+{
+    if (index > 1)
+        throw std::out_of_range("Operand index out of range -> OperationSub::operand");
+    return index == 0 ? left : right;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationSub<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
+{
+    return make_ref<OperationSub<T>>(operands.at(0), operands.at(1));
+}
+
+template <typename T>
+OperationSub<T>::~OperationSub()
+{
+	this->release(left);
+	this->release(right);
+}
+
+template class OperationSub<long double>;
+template class OperationSub<std::complex<long double>>;
 // =====================
 // |class OperationDiv|
 // =====================
@@ -410,47 +1476,92 @@ template class OperationSub<std::complex<long double>>;
 
 template <typename T>
 OperationDiv<T>::OperationDiv(
-	const std::shared_ptr<ExpressionImpl<T>> &left_,
-	const std::shared_ptr<ExpressionImpl<T>> &right_
+	Ref<ExpressionImpl<T>> left_,
+	Ref<ExpressionImpl<T>> right_
 ):
-    left(left_),
-    right(right_)
+    left(std::move(left_)),
+    right(std::move(right_))
 {}
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> OperationDiv<T>::diff(const std::string &by) const 
+Ref<ExpressionImpl<T>> OperationDiv<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
 {
-	return std::make_shared<OperationDiv<T>>(
-		std::make_shared<OperationSub<T>>(
-            std::make_shared<OperationMult<T>>(left->diff(by), right), std::make_shared<OperationMult<T>>(left, right->diff(by))),
-		std::make_shared<OperationMult<T>>(right, right)
+	return make_ref<OperationDiv<T>>(
+		make_ref<OperationSub<T>>(
+            make_ref<OperationMult<T>>(derivatives[0], right), make_ref<OperationMult<T>>(left, derivatives[1])),
+		make_ref<OperationMult<T>>(right, right)
 	);
 }
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> OperationDiv<T>::with_context(const std::unordered_map<std::string, T> &context) const
+Ref<ExpressionImpl<T>> OperationDiv<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
 {
-	return std::make_shared<OperationDiv<T>>(
-		left->with_context(context), right->with_context(context)
+	return make_ref<OperationDiv<T>>(
+		operands[0], operands[1]
 	);
 };
 
 template <typename T>
-T OperationDiv<T>::eval() const
+Ref<ExpressionImpl<T>> OperationDiv<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
 {
-    T r_value = right->eval();
+	const auto &l = operands[0];
+	const auto &r = operands[1];
+	if (as_value(l) && as_value(r))
+		return make_ref<Value<T>>(OperationDiv<T>(l, r).eval());
+	if (is_value(r, T(1))) return l;
+	if (l == left && r == right)
+		return share(this);
+	return make_ref<OperationDiv<T>>(l, r);
+}
+
+template <typename T>
+T OperationDiv<T>::eval_step(const T *operands) const
+{
+    T r_value = operands[1];
     if (r_value == 0.L){
         throw std::runtime_error("Division by zero -> OperationDiv::eval");
     }
-    return left->eval() / r_value;
+    return operands[0] / r_value;
+}
+
+template <typename T>
+void OperationDiv<T>::to_string_step(std::string &out, std::size_t position) const
+{
+    static constexpr const char *parts[] = {"(", " / ", ")"};
+    out += parts[position];
+}
+
+template <typename T>
+NodeKind OperationDiv<T>::kind() const
+{
+    return NodeKind::Div;
+}
+
+template <typename T>
+std::size_t OperationDiv<T>::arity() const
+{
+    return 2;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &OperationDiv<T>::operand(std::size_t index) const
+{
+    if (index > 1)
+        throw std::out_of_range("Operand index out of range -> OperationDiv::operand");
+    return index == 0 ? left : right;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationDiv<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
+{
+    return make_ref<OperationDiv<T>>(operands.at(0), operands.at(1));
 }
 
 template <typename T>
-std::string OperationDiv<T>::to_string() const
+OperationDiv<T>::~OperationDiv()
 {
-    return std::string("(")   + left->to_string()  +
-           std::string(" / ") + right->to_string() +
-           std::string(")");
+	this->release(left);
+	this->release(right);
 }
 
 template class OperationDiv<long double>;
@@ -465,47 +1576,163 @@ template class OperationDiv<std::complex<long double>>;
 
 template <typename T>
 OperationPow<T>::OperationPow(
-	const std::shared_ptr<ExpressionImpl<T>> &left_,
-	const std::shared_ptr<ExpressionImpl<T>> &right_
+	Ref<ExpressionImpl<T>> left_,
+	Ref<ExpressionImpl<T>> right_
 ):
-    left(left_),
-    right(right_)
-{}
+    left(std::move(left_)),
+    right(std::move(right_)),
+    exponent_class(ExponentClass::General),
+    integer_exponent(0)
+{
+	if (const Value<T> *exponent = as_value(right))
+		exponent_class = classify(exponent->get_value(), integer_exponent);
+}
+
+template <typename T>
+ExponentClass OperationPow<T>::classify(T exponent, std::int64_t &integer)
+{
+	const auto real = std::real(exponent);
+	if (std::imag(exponent) != 0)
+		return ExponentClass::Constant;
+	if (real == std::trunc(real) && std::abs(real) <= max_integer_exponent) {
+		integer = static_cast<std::int64_t>(real);
+		return ExponentClass::Integer;
+	}
+	return real == 0.5L ? ExponentClass::SquareRoot : ExponentClass::Constant;
+}
+
+template <typename T>
+T OperationPow<T>::power(T base, T exponent)
+{
+	std::int64_t integer = 0;
+	switch (classify(exponent, integer)) {
+		case ExponentClass::Integer:
+			return integer_power(base, integer);
+		case ExponentClass::SquareRoot:
+			return std::sqrt(base);
+		default:
+			return std::pow(base, exponent);
+	}
+}
+
+template <typename T>
+ExponentClass OperationPow<T>::get_exponent_class() const
+{
+	return exponent_class;
+}
+
+template <typename T>
+std::int64_t OperationPow<T>::get_integer_exponent() const
+{
+	return integer_exponent;
+}
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> OperationPow<T>::diff(const std::string &by) const 
+Ref<ExpressionImpl<T>> OperationPow<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
 {
+	if (exponent_class != ExponentClass::General) {
+		// c * left^(c - 1) * left'
+		if (exponent_class == ExponentClass::Integer && integer_exponent == 0)
+			return make_ref<Value<T>>(T(0));
+		if (exponent_class == ExponentClass::Integer && integer_exponent == 1)
+			return derivatives[0];
+		const T exponent = as_value(right)->get_value();
+		Ref<ExpressionImpl<T>> lowered = left;
+		if (exponent != T(2))
+			lowered = make_ref<OperationPow<T>>(left, make_ref<Value<T>>(exponent - T(1)));
+		return make_ref<OperationMult<T>>(
+			make_ref<OperationMult<T>>(right, lowered), derivatives[0]);
+	}
+
 	// left^right * (right' * ln(left) + (right * left') / left)
 
-    auto exp1 = std::make_shared<OperationMult<T>>(right->diff(by), std::make_shared<LnFunc<T>>(left));
+    auto exp1 = make_ref<OperationMult<T>>(derivatives[1], make_ref<LnFunc<T>>(left));
 
-    auto exp2 = std::make_shared<OperationDiv<T>>(std::make_shared<OperationMult<T>>(right, left->diff(by)), left);
+    auto exp2 = make_ref<OperationDiv<T>>(make_ref<OperationMult<T>>(right, derivatives[0]), left);
 
-    return std::make_shared<OperationMult<T>>(std::make_shared<OperationPow<T>>(left,right), 
-                                              std::make_shared<OperationAdd<T>>(exp1, exp2)
+    // A node without owners lives outside of any handle and cannot be shared.
+    auto self = this->use_count() != 0 ? Ref<ExpressionImpl<T>>(const_cast<OperationPow<T> *>(this)) : nullptr;
+    if (!self)
+        self = make_ref<OperationPow<T>>(left, right);
+    return make_ref<OperationMult<T>>(self, 
+                                              make_ref<OperationAdd<T>>(exp1, exp2)
     );
 }
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> OperationPow<T>::with_context(const std::unordered_map<std::string, T> &context) const
+Ref<ExpressionImpl<T>> OperationPow<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
 {
-	return std::make_shared<OperationPow<T>>(
-		left->with_context(context), right->with_context(context)
+	return make_ref<OperationPow<T>>(
+		operands[0], operands[1]
 	);
 };
 
 template <typename T>
-T OperationPow<T>::eval() const
+Ref<ExpressionImpl<T>> OperationPow<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	const auto &l = operands[0];
+	const auto &r = operands[1];
+	if (as_value(l) && as_value(r))
+		return make_ref<Value<T>>(OperationPow<T>(l, r).eval());
+	if (is_value(r, T(0)) || is_value(l, T(1)))
+		return make_ref<Value<T>>(T(1));
+	if (is_value(r, T(1))) return l;
+	if (l == left && r == right)
+		return share(this);
+	return make_ref<OperationPow<T>>(l, r);
+}
+
+template <typename T>
+T OperationPow<T>::eval_step(const T *operands) const
 {   
-    return std::pow(left->eval(), right->eval());
+    switch (exponent_class) {
+        case ExponentClass::Integer:
+            return integer_power(operands[0], integer_exponent);
+        case ExponentClass::SquareRoot:
+            return std::sqrt(operands[0]);
+        default:
+            return std::pow(operands[0], operands[1]);
+    }
+}
+
+template <typename T>
+void OperationPow<T>::to_string_step(std::string &out, std::size_t position) const
+{
+    static constexpr const char *parts[] = {"(", ") ^ (", ")"};
+    out += parts[position];
+}
+
+template <typename T>
+NodeKind OperationPow<T>::kind() const
+{
+    return NodeKind::Pow;
+}
+
+template <typename T>
+std::size_t OperationPow<T>::arity() const
+{
+    return 2;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &OperationPow<T>::operand(std::size_t index) const
+{
+    if (index > 1)
+        throw std::out_of_range("Operand index out of range -> OperationPow::operand");
+    return index == 0 ? left : right;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> OperationPow<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
+{
+    return make_ref<OperationPow<T>>(operands.at(0), operands.at(1));
 }
 
 template <typename T>
-std::string OperationPow<T>::to_string() const
+OperationPow<T>::~OperationPow()
 {
-    return std::string("(")   + left->to_string()  +
-           std::string(") ^ (") + right->to_string() +
-           std::string(")");
+	this->release(left);
+	this->release(right);
 }
 
 template class OperationPow<long double>;
@@ -516,32 +1743,75 @@ template class OperationPow<std::complex<long double>>;
 // =====================
 
 template <typename T>
-SinFunc<T>::SinFunc(std::shared_ptr<ExpressionImpl<T>> argument_) :
-    argument(argument_)
+SinFunc<T>::SinFunc(Ref<ExpressionImpl<T>> argument_) :
+    argument(std::move(argument_))
 {};
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> SinFunc<T>::diff(const std::string &by) const 
+Ref<ExpressionImpl<T>> SinFunc<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
 {
-	return std::make_shared<OperationMult<T>>(
-        std::make_shared<CosFunc<T>>(argument), argument->diff(by));
+	return make_ref<OperationMult<T>>(
+        make_ref<CosFunc<T>>(argument), derivatives[0]);
 };
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> SinFunc<T>::with_context(const std::unordered_map<std::string, T> &context) const 
+Ref<ExpressionImpl<T>> SinFunc<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
 {
-	return std::make_shared<SinFunc<T>>(argument->with_context(context));
+	return make_ref<SinFunc<T>>(operands[0]);
 };
 
-template <typename T> T SinFunc<T>::eval() const {
-	return std::sin(argument->eval());
+template <typename T>
+Ref<ExpressionImpl<T>> SinFunc<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	const auto &arg = operands[0];
+	if (as_value(arg))
+		return make_ref<Value<T>>(SinFunc<T>(arg).eval());
+	if (arg == argument)
+		return share(this);
+	return make_ref<SinFunc<T>>(arg);
 };
 
-template <typename T> std::string SinFunc<T>::to_string(void) const 
+template <typename T> T SinFunc<T>::eval_step(const T *operands) const{
+	return std::sin(operands[0]);
+};
+
+template <typename T> void SinFunc<T>::to_string_step(std::string &out, std::size_t position) const
 {
-	return "sin(" + argument->to_string() + ")";
+	out += position == 0 ? "sin(" : ")";
 };
 
+template <typename T>
+NodeKind SinFunc<T>::kind() const
+{
+    return NodeKind::Sin;
+}
+
+template <typename T>
+std::size_t SinFunc<T>::arity() const
+{
+    return 1;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &SinFunc<T>::operand(std::size_t index) const
+{
+    if (index != 0)
+        throw std::out_of_range("Operand index out of range -> SinFunc::operand");
+    return argument;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> SinFunc<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
+{
+    return make_ref<SinFunc<T>>(operands.at(0));
+}
+
+template <typename T>
+SinFunc<T>::~SinFunc()
+{
+	this->release(argument);
+}
+
 template class SinFunc<long double>;
 template class SinFunc<std::complex<long double>>;
 
@@ -551,35 +1821,78 @@ template class SinFunc<std::complex<long double>>;
 // =====================
 
 template <typename T>
-CosFunc<T>::CosFunc(std::shared_ptr<ExpressionImpl<T>> argument_) :
-    argument(argument_)
+CosFunc<T>::CosFunc(Ref<ExpressionImpl<T>> argument_) :
+    argument(std::move(argument_))
 {};
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> CosFunc<T>::diff(const std::string &by) const 
+Ref<ExpressionImpl<T>> CosFunc<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
+{
+	return make_ref<OperationMult<T>>(
+        make_ref<OperationMult<T>>(
+            make_ref<SinFunc<T>>(argument), make_ref<Value<T>>(-1.0L)),
+      derivatives[0]);
+};
+
+template <typename T>
+Ref<ExpressionImpl<T>> CosFunc<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
 {
-	return std::make_shared<OperationMult<T>>(
-        std::make_shared<OperationMult<T>>(
-            std::make_shared<SinFunc<T>>(argument), std::make_shared<Value<T>>(-1.0L)),
-      argument->diff(by));
+	return make_ref<CosFunc<T>>(operands[0]);
 };
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> CosFunc<T>::with_context(const std::unordered_map<std::string, T> &context) const
+Ref<ExpressionImpl<T>> CosFunc<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
 {
-	return std::make_shared<CosFunc<T>>(argument->with_context(context));
+	const auto &arg = operands[0];
+	if (as_value(arg))
+		return make_ref<Value<T>>(CosFunc<T>(arg).eval());
+	if (arg == argument)
+		return share(this);
+	return make_ref<CosFunc<T>>(arg);
 };
 
-template <typename T> T CosFunc<T>::eval() const 
+template <typename T> T CosFunc<T>::eval_step(const T *operands) const
 {
-	return std::cos(argument->eval());
+	return std::cos(operands[0]);
 };
 
-template <typename T> std::string CosFunc<T>::to_string(void) const 
+template <typename T> void CosFunc<T>::to_string_step(std::string &out, std::size_t position) const
 {
-	return "cos(" + argument->to_string() + ")";
+	out += position == 0 ? "cos(" : ")";
 };
 
+template <typename T>
+NodeKind CosFunc<T>::kind() const
+{
+    return NodeKind::Cos;
+}
+
+template <typename T>
+std::size_t CosFunc<T>::arity() const
+{
+    return 1;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &CosFunc<T>::operand(std::size_t index) const
+{
+    if (index != 0)
+        throw std::out_of_range("Operand index out of range -> CosFunc::operand");
+    return argument;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> CosFunc<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
+{
+    return make_ref<CosFunc<T>>(operands.at(0));
+}
+
+template <typename T>
+CosFunc<T>::~CosFunc()
+{
+	this->release(argument);
+}
+
 template class CosFunc<long double>;
 template class CosFunc<std::complex<long double>>;
 
@@ -589,45 +1902,88 @@ template class CosFunc<std::complex<long double>>;
 // =====================
 
 template <typename T>
-LnFunc<T>::LnFunc(std::shared_ptr<ExpressionImpl<T>> argument_) :
-    argument(argument_)
+LnFunc<T>::LnFunc(Ref<ExpressionImpl<T>> argument_) :
+    argument(std::move(argument_))
 {};
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> LnFunc<T>::diff(const std::string &by) const 
+Ref<ExpressionImpl<T>> LnFunc<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
 {
-	return std::make_shared<OperationMult<T>>(
-        std::make_shared<OperationDiv<T>>(std::make_shared<Value<T>>(1.0L), argument), 
-        argument->diff(by));
+	return make_ref<OperationMult<T>>(
+        make_ref<OperationDiv<T>>(make_ref<Value<T>>(1.0L), argument), 
+        derivatives[0]);
 };
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> LnFunc<T>::with_context(const std::unordered_map<std::string, T> &context) const 
+Ref<ExpressionImpl<T>> LnFunc<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
 {
-	return std::make_shared<LnFunc<T>>(argument->with_context(context));
+	return make_ref<LnFunc<T>>(operands[0]);
 };
 
-template <typename T> T LnFunc<T>::eval() const
+template <typename T>
+Ref<ExpressionImpl<T>> LnFunc<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	const auto &arg = operands[0];
+	if (as_value(arg))
+		return make_ref<Value<T>>(LnFunc<T>(arg).eval());
+	if (arg == argument)
+		return share(this);
+	return make_ref<LnFunc<T>>(arg);
+};
+
+template <typename T> T LnFunc<T>::eval_step(const T *operands) const
  {
-    T arg_val = argument->eval();
+    T arg_val = operands[0];
 	if (arg_val <= 0.0L)
 		throw std::runtime_error("Argument cannot be negative in LnFunc::eval");
 	return std::log(arg_val);
 };
 
+// Principal branch, arg in (-pi, pi]. ln 0 is -inf + 0i as from std::log,
+// the same as on the flat tape and in ComplexBatchEvaluator.
 template <>
-std::complex<long double> LnFunc<std::complex<long double>>::eval() const 
+std::complex<long double> LnFunc<std::complex<long double>>::eval_step(const std::complex<long double> *operands) const
 {
-	throw std::runtime_error(
-		"Logarithm of complex numbers is not supported in this implementation"
-	);
+	return std::log(operands[0]);
 }
 
-template <typename T> std::string LnFunc<T>::to_string(void) const 
+template <typename T> void LnFunc<T>::to_string_step(std::string &out, std::size_t position) const
 {
-	return "ln(" + argument->to_string() + ")";
+	out += position == 0 ? "ln(" : ")";
 };
 
+template <typename T>
+NodeKind LnFunc<T>::kind() const
+{
+    return NodeKind::Ln;
+}
+
+template <typename T>
+std::size_t LnFunc<T>::arity() const
+{
+    return 1;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &LnFunc<T>::operand(std::size_t index) const
+{
+    if (index != 0)
+        throw std::out_of_range("Operand index out of range -> LnFunc::operand");
+    return argument;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> LnFunc<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
+{
+    return make_ref<LnFunc<T>>(operands.at(0));
+}
+
+template <typename T>
+LnFunc<T>::~LnFunc()
+{
+	this->release(argument);
+}
+
 template class LnFunc<long double>;
 template class LnFunc<std::complex<long double>>;
 
@@ -637,33 +1993,217 @@ template class LnFunc<std::complex<long double>>;
 // =====================
 
 template <typename T>
-ExpFunc<T>::ExpFunc(std::shared_ptr<ExpressionImpl<T>> argument_) :
-    argument(argument_)
+ExpFunc<T>::ExpFunc(Ref<ExpressionImpl<T>> argument_) :
+    argument(std::move(argument_))
 {};
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> ExpFunc<T>::diff(const std::string &by) const 
+Ref<ExpressionImpl<T>> ExpFunc<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
 {
-	return std::make_shared<OperationMult<T>>(std::make_shared<ExpFunc<T>>(argument), argument->diff(by));
+	return make_ref<OperationMult<T>>(make_ref<ExpFunc<T>>(argument), derivatives[0]);
 };
 
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> ExpFunc<T>::with_context(const std::unordered_map<std::string, T> &context) const 
+Ref<ExpressionImpl<T>> ExpFunc<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	return make_ref<ExpFunc<T>>(operands[0]);
+};
+
+template <typename T>
+Ref<ExpressionImpl<T>> ExpFunc<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
 {
-	return std::make_shared<ExpFunc<T>>(argument->with_context(context));
+	const auto &arg = operands[0];
+	if (as_value(arg))
+		return make_ref<Value<T>>(ExpFunc<T>(arg).eval());
+	if (arg == argument)
+		return share(this);
+	return make_ref<ExpFunc<T>>(arg);
 };
 
-template <typename T> T ExpFunc<T>::eval() const 
+template <typename T> T ExpFunc<T>::eval_step(const T *operands) const
 {
-    return std::exp(argument->eval());
+    return std::exp(operands[0]);
 
 };
 
-template <typename T> std::string ExpFunc<T>::to_string(void) const 
+template <typename T> void ExpFunc<T>::to_string_step(std::string &out, std::size_t position) const
 {
-	return "exp(" + argument->to_string() + ")";
+	out += position == 0 ? "exp(" : ")";
 };
 
+template <typename T>
+NodeKind ExpFunc<T>::kind() const
+{
+    return NodeKind::Exp;
+}
+
+template <typename T>
+std::size_t ExpFunc<T>::arity() const
+{
+    return 1;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &ExpFunc<T>::operand(std::size_t index) const
+{
+    if (index != 0)
+        throw std::out_of_range("Operand index out of range -> ExpFunc::operand");
+    return argument;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> ExpFunc<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
+{
+    return make_ref<ExpFunc<T>>(operands.at(0));
+}
+
+template <typename T>
+ExpFunc<T>::~ExpFunc()
+{
+	this->release(argument);
+}
+
 template class ExpFunc<long double>;
-template class ExpFunc<std::complex<long double>>;
\ No newline at end of file
+template class ExpFunc<std::complex<long double>>;
+
+// ======================
+// |class LazyDerivative|
+// ======================
+
+template <typename T>
+LazyDerivative<T>::LazyDerivative(Ref<ExpressionImpl<T>> source_, std::shared_ptr<Scope> scope_) :
+    source(std::move(source_)), scope(std::move(scope_))
+{}
+
+template <typename T>
+Ref<ExpressionImpl<T>> LazyDerivative<T>::of(
+	const Ref<ExpressionImpl<T>> &source, const std::shared_ptr<Scope> &scope
+)
+{
+	if (source->kind() == NodeKind::Value)
+		return make_ref<Value<T>>(T(0));
+	if (source->kind() == NodeKind::Variable)
+		return source->diff(scope->by);
+
+	std::lock_guard lock(scope->mutex);
+	auto &slot = scope->derivatives[source.get()];
+	if (auto existing = Ref<LazyDerivative<T>>::try_share(slot))
+		return existing;
+	auto derivative = make_ref<LazyDerivative<T>>(source, scope);
+	slot = derivative.get();
+	return derivative;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &LazyDerivative<T>::expanded() const
+{
+	std::call_once(once, [this] {
+		if (source->kind() == NodeKind::Polynomial) {
+			expansion = source->diff(scope->by);
+		} else {
+			// sum_i d source / d operand_i * (d operand_i, lazily)
+			const LocalPartials<T> local = local_partials(source);
+			std::vector<Ref<ExpressionImpl<T>>> terms;
+			for (std::size_t i = 0; i < local.operands.size(); ++i) {
+				const auto &partial = local.operands[i];
+				if (is_value(partial, T(0)))
+					continue;
+				auto derivative = of(source->operand(i), scope);
+				if (is_value(derivative, T(0)))
+					continue;
+				if (is_value(derivative, T(1)))
+					terms.push_back(partial);
+				else if (is_value(partial, T(1)))
+					terms.push_back(derivative);
+				else
+					terms.push_back(make_ref<OperationMult<T>>(partial, derivative));
+			}
+			if (terms.empty())
+				expansion = make_ref<Value<T>>(T(0));
+			else if (terms.size() == 1)
+				expansion = terms.front();
+			else
+				expansion = make_ref<OperationSum<T>>(std::move(terms));
+		}
+		ready.store(true, std::memory_order_release);
+	});
+	return expansion;
+}
+
+template <typename T>
+bool LazyDerivative<T>::is_expanded() const
+{
+	return ready.load(std::memory_order_acquire);
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> LazyDerivative<T>::diff_step(Symbol, const Ref<ExpressionImpl<T>> *derivatives) const
+{
+	return derivatives[0];
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> LazyDerivative<T>::with_context_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	return operands[0];
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> LazyDerivative<T>::specialize_step(const Bindings<T> &, const Ref<ExpressionImpl<T>> *operands) const
+{
+	return operands[0];
+}
+
+template <typename T> T LazyDerivative<T>::eval_step(const T *operands) const
+{
+	return operands[0];
+}
+
+template <typename T> void LazyDerivative<T>::to_string_step(std::string &, std::size_t) const
+{
+	// Transparent: only the expansion is printed.
+}
+
+template <typename T>
+NodeKind LazyDerivative<T>::kind() const
+{
+    return NodeKind::Derivative;
+}
+
+template <typename T>
+std::size_t LazyDerivative<T>::arity() const
+{
+    return 1;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &LazyDerivative<T>::operand(std::size_t index) const
+{
+    if (index != 0)
+        throw std::out_of_range("Operand index out of range -> LazyDerivative::operand");
+    return expanded();
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> LazyDerivative<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>> operands) const
+{
+    // A derivative is transparent once expanded.
+    return operands.at(0);
+}
+
+template <typename T>
+LazyDerivative<T>::~LazyDerivative()
+{
+	{
+		std::lock_guard lock(scope->mutex);
+		auto it = scope->derivatives.find(source.get());
+		if (it != scope->derivatives.end() && it->second == this)
+			scope->derivatives.erase(it);
+	}
+	this->release(source);
+	this->release(expansion);
+}
+
+template class LazyDerivative<long double>;
+template class LazyDerivative<std::complex<long double>>;
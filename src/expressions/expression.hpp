@@ -4,10 +4,19 @@
 
 
 #include <complex>
+#include <cstdint>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <ranges>
 #include <string>
 #include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ref_count.hpp"
+#include "symbol.hpp"
 
 enum class OpPrecedence {
     AddSub = 0,
@@ -15,18 +24,85 @@ enum class OpPrecedence {
     Div = 2,
     Pow = 3
 };
+enum class NodeKind {
+    Value,
+    Variable,
+    Add,
+    Sub,
+    Mult,
+    Div,
+    Pow,
+    Sum,
+    Product,
+    Polynomial,
+    Sin,
+    Cos,
+    Ln,
+    Exp,
+    Derivative
+};
+
+// How OperationPow evaluates and differentiates, decided once from its exponent.
+enum class ExponentClass {
+    General,    // variable exponent: std::pow and the full logarithmic rule
+    Constant,   // constant exponent: std::pow and the plain power rule
+    Integer,    // small integer: repeated squaring
+    SquareRoot  // 0.5: std::sqrt
+};
+
 template <typename T> class Parser;
+template <typename T> class FlatExpression;
 
-template <typename T> class ExpressionImpl {
+template <typename T>
+class ExpressionImpl : public RefCounted {
   public:
 	virtual ~ExpressionImpl() = default;
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	// The traversals below walk the DAG with an explicit stack on the heap,
+	// so nesting depth is bounded by memory only. A node with several owners
+	// is processed once and its result reused; to_string prints it at every
+	// occurrence.
+	Ref<ExpressionImpl<T>> diff(Symbol by) const;
+	Ref<ExpressionImpl<T>> with_context(const Bindings<T> &context) const;
+	// Binds the known variables, folds every variable-free subtree into a
+	// single Value and returns unchanged subtrees shared rather than copied.
+	Ref<ExpressionImpl<T>> specialize(const Bindings<T> &context) const;
+
+	T eval(void) const;
+	// Same value as with_context(context)->eval(), without building the
+	// bound copy.
+	T eval(const Bindings<T> &context) const;
+	std::string to_string(void) const;
+
+	// One node of each traversal, given the results for its operands in
+	// operand order.
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
+	) const = 0;
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const = 0;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const = 0;
+	virtual T eval_step(const T *operands) const = 0;
+	// Appends the text before operand `position`, or after the last operand
+	// when position == arity().
+	virtual void to_string_step(std::string &out, std::size_t position) const = 0;
+
+	virtual NodeKind kind(void) const = 0;
+	virtual std::size_t arity(void) const = 0;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const = 0;
+	// Same node kind over new operands; leaves return themselves.
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const = 0;
-	virtual std::shared_ptr<ExpressionImpl<T>> with_context(const std::unordered_map<std::string, T> &context) const = 0;
 
-	virtual T eval(void) const = 0;
-	virtual std::string to_string(void) const = 0;
+  protected:
+	// Destructors hand their operands over here instead of dropping them, and
+	// the last owner is released from a loop, so destroying a deep chain does
+	// not recurse either.
+	static void release(Ref<ExpressionImpl<T>> &operand);
 };
 
 template <typename T> class Expression {
@@ -36,42 +112,113 @@ template <typename T> class Expression {
 
 	~Expression() = default;
 	Expression(const Expression &other);
-
-	Expression<T> sin(void) const;
-	Expression<T> cos(void) const;
-	Expression<T> ln(void) const;
-	Expression<T> exp(void) const;
-
-	Expression<T> diff(const std::string &by) const;
-	Expression<T> with_context(const std::unordered_map<std::string, T> &context
-	) const;
+	Expression(Expression &&other) noexcept;
+
+	// The && overloads here and below move the node of a temporary into the
+	// result instead of sharing it.
+	Expression<T> sin(void) const &;
+	Expression<T> sin(void) &&;
+	Expression<T> cos(void) const &;
+	Expression<T> cos(void) &&;
+	Expression<T> ln(void) const &;
+	Expression<T> ln(void) &&;
+	Expression<T> exp(void) const &;
+	Expression<T> exp(void) &&;
+
+	Expression<T> diff(Symbol by) const;
+	// order-th derivative; every stage is built on the shared DAG of the
+	// previous one and simplified before the next.
+	Expression<T> diff(Symbol by, std::size_t order) const;
+	// Derivative whose chain rule is expanded per subtree only when eval,
+	// to_string or a further diff reaches it.
+	Expression<T> lazy_diff(Symbol by) const;
+	Expression<T> with_context(const Bindings<T> &context) const;
+	Expression<T> specialize(const Bindings<T> &context) const;
+	// Replaces variables by expressions, all at once. Each node is rewritten
+	// once however many paths reach it, so the result stays a DAG linear in
+	// the size of this expression and the replacements.
+	Expression<T> substitute(Symbol var, const Expression<T> &replacement) const;
+	Expression<T> substitute(const std::vector<std::pair<Symbol, Expression<T>>> &replacements) const;
+	// outer[k](vars := inner) for every k; the results share one DAG.
+	static std::vector<Expression<T>> compose(
+		const std::vector<Expression<T>> &outer, const std::vector<Symbol> &vars,
+		const std::vector<Expression<T>> &inner
+	);
+	Expression<T> detect_polynomials(void) const;
+	// Constant folding and removal of neutral elements, linear in the DAG size.
+	Expression<T> simplify(void) const;
+	// One n-ary node for all terms, the same as a chain of + would give but
+	// built in a single pass; 0 for no terms. Any range of expressions
+	// convertible to Expression<T> is accepted.
+	static Expression<T> sum(std::vector<Expression<T>> terms);
+	// 1 for no factors.
+	static Expression<T> product(std::vector<Expression<T>> factors);
+	template <std::ranges::input_range R> static Expression<T> sum(R &&terms)
+	{
+		return sum(collect(std::forward<R>(terms)));
+	}
+	template <std::ranges::input_range R> static Expression<T> product(R &&factors)
+	{
+		return product(collect(std::forward<R>(factors)));
+	}
+	// All partial derivatives from a single reverse sweep. The results of
+	// one call share their intermediate adjoints and form a single DAG.
+	std::vector<Expression<T>> gradient(const std::vector<Symbol> &vars) const;
+	static std::vector<std::vector<Expression<T>>> jacobian(
+		const std::vector<Expression<T>> &expressions, const std::vector<Symbol> &vars
+	);
+	// Symmetric matrix of second derivatives. Only the upper triangle is
+	// derived (reverse over the shared gradient); the lower one aliases it.
+	std::vector<std::vector<Expression<T>>> hessian(const std::vector<Symbol> &vars) const;
 	T eval(void) const;
-	T eval_with(const std::unordered_map<std::string, T> &context) const;
+	T eval_with(const Bindings<T> &context) const;
 	std::string to_string(void) const;
 	static Expression<T> from_string(const std::string& expression_str, bool ignore_case);
+	// Parses the file through a read-only mapping, scanning it in place:
+	// memory use is that of the resulting expression, not of the text.
+	static Expression<T> from_file(const std::string& path, bool ignore_case);
 
 	Expression<T> &operator=(const Expression<T> &other);
-	Expression<T> &operator=(Expression<T> &&other);
+	Expression<T> &operator=(Expression<T> &&other) noexcept;
 
-	Expression<T> operator+(const Expression<T> &other) const;
-	Expression<T> &operator+=(const Expression<T> &other);
+	// The right operand is taken by value and moved into the result, so a
+	// temporary on either side is not copied. A temporary Sum or Product on
+	// the left that nothing else shares is extended in place, so a + b + c
+	// builds a single node.
+	Expression<T> operator+(Expression<T> other) const &;
+	Expression<T> operator+(Expression<T> other) &&;
+	Expression<T> &operator+=(Expression<T> other);
 
-	Expression<T> operator-(const Expression<T> &other) const;
-	Expression<T> &operator-=(const Expression<T> &other);
+	Expression<T> operator-(Expression<T> other) const &;
+	Expression<T> operator-(Expression<T> other) &&;
+	Expression<T> &operator-=(Expression<T> other);
 
-	Expression<T> operator*(const Expression<T> &other) const;
-	Expression<T> &operator*=(const Expression<T> &other);
+	Expression<T> operator*(Expression<T> other) const &;
+	Expression<T> operator*(Expression<T> other) &&;
+	Expression<T> &operator*=(Expression<T> other);
 
-	Expression<T> operator/(const Expression<T> &other) const;
-	Expression<T> &operator/=(const Expression<T> &other);
+	Expression<T> operator/(Expression<T> other) const &;
+	Expression<T> operator/(Expression<T> other) &&;
+	Expression<T> &operator/=(Expression<T> other);
 
-	Expression<T> operator^(const Expression<T> &other) const;
-	Expression<T> &operator^=(const Expression<T> &other);
+	Expression<T> operator^(Expression<T> other) const &;
+	Expression<T> operator^(Expression<T> other) &&;
+	Expression<T> &operator^=(Expression<T> other);
 
   private:
-	Expression(std::shared_ptr<ExpressionImpl<T>> impl_);
-	std::shared_ptr<ExpressionImpl<T>> impl;
+	Expression(Ref<ExpressionImpl<T>> impl_);
+	template <typename R> static std::vector<Expression<T>> collect(R &&range)
+	{
+		std::vector<Expression<T>> items;
+		if constexpr (std::ranges::sized_range<R>)
+			items.reserve(std::ranges::size(range));
+		for (auto &&item : range)
+			items.emplace_back(std::forward<decltype(item)>(item));
+		return items;
+	}
+	Ref<ExpressionImpl<T>> impl;
 	friend class Parser<T>;
+	friend class FlatExpression<T>;
 };
 
 template <typename T> class Value : public ExpressionImpl<T> {
@@ -81,192 +228,492 @@ template <typename T> class Value : public ExpressionImpl<T> {
   public:
 	explicit Value(T number);
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	T get_value(void) const;
+
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
+	) const override;
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
 	) const override;
-	virtual std::shared_ptr<ExpressionImpl<T>>
-	with_context(const std::unordered_map<std::string, T> &context
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const override;
-	virtual T eval(void) const override;
-	virtual std::string to_string(void) const override;
 };
 
 template <typename T> class Variable : public ExpressionImpl<T> {
   private:
-	std::string name;
+	Symbol symbol;
 
   public:
-	Variable(const std::string var);
+	explicit Variable(Symbol symbol_);
+
+	Symbol get_symbol(void) const;
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
+	) const override;
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
 	) const override;
-	virtual std::shared_ptr<ExpressionImpl<T>>
-	with_context(const std::unordered_map<std::string, T> &context
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const override;
-	virtual T eval(void) const override;
-	virtual std::string to_string(void) const override;
 };
 
 template <typename T> class SinFunc : public ExpressionImpl<T> {
   private:
-	std::shared_ptr<ExpressionImpl<T>> argument;
+	Ref<ExpressionImpl<T>> argument;
 
   public:
-	explicit SinFunc(std::shared_ptr<ExpressionImpl<T>> argument_);
+	explicit SinFunc(Ref<ExpressionImpl<T>> argument_);
+
+	~SinFunc() override;
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
 	) const override;
-	virtual std::shared_ptr<ExpressionImpl<T>>
-	with_context(const std::unordered_map<std::string, T> &context
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const override;
-	virtual T eval(void) const override;
-	virtual std::string to_string(void) const override;
 };
 
 template <typename T> class CosFunc : public ExpressionImpl<T> {
   private:
-	std::shared_ptr<ExpressionImpl<T>> argument;
+	Ref<ExpressionImpl<T>> argument;
 
   public:
-	explicit CosFunc(std::shared_ptr<ExpressionImpl<T>> argument_);
+	explicit CosFunc(Ref<ExpressionImpl<T>> argument_);
+
+	~CosFunc() override;
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
 	) const override;
-	virtual std::shared_ptr<ExpressionImpl<T>>
-	with_context(const std::unordered_map<std::string, T> &context
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const override;
-	virtual T eval(void) const override;
-	virtual std::string to_string(void) const override;
 };
 
 template <typename T> class LnFunc : public ExpressionImpl<T> {
   private:
-	std::shared_ptr<ExpressionImpl<T>> argument;
+	Ref<ExpressionImpl<T>> argument;
 
   public:
-	explicit LnFunc(std::shared_ptr<ExpressionImpl<T>> argument_);
+	explicit LnFunc(Ref<ExpressionImpl<T>> argument_);
+
+	~LnFunc() override;
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
 	) const override;
-	virtual std::shared_ptr<ExpressionImpl<T>>
-	with_context(const std::unordered_map<std::string, T> &context
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const override;
-	virtual T eval(void) const override;
-	virtual std::string to_string(void) const override;
 };
 
 template <typename T> class ExpFunc : public ExpressionImpl<T> {
   private:
-	std::shared_ptr<ExpressionImpl<T>> argument;
+	Ref<ExpressionImpl<T>> argument;
 
   public:
-	explicit ExpFunc(std::shared_ptr<ExpressionImpl<T>> argument_);
+	explicit ExpFunc(Ref<ExpressionImpl<T>> argument_);
+
+	~ExpFunc() override;
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
 	) const override;
-	virtual std::shared_ptr<ExpressionImpl<T>>
-	with_context(const std::unordered_map<std::string, T> &context
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const override;
-	virtual T eval(void) const override;
-	virtual std::string to_string(void) const override;
 };
 
 template <typename T> class OperationAdd : public ExpressionImpl<T> {
   private:
-	std::shared_ptr<ExpressionImpl<T>> left;
-	std::shared_ptr<ExpressionImpl<T>> right;
+	Ref<ExpressionImpl<T>> left;
+	Ref<ExpressionImpl<T>> right;
 
   public:
 	OperationAdd(
-		const std::shared_ptr<ExpressionImpl<T>> &_left,
-		const std::shared_ptr<ExpressionImpl<T>> &_right
+		Ref<ExpressionImpl<T>> _left,
+		Ref<ExpressionImpl<T>> _right
 	);
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	~OperationAdd() override;
+
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
 	) const override;
-	virtual std::shared_ptr<ExpressionImpl<T>>
-	with_context(const std::unordered_map<std::string, T> &context
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const override;
-	virtual T eval(void) const override;
-	virtual std::string to_string(void) const override;
 };
 
 template <typename T> class OperationMult : public ExpressionImpl<T> {
   private:
-	std::shared_ptr<ExpressionImpl<T>> left;
-	std::shared_ptr<ExpressionImpl<T>> right;
+	Ref<ExpressionImpl<T>> left;
+	Ref<ExpressionImpl<T>> right;
 
   public:
 	OperationMult(
-		const std::shared_ptr<ExpressionImpl<T>> &_left,
-		const std::shared_ptr<ExpressionImpl<T>> &_right
+		Ref<ExpressionImpl<T>> _left,
+		Ref<ExpressionImpl<T>> _right
+	);
+
+	~OperationMult() override;
+
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
+	) const override;
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
+	) const override;
+};
+
+template <typename T> class OperationSum : public ExpressionImpl<T> {
+  private:
+	// Operands in canonical order, kept as two blocks: the constant and the
+	// variables, then the rest. build() appends to one without moving the other.
+	std::vector<Ref<ExpressionImpl<T>>> leaves;
+	std::vector<Ref<ExpressionImpl<T>>> others;
+
+  public:
+	explicit OperationSum(std::vector<Ref<ExpressionImpl<T>>> terms_);
+
+	// Builds left + right, flattening nested sums into one node with
+	// constants folded in front. A uniquely owned left sum is extended in
+	// place: an operand that is not a variable, or a variable whose name
+	// sorts after those present, is appended in amortized constant time; any
+	// other variable shifts the variables after it, but never the other
+	// operands.
+	static Ref<ExpressionImpl<T>> build(
+		Ref<ExpressionImpl<T>> left,
+		Ref<ExpressionImpl<T>> right
 	);
+	// The same node as a chain of build calls over all terms, in one pass;
+	// 0 for no terms.
+	static Ref<ExpressionImpl<T>> build(std::vector<Ref<ExpressionImpl<T>>> terms);
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	~OperationSum() override;
+
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
+	) const override;
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
 	) const override;
-	virtual std::shared_ptr<ExpressionImpl<T>>
-	with_context(const std::unordered_map<std::string, T> &context
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
+	) const override;
+};
+
+template <typename T> class OperationProduct : public ExpressionImpl<T> {
+  private:
+	// Operands in canonical order, kept as two blocks: the constant and the
+	// variables, then the rest. build() appends to one without moving the other.
+	std::vector<Ref<ExpressionImpl<T>>> leaves;
+	std::vector<Ref<ExpressionImpl<T>>> others;
+
+  public:
+	explicit OperationProduct(std::vector<Ref<ExpressionImpl<T>>> factors_);
+
+	// Builds left * right, flattening nested products into one node with
+	// constants folded in front. Extends a uniquely owned left product in
+	// place at the same cost as OperationSum::build.
+	static Ref<ExpressionImpl<T>> build(
+		Ref<ExpressionImpl<T>> left,
+		Ref<ExpressionImpl<T>> right
+	);
+	// The same node as a chain of build calls over all factors, in one pass;
+	// 1 for no factors.
+	static Ref<ExpressionImpl<T>> build(std::vector<Ref<ExpressionImpl<T>>> factors);
+
+	~OperationProduct() override;
+
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
+	) const override;
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const override;
-	virtual T eval(void) const override;
-	virtual std::string to_string(void) const override;
 };
 
 template <typename T> class OperationSub : public ExpressionImpl<T> {
   private:
-	std::shared_ptr<ExpressionImpl<T>> left;
-	std::shared_ptr<ExpressionImpl<T>> right;
+	Ref<ExpressionImpl<T>> left;
+	Ref<ExpressionImpl<T>> right;
 
   public:
 	OperationSub(
-		const std::shared_ptr<ExpressionImpl<T>> &_left,
-		const std::shared_ptr<ExpressionImpl<T>> &_right
+		Ref<ExpressionImpl<T>> _left,
+		Ref<ExpressionImpl<T>> _right
 	);
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	~OperationSub() override;
+
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
+	) const override;
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
 	) const override;
-	virtual std::shared_ptr<ExpressionImpl<T>>
-	with_context(const std::unordered_map<std::string, T> &context
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const override;
-	virtual T eval(void) const override;
-	virtual std::string to_string(void) const override;
 };
 
 template <typename T> class OperationDiv : public ExpressionImpl<T> {
   private:
-	std::shared_ptr<ExpressionImpl<T>> left;
-	std::shared_ptr<ExpressionImpl<T>> right;
+	Ref<ExpressionImpl<T>> left;
+	Ref<ExpressionImpl<T>> right;
 
   public:
 	OperationDiv(
-		const std::shared_ptr<ExpressionImpl<T>> &_left,
-		const std::shared_ptr<ExpressionImpl<T>> &_right
+		Ref<ExpressionImpl<T>> _left,
+		Ref<ExpressionImpl<T>> _right
 	);
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	~OperationDiv() override;
+
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
+	) const override;
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
 	) const override;
-	virtual std::shared_ptr<ExpressionImpl<T>>
-	with_context(const std::unordered_map<std::string, T> &context
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const override;
-	virtual T eval(void) const override;
-	virtual std::string to_string(void) const override;
 };
 
 template <typename T> class OperationPow : public ExpressionImpl<T> {
   private:
-	std::shared_ptr<ExpressionImpl<T>> left;
-	std::shared_ptr<ExpressionImpl<T>> right;
+	Ref<ExpressionImpl<T>> left;
+	Ref<ExpressionImpl<T>> right;
+	ExponentClass exponent_class;
+	std::int64_t integer_exponent;
 
   public:
+	// Exponents up to this magnitude take the repeated squaring path.
+	static constexpr std::int64_t max_integer_exponent = 64;
+
 	OperationPow(
-		const std::shared_ptr<ExpressionImpl<T>> &_left,
-		const std::shared_ptr<ExpressionImpl<T>> &_right
+		Ref<ExpressionImpl<T>> _left,
+		Ref<ExpressionImpl<T>> _right
 	);
 
-	virtual std::shared_ptr<ExpressionImpl<T>> diff(const std::string &by
+	ExponentClass get_exponent_class(void) const;
+	std::int64_t get_integer_exponent(void) const;
+	// Class of a constant exponent; `integer` receives it when Integer.
+	static ExponentClass classify(T exponent, std::int64_t &integer);
+	// base^exponent along the path a constant exponent takes.
+	static T power(T base, T exponent);
+
+	~OperationPow() override;
+
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
+	) const override;
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
 	) const override;
-	virtual std::shared_ptr<ExpressionImpl<T>>
-	with_context(const std::unordered_map<std::string, T> &context
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
 	) const override;
-	virtual T eval(void) const override;
-	virtual std::string to_string(void) const override;
 };
-#endif
\ No newline at end of file
+
+// Derivative of `source` that applies the chain rule one level at a time
+// when something reaches it, and keeps that expansion. The derivatives of
+// the operands are lazy again and shared through a common scope, so every
+// node of a DAG is expanded at most once.
+template <typename T> class LazyDerivative : public ExpressionImpl<T> {
+  public:
+	struct Scope {
+		explicit Scope(Symbol by_) : by(by_) {}
+
+		Symbol by;
+		std::mutex mutex;
+		// Not owning: every derivative removes its own entry when destroyed.
+		std::unordered_map<const ExpressionImpl<T> *, LazyDerivative<T> *> derivatives;
+	};
+
+	LazyDerivative(Ref<ExpressionImpl<T>> source_, std::shared_ptr<Scope> scope_);
+
+	// d source / d scope->by; leaves are differentiated right away.
+	static Ref<ExpressionImpl<T>> of(
+		const Ref<ExpressionImpl<T>> &source, const std::shared_ptr<Scope> &scope
+	);
+
+	bool is_expanded(void) const;
+
+	~LazyDerivative() override;
+
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
+	) const override;
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	// The expansion; reaching it through a traversal expands this node.
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
+	) const override;
+
+  private:
+	const Ref<ExpressionImpl<T>> &expanded(void) const;
+
+	Ref<ExpressionImpl<T>> source;
+	std::shared_ptr<Scope> scope;
+	mutable std::once_flag once;
+	mutable std::atomic<bool> ready{false};
+	mutable Ref<ExpressionImpl<T>> expansion;
+};
+#endif
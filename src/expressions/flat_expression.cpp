@@ -0,0 +1,939 @@
+#include "flat_expression.hpp"
+#include "numeric.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <functional>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+constexpr std::uint32_t ZERO = std::numeric_limits<std::uint32_t>::max();
+
+OpCode opcode_of(NodeKind kind)
+{
+	switch (kind) {
+		case NodeKind::Value: return OpCode::Const;
+		case NodeKind::Variable: return OpCode::Var;
+		case NodeKind::Add: return OpCode::Add;
+		case NodeKind::Sub: return OpCode::Sub;
+		case NodeKind::Mult: return OpCode::Mult;
+		case NodeKind::Div: return OpCode::Div;
+		case NodeKind::Pow: return OpCode::Pow;
+		case NodeKind::Sum: return OpCode::Add;
+		case NodeKind::Product: return OpCode::Mult;
+		case NodeKind::Polynomial: break;
+		case NodeKind::Sin: return OpCode::Sin;
+		case NodeKind::Cos: return OpCode::Cos;
+		case NodeKind::Ln: return OpCode::Ln;
+		case NodeKind::Exp: return OpCode::Exp;
+		case NodeKind::Derivative: break;
+	}
+	throw std::logic_error("Unknown node kind -> opcode_of");
+}
+
+std::int32_t power_of(const FlatNode &node)
+{
+	return static_cast<std::int32_t>(node.rhs);
+}
+
+template <typename T> T checked_div(T left, T right)
+{
+	if (right == T(0))
+		throw std::runtime_error("Division by zero -> FlatExpression::eval");
+	return left / right;
+}
+
+template <typename T> T checked_log(T argument)
+{
+	if constexpr (std::is_same_v<T, std::complex<long double>>) {
+		// Complex zero gives -inf + 0i, as in LnFunc.
+		return std::log(argument);
+	} else {
+		if (argument <= T(0))
+			throw std::runtime_error("Argument cannot be negative in FlatExpression::eval");
+		return std::log(argument);
+	}
+}
+
+// Values of every node of a tape, in order.
+template <typename T>
+void run_tape(const std::vector<FlatNode> &tape, const std::vector<T> &pool, const Bindings<T> &context, T *values)
+{
+	for (std::size_t i = 0; i < tape.size(); ++i) {
+		const FlatNode &node = tape[i];
+		switch (node.op) {
+			case OpCode::Const: values[i] = pool[node.lhs]; break;
+			case OpCode::Var: {
+				const T *value = context.find(Symbol(node.lhs));
+				if (value == nullptr)
+					throw std::runtime_error("Variable " + Symbol(node.lhs).name() + " cannot be resolved without context");
+				values[i] = *value;
+				break;
+			}
+			case OpCode::Add: values[i] = values[node.lhs] + values[node.rhs]; break;
+			case OpCode::Sub: values[i] = values[node.lhs] - values[node.rhs]; break;
+			case OpCode::Mult: values[i] = values[node.lhs] * values[node.rhs]; break;
+			case OpCode::Div: values[i] = checked_div(values[node.lhs], values[node.rhs]); break;
+			case OpCode::Pow: values[i] = std::pow(values[node.lhs], values[node.rhs]); break;
+			case OpCode::PowInt: values[i] = integer_power(values[node.lhs], power_of(node)); break;
+			case OpCode::Sqrt: values[i] = std::sqrt(values[node.lhs]); break;
+			case OpCode::Sin: values[i] = std::sin(values[node.lhs]); break;
+			case OpCode::Cos: values[i] = std::cos(values[node.lhs]); break;
+			case OpCode::Ln: values[i] = checked_log(values[node.lhs]); break;
+			case OpCode::Exp: values[i] = std::exp(values[node.lhs]); break;
+		}
+	}
+}
+
+// Value together with its directional derivative.
+template <typename T> struct Dual {
+	T value;
+	T tangent;
+};
+
+template <typename T> Dual<T> operator+(Dual<T> a, Dual<T> b) { return {a.value + b.value, a.tangent + b.tangent}; }
+template <typename T> Dual<T> operator-(Dual<T> a, Dual<T> b) { return {a.value - b.value, a.tangent - b.tangent}; }
+template <typename T> Dual<T> operator*(Dual<T> a, Dual<T> b)
+{
+	return {a.value * b.value, a.tangent * b.value + a.value * b.tangent};
+}
+template <typename T> Dual<T> operator/(Dual<T> a, Dual<T> b)
+{
+	T value = checked_div(a.value, b.value);
+	return {value, (a.tangent - value * b.tangent) / b.value};
+}
+
+template <typename T> Dual<T> dual_pow(Dual<T> base, Dual<T> exponent)
+{
+	T value = std::pow(base.value, exponent.value);
+	T tangent = exponent.value * std::pow(base.value, exponent.value - T(1)) * base.tangent;
+	if (exponent.tangent != T(0))
+		tangent += value * checked_log(base.value) * exponent.tangent;
+	return {value, tangent};
+}
+
+// Truncated power series helpers; every array holds n coefficients.
+template <typename T> void series_mult(const T *a, const T *b, T *out, std::size_t n)
+{
+	for (std::size_t k = 0; k < n; ++k) {
+		T sum = T(0);
+		for (std::size_t j = 0; j <= k; ++j)
+			sum += a[j] * b[k - j];
+		out[k] = sum;
+	}
+}
+
+template <typename T> void series_div(const T *a, const T *b, T *out, std::size_t n)
+{
+	for (std::size_t k = 0; k < n; ++k) {
+		T sum = a[k];
+		for (std::size_t j = 1; j <= k; ++j)
+			sum -= b[j] * out[k - j];
+		out[k] = checked_div(sum, b[0]);
+	}
+}
+
+template <typename T> void series_exp(const T *a, T *out, std::size_t n)
+{
+	out[0] = std::exp(a[0]);
+	for (std::size_t k = 1; k < n; ++k) {
+		T sum = T(0);
+		for (std::size_t j = 1; j <= k; ++j)
+			sum += T(static_cast<long double>(j)) * a[j] * out[k - j];
+		out[k] = sum / T(static_cast<long double>(k));
+	}
+}
+
+template <typename T> void series_log(const T *a, T *out, std::size_t n)
+{
+	out[0] = checked_log(a[0]);
+	for (std::size_t k = 1; k < n; ++k) {
+		T sum = T(0);
+		for (std::size_t j = 1; j < k; ++j)
+			sum += T(static_cast<long double>(j)) * out[j] * a[k - j];
+		out[k] = checked_div(a[k] - sum / T(static_cast<long double>(k)), a[0]);
+	}
+}
+
+// sin and cos of a series depend on each other, so both are produced.
+template <typename T> void series_sin_cos(const T *a, T *sin, T *cos, std::size_t n)
+{
+	sin[0] = std::sin(a[0]);
+	cos[0] = std::cos(a[0]);
+	for (std::size_t k = 1; k < n; ++k) {
+		T s = T(0), c = T(0);
+		for (std::size_t j = 1; j <= k; ++j) {
+			s += T(static_cast<long double>(j)) * a[j] * cos[k - j];
+			c += T(static_cast<long double>(j)) * a[j] * sin[k - j];
+		}
+		sin[k] = s / T(static_cast<long double>(k));
+		cos[k] = -c / T(static_cast<long double>(k));
+	}
+}
+
+// a^r for a constant r, from a * p' = r * a' * p; needs a[0] != 0.
+template <typename T> void series_pow(const T *a, T r, T *out, std::size_t n)
+{
+	out[0] = std::pow(a[0], r);
+	for (std::size_t k = 1; k < n; ++k) {
+		T sum = T(0);
+		for (std::size_t j = 1; j <= k; ++j)
+			sum += (r * T(static_cast<long double>(j)) - T(static_cast<long double>(k - j))) * a[j] * out[k - j];
+		out[k] = checked_div(sum, T(static_cast<long double>(k)) * a[0]);
+	}
+}
+
+template <typename T> void series_sqrt(const T *a, T *out, std::size_t n)
+{
+	out[0] = std::sqrt(a[0]);
+	for (std::size_t k = 1; k < n; ++k) {
+		T sum = a[k];
+		for (std::size_t j = 1; j < k; ++j)
+			sum -= out[j] * out[k - j];
+		out[k] = checked_div(sum, T(2) * out[0]);
+	}
+}
+
+// a^e by repeated squaring of series, so a zero constant term is fine.
+template <typename T> void series_integer_power(const T *a, std::int32_t exponent, T *out, std::size_t n)
+{
+	std::vector<T> base(a, a + n), result(n, T(0)), scratch(n);
+	result[0] = T(1);
+	for (std::uint32_t e = exponent < 0 ? -static_cast<std::uint32_t>(exponent) : exponent; e > 0; e >>= 1) {
+		if (e & 1u) {
+			series_mult(result.data(), base.data(), scratch.data(), n);
+			result.swap(scratch);
+		}
+		if (e > 1) {
+			series_mult(base.data(), base.data(), scratch.data(), n);
+			base.swap(scratch);
+		}
+	}
+	if (exponent >= 0) {
+		std::copy(result.begin(), result.end(), out);
+		return;
+	}
+	std::vector<T> one(n, T(0));
+	one[0] = T(1);
+	series_div(one.data(), result.data(), out, n);
+}
+
+} // namespace
+
+template <typename T>
+FlatExpression<T>::FlatExpression(const Expression<T> &expression)
+{
+	// Iterative post-order walk; shared subtrees are emitted once.
+	std::unordered_map<const ExpressionImpl<T> *, std::uint32_t> index;
+	std::vector<std::pair<const ExpressionImpl<T> *, bool>> stack{{expression.impl.get(), false}};
+
+	while (!stack.empty()) {
+		auto [node, expanded] = stack.back();
+		stack.pop_back();
+		if (index.contains(node))
+			continue;
+		if (!expanded) {
+			stack.emplace_back(node, true);
+			for (std::size_t i = node->arity(); i-- > 0;) {
+				if (!index.contains(node->operand(i).get()))
+					stack.emplace_back(node->operand(i).get(), false);
+			}
+			continue;
+		}
+
+		if (node->kind() == NodeKind::Pow) {
+			const auto *pow = static_cast<const OperationPow<T> *>(node);
+			std::uint32_t base = index.at(node->operand(0).get());
+			if (pow->get_exponent_class() == ExponentClass::Integer) {
+				index[node] = push(OpCode::PowInt, base, static_cast<std::uint32_t>(pow->get_integer_exponent()));
+				continue;
+			}
+			if (pow->get_exponent_class() == ExponentClass::SquareRoot) {
+				index[node] = push(OpCode::Sqrt, base);
+				continue;
+			}
+		}
+		if (node->kind() == NodeKind::Derivative) {
+			index[node] = index.at(node->operand(0).get());
+			continue;
+		}
+		if (node->kind() == NodeKind::Polynomial) {
+			index[node] = push_polynomial(*static_cast<const Polynomial<T> *>(node));
+			continue;
+		}
+		if (node->kind() == NodeKind::Sum || node->kind() == NodeKind::Product) {
+			// n-ary nodes are lowered to chains of binary operations
+			OpCode op = node->kind() == NodeKind::Sum ? OpCode::Add : OpCode::Mult;
+			std::uint32_t result = index.at(node->operand(0).get());
+			for (std::size_t i = 1; i < node->arity(); ++i)
+				result = push(op, result, index.at(node->operand(i).get()));
+			index[node] = result;
+			continue;
+		}
+
+		OpCode op = opcode_of(node->kind());
+		switch (op) {
+			case OpCode::Const:
+				index[node] = push(op, push_constant(static_cast<const Value<T> *>(node)->get_value()));
+				break;
+			case OpCode::Var:
+				index[node] = push(op, static_cast<const Variable<T> *>(node)->get_symbol().id());
+				break;
+			case OpCode::Sin: case OpCode::Cos: case OpCode::Ln: case OpCode::Exp:
+				index[node] = push(op, index.at(node->operand(0).get()));
+				break;
+			default:
+				index[node] = push(op, index.at(node->operand(0).get()), index.at(node->operand(1).get()));
+				break;
+		}
+	}
+}
+
+template <typename T>
+std::uint32_t FlatExpression<T>::push(OpCode op, std::uint32_t lhs, std::uint32_t rhs)
+{
+	tape.push_back(FlatNode{op, lhs, rhs});
+	return static_cast<std::uint32_t>(tape.size() - 1);
+}
+
+template <typename T>
+std::uint32_t FlatExpression<T>::push_constant(T value)
+{
+	pool.push_back(value);
+	return static_cast<std::uint32_t>(pool.size() - 1);
+}
+
+template <typename T>
+std::uint32_t FlatExpression<T>::push_power(std::uint32_t base, std::uint32_t exponent)
+{
+	// Repeated squaring with multiplications only.
+	std::uint32_t result = ZERO;
+	while (exponent > 0) {
+		if (exponent & 1u)
+			result = result == ZERO ? base : push(OpCode::Mult, result, base);
+		exponent >>= 1;
+		if (exponent > 0)
+			base = push(OpCode::Mult, base, base);
+	}
+	return result;
+}
+
+template <typename T>
+std::uint32_t FlatExpression<T>::push_polynomial(const Polynomial<T> &polynomial)
+{
+	using Iterator = typename Polynomial<T>::Terms::const_iterator;
+	const auto &variables = polynomial.get_variables();
+	const auto &terms = polynomial.get_terms();
+	if (terms.empty())
+		return push(OpCode::Const, push_constant(T(0)));
+
+	std::vector<std::uint32_t> inputs;
+	for (Symbol symbol : variables)
+		inputs.push_back(push(OpCode::Var, symbol.id()));
+
+	// Same nested Horner scheme as Polynomial::eval_at.
+	auto horner = [&](auto &self, Iterator begin, Iterator end, std::size_t level) -> std::uint32_t {
+		if (level == variables.size())
+			return push(OpCode::Const, push_constant(begin->second));
+
+		std::vector<Iterator> groups;
+		for (auto it = begin; it != end; ++it) {
+			if (groups.empty() || it->first[level] != groups.back()->first[level])
+				groups.push_back(it);
+		}
+		std::uint32_t result = ZERO, previous = 0;
+		for (std::size_t g = groups.size(); g-- > 0;) {
+			std::uint32_t exponent = groups[g]->first[level];
+			if (result != ZERO)
+				result = push(OpCode::Mult, result, push_power(inputs[level], previous - exponent));
+			std::uint32_t inner = self(self, groups[g], g + 1 < groups.size() ? groups[g + 1] : end, level + 1);
+			result = result == ZERO ? inner : push(OpCode::Add, result, inner);
+			previous = exponent;
+		}
+		if (previous > 0)
+			result = push(OpCode::Mult, result, push_power(inputs[level], previous));
+		return result;
+	};
+	return horner(horner, terms.begin(), terms.end(), 0);
+}
+
+template <typename T>
+Expression<T> FlatExpression<T>::to_expression() const
+{
+	std::vector<Ref<ExpressionImpl<T>>> built(tape.size());
+	for (std::size_t i = 0; i < tape.size(); ++i) {
+		const FlatNode &node = tape[i];
+		switch (node.op) {
+			case OpCode::Const: built[i] = make_ref<Value<T>>(pool[node.lhs]); break;
+			case OpCode::Var: built[i] = make_ref<Variable<T>>(Symbol(node.lhs)); break;
+			case OpCode::Add: built[i] = make_ref<OperationAdd<T>>(built[node.lhs], built[node.rhs]); break;
+			case OpCode::Sub: built[i] = make_ref<OperationSub<T>>(built[node.lhs], built[node.rhs]); break;
+			case OpCode::Mult: built[i] = make_ref<OperationMult<T>>(built[node.lhs], built[node.rhs]); break;
+			case OpCode::Div: built[i] = make_ref<OperationDiv<T>>(built[node.lhs], built[node.rhs]); break;
+			case OpCode::Pow: built[i] = make_ref<OperationPow<T>>(built[node.lhs], built[node.rhs]); break;
+			case OpCode::PowInt:
+				built[i] = make_ref<OperationPow<T>>(built[node.lhs], make_ref<Value<T>>(T(power_of(node))));
+				break;
+			case OpCode::Sqrt:
+				built[i] = make_ref<OperationPow<T>>(built[node.lhs], make_ref<Value<T>>(T(0.5L)));
+				break;
+			case OpCode::Sin: built[i] = make_ref<SinFunc<T>>(built[node.lhs]); break;
+			case OpCode::Cos: built[i] = make_ref<CosFunc<T>>(built[node.lhs]); break;
+			case OpCode::Ln: built[i] = make_ref<LnFunc<T>>(built[node.lhs]); break;
+			case OpCode::Exp: built[i] = make_ref<ExpFunc<T>>(built[node.lhs]); break;
+		}
+	}
+	return Expression<T>(built.back());
+}
+
+template <typename T>
+FlatExpression<T> FlatExpression<T>::diff(Symbol by) const
+{
+	FlatExpression<T> result;
+	result.tape = tape;
+	result.pool = pool;
+
+	std::uint32_t one = ZERO, minus_one = ZERO;
+	auto constant = [&](std::uint32_t &cached, T value) {
+		if (cached == ZERO)
+			cached = result.push(OpCode::Const, result.push_constant(value));
+		return cached;
+	};
+	auto add = [&](std::uint32_t a, std::uint32_t b) {
+		if (a == ZERO) return b;
+		if (b == ZERO) return a;
+		return result.push(OpCode::Add, a, b);
+	};
+	auto sub = [&](std::uint32_t a, std::uint32_t b) {
+		if (b == ZERO) return a;
+		if (a == ZERO) return result.push(OpCode::Mult, constant(minus_one, T(-1)), b);
+		return result.push(OpCode::Sub, a, b);
+	};
+	auto mult = [&](std::uint32_t a, std::uint32_t b) {
+		if (a == ZERO || b == ZERO) return ZERO;
+		if (a == one) return b;
+		if (b == one) return a;
+		return result.push(OpCode::Mult, a, b);
+	};
+
+	// d[i] is the node holding the derivative of node i, ZERO if it vanishes.
+	std::vector<std::uint32_t> d(tape.size(), ZERO);
+	for (std::uint32_t i = 0; i < tape.size(); ++i) {
+		const FlatNode node = tape[i];
+		const std::uint32_t l = node.lhs, r = node.rhs;
+		switch (node.op) {
+			case OpCode::Const:
+				break;
+			case OpCode::Var:
+				if (Symbol(node.lhs) == by)
+					d[i] = constant(one, T(1));
+				break;
+			case OpCode::Add:
+				d[i] = add(d[l], d[r]);
+				break;
+			case OpCode::Sub:
+				d[i] = sub(d[l], d[r]);
+				break;
+			case OpCode::Mult:
+				d[i] = add(mult(d[l], r), mult(l, d[r]));
+				break;
+			case OpCode::Div:
+				if (d[l] != ZERO || d[r] != ZERO)
+					d[i] = result.push(OpCode::Div, sub(mult(d[l], r), mult(l, d[r])), result.push(OpCode::Mult, r, r));
+				break;
+			case OpCode::Pow: {
+				// left^right * (right' * ln(left) + (right * left') / left)
+				std::uint32_t by_exponent = d[r] == ZERO ? ZERO : mult(d[r], result.push(OpCode::Ln, l));
+				std::uint32_t by_base = d[l] == ZERO ? ZERO : result.push(OpCode::Div, mult(r, d[l]), l);
+				d[i] = mult(i, add(by_exponent, by_base));
+				break;
+			}
+			case OpCode::PowInt: {
+				// n * left^(n - 1) * left'
+				const std::int32_t n = power_of(node);
+				if (d[l] == ZERO || n == 0)
+					break;
+				std::uint32_t lowered = n == 2 ? l : result.push(OpCode::PowInt, l, static_cast<std::uint32_t>(n - 1));
+				if (n == 1)
+					lowered = ZERO;
+				std::uint32_t factor = result.push(OpCode::Const, result.push_constant(T(static_cast<long double>(n))));
+				d[i] = mult(lowered == ZERO ? factor : result.push(OpCode::Mult, factor, lowered), d[l]);
+				break;
+			}
+			case OpCode::Sqrt:
+				if (d[l] != ZERO)
+					d[i] = mult(result.push(OpCode::Div, result.push(OpCode::Const, result.push_constant(T(0.5L))), i), d[l]);
+				break;
+			case OpCode::Sin:
+				if (d[l] != ZERO)
+					d[i] = mult(result.push(OpCode::Cos, l), d[l]);
+				break;
+			case OpCode::Cos:
+				if (d[l] != ZERO)
+					d[i] = mult(result.push(OpCode::Mult, result.push(OpCode::Sin, l), constant(minus_one, T(-1))), d[l]);
+				break;
+			case OpCode::Ln:
+				if (d[l] != ZERO)
+					d[i] = mult(result.push(OpCode::Div, constant(one, T(1)), l), d[l]);
+				break;
+			case OpCode::Exp:
+				d[i] = mult(i, d[l]);
+				break;
+		}
+	}
+
+	std::uint32_t root = d.back();
+	if (root == ZERO)
+		root = result.push(OpCode::Const, result.push_constant(T(0)));
+	return result.compacted(root);
+}
+
+template <typename T>
+FlatExpression<T> FlatExpression<T>::compacted(std::uint32_t root) const
+{
+	std::vector<bool> reachable(root + 1, false);
+	reachable[root] = true;
+	for (std::uint32_t i = root + 1; i-- > 0;) {
+		if (!reachable[i])
+			continue;
+		switch (tape[i].op) {
+			case OpCode::Const: case OpCode::Var:
+				break;
+			case OpCode::PowInt: case OpCode::Sqrt: case OpCode::Sin: case OpCode::Cos: case OpCode::Ln: case OpCode::Exp:
+				reachable[tape[i].lhs] = true;
+				break;
+			default:
+				reachable[tape[i].lhs] = true;
+				reachable[tape[i].rhs] = true;
+				break;
+		}
+	}
+
+	FlatExpression<T> result;
+	std::vector<std::uint32_t> remap(root + 1, ZERO);
+	for (std::uint32_t i = 0; i <= root; ++i) {
+		if (!reachable[i])
+			continue;
+		FlatNode node = tape[i];
+		switch (node.op) {
+			case OpCode::Const:
+				node.lhs = result.push_constant(pool[node.lhs]);
+				break;
+			case OpCode::Var:
+				break;
+			case OpCode::PowInt: case OpCode::Sqrt: case OpCode::Sin: case OpCode::Cos: case OpCode::Ln: case OpCode::Exp:
+				node.lhs = remap[node.lhs];
+				break;
+			default:
+				node.lhs = remap[node.lhs];
+				node.rhs = remap[node.rhs];
+				break;
+		}
+		remap[i] = result.push(node.op, node.lhs, node.rhs);
+	}
+	return result;
+}
+
+template <typename T>
+FlatExpression<T> FlatExpression<T>::with_context(const Bindings<T> &context) const
+{
+	FlatExpression<T> result = *this;
+	for (FlatNode &node : result.tape) {
+		if (node.op != OpCode::Var)
+			continue;
+		if (const T *value = context.find(Symbol(node.lhs)); value != nullptr)
+			node = FlatNode{OpCode::Const, result.push_constant(*value), 0};
+	}
+	return result;
+}
+
+template <typename T>
+T FlatExpression<T>::eval(const Bindings<T> &context) const
+{
+	std::vector<T> workspace;
+	return eval(context, workspace);
+}
+
+template <typename T>
+T FlatExpression<T>::eval(const Bindings<T> &context, std::vector<T> &workspace) const
+{
+	workspace.resize(tape.size());
+	run_tape(tape, pool, context, workspace.data());
+	return workspace[tape.size() - 1];
+}
+
+template <typename T>
+std::vector<T> FlatExpression<T>::hessian_vector_product(
+	const Bindings<T> &context, const std::vector<Symbol> &vars, const std::vector<T> &direction
+) const
+{
+	if (vars.size() != direction.size())
+		throw std::invalid_argument("Direction size does not match variables -> FlatExpression::hessian_vector_product");
+	std::unordered_map<SymbolId, std::size_t> slot;
+	for (std::size_t j = 0; j < vars.size(); ++j)
+		slot.emplace(vars[j].id(), j);
+
+	const Dual<T> zero{T(0), T(0)};
+	std::vector<Dual<T>> x(tape.size());
+	for (std::size_t i = 0; i < tape.size(); ++i) {
+		const FlatNode &node = tape[i];
+		const bool leaf = node.op == OpCode::Const || node.op == OpCode::Var;
+		const Dual<T> &l = leaf ? zero : x[node.lhs];
+		switch (node.op) {
+			case OpCode::Const: x[i] = {pool[node.lhs], T(0)}; break;
+			case OpCode::Var: {
+				const T *value = context.find(Symbol(node.lhs));
+				if (value == nullptr)
+					throw std::runtime_error("Variable " + Symbol(node.lhs).name() + " cannot be resolved without context");
+				auto found = slot.find(node.lhs);
+				x[i] = {*value, found == slot.end() ? T(0) : direction[found->second]};
+				break;
+			}
+			case OpCode::Add: x[i] = l + x[node.rhs]; break;
+			case OpCode::Sub: x[i] = l - x[node.rhs]; break;
+			case OpCode::Mult: x[i] = l * x[node.rhs]; break;
+			case OpCode::Div: x[i] = l / x[node.rhs]; break;
+			case OpCode::Pow: x[i] = dual_pow(l, x[node.rhs]); break;
+			case OpCode::PowInt: {
+				const std::int32_t n = power_of(node);
+				x[i] = {integer_power(l.value, n), n == 0 ? T(0) : T(n) * integer_power(l.value, n - 1) * l.tangent};
+				break;
+			}
+			case OpCode::Sqrt: {
+				T root = std::sqrt(l.value);
+				x[i] = {root, checked_div(l.tangent, T(2) * root)};
+				break;
+			}
+			case OpCode::Sin: x[i] = {std::sin(l.value), std::cos(l.value) * l.tangent}; break;
+			case OpCode::Cos: x[i] = {std::cos(l.value), -std::sin(l.value) * l.tangent}; break;
+			case OpCode::Ln: x[i] = {checked_log(l.value), checked_div(l.tangent, l.value)}; break;
+			case OpCode::Exp: {
+				T value = std::exp(l.value);
+				x[i] = {value, value * l.tangent};
+				break;
+			}
+		}
+	}
+
+	// Reverse pass in dual arithmetic: the tangent of each adjoint is the
+	// corresponding row of H * direction.
+	std::vector<Dual<T>> adjoint(tape.size(), zero);
+	std::vector<T> result(vars.size(), T(0));
+	adjoint.back() = {T(1), T(0)};
+	for (std::size_t i = tape.size(); i-- > 0;) {
+		const FlatNode &node = tape[i];
+		const Dual<T> a = adjoint[i];
+		if (a.value == T(0) && a.tangent == T(0))
+			continue;
+		const bool leaf = node.op == OpCode::Const || node.op == OpCode::Var;
+		const Dual<T> &l = leaf ? zero : x[node.lhs];
+		switch (node.op) {
+			case OpCode::Const:
+				break;
+			case OpCode::Var: {
+				auto found = slot.find(node.lhs);
+				if (found != slot.end())
+					result[found->second] += a.tangent;
+				break;
+			}
+			case OpCode::Add:
+				adjoint[node.lhs] = adjoint[node.lhs] + a;
+				adjoint[node.rhs] = adjoint[node.rhs] + a;
+				break;
+			case OpCode::Sub:
+				adjoint[node.lhs] = adjoint[node.lhs] + a;
+				adjoint[node.rhs] = adjoint[node.rhs] - a;
+				break;
+			case OpCode::Mult:
+				adjoint[node.lhs] = adjoint[node.lhs] + a * x[node.rhs];
+				adjoint[node.rhs] = adjoint[node.rhs] + a * l;
+				break;
+			case OpCode::Div:
+				adjoint[node.lhs] = adjoint[node.lhs] + a / x[node.rhs];
+				adjoint[node.rhs] = adjoint[node.rhs] - a * x[i] / x[node.rhs];
+				break;
+			case OpCode::Pow: {
+				const Dual<T> &r = x[node.rhs];
+				adjoint[node.lhs] = adjoint[node.lhs] + a * r * dual_pow(l, r - Dual<T>{T(1), T(0)});
+				if (tape[node.rhs].op != OpCode::Const) {
+					Dual<T> log{checked_log(l.value), checked_div(l.tangent, l.value)};
+					adjoint[node.rhs] = adjoint[node.rhs] + a * x[i] * log;
+				}
+				break;
+			}
+			case OpCode::PowInt: {
+				// n * l^(n - 1), with its own tangent n (n - 1) l^(n - 2) l'
+				const std::int32_t n = power_of(node);
+				if (n == 0)
+					break;
+				Dual<T> partial{T(n) * integer_power(l.value, n - 1),
+				                n == 1 ? T(0) : T(n) * T(n - 1) * integer_power(l.value, n - 2) * l.tangent};
+				adjoint[node.lhs] = adjoint[node.lhs] + a * partial;
+				break;
+			}
+			case OpCode::Sqrt:
+				adjoint[node.lhs] = adjoint[node.lhs] + a / (Dual<T>{T(2), T(0)} * x[i]);
+				break;
+			case OpCode::Sin:
+				adjoint[node.lhs] = adjoint[node.lhs] + a * Dual<T>{std::cos(l.value), -std::sin(l.value) * l.tangent};
+				break;
+			case OpCode::Cos:
+				adjoint[node.lhs] = adjoint[node.lhs] - a * Dual<T>{std::sin(l.value), std::cos(l.value) * l.tangent};
+				break;
+			case OpCode::Ln:
+				adjoint[node.lhs] = adjoint[node.lhs] + a / l;
+				break;
+			case OpCode::Exp:
+				adjoint[node.lhs] = adjoint[node.lhs] + a * x[i];
+				break;
+		}
+	}
+	return result;
+}
+
+template <typename T>
+std::vector<T> FlatExpression<T>::taylor_coefficients(const Bindings<T> &context, Symbol by, std::size_t order) const
+{
+	const std::size_t n = order + 1;
+	std::vector<T> series(tape.size() * n, T(0));
+	std::vector<T> scratch(2 * n);
+	for (std::size_t i = 0; i < tape.size(); ++i) {
+		const FlatNode &node = tape[i];
+		T *out = series.data() + i * n;
+		const bool leaf = node.op == OpCode::Const || node.op == OpCode::Var;
+		const T *l = leaf ? nullptr : series.data() + node.lhs * n;
+		const T *r = leaf || node.op == OpCode::PowInt ? nullptr : series.data() + node.rhs * n;
+		switch (node.op) {
+			case OpCode::Const: out[0] = pool[node.lhs]; break;
+			case OpCode::Var: {
+				const T *value = context.find(Symbol(node.lhs));
+				if (value == nullptr)
+					throw std::runtime_error("Variable " + Symbol(node.lhs).name() + " cannot be resolved without context");
+				out[0] = *value;
+				if (node.lhs == by.id() && n > 1)
+					out[1] = T(1);
+				break;
+			}
+			case OpCode::Add:
+				for (std::size_t k = 0; k < n; ++k) out[k] = l[k] + r[k];
+				break;
+			case OpCode::Sub:
+				for (std::size_t k = 0; k < n; ++k) out[k] = l[k] - r[k];
+				break;
+			case OpCode::Mult: series_mult(l, r, out, n); break;
+			case OpCode::Div: series_div(l, r, out, n); break;
+			case OpCode::Pow:
+				if (tape[node.rhs].op == OpCode::Const) {
+					series_pow(l, pool[tape[node.rhs].lhs], out, n);
+				} else {
+					// exp(right * ln(left))
+					series_log(l, scratch.data(), n);
+					series_mult(r, scratch.data(), scratch.data() + n, n);
+					series_exp(scratch.data() + n, out, n);
+				}
+				break;
+			case OpCode::PowInt: series_integer_power(l, power_of(node), out, n); break;
+			case OpCode::Sqrt: series_sqrt(l, out, n); break;
+			case OpCode::Sin: series_sin_cos(l, out, scratch.data(), n); break;
+			case OpCode::Cos: series_sin_cos(l, scratch.data(), out, n); break;
+			case OpCode::Ln: series_log(l, out, n); break;
+			case OpCode::Exp: series_exp(l, out, n); break;
+		}
+	}
+	return std::vector<T>(series.end() - n, series.end());
+}
+
+template <typename T>
+std::string FlatExpression<T>::to_string() const
+{
+	// Operand strings are moved into their last user instead of copied.
+	std::vector<std::uint32_t> uses(tape.size(), 0);
+	for (const FlatNode &node : tape) {
+		switch (node.op) {
+			case OpCode::Const: case OpCode::Var:
+				break;
+			case OpCode::PowInt: case OpCode::Sqrt: case OpCode::Sin: case OpCode::Cos: case OpCode::Ln: case OpCode::Exp:
+				++uses[node.lhs];
+				break;
+			default:
+				++uses[node.lhs];
+				++uses[node.rhs];
+				break;
+		}
+	}
+
+	std::vector<std::string> parts(tape.size());
+	auto take = [&](std::uint32_t index) -> std::string {
+		return --uses[index] == 0 ? std::move(parts[index]) : parts[index];
+	};
+	auto binary = [&](const FlatNode &node, const char *op) {
+		std::string result = "(";
+		result += take(node.lhs);
+		result += op;
+		result += take(node.rhs);
+		return result + ")";
+	};
+	auto call = [&](const FlatNode &node, const char *name) {
+		std::string result = name;
+		result += take(node.lhs);
+		return result + ")";
+	};
+	auto power = [&](const FlatNode &node, T exponent) {
+		std::string result = "(";
+		result += take(node.lhs);
+		result += ") ^ (";
+		result += Value<T>(exponent).to_string();
+		return result + ")";
+	};
+	for (std::size_t i = 0; i < tape.size(); ++i) {
+		const FlatNode &node = tape[i];
+		switch (node.op) {
+			case OpCode::Const: parts[i] = Value<T>(pool[node.lhs]).to_string(); break;
+			case OpCode::Var: parts[i] = Symbol(node.lhs).name(); break;
+			case OpCode::Add: parts[i] = binary(node, " + "); break;
+			case OpCode::Sub: parts[i] = binary(node, " - "); break;
+			case OpCode::Mult: parts[i] = binary(node, " * "); break;
+			case OpCode::Div: parts[i] = binary(node, " / "); break;
+			case OpCode::Pow: parts[i] = binary(node, ") ^ ("); break;
+			case OpCode::PowInt: parts[i] = power(node, T(power_of(node))); break;
+			case OpCode::Sqrt: parts[i] = power(node, T(0.5L)); break;
+			case OpCode::Sin: parts[i] = call(node, "sin("); break;
+			case OpCode::Cos: parts[i] = call(node, "cos("); break;
+			case OpCode::Ln: parts[i] = call(node, "ln("); break;
+			case OpCode::Exp: parts[i] = call(node, "exp("); break;
+		}
+	}
+	return parts.back();
+}
+
+template <typename T>
+std::size_t FlatExpression<T>::size() const
+{
+	return tape.size();
+}
+
+template <typename T>
+const std::vector<FlatNode> &FlatExpression<T>::nodes() const
+{
+	return tape;
+}
+
+template <typename T>
+const std::vector<T> &FlatExpression<T>::constants() const
+{
+	return pool;
+}
+
+template <typename T>
+CompiledBundle<T>::CompiledBundle(const std::vector<Expression<T>> &expressions)
+{
+	std::map<std::tuple<OpCode, std::uint32_t, std::uint32_t>, std::uint32_t> interned;
+	std::unordered_multimap<std::size_t, std::uint32_t> constant_nodes;
+	std::vector<std::uint32_t> remap;
+
+	for (const auto &expression : expressions) {
+		FlatExpression<T> flat(expression);
+		const auto &nodes = flat.nodes();
+		remap.assign(nodes.size(), ZERO);
+		for (std::size_t i = 0; i < nodes.size(); ++i) {
+			FlatNode node = nodes[i];
+			switch (node.op) {
+				case OpCode::Const: {
+					const T value = flat.constants()[node.lhs];
+					const std::size_t hash = constant_hash(value);
+					for (auto [it, end] = constant_nodes.equal_range(hash); it != end; ++it) {
+						if (same_constant(pool[tape[it->second].lhs], value)) {
+							remap[i] = it->second;
+							break;
+						}
+					}
+					if (remap[i] == ZERO) {
+						pool.push_back(value);
+						tape.push_back(FlatNode{OpCode::Const, static_cast<std::uint32_t>(pool.size() - 1), 0});
+						remap[i] = static_cast<std::uint32_t>(tape.size() - 1);
+						constant_nodes.emplace(hash, remap[i]);
+					}
+					continue;
+				}
+				case OpCode::Var:
+					break;
+				case OpCode::PowInt: case OpCode::Sqrt: case OpCode::Sin: case OpCode::Cos: case OpCode::Ln: case OpCode::Exp:
+					node.lhs = remap[node.lhs];
+					break;
+				default:
+					node.lhs = remap[node.lhs];
+					node.rhs = remap[node.rhs];
+					if ((node.op == OpCode::Add || node.op == OpCode::Mult) && node.lhs > node.rhs)
+						std::swap(node.lhs, node.rhs);
+					break;
+			}
+			auto [it, inserted] = interned.try_emplace(
+				{node.op, node.lhs, node.rhs}, static_cast<std::uint32_t>(tape.size())
+			);
+			if (inserted)
+				tape.push_back(node);
+			remap[i] = it->second;
+		}
+		results.push_back(remap.back());
+	}
+}
+
+template <typename T>
+void CompiledBundle<T>::eval(const Bindings<T> &context, T *out, std::vector<T> &workspace) const
+{
+	workspace.resize(tape.size());
+	run_tape(tape, pool, context, workspace.data());
+	for (std::size_t k = 0; k < results.size(); ++k)
+		out[k] = workspace[results[k]];
+}
+
+template <typename T>
+std::vector<T> CompiledBundle<T>::eval(const Bindings<T> &context) const
+{
+	std::vector<T> workspace, out(results.size());
+	eval(context, out.data(), workspace);
+	return out;
+}
+
+template <typename T>
+std::size_t CompiledBundle<T>::size() const
+{
+	return tape.size();
+}
+
+template <typename T>
+std::size_t CompiledBundle<T>::outputs() const
+{
+	return results.size();
+}
+
+template <typename T>
+const std::vector<FlatNode> &CompiledBundle<T>::nodes() const
+{
+	return tape;
+}
+
+template <typename T>
+const std::vector<T> &CompiledBundle<T>::constants() const
+{
+	return pool;
+}
+
+template <typename T>
+const std::vector<std::uint32_t> &CompiledBundle<T>::roots() const
+{
+	return results;
+}
+
+template class FlatExpression<long double>;
+template class FlatExpression<std::complex<long double>>;
+template class CompiledBundle<long double>;
+template class CompiledBundle<std::complex<long double>>;
@@ -0,0 +1,110 @@
+#ifndef FLAT_EXPRESSION_HPP
+#define FLAT_EXPRESSION_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "expression.hpp"
+#include "polynomial.hpp"
+#include "symbol.hpp"
+
+template <typename T> class EGraph;
+
+enum class OpCode : std::uint8_t {
+    Const,
+    Var,
+    Add,
+    Sub,
+    Mult,
+    Div,
+    Pow,
+    PowInt,
+    Sqrt,
+    Sin,
+    Cos,
+    Ln,
+    Exp
+};
+
+// For Const `lhs` indexes the constant pool, for Var it holds the SymbolId,
+// for operations `lhs`/`rhs` index earlier nodes of the tape. PowInt keeps
+// its integer exponent in `rhs`.
+struct FlatNode {
+	OpCode op;
+	std::uint32_t lhs;
+	std::uint32_t rhs;
+};
+
+// Closed, devirtualized counterpart of the ExpressionImpl hierarchy.
+// The DAG is stored as a topologically ordered tape with the root last,
+// and every algorithm is one switch over the opcodes instead of a virtual
+// call per node.
+template <typename T> class FlatExpression {
+  public:
+	explicit FlatExpression(const Expression<T> &expression);
+
+	Expression<T> to_expression(void) const;
+
+	FlatExpression<T> diff(Symbol by) const;
+	FlatExpression<T> with_context(const Bindings<T> &context) const;
+	T eval(const Bindings<T> &context) const;
+	T eval(const Bindings<T> &context, std::vector<T> &workspace) const;
+	// H * direction at `context`, where H is the Hessian over `vars`. One
+	// forward pass with tangents and one reverse pass over them, so the
+	// cost is a small multiple of eval and no symbolic Hessian is built.
+	std::vector<T> hessian_vector_product(
+		const Bindings<T> &context, const std::vector<Symbol> &vars, const std::vector<T> &direction
+	) const;
+	// Coefficients c_0..c_order of f(x0 + t) in t, where x0 is the value of
+	// `by` in `context`; the k-th derivative at x0 is k! * c_k. Truncated
+	// series are propagated through the tape with the usual recurrences in
+	// O(order^2) per node, without building any derivative expression.
+	std::vector<T> taylor_coefficients(const Bindings<T> &context, Symbol by, std::size_t order) const;
+	std::string to_string(void) const;
+
+	std::size_t size(void) const;
+	const std::vector<FlatNode> &nodes(void) const;
+	const std::vector<T> &constants(void) const;
+
+  private:
+	FlatExpression() = default;
+
+	std::uint32_t push(OpCode op, std::uint32_t lhs = 0, std::uint32_t rhs = 0);
+	std::uint32_t push_constant(T value);
+	std::uint32_t push_power(std::uint32_t base, std::uint32_t exponent);
+	std::uint32_t push_polynomial(const Polynomial<T> &polynomial);
+	FlatExpression<T> compacted(std::uint32_t root) const;
+
+	std::vector<FlatNode> tape;
+	std::vector<T> pool;
+
+	friend class EGraph<T>;
+};
+
+// Several expressions merged into one tape. Nodes are hash-consed across
+// all inputs (operands of + and * in canonical order, equal constants
+// shared), so work common to the outputs, such as the subexpressions a
+// function shares with its derivatives, is done once per evaluation.
+template <typename T> class CompiledBundle {
+  public:
+	explicit CompiledBundle(const std::vector<Expression<T>> &expressions);
+
+	// out[k] is the value of expressions[k].
+	void eval(const Bindings<T> &context, T *out, std::vector<T> &workspace) const;
+	std::vector<T> eval(const Bindings<T> &context) const;
+
+	std::size_t size(void) const;
+	std::size_t outputs(void) const;
+	const std::vector<FlatNode> &nodes(void) const;
+	const std::vector<T> &constants(void) const;
+	// Tape index of each output.
+	const std::vector<std::uint32_t> &roots(void) const;
+
+  private:
+	std::vector<FlatNode> tape;
+	std::vector<T> pool;
+	std::vector<std::uint32_t> results;
+};
+
+#endif
@@ -0,0 +1,405 @@
+#include "interval.hpp"
+#include "numeric.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numbers>
+#include <queue>
+#include <stdexcept>
+
+namespace {
+
+constexpr long double infinity = std::numeric_limits<long double>::infinity();
+constexpr long double pi = std::numbers::pi_v<long double>;
+
+// Outward rounding by whole ulps. The library calls and the arithmetic
+// round to nearest, so one ulp per correctly rounded operation (and a
+// little more for libm) covers the exact result without switching the
+// rounding mode.
+long double down(long double value, int ulps = 1)
+{
+	for (int i = 0; i < ulps && std::isfinite(value); ++i)
+		value = std::nextafter(value, -infinity);
+	return value;
+}
+
+long double up(long double value, int ulps = 1)
+{
+	for (int i = 0; i < ulps && std::isfinite(value); ++i)
+		value = std::nextafter(value, infinity);
+	return value;
+}
+
+Interval outward(long double lo, long double hi, int ulps = 1)
+{
+	if (std::isnan(lo) || std::isnan(hi))
+		return {-infinity, infinity};
+	return {down(lo, ulps), up(hi, ulps)};
+}
+
+// 0 * inf = 0: an unbounded factor cannot make a zero one nonzero.
+long double product(long double a, long double b)
+{
+	return a == 0.0L || b == 0.0L ? 0.0L : a * b;
+}
+
+Interval add(Interval a, Interval b)
+{
+	if (a.is_empty() || b.is_empty())
+		return Interval::empty();
+	return outward(a.lo + b.lo, a.hi + b.hi);
+}
+
+Interval sub(Interval a, Interval b)
+{
+	if (a.is_empty() || b.is_empty())
+		return Interval::empty();
+	return outward(a.lo - b.hi, a.hi - b.lo);
+}
+
+Interval mult(Interval a, Interval b)
+{
+	if (a.is_empty() || b.is_empty())
+		return Interval::empty();
+	const long double p[] = {product(a.lo, b.lo), product(a.lo, b.hi), product(a.hi, b.lo), product(a.hi, b.hi)};
+	return outward(*std::min_element(p, p + 4), *std::max_element(p, p + 4));
+}
+
+Interval div(Interval a, Interval b)
+{
+	if (a.is_empty() || b.is_empty() || (b.lo == 0.0L && b.hi == 0.0L))
+		return Interval::empty();
+	if (b.contains(0.0L))
+		return {-infinity, infinity};
+	const long double q[] = {a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi};
+	return outward(*std::min_element(q, q + 4), *std::max_element(q, q + 4));
+}
+
+Interval integer_power(Interval x, std::int32_t exponent)
+{
+	if (x.is_empty())
+		return x;
+	const std::uint32_t n = exponent < 0 ? -static_cast<std::uint32_t>(exponent) : static_cast<std::uint32_t>(exponent);
+	// one rounding per multiplication of the repeated squaring
+	const int ulps = 2 * std::bit_width(n) + 1;
+	const long double at_lo = ::integer_power(x.lo, n), at_hi = ::integer_power(x.hi, n);
+	Interval power;
+	if (n % 2 == 1 || x.lo >= 0.0L)
+		power = outward(at_lo, at_hi, ulps);
+	else if (x.hi <= 0.0L)
+		power = outward(at_hi, at_lo, ulps);
+	else
+		power = outward(0.0L, std::max(at_lo, at_hi), ulps);
+	if (n % 2 == 0)
+		power.lo = std::max(power.lo, 0.0L);
+	return exponent < 0 ? div(Interval::point(1.0L), power) : power;
+}
+
+Interval square_root(Interval x)
+{
+	if (x.is_empty() || x.hi < 0.0L)
+		return Interval::empty();
+	Interval root = outward(std::sqrt(std::max(x.lo, 0.0L)), std::sqrt(x.hi));
+	root.lo = std::max(root.lo, 0.0L);
+	return root;
+}
+
+// f is sin or cos, with maxima at maximum + 2 pi k and minima at
+// maximum + pi + 2 pi k. A critical point within rounding distance of the
+// interval is taken as inside it.
+template <typename F> Interval periodic(Interval x, F f, long double maximum)
+{
+	if (x.is_empty())
+		return x;
+	if (!std::isfinite(x.lo) || !std::isfinite(x.hi) || x.width() >= 2 * pi)
+		return {-1.0L, 1.0L};
+	const long double margin = 1e-15L * (1.0L + std::max(std::abs(x.lo), std::abs(x.hi)));
+	auto reaches = [&](long double critical) {
+		const long double k = std::ceil((x.lo - margin - critical) / (2 * pi));
+		return critical + 2 * pi * k <= x.hi + margin;
+	};
+	const long double a = f(x.lo), b = f(x.hi);
+	Interval range = outward(std::min(a, b), std::max(a, b), 2);
+	if (reaches(maximum))
+		range.hi = 1.0L;
+	if (reaches(maximum + pi))
+		range.lo = -1.0L;
+	return {std::max(range.lo, -1.0L), std::min(range.hi, 1.0L)};
+}
+
+Interval logarithm(Interval x)
+{
+	if (x.is_empty() || x.hi <= 0.0L)
+		return Interval::empty();
+	return outward(std::log(std::max(x.lo, 0.0L)), std::log(x.hi), 2);
+}
+
+Interval exponential(Interval x)
+{
+	if (x.is_empty())
+		return x;
+	Interval range = outward(std::exp(x.lo), std::exp(x.hi), 2);
+	range.lo = std::max(range.lo, 0.0L);
+	return range;
+}
+
+// x^y = exp(y ln x) over the part of x where it is defined for every y;
+// integer constant exponents are PowInt nodes and keep negative bases.
+Interval power(Interval x, Interval y)
+{
+	return exponential(mult(y, logarithm(x)));
+}
+
+} // namespace
+
+Interval Interval::point(long double value)
+{
+	return {value, value};
+}
+
+Interval Interval::empty(void)
+{
+	return {infinity, -infinity};
+}
+
+bool Interval::is_empty(void) const
+{
+	return !(lo <= hi);
+}
+
+bool Interval::contains(long double value) const
+{
+	return lo <= value && value <= hi;
+}
+
+long double Interval::width(void) const
+{
+	return is_empty() ? 0.0L : hi - lo;
+}
+
+long double Interval::midpoint(void) const
+{
+	if (std::isinf(lo) || std::isinf(hi))
+		return std::isinf(lo) && std::isinf(hi) ? 0.0L : (std::isinf(lo) ? hi : lo);
+	return lo + (hi - lo) / 2;
+}
+
+IntervalEvaluator::IntervalEvaluator(const FlatExpression<long double> &expression)
+	: tape(expression.nodes()), pool(expression.constants())
+{
+}
+
+Interval IntervalEvaluator::eval(const Box &box) const
+{
+	std::vector<Interval> workspace;
+	return eval(box, workspace);
+}
+
+Interval IntervalEvaluator::eval(const Box &box, std::vector<Interval> &workspace) const
+{
+	workspace.resize(tape.size());
+	Interval *values = workspace.data();
+	for (std::size_t i = 0; i < tape.size(); ++i) {
+		const FlatNode &node = tape[i];
+		switch (node.op) {
+			case OpCode::Const: values[i] = Interval::point(pool[node.lhs]); break;
+			case OpCode::Var: {
+				auto found = std::find_if(box.begin(), box.end(), [&](const auto &range) {
+					return range.first.id() == node.lhs;
+				});
+				if (found == box.end())
+					throw std::runtime_error("Variable " + Symbol(node.lhs).name() + " cannot be resolved without context");
+				values[i] = found->second;
+				break;
+			}
+			case OpCode::Add: values[i] = add(values[node.lhs], values[node.rhs]); break;
+			case OpCode::Sub: values[i] = sub(values[node.lhs], values[node.rhs]); break;
+			case OpCode::Mult: values[i] = mult(values[node.lhs], values[node.rhs]); break;
+			case OpCode::Div: values[i] = div(values[node.lhs], values[node.rhs]); break;
+			case OpCode::Pow: values[i] = power(values[node.lhs], values[node.rhs]); break;
+			case OpCode::PowInt: values[i] = integer_power(values[node.lhs], static_cast<std::int32_t>(node.rhs)); break;
+			case OpCode::Sqrt: values[i] = square_root(values[node.lhs]); break;
+			case OpCode::Sin: values[i] = periodic(values[node.lhs], [](long double v) { return std::sin(v); }, pi / 2); break;
+			case OpCode::Cos: values[i] = periodic(values[node.lhs], [](long double v) { return std::cos(v); }, 0.0L); break;
+			case OpCode::Ln: values[i] = logarithm(values[node.lhs]); break;
+			case OpCode::Exp: values[i] = exponential(values[node.lhs]); break;
+		}
+	}
+	return values[tape.size() - 1];
+}
+
+namespace {
+
+// Range and partial derivative ranges of one function over boxes.
+class Bounds {
+  public:
+	Bounds(const Expression<long double> &f, const Box &domain)
+		: flat(f), range(flat)
+	{
+		std::vector<Symbol> vars;
+		for (const auto &[symbol, interval] : domain)
+			vars.push_back(symbol);
+		for (const auto &partial : f.gradient(vars))
+			slopes.emplace_back(FlatExpression<long double>(partial));
+	}
+
+	Interval value(const Box &box) { return range.eval(box, workspace); }
+	Interval slope(std::size_t j, const Box &box) { return slopes[j].eval(box, workspace); }
+	std::size_t dimension(void) const { return slopes.size(); }
+
+	FlatExpression<long double> flat;
+
+  private:
+	IntervalEvaluator range;
+	std::vector<IntervalEvaluator> slopes;
+	std::vector<Interval> workspace;
+};
+
+std::size_t widest(const Box &box)
+{
+	std::size_t j = 0;
+	for (std::size_t k = 1; k < box.size(); ++k) {
+		if (box[k].second.width() > box[j].second.width())
+			j = k;
+	}
+	return j;
+}
+
+// Whether the box is down to adjacent floating-point numbers in x_j.
+bool indivisible(const Box &box, std::size_t j)
+{
+	const Interval &x = box[j].second;
+	const long double middle = x.midpoint();
+	return !(x.lo < middle && middle < x.hi);
+}
+
+std::pair<Box, Box> bisect(const Box &box, std::size_t j)
+{
+	Box left = box, right = box;
+	const long double middle = box[j].second.midpoint();
+	left[j].second.hi = middle;
+	right[j].second.lo = middle;
+	return {std::move(left), std::move(right)};
+}
+
+} // namespace
+
+GlobalMinimum global_minimum(const Expression<long double> &f, const Box &domain, long double tolerance, std::size_t max_boxes)
+{
+	Bounds bounds(f, domain);
+	GlobalMinimum result{-infinity, infinity, {}, 0};
+
+	// Midpoint values give the upper bound.
+	Bindings<long double> at;
+	std::vector<long double> scratch;
+	auto sample = [&](const Box &box) {
+		std::vector<long double> point;
+		for (const auto &[symbol, interval] : box) {
+			point.push_back(interval.midpoint());
+			at.bind(symbol, point.back());
+		}
+		try {
+			const long double value = bounds.flat.eval(at, scratch);
+			if (value < result.upper) {
+				result.upper = value;
+				result.argument = std::move(point);
+			}
+		} catch (const std::runtime_error &) {
+			// outside the domain of f at this point
+		}
+	};
+
+	using Candidate = std::pair<long double, Box>;
+	auto above = [](const Candidate &a, const Candidate &b) { return a.first > b.first; };
+	std::priority_queue<Candidate, std::vector<Candidate>, decltype(above)> queue(above);
+	auto consider = [&](Box box) {
+		Interval value = bounds.value(box);
+		if (value.is_empty() || value.lo > result.upper)
+			return;
+		// A minimum of a box on which f is monotone in x_j lies on one face;
+		// unless that face is on the domain boundary, it is also in the
+		// neighbouring box.
+		bool collapsed = false;
+		for (std::size_t j = 0; j < bounds.dimension(); ++j) {
+			const Interval slope = bounds.slope(j, box);
+			if (slope.is_empty() || slope.contains(0.0L))
+				continue;
+			Interval &x = box[j].second;
+			const bool increasing = slope.lo > 0.0L;
+			if (increasing ? x.lo != domain[j].second.lo : x.hi != domain[j].second.hi)
+				return;
+			x = Interval::point(increasing ? x.lo : x.hi);
+			collapsed = true;
+		}
+		if (collapsed) {
+			value = bounds.value(box);
+			if (value.is_empty() || value.lo > result.upper)
+				return;
+		}
+		sample(box);
+		queue.emplace(value.lo, std::move(box));
+	};
+
+	long double settled = infinity;
+	consider(domain);
+	while (!queue.empty() && queue.top().first < result.upper - tolerance && result.boxes < max_boxes) {
+		Box box = queue.top().second;
+		const long double lower = queue.top().first;
+		queue.pop();
+		++result.boxes;
+		const std::size_t j = widest(box);
+		if (indivisible(box, j)) {
+			// nothing left to split
+			settled = std::min(settled, lower);
+			continue;
+		}
+		auto [left, right] = bisect(box, j);
+		consider(std::move(left));
+		consider(std::move(right));
+	}
+	result.lower = std::min({settled, queue.empty() ? result.upper : queue.top().first, result.upper});
+	return result;
+}
+
+std::vector<Box> isolate_roots(const Expression<long double> &f, const Box &domain, long double width, std::size_t max_boxes)
+{
+	Bounds bounds(f, domain);
+	std::vector<Box> roots;
+	std::vector<Box> stack{domain};
+	std::size_t boxes = 0;
+	while (!stack.empty() && boxes < max_boxes) {
+		Box box = std::move(stack.back());
+		stack.pop_back();
+		++boxes;
+		const Interval value = bounds.value(box);
+		if (value.is_empty() || !value.contains(0.0L))
+			continue;
+		// In one variable a monotone box has a zero only on a sign change.
+		if (bounds.dimension() == 1) {
+			const Interval slope = bounds.slope(0, box);
+			if (!slope.is_empty() && !slope.contains(0.0L)) {
+				Box lo = box, hi = box;
+				lo[0].second = Interval::point(box[0].second.lo);
+				hi[0].second = Interval::point(box[0].second.hi);
+				const Interval a = bounds.value(lo), b = bounds.value(hi);
+				if ((a.lo > 0.0L && b.lo > 0.0L) || (a.hi < 0.0L && b.hi < 0.0L))
+					continue;
+			}
+		}
+		const std::size_t j = widest(box);
+		if (box[j].second.width() <= width || indivisible(box, j)) {
+			roots.push_back(std::move(box));
+			continue;
+		}
+		auto [left, right] = bisect(box, j);
+		stack.push_back(std::move(right));
+		stack.push_back(std::move(left));
+	}
+	// Out of budget: what was never looked at may still hold zeros.
+	for (auto it = stack.rbegin(); it != stack.rend(); ++it)
+		roots.push_back(std::move(*it));
+	return roots;
+}
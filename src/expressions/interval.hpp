@@ -0,0 +1,71 @@
+#ifndef INTERVAL_HPP
+#define INTERVAL_HPP
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "expression.hpp"
+#include "flat_expression.hpp"
+#include "symbol.hpp"
+
+// Closed interval [lo, hi]; lo > hi is the empty set, e.g. ln over x <= 0.
+struct Interval {
+	long double lo;
+	long double hi;
+
+	static Interval point(long double value);
+	static Interval empty(void);
+
+	bool is_empty(void) const;
+	bool contains(long double value) const;
+	long double width(void) const;
+	long double midpoint(void) const;
+};
+
+using Box = std::vector<std::pair<Symbol, Interval>>;
+
+// Evaluates a tape over a box of variable ranges. Every result encloses
+// the exact range of the expression over the box: bounds are rounded
+// outward, and sin, cos, ln, exp and pow are split at their extrema and
+// domain limits instead of being evaluated at the endpoints only. Parts of
+// the box outside an operation's domain are dropped, division by an
+// interval containing zero yields the whole line.
+class IntervalEvaluator {
+  public:
+	explicit IntervalEvaluator(const FlatExpression<long double> &expression);
+
+	Interval eval(const Box &box) const;
+	Interval eval(const Box &box, std::vector<Interval> &workspace) const;
+
+  private:
+	std::vector<FlatNode> tape;
+	std::vector<long double> pool;
+};
+
+struct GlobalMinimum {
+	// The minimum over the domain lies in [lower, upper].
+	long double lower;
+	long double upper;
+	// Best point found, aligned with the domain.
+	std::vector<long double> argument;
+	std::size_t boxes;
+};
+
+// Branch-and-bound over `domain`: boxes whose range lies above the best
+// value found are discarded whole, and boxes on which a partial derivative
+// keeps its sign are pushed to their boundary face or discarded. Stops when
+// upper - lower <= tolerance or after `max_boxes` boxes.
+GlobalMinimum global_minimum(
+	const Expression<long double> &f, const Box &domain, long double tolerance, std::size_t max_boxes = 1 << 20
+);
+
+// Boxes no wider than `width` that together contain every zero of `f` in
+// `domain`; neighbouring boxes may share one zero. When `max_boxes` runs
+// out first, the boxes not yet explored are returned as they are, wider
+// than `width`, so the result still contains every zero.
+std::vector<Box> isolate_roots(
+	const Expression<long double> &f, const Box &domain, long double width, std::size_t max_boxes = 1 << 20
+);
+
+#endif
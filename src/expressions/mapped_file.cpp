@@ -0,0 +1,97 @@
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string &path)
+{
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+	struct stat info;
+	if (::fstat(fd, &info) != 0) {
+		const int error = errno;
+		::close(fd);
+		throw std::runtime_error("Cannot stat " + path + ": " + std::strerror(error));
+	}
+	length = static_cast<std::size_t>(info.st_size);
+	// mmap rejects empty mappings; an empty file is an empty view.
+	if (length != 0) {
+		void *mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			const int error = errno;
+			::close(fd);
+			throw std::runtime_error("Cannot map " + path + ": " + std::strerror(error));
+		}
+		bytes = static_cast<const char *>(mapping);
+	}
+	// The mapping stays valid after the descriptor is closed.
+	::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+	unmap();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept :
+	bytes(std::exchange(other.bytes, nullptr)), length(std::exchange(other.length, 0))
+{}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+	if (this != &other) {
+		unmap();
+		bytes = std::exchange(other.bytes, nullptr);
+		length = std::exchange(other.length, 0);
+	}
+	return *this;
+}
+
+const char *MappedFile::data() const
+{
+	return bytes;
+}
+
+std::size_t MappedFile::size() const
+{
+	return length;
+}
+
+std::string_view MappedFile::view() const
+{
+	return bytes ? std::string_view(bytes, length) : std::string_view();
+}
+
+void MappedFile::advise_sequential() const
+{
+	if (bytes)
+		::madvise(const_cast<char *>(bytes), length, MADV_SEQUENTIAL);
+}
+
+std::size_t MappedFile::release(std::size_t offset, std::size_t count) const
+{
+	const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+	const std::size_t begin = (offset + page - 1) / page * page;
+	const std::size_t end = std::min(offset + count, length) / page * page;
+	if (bytes == nullptr || end <= begin)
+		return offset;
+	::madvise(const_cast<char *>(bytes) + begin, end - begin, MADV_DONTNEED);
+	return end;
+}
+
+void MappedFile::unmap()
+{
+	if (bytes)
+		::munmap(const_cast<char *>(bytes), length);
+	bytes = nullptr;
+	length = 0;
+}
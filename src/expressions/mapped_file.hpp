@@ -0,0 +1,41 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only mapping of a whole file. Pages are read on first access and
+// can be dropped again by the kernel, so scanning a file costs address
+// space rather than heap however large it is.
+class MappedFile {
+  public:
+	explicit MappedFile(const std::string &path);
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	MappedFile(MappedFile &&other) noexcept;
+	MappedFile &operator=(MappedFile &&other) noexcept;
+
+	const char *data(void) const;
+	std::size_t size(void) const;
+	std::string_view view(void) const;
+
+	// Tells the kernel the bytes will be read once, front to back, so it
+	// reads ahead more and keeps less behind.
+	void advise_sequential(void) const;
+	// Returns the pages lying entirely inside [offset, offset + count) to
+	// the kernel; reading them again maps them in from the file anew.
+	// Returns the end of what was released, or `offset` if nothing was, so
+	// a reader can pass it back as the next offset.
+	std::size_t release(std::size_t offset, std::size_t count) const;
+
+  private:
+	void unmap(void);
+
+	const char *bytes = nullptr;
+	std::size_t length = 0;
+};
+
+#endif
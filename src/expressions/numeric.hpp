@@ -0,0 +1,48 @@
+#ifndef NUMERIC_HPP
+#define NUMERIC_HPP
+
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// x^n by repeated squaring; negative n yields 1 / x^|n|.
+template <typename T> T integer_power(T base, std::int64_t exponent)
+{
+	const bool invert = exponent < 0;
+	std::uint64_t n = invert ? -static_cast<std::uint64_t>(exponent) : static_cast<std::uint64_t>(exponent);
+	T result = T(1);
+	while (n > 0) {
+		if (n & 1u)
+			result *= base;
+		n >>= 1;
+		if (n > 0)
+			base *= base;
+	}
+	return invert ? T(1) / result : result;
+}
+
+// Constants are shared only when they are the same value bit for bit up to
+// NaN payloads: 0 and -0 stay apart, they divide differently.
+inline bool same_constant(long double a, long double b)
+{
+	return a == b && std::signbit(a) == std::signbit(b);
+}
+
+inline bool same_constant(std::complex<long double> a, std::complex<long double> b)
+{
+	return same_constant(a.real(), b.real()) && same_constant(a.imag(), b.imag());
+}
+
+inline std::size_t constant_hash(long double value)
+{
+	return std::hash<long double>{}(value);
+}
+
+inline std::size_t constant_hash(std::complex<long double> value)
+{
+	return constant_hash(value.real()) * 31 + constant_hash(value.imag());
+}
+
+#endif
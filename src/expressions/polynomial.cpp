@@ -0,0 +1,579 @@
+#include "polynomial.hpp"
+#include "numeric.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+template <typename T>
+Ref<ExpressionImpl<T>> share(const ExpressionImpl<T> *node)
+{
+	return Ref<ExpressionImpl<T>>(const_cast<ExpressionImpl<T> *>(node));
+}
+
+// Polynomial under construction; `vars` are kept sorted by symbol id.
+template <typename T> struct PolyData {
+	std::vector<SymbolId> vars;
+	typename Polynomial<T>::Terms terms;
+};
+
+template <typename T> PolyData<T> constant(T value)
+{
+	PolyData<T> result;
+	if (value != T(0))
+		result.terms[{}] = value;
+	return result;
+}
+
+template <typename T> PolyData<T> variable(SymbolId id)
+{
+	PolyData<T> result;
+	result.vars = {id};
+	result.terms[{1}] = T(1);
+	return result;
+}
+
+template <typename T>
+PolyData<T> aligned(const PolyData<T> &poly, const std::vector<SymbolId> &vars)
+{
+	if (poly.vars == vars)
+		return poly;
+	std::vector<std::size_t> position(poly.vars.size());
+	for (std::size_t i = 0; i < poly.vars.size(); ++i)
+		position[i] = std::lower_bound(vars.begin(), vars.end(), poly.vars[i]) - vars.begin();
+
+	PolyData<T> result;
+	result.vars = vars;
+	for (const auto &[exponents, coefficient] : poly.terms) {
+		typename Polynomial<T>::Exponents moved(vars.size(), 0);
+		for (std::size_t i = 0; i < exponents.size(); ++i)
+			moved[position[i]] = exponents[i];
+		result.terms[moved] += coefficient;
+	}
+	return result;
+}
+
+template <typename T>
+std::vector<SymbolId> merged(const PolyData<T> &left, const PolyData<T> &right)
+{
+	std::vector<SymbolId> vars;
+	std::set_union(left.vars.begin(), left.vars.end(), right.vars.begin(), right.vars.end(), std::back_inserter(vars));
+	return vars;
+}
+
+template <typename T> void drop_zeros(PolyData<T> &poly)
+{
+	std::erase_if(poly.terms, [](const auto &term) { return term.second == T(0); });
+}
+
+template <typename T> bool within_limits(const PolyData<T> &poly)
+{
+	if (poly.terms.size() > Polynomial<T>::max_terms)
+		return false;
+	for (const auto &[exponents, coefficient] : poly.terms) {
+		for (std::uint32_t exponent : exponents) {
+			if (exponent > Polynomial<T>::max_degree)
+				return false;
+		}
+	}
+	return true;
+}
+
+template <typename T> PolyData<T> add(const PolyData<T> &left, const PolyData<T> &right, T sign = T(1))
+{
+	auto vars = merged(left, right);
+	PolyData<T> result = aligned(left, vars);
+	for (const auto &[exponents, coefficient] : aligned(right, vars).terms)
+		result.terms[exponents] += sign * coefficient;
+	drop_zeros(result);
+	return result;
+}
+
+// Divides rather than scaling by 1 / divisor, which would round twice.
+template <typename T> PolyData<T> divide(PolyData<T> poly, T divisor)
+{
+	for (auto &[exponents, coefficient] : poly.terms)
+		coefficient /= divisor;
+	drop_zeros(poly);
+	return poly;
+}
+
+template <typename T>
+std::optional<PolyData<T>> mult(const PolyData<T> &left, const PolyData<T> &right)
+{
+	auto vars = merged(left, right);
+	PolyData<T> a = aligned(left, vars), b = aligned(right, vars);
+	PolyData<T> result;
+	result.vars = vars;
+	for (const auto &[left_exponents, left_coefficient] : a.terms) {
+		for (const auto &[right_exponents, right_coefficient] : b.terms) {
+			typename Polynomial<T>::Exponents exponents(vars.size());
+			for (std::size_t i = 0; i < vars.size(); ++i)
+				exponents[i] = left_exponents[i] + right_exponents[i];
+			result.terms[exponents] += left_coefficient * right_coefficient;
+		}
+	}
+	drop_zeros(result);
+	if (!within_limits(result))
+		return std::nullopt;
+	return result;
+}
+
+template <typename T>
+std::optional<PolyData<T>> power(const PolyData<T> &base, std::uint32_t exponent)
+{
+	std::optional<PolyData<T>> result = constant(T(1)), square = base;
+	while (exponent > 0) {
+		if (exponent & 1u) {
+			result = mult(*result, *square);
+			if (!result)
+				return std::nullopt;
+		}
+		exponent >>= 1;
+		if (exponent > 0) {
+			square = mult(*square, *square);
+			if (!square)
+				return std::nullopt;
+		}
+	}
+	return result;
+}
+
+template <typename T> std::optional<std::uint32_t> integer_exponent(T value)
+{
+	if (std::imag(value) != 0)
+		return std::nullopt;
+	auto real = std::real(value);
+	if (real < 0 || real > Polynomial<T>::max_degree || real != std::floor(real))
+		return std::nullopt;
+	return static_cast<std::uint32_t>(real);
+}
+
+// Drops variables that no longer occur and collapses constants to Value.
+template <typename T> Ref<ExpressionImpl<T>> make_polynomial(const PolyData<T> &poly)
+{
+	std::vector<bool> used(poly.vars.size(), false);
+	for (const auto &[exponents, coefficient] : poly.terms) {
+		for (std::size_t i = 0; i < exponents.size(); ++i)
+			used[i] = used[i] || exponents[i] > 0;
+	}
+
+	std::vector<Symbol> vars;
+	std::vector<std::size_t> kept;
+	for (std::size_t i = 0; i < poly.vars.size(); ++i) {
+		if (used[i]) {
+			vars.emplace_back(poly.vars[i]);
+			kept.push_back(i);
+		}
+	}
+	if (vars.empty()) {
+		T value = T(0);
+		for (const auto &[exponents, coefficient] : poly.terms)
+			value += coefficient;
+		return make_ref<Value<T>>(value);
+	}
+
+	typename Polynomial<T>::Terms terms;
+	for (const auto &[exponents, coefficient] : poly.terms) {
+		typename Polynomial<T>::Exponents reduced(kept.size());
+		for (std::size_t i = 0; i < kept.size(); ++i)
+			reduced[i] = exponents[kept[i]];
+		terms[reduced] += coefficient;
+	}
+	return make_ref<Polynomial<T>>(std::move(vars), std::move(terms));
+}
+
+// Both walks below are post-order with an explicit stack, so the depth of
+// the expression is bounded by memory only.
+template <typename T> class Detector {
+  public:
+	Ref<ExpressionImpl<T>> convert(const Ref<ExpressionImpl<T>> &root)
+	{
+		compute_all(root);
+
+		// Nodes above the maximal polynomial subtrees are rebuilt over the
+		// converted operands; the subtrees themselves are not entered.
+		std::vector<std::pair<const Ref<ExpressionImpl<T>> *, bool>> stack{{&root, false}};
+		while (!stack.empty()) {
+			auto [node, expanded] = stack.back();
+			stack.pop_back();
+			if (converted.contains(node->get()))
+				continue;
+
+			const NodeKind kind = (*node)->kind();
+			const bool leaf = kind == NodeKind::Value || kind == NodeKind::Variable || kind == NodeKind::Polynomial;
+			if (const auto &poly = as_poly(*node); poly && !leaf) {
+				converted.emplace(node->get(), make_polynomial(*poly));
+				continue;
+			}
+			if (!expanded) {
+				stack.emplace_back(node, true);
+				for (std::size_t i = (*node)->arity(); i-- > 0;) {
+					if (!converted.contains((*node)->operand(i).get()))
+						stack.emplace_back(&(*node)->operand(i), false);
+				}
+				continue;
+			}
+
+			Ref<ExpressionImpl<T>> result = *node;
+			std::vector<Ref<ExpressionImpl<T>>> operands;
+			bool changed = false;
+			for (std::size_t i = 0; i < (*node)->arity(); ++i) {
+				operands.push_back(converted.at((*node)->operand(i).get()));
+				changed |= operands.back() != (*node)->operand(i);
+			}
+			if (changed)
+				result = (*node)->with_operands(std::move(operands));
+			converted.emplace(node->get(), std::move(result));
+		}
+		return converted.at(root.get());
+	}
+
+  private:
+	const std::optional<PolyData<T>> &as_poly(const Ref<ExpressionImpl<T>> &node) const
+	{
+		return polys.at(node.get());
+	}
+
+	// The polynomial of every node below `root`, operands first.
+	void compute_all(const Ref<ExpressionImpl<T>> &root)
+	{
+		std::vector<std::pair<const ExpressionImpl<T> *, bool>> stack{{root.get(), false}};
+		while (!stack.empty()) {
+			auto [node, expanded] = stack.back();
+			stack.pop_back();
+			if (polys.contains(node))
+				continue;
+			if (!expanded) {
+				stack.emplace_back(node, true);
+				for (std::size_t i = node->arity(); i-- > 0;) {
+					if (!polys.contains(node->operand(i).get()))
+						stack.emplace_back(node->operand(i).get(), false);
+				}
+				continue;
+			}
+			auto poly = compute(*node);
+			if (poly && !within_limits(*poly))
+				poly.reset();
+			polys.emplace(node, std::move(poly));
+		}
+	}
+
+	std::optional<PolyData<T>> compute(const ExpressionImpl<T> &node) const
+	{
+		switch (node.kind()) {
+			case NodeKind::Value:
+				return constant(static_cast<const Value<T> &>(node).get_value());
+			case NodeKind::Variable:
+				return variable<T>(static_cast<const Variable<T> &>(node).get_symbol().id());
+			case NodeKind::Polynomial: {
+				const auto &polynomial = static_cast<const Polynomial<T> &>(node);
+				PolyData<T> poly;
+				for (Symbol symbol : polynomial.get_variables())
+					poly.vars.push_back(symbol.id());
+				poly.terms = polynomial.get_terms();
+				auto sorted = poly.vars;
+				std::sort(sorted.begin(), sorted.end());
+				return aligned(poly, sorted);
+			}
+			case NodeKind::Derivative:
+				return as_poly(node.operand(0));
+			case NodeKind::Add: case NodeKind::Sum: case NodeKind::Sub: {
+				std::optional<PolyData<T>> result = constant(T(0));
+				for (std::size_t i = 0; i < node.arity(); ++i) {
+					const auto &operand = as_poly(node.operand(i));
+					if (!operand)
+						return std::nullopt;
+					bool negate = node.kind() == NodeKind::Sub && i == 1;
+					result = add(*result, *operand, negate ? T(-1) : T(1));
+				}
+				return result;
+			}
+			case NodeKind::Mult: case NodeKind::Product: {
+				std::optional<PolyData<T>> result = constant(T(1));
+				for (std::size_t i = 0; i < node.arity() && result; ++i) {
+					const auto &operand = as_poly(node.operand(i));
+					if (!operand)
+						return std::nullopt;
+					result = mult(*result, *operand);
+				}
+				return result;
+			}
+			case NodeKind::Div: {
+				const auto &numerator = as_poly(node.operand(0));
+				const auto *denominator = dynamic_cast<const Value<T> *>(node.operand(1).get());
+				if (!numerator || denominator == nullptr || denominator->get_value() == T(0))
+					return std::nullopt;
+				return divide(*numerator, denominator->get_value());
+			}
+			case NodeKind::Pow: {
+				const auto &base = as_poly(node.operand(0));
+				const auto *exponent = dynamic_cast<const Value<T> *>(node.operand(1).get());
+				if (!base || exponent == nullptr)
+					return std::nullopt;
+				auto n = integer_exponent(exponent->get_value());
+				if (!n)
+					return std::nullopt;
+				return power(*base, *n);
+			}
+			default:
+				return std::nullopt;
+		}
+	}
+
+	std::unordered_map<const ExpressionImpl<T> *, std::optional<PolyData<T>>> polys;
+	std::unordered_map<const ExpressionImpl<T> *, Ref<ExpressionImpl<T>>> converted;
+};
+
+} // namespace
+
+// ==================
+// |class Polynomial|
+// ==================
+
+template <typename T>
+Polynomial<T>::Polynomial(std::vector<Symbol> variables_, Terms terms_) :
+    variables(std::move(variables_)),
+    terms(std::move(terms_))
+{
+	std::erase_if(terms, [](const auto &term) { return term.second == T(0); });
+	if (!terms.empty()) {
+		horner.push_back({0, 0, 0});
+		build_horner(0, terms.begin(), terms.end(), 0);
+	}
+}
+
+template <typename T>
+void Polynomial<T>::build_horner(
+	std::size_t node, typename Terms::const_iterator begin, typename Terms::const_iterator end, std::size_t level
+)
+{
+	if (level == variables.size()) {
+		horner[node].first = static_cast<std::uint32_t>(coefficients.size());
+		coefficients.push_back(begin->second);
+		return;
+	}
+	// Terms are ordered lexicographically by exponents, so for a fixed prefix
+	// the exponents of the next variable form ascending contiguous groups.
+	std::vector<typename Terms::const_iterator> groups;
+	for (auto it = begin; it != end; ++it) {
+		if (groups.empty() || it->first[level] != groups.back()->first[level])
+			groups.push_back(it);
+	}
+	// Children are laid out next to each other before any of them is
+	// expanded, so every node's children form one range.
+	const std::size_t first = horner.size();
+	for (std::size_t g = groups.size(); g-- > 0;)
+		horner.push_back({groups[g]->first[level], 0, 0});
+	horner[node].first = static_cast<std::uint32_t>(first);
+	horner[node].last = static_cast<std::uint32_t>(horner.size());
+	for (std::size_t g = groups.size(); g-- > 0;) {
+		const std::size_t child = first + (groups.size() - 1 - g);
+		build_horner(child, groups[g], g + 1 < groups.size() ? groups[g + 1] : end, level + 1);
+	}
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> Polynomial<T>::detect(const Ref<ExpressionImpl<T>> &node)
+{
+	return Detector<T>().convert(node);
+}
+
+template <typename T>
+const std::vector<Symbol> &Polynomial<T>::get_variables() const
+{
+	return variables;
+}
+
+template <typename T>
+const typename Polynomial<T>::Terms &Polynomial<T>::get_terms() const
+{
+	return terms;
+}
+
+template <typename T>
+std::uint32_t Polynomial<T>::degree() const
+{
+	std::uint32_t result = 0;
+	for (const auto &[exponents, coefficient] : terms) {
+		std::uint32_t total = 0;
+		for (std::uint32_t exponent : exponents)
+			total += exponent;
+		result = std::max(result, total);
+	}
+	return result;
+}
+
+template <typename T>
+T Polynomial<T>::eval_at(const std::vector<T> &values) const
+{
+	if (horner.empty())
+		return T(0);
+	auto eval = [&](auto &self, const HornerNode &node, std::size_t level) -> T {
+		if (level == variables.size())
+			return coefficients[node.first];
+
+		T result = T(0);
+		std::uint32_t previous = 0;
+		for (std::uint32_t i = node.first; i < node.last; ++i) {
+			const HornerNode &child = horner[i];
+			if (i != node.first)
+				result *= integer_power(values[level], previous - child.exponent);
+			result += self(self, child, level + 1);
+			previous = child.exponent;
+		}
+		return result * integer_power(values[level], previous);
+	};
+	return eval(eval, horner.front(), 0);
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> Polynomial<T>::diff_step(Symbol by, const Ref<ExpressionImpl<T>> *) const
+{
+	auto position = std::find(variables.begin(), variables.end(), by);
+	if (position == variables.end())
+		return make_ref<Value<T>>(T(0));
+	const std::size_t k = position - variables.begin();
+
+	PolyData<T> derivative;
+	for (Symbol symbol : variables)
+		derivative.vars.push_back(symbol.id());
+	for (const auto &[exponents, coefficient] : terms) {
+		if (exponents[k] == 0)
+			continue;
+		Exponents lowered = exponents;
+		--lowered[k];
+		derivative.terms[lowered] += coefficient * T(static_cast<long double>(exponents[k]));
+	}
+	drop_zeros(derivative);
+	return make_polynomial(derivative);
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> Polynomial<T>::with_context_step(const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands) const
+{
+	auto special = specialize_step(context, operands);
+	if (special.get() == this)
+		return make_ref<Polynomial<T>>(variables, terms);
+	return special;
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> Polynomial<T>::specialize_step(const Bindings<T> &context, const Ref<ExpressionImpl<T>> *) const
+{
+	std::vector<const T *> bound(variables.size());
+	std::size_t bound_count = 0;
+	for (std::size_t i = 0; i < variables.size(); ++i) {
+		bound[i] = context.find(variables[i]);
+		bound_count += bound[i] != nullptr;
+	}
+	if (bound_count == 0)
+		return share(this);
+	if (bound_count == variables.size()) {
+		std::vector<T> values;
+		for (const T *value : bound)
+			values.push_back(*value);
+		return make_ref<Value<T>>(eval_at(values));
+	}
+
+	PolyData<T> rest;
+	for (std::size_t i = 0; i < variables.size(); ++i) {
+		if (bound[i] == nullptr)
+			rest.vars.push_back(variables[i].id());
+	}
+	for (const auto &[exponents, coefficient] : terms) {
+		T scaled = coefficient;
+		Exponents reduced;
+		for (std::size_t i = 0; i < variables.size(); ++i) {
+			if (bound[i] != nullptr)
+				scaled *= integer_power(*bound[i], exponents[i]);
+			else
+				reduced.push_back(exponents[i]);
+		}
+		rest.terms[reduced] += scaled;
+	}
+	drop_zeros(rest);
+	return make_polynomial(rest);
+}
+
+template <typename T>
+T Polynomial<T>::eval_step(const T *) const
+{
+	if (!variables.empty())
+		throw std::runtime_error("Variable " + variables.front().name() + " cannot be resolved without context");
+	return eval_at({});
+}
+
+template <typename T>
+void Polynomial<T>::to_string_step(std::string &out, std::size_t) const
+{
+	if (terms.empty()) {
+		out += "0";
+		return;
+	}
+	std::string result = "(";
+	for (auto it = terms.rbegin(); it != terms.rend(); ++it) {
+		const auto &[exponents, coefficient] = *it;
+		std::string monomial;
+		bool has_variables = false;
+		for (std::size_t i = 0; i < variables.size(); ++i) {
+			if (exponents[i] == 0)
+				continue;
+			if (has_variables)
+				monomial += " * ";
+			monomial += variables[i].name();
+			if (exponents[i] > 1)
+				monomial += " ^ " + std::to_string(exponents[i]);
+			has_variables = true;
+		}
+		// After the first term a negative real coefficient becomes the sign.
+		T shown = coefficient;
+		if (it != terms.rbegin()) {
+			const bool negative = std::imag(coefficient) == 0 && std::real(coefficient) < 0;
+			result += negative ? " - " : " + ";
+			if (negative)
+				shown = -coefficient;
+		}
+		if (!has_variables)
+			result += Value<T>(shown).to_string();
+		else if (shown == T(1))
+			result += monomial;
+		else
+			result += Value<T>(shown).to_string() + " * " + monomial;
+	}
+	out += result + ")";
+}
+
+template <typename T>
+NodeKind Polynomial<T>::kind() const
+{
+	return NodeKind::Polynomial;
+}
+
+template <typename T>
+std::size_t Polynomial<T>::arity() const
+{
+	return 0;
+}
+
+template <typename T>
+const Ref<ExpressionImpl<T>> &Polynomial<T>::operand(std::size_t) const
+{
+	throw std::out_of_range("Polynomial has no operands -> Polynomial::operand");
+}
+
+template <typename T>
+Ref<ExpressionImpl<T>> Polynomial<T>::with_operands(std::vector<Ref<ExpressionImpl<T>>>) const
+{
+	return share(this);
+}
+
+template class Polynomial<long double>;
+template class Polynomial<std::complex<long double>>;
@@ -0,0 +1,79 @@
+#ifndef POLYNOMIAL_HPP
+#define POLYNOMIAL_HPP
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "expression.hpp"
+#include "symbol.hpp"
+
+// Sparse polynomial in a few variables. Each monomial is keyed by its
+// exponent vector aligned with `variables`; like terms are combined on
+// construction, so the coefficients are never re-associated through
+// std::pow calls. Evaluation is nested Horner in the variable order; the
+// grouping of the terms is worked out once, when the node is built.
+template <typename T> class Polynomial : public ExpressionImpl<T> {
+  public:
+	using Exponents = std::vector<std::uint32_t>;
+	using Terms = std::map<Exponents, T>;
+
+	// Limits that keep detection from expanding e.g. (a + b + c)^40.
+	static constexpr std::uint32_t max_degree = 64;
+	static constexpr std::size_t max_terms = 256;
+
+	Polynomial(std::vector<Symbol> variables_, Terms terms_);
+
+	// Replaces every maximal polynomial subtree of `node` (sums, products,
+	// constant scalings and non-negative integer powers of variables) by a
+	// single Polynomial node. Shared subtrees are converted once.
+	static Ref<ExpressionImpl<T>> detect(const Ref<ExpressionImpl<T>> &node);
+
+	const std::vector<Symbol> &get_variables(void) const;
+	const Terms &get_terms(void) const;
+	std::uint32_t degree(void) const;
+	// Nested Horner evaluation; `values` is aligned with `variables`.
+	T eval_at(const std::vector<T> &values) const;
+
+	virtual Ref<ExpressionImpl<T>> diff_step(
+		Symbol by, const Ref<ExpressionImpl<T>> *derivatives
+	) const override;
+	virtual Ref<ExpressionImpl<T>> with_context_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual Ref<ExpressionImpl<T>> specialize_step(
+		const Bindings<T> &context, const Ref<ExpressionImpl<T>> *operands
+	) const override;
+	virtual T eval_step(const T *operands) const override;
+	virtual void to_string_step(std::string &out, std::size_t position) const override;
+
+	virtual NodeKind kind(void) const override;
+	virtual std::size_t arity(void) const override;
+	virtual const Ref<ExpressionImpl<T>> &operand(std::size_t index) const override;
+	virtual Ref<ExpressionImpl<T>> with_operands(
+		std::vector<Ref<ExpressionImpl<T>>> operands
+	) const override;
+
+  private:
+	// Terms sharing the exponents of the first `level` variables. Below the
+	// last level its children, [first, last) in `horner`, are the groups
+	// with equal exponents of variable `level`, highest first; at the last
+	// level `first` indexes `coefficients`.
+	struct HornerNode {
+		std::uint32_t exponent;
+		std::uint32_t first;
+		std::uint32_t last;
+	};
+
+	void build_horner(std::size_t node, typename Terms::const_iterator begin, typename Terms::const_iterator end, std::size_t level);
+
+	std::vector<Symbol> variables;
+	Terms terms;
+	// Root first; empty when there are no terms.
+	std::vector<HornerNode> horner;
+	std::vector<T> coefficients;
+};
+
+#endif
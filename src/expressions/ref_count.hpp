@@ -0,0 +1,188 @@
+#ifndef REF_COUNT_HPP
+#define REF_COUNT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+// Expression nodes carry their reference count themselves. With
+// EXPRESSION_ATOMIC_REFCOUNT=0 the count is a plain integer: copying a
+// handle costs an ordinary increment, but expressions must then not be
+// shared between threads.
+#ifndef EXPRESSION_ATOMIC_REFCOUNT
+#define EXPRESSION_ATOMIC_REFCOUNT 1
+#endif
+
+template <typename U> class Ref;
+
+class RefCounted {
+  public:
+	std::size_t use_count(void) const noexcept
+	{
+#if EXPRESSION_ATOMIC_REFCOUNT
+		return refs.load(std::memory_order_relaxed);
+#else
+		return refs;
+#endif
+	}
+
+  protected:
+	RefCounted() noexcept = default;
+	// A copy is a new object with no owners yet.
+	RefCounted(const RefCounted &) noexcept {}
+	RefCounted &operator=(const RefCounted &) noexcept { return *this; }
+	~RefCounted() = default;
+
+  private:
+	template <typename U> friend class Ref;
+
+	void acquire(void) const noexcept
+	{
+#if EXPRESSION_ATOMIC_REFCOUNT
+		refs.fetch_add(1, std::memory_order_relaxed);
+#else
+		++refs;
+#endif
+	}
+
+	// True when the last owner is gone.
+	bool drop(void) const noexcept
+	{
+#if EXPRESSION_ATOMIC_REFCOUNT
+		return refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+#else
+		return --refs == 0;
+#endif
+	}
+
+	// Takes a reference unless the count has already dropped to zero, for
+	// caches that must not resurrect an object under destruction.
+	bool try_acquire(void) const noexcept
+	{
+#if EXPRESSION_ATOMIC_REFCOUNT
+		std::size_t current = refs.load(std::memory_order_relaxed);
+		while (current != 0) {
+			if (refs.compare_exchange_weak(current, current + 1, std::memory_order_acquire, std::memory_order_relaxed))
+				return true;
+		}
+		return false;
+#else
+		if (refs == 0)
+			return false;
+		++refs;
+		return true;
+#endif
+	}
+
+#if EXPRESSION_ATOMIC_REFCOUNT
+	mutable std::atomic<std::size_t> refs{0};
+#else
+	mutable std::size_t refs = 0;
+#endif
+};
+
+// Owning handle to a RefCounted object allocated with new (or make_ref).
+// U needs a virtual destructor when handles to a base class may hold the
+// last reference to a derived object.
+template <typename U> class Ref {
+  public:
+	using element_type = U;
+
+	constexpr Ref() noexcept = default;
+	constexpr Ref(std::nullptr_t) noexcept {}
+	// Shares ownership with every other handle to `object`.
+	explicit Ref(U *object) noexcept : pointer(object)
+	{
+		if (pointer)
+			pointer->acquire();
+	}
+
+	Ref(const Ref &other) noexcept : Ref(other.pointer) {}
+	Ref(Ref &&other) noexcept : pointer(std::exchange(other.pointer, nullptr)) {}
+	template <typename V, typename = std::enable_if_t<std::is_convertible_v<V *, U *>>>
+	Ref(const Ref<V> &other) noexcept : Ref(other.get()) {}
+	template <typename V, typename = std::enable_if_t<std::is_convertible_v<V *, U *>>>
+	Ref(Ref<V> &&other) noexcept : pointer(other.detach()) {}
+
+	~Ref() { reset(); }
+
+	Ref &operator=(const Ref &other) noexcept
+	{
+		Ref(other).swap(*this);
+		return *this;
+	}
+	Ref &operator=(Ref &&other) noexcept
+	{
+		Ref(std::move(other)).swap(*this);
+		return *this;
+	}
+	template <typename V, typename = std::enable_if_t<std::is_convertible_v<V *, U *>>>
+	Ref &operator=(Ref<V> &&other) noexcept
+	{
+		Ref(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	void reset(void) noexcept
+	{
+		if (U *object = std::exchange(pointer, nullptr); object && object->drop())
+			delete object;
+	}
+
+	void swap(Ref &other) noexcept { std::swap(pointer, other.pointer); }
+
+	// Gives up ownership without touching the count.
+	U *detach(void) noexcept { return std::exchange(pointer, nullptr); }
+	// Takes over a reference given up by detach().
+	static Ref adopt(U *object) noexcept
+	{
+		Ref result;
+		result.pointer = object;
+		return result;
+	}
+
+	// Handle to an object found through a non-owning pointer, empty if its
+	// last owner is already releasing it.
+	static Ref try_share(U *object) noexcept
+	{
+		Ref result;
+		if (object && object->try_acquire())
+			result.pointer = object;
+		return result;
+	}
+
+	U *get(void) const noexcept { return pointer; }
+	U &operator*(void) const noexcept { return *pointer; }
+	U *operator->(void) const noexcept { return pointer; }
+	explicit operator bool(void) const noexcept { return pointer != nullptr; }
+	std::size_t use_count(void) const noexcept { return pointer ? pointer->use_count() : 0; }
+
+	template <typename V> bool operator==(const Ref<V> &other) const noexcept { return pointer == other.get(); }
+	bool operator==(std::nullptr_t) const noexcept { return pointer == nullptr; }
+
+  private:
+	U *pointer = nullptr;
+};
+
+template <typename U, typename... Args> Ref<U> make_ref(Args &&...args)
+{
+	return Ref<U>(new U(std::forward<Args>(args)...));
+}
+
+template <typename U, typename V> Ref<U> static_ref_cast(Ref<V> &&from) noexcept
+{
+	return Ref<U>::adopt(static_cast<U *>(from.detach()));
+}
+
+template <typename U, typename V> Ref<U> static_ref_cast(const Ref<V> &from) noexcept
+{
+	return Ref<U>(static_cast<U *>(from.get()));
+}
+
+template <typename U, typename V> Ref<U> const_ref_cast(const Ref<V> &from) noexcept
+{
+	return Ref<U>(const_cast<U *>(from.get()));
+}
+
+#endif
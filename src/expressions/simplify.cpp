@@ -0,0 +1,130 @@
+#include "simplify.hpp"
+
+#include <complex>
+#include <stdexcept>
+
+namespace {
+
+template <typename T>
+const Value<T> *as_value(const Ref<ExpressionImpl<T>> &node)
+{
+	return node->kind() == NodeKind::Value ? static_cast<const Value<T> *>(node.get()) : nullptr;
+}
+
+template <typename T>
+bool is_value(const Ref<ExpressionImpl<T>> &node, T number)
+{
+	const Value<T> *value = as_value(node);
+	return value != nullptr && value->get_value() == number;
+}
+
+} // namespace
+
+template <typename T>
+typename Simplifier<T>::Node Simplifier<T>::operator()(const Node &root)
+{
+	std::vector<std::pair<Node, bool>> stack{{root, false}};
+	while (!stack.empty()) {
+		auto [node, expanded] = std::move(stack.back());
+		stack.pop_back();
+		if (memo.contains(node.get()))
+			continue;
+		if (!expanded) {
+			stack.emplace_back(node, true);
+			for (std::size_t i = node->arity(); i-- > 0;) {
+				if (!memo.contains(node->operand(i).get()))
+					stack.emplace_back(node->operand(i), false);
+			}
+			continue;
+		}
+
+		std::vector<Node> operands;
+		operands.reserve(node->arity());
+		for (std::size_t i = 0; i < node->arity(); ++i)
+			operands.push_back(memo.at(node->operand(i).get()).second);
+		Node result = rewrite(node, std::move(operands));
+		memo.emplace(node.get(), std::make_pair(node, std::move(result)));
+	}
+	return memo.at(root.get()).second;
+}
+
+template <typename T>
+typename Simplifier<T>::Node Simplifier<T>::rewrite(const Node &node, std::vector<Node> operands) const
+{
+	const std::size_t n = operands.size();
+	if (n == 0)
+		return node;
+
+	bool changed = false, constant = true;
+	for (std::size_t i = 0; i < n; ++i) {
+		changed = changed || operands[i] != node->operand(i);
+		constant = constant && as_value(operands[i]);
+	}
+	Node rebuilt = changed ? node->with_operands(operands) : node;
+	if (constant) {
+		try {
+			return make_ref<Value<T>>(rebuilt->eval());
+		} catch (const std::runtime_error &) {
+			// e.g. 1 / 0 stays symbolic and fails at evaluation as before
+			return rebuilt;
+		}
+	}
+
+	switch (node->kind()) {
+		case NodeKind::Derivative:
+			return operands[0];
+		case NodeKind::Add:
+			if (is_value(operands[0], T(0))) return operands[1];
+			if (is_value(operands[1], T(0))) return operands[0];
+			break;
+		case NodeKind::Sub:
+			if (is_value(operands[1], T(0))) return operands[0];
+			if (operands[0] == operands[1]) return make_ref<Value<T>>(T(0));
+			break;
+		case NodeKind::Mult:
+			if (is_value(operands[0], T(0)) || is_value(operands[1], T(0)))
+				return make_ref<Value<T>>(T(0));
+			if (is_value(operands[0], T(1))) return operands[1];
+			if (is_value(operands[1], T(1))) return operands[0];
+			break;
+		case NodeKind::Div:
+			if (is_value(operands[1], T(1))) return operands[0];
+			if (is_value(operands[0], T(0))) return operands[0];
+			break;
+		case NodeKind::Pow:
+			if (is_value(operands[1], T(1))) return operands[0];
+			if (is_value(operands[1], T(0))) return make_ref<Value<T>>(T(1));
+			break;
+		case NodeKind::Sum:
+		case NodeKind::Product: {
+			// Fold all constants into one, drop it when neutral.
+			const bool sum = node->kind() == NodeKind::Sum;
+			const T neutral = sum ? T(0) : T(1);
+			T folded = neutral;
+			std::vector<Node> kept;
+			for (auto &operand : operands) {
+				if (const Value<T> *value = as_value(operand))
+					folded = sum ? folded + value->get_value() : folded * value->get_value();
+				else
+					kept.push_back(std::move(operand));
+			}
+			if (!sum && folded == T(0))
+				return make_ref<Value<T>>(T(0));
+			if (folded != neutral)
+				kept.insert(kept.begin(), make_ref<Value<T>>(folded));
+			if (kept.empty())
+				return make_ref<Value<T>>(neutral);
+			if (kept.size() == 1)
+				return kept.front();
+			if (kept.size() != n)
+				return node->with_operands(std::move(kept));
+			break;
+		}
+		default:
+			break;
+	}
+	return rebuilt;
+}
+
+template class Simplifier<long double>;
+template class Simplifier<std::complex<long double>>;
@@ -0,0 +1,28 @@
+#ifndef SIMPLIFY_HPP
+#define SIMPLIFY_HPP
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "expression.hpp"
+
+// Memoized bottom-up cleanup: folds constant subtrees and drops neutral
+// elements (x + 0, x * 1, x ^ 1, ...). Every node is visited once, so the
+// pass is linear in the DAG size, and results are shared between all
+// calls made through the same instance.
+template <typename T> class Simplifier {
+  public:
+	using Node = Ref<ExpressionImpl<T>>;
+
+	Node operator()(const Node &root);
+
+  private:
+	Node rewrite(const Node &node, std::vector<Node> operands) const;
+
+	// The original node is kept alive so its address cannot be reused.
+	std::unordered_map<const ExpressionImpl<T> *, std::pair<Node, Node>> memo;
+};
+
+#endif
@@ -0,0 +1,482 @@
+#include "solver.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// Line searches give up below this step length.
+constexpr long double min_step = 1e-12L;
+// Sufficient decrease for Armijo backtracking.
+constexpr long double armijo = 1e-4L;
+
+long double norm(const std::vector<long double> &v)
+{
+	long double sum = 0.0L;
+	for (long double x : v)
+		sum += x * x;
+	return std::sqrt(sum);
+}
+
+long double dot(const std::vector<long double> &a, const std::vector<long double> &b)
+{
+	long double sum = 0.0L;
+	for (std::size_t i = 0; i < a.size(); ++i)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+// Solves A x = b for row-major n x n A by Gaussian elimination with partial
+// pivoting. A and b are overwritten, the solution is left in b. Returns
+// false for a (numerically) singular matrix.
+bool solve_in_place(std::vector<long double> &a, std::vector<long double> &b, std::size_t n)
+{
+	long double scale = 0.0L;
+	for (std::size_t i = 0; i < n * n; ++i)
+		scale = std::max(scale, std::fabs(a[i]));
+	const long double singular = scale * n * 1e-18L;
+
+	for (std::size_t k = 0; k < n; ++k) {
+		std::size_t pivot = k;
+		for (std::size_t i = k + 1; i < n; ++i)
+			if (std::fabs(a[i * n + k]) > std::fabs(a[pivot * n + k]))
+				pivot = i;
+		if (!(std::fabs(a[pivot * n + k]) > singular))
+			return false;
+		if (pivot != k) {
+			std::swap_ranges(a.begin() + k * n, a.begin() + (k + 1) * n, a.begin() + pivot * n);
+			std::swap(b[k], b[pivot]);
+		}
+		for (std::size_t i = k + 1; i < n; ++i) {
+			const long double factor = a[i * n + k] / a[k * n + k];
+			for (std::size_t j = k; j < n; ++j)
+				a[i * n + j] -= factor * a[k * n + j];
+			b[i] -= factor * b[k];
+		}
+	}
+	for (std::size_t k = n; k-- > 0;) {
+		long double sum = b[k];
+		for (std::size_t j = k + 1; j < n; ++j)
+			sum -= a[k * n + j] * b[j];
+		b[k] = sum / a[k * n + k];
+	}
+	return true;
+}
+
+// Cholesky solve of A x = b for symmetric A, of which only the upper
+// triangle is read. A is overwritten by the factor, the solution is left in
+// b. Returns false when A is not positive definite.
+bool cholesky_in_place(std::vector<long double> &a, std::vector<long double> &b, std::size_t n)
+{
+	for (std::size_t k = 0; k < n; ++k) {
+		long double diagonal = a[k * n + k];
+		for (std::size_t i = 0; i < k; ++i)
+			diagonal -= a[i * n + k] * a[i * n + k];
+		if (!(diagonal > 0.0L))
+			return false;
+		a[k * n + k] = std::sqrt(diagonal);
+		for (std::size_t j = k + 1; j < n; ++j) {
+			long double sum = a[k * n + j];
+			for (std::size_t i = 0; i < k; ++i)
+				sum -= a[i * n + k] * a[i * n + j];
+			a[k * n + j] = sum / a[k * n + k];
+		}
+	}
+	// U^T y = b, then U x = y.
+	for (std::size_t k = 0; k < n; ++k) {
+		long double sum = b[k];
+		for (std::size_t i = 0; i < k; ++i)
+			sum -= a[i * n + k] * b[i];
+		b[k] = sum / a[k * n + k];
+	}
+	for (std::size_t k = n; k-- > 0;) {
+		long double sum = b[k];
+		for (std::size_t j = k + 1; j < n; ++j)
+			sum -= a[k * n + j] * b[j];
+		b[k] = sum / a[k * n + k];
+	}
+	return true;
+}
+
+void bind_all(Bindings<long double> &context, const std::vector<Symbol> &vars, const std::vector<long double> &x)
+{
+	for (std::size_t j = 0; j < vars.size(); ++j)
+		context.bind(vars[j], x[j]);
+}
+
+// F followed by its Jacobian, row by row.
+std::vector<Expression<long double>> with_jacobian(
+	const std::vector<Expression<long double>> &equations, const std::vector<Symbol> &vars
+)
+{
+	std::vector<Expression<long double>> outputs = equations;
+	for (const auto &row : Expression<long double>::jacobian(equations, vars))
+		outputs.insert(outputs.end(), row.begin(), row.end());
+	return outputs;
+}
+
+// f followed by its gradient.
+std::vector<Expression<long double>> with_gradient(const Expression<long double> &f, const std::vector<Symbol> &vars)
+{
+	std::vector<Expression<long double>> outputs{f};
+	for (const auto &partial : f.gradient(vars))
+		outputs.push_back(partial);
+	return outputs;
+}
+
+void check_start(const std::vector<Symbol> &vars, const std::vector<long double> &x)
+{
+	if (x.size() != vars.size())
+		throw std::invalid_argument("Initial guess does not match the number of variables");
+}
+
+} // namespace
+
+SystemSolver::SystemSolver(const std::vector<Expression<long double>> &equations_, std::vector<Symbol> vars_)
+	: vars(std::move(vars_)), equations(equations_), system(with_jacobian(equations_, vars))
+{
+	if (equations_.empty() || vars.empty())
+		throw std::invalid_argument("System needs at least one equation and one variable");
+
+	const std::size_t m = equations.outputs(), n = vars.size();
+	residual.resize(m);
+	jacobian_values.resize(m * n);
+	combined.resize(m + m * n);
+	matrix.resize(n * n);
+	step.resize(std::max(m, n));
+	trial.resize(n);
+	bind_all(context, vars, trial);
+}
+
+long double SystemSolver::evaluate(const std::vector<long double> &x, bool with_jacobian)
+{
+	bind_all(context, vars, x);
+	if (with_jacobian) {
+		system.eval(context, combined.data(), workspace);
+		std::copy(combined.begin(), combined.begin() + residual.size(), residual.begin());
+		std::copy(combined.begin() + residual.size(), combined.end(), jacobian_values.begin());
+	} else {
+		equations.eval(context, residual.data(), workspace);
+	}
+	return norm(residual);
+}
+
+SolverResult SystemSolver::newton(std::vector<long double> x, const SolverOptions &options)
+{
+	check_start(vars, x);
+	const std::size_t n = vars.size();
+	if (equations.outputs() != n)
+		throw std::invalid_argument("Newton's method needs as many equations as variables");
+
+	SolverResult result{std::move(x), 0.0L, 0, false};
+	while (true) {
+		result.residual = evaluate(result.x, true);
+		if (result.residual <= options.tolerance) {
+			result.converged = true;
+			break;
+		}
+		if (result.iterations == options.max_iterations || !std::isfinite(result.residual))
+			break;
+
+		std::copy(jacobian_values.begin(), jacobian_values.end(), matrix.begin());
+		for (std::size_t i = 0; i < n; ++i)
+			step[i] = -residual[i];
+		if (!solve_in_place(matrix, step, n))
+			break;
+		for (std::size_t j = 0; j < n; ++j)
+			result.x[j] += step[j];
+		++result.iterations;
+	}
+	return result;
+}
+
+SolverResult SystemSolver::damped_newton(std::vector<long double> x, const SolverOptions &options)
+{
+	check_start(vars, x);
+	const std::size_t n = vars.size();
+	if (equations.outputs() != n)
+		throw std::invalid_argument("Newton's method needs as many equations as variables");
+
+	SolverResult result{std::move(x), 0.0L, 0, false};
+	result.residual = evaluate(result.x, true);
+	while (true) {
+		if (result.residual <= options.tolerance) {
+			result.converged = true;
+			break;
+		}
+		if (result.iterations == options.max_iterations || !std::isfinite(result.residual))
+			break;
+
+		std::copy(jacobian_values.begin(), jacobian_values.end(), matrix.begin());
+		for (std::size_t i = 0; i < n; ++i)
+			step[i] = -residual[i];
+		if (!solve_in_place(matrix, step, n))
+			break;
+
+		// Along the Newton direction |F|^2 decreases at rate 2|F|^2, so
+		// |F(x + t step)| <= (1 - armijo t) |F(x)| is reachable for small t.
+		long double t = 1.0L, trial_residual = 0.0L;
+		for (; t >= min_step; t /= 2) {
+			for (std::size_t j = 0; j < n; ++j)
+				trial[j] = result.x[j] + t * step[j];
+			trial_residual = evaluate(trial, false);
+			if (trial_residual <= (1.0L - armijo * t) * result.residual)
+				break;
+		}
+		if (t < min_step)
+			break;
+		std::swap(result.x, trial);
+		result.residual = evaluate(result.x, true);
+		++result.iterations;
+	}
+	return result;
+}
+
+SolverResult SystemSolver::levenberg_marquardt(std::vector<long double> x, const SolverOptions &options)
+{
+	check_start(vars, x);
+	const std::size_t m = equations.outputs(), n = vars.size();
+	if (m < n)
+		throw std::invalid_argument("Levenberg-Marquardt needs at least as many equations as variables");
+
+	SolverResult result{std::move(x), 0.0L, 0, false};
+	long double lambda = 1e-3L;
+	result.residual = evaluate(result.x, true);
+	while (true) {
+		// J^T F; zero at a least-squares stationary point.
+		long double gradient = 0.0L;
+		for (std::size_t j = 0; j < n; ++j) {
+			long double sum = 0.0L;
+			for (std::size_t i = 0; i < m; ++i)
+				sum += jacobian_values[i * n + j] * residual[i];
+			step[j] = -sum;
+			gradient = std::max(gradient, std::fabs(sum));
+		}
+		if (result.residual <= options.tolerance || gradient <= options.tolerance) {
+			result.converged = true;
+			break;
+		}
+		if (result.iterations == options.max_iterations || !std::isfinite(result.residual) || lambda > 1e16L)
+			break;
+
+		// (J^T J + lambda diag(J^T J)) step = -J^T F
+		for (std::size_t j = 0; j < n; ++j)
+			for (std::size_t k = j; k < n; ++k) {
+				long double sum = 0.0L;
+				for (std::size_t i = 0; i < m; ++i)
+					sum += jacobian_values[i * n + j] * jacobian_values[i * n + k];
+				matrix[j * n + k] = matrix[k * n + j] = sum;
+			}
+		for (std::size_t j = 0; j < n; ++j)
+			matrix[j * n + j] += lambda * std::max(matrix[j * n + j], 1e-12L);
+		++result.iterations;
+		if (!cholesky_in_place(matrix, step, n)) {
+			lambda *= 10;
+			continue;
+		}
+
+		// Relative decrease of |F|^2 predicted by the linear model F + J step.
+		long double linear = 0.0L;
+		for (std::size_t i = 0; i < m; ++i) {
+			long double sum = residual[i];
+			for (std::size_t j = 0; j < n; ++j)
+				sum += jacobian_values[i * n + j] * step[j];
+			linear += sum * sum;
+		}
+		const long double predicted = 1.0L - linear / (result.residual * result.residual);
+
+		for (std::size_t j = 0; j < n; ++j)
+			trial[j] = result.x[j] + step[j];
+		const long double trial_residual = evaluate(trial, false);
+		const long double actual = 1.0L - (trial_residual * trial_residual) / (result.residual * result.residual);
+		// Nonzero minimum: the remaining decrease is below what |F| resolves,
+		// the test MINPACK calls ftol.
+		if (predicted <= options.tolerance && actual <= options.tolerance) {
+			if (actual > 0.0L)
+				std::swap(result.x, trial);
+			result.residual = evaluate(result.x, false);
+			result.converged = true;
+			break;
+		}
+		if (trial_residual < result.residual) {
+			std::swap(result.x, trial);
+			result.residual = evaluate(result.x, true);
+			lambda = std::max(lambda / 10, 1e-12L);
+		} else {
+			// Restore F at x for the gradient test of the next round.
+			evaluate(result.x, false);
+			lambda *= 10;
+		}
+	}
+	return result;
+}
+
+Minimizer::Minimizer(const Expression<long double> &objective_, std::vector<Symbol> vars_)
+	: vars(std::move(vars_)), objective(objective_), first_order(with_gradient(objective_, vars)), source(objective_)
+{
+	if (vars.empty())
+		throw std::invalid_argument("Objective needs at least one variable");
+
+	const std::size_t n = vars.size();
+	gradient_values.resize(n);
+	combined.resize(n + 1);
+	matrix.resize(n * n);
+	step.resize(n);
+	trial.resize(n);
+	previous_gradient.resize(n);
+	inverse.resize(n * n);
+	scratch.resize(n);
+	bind_all(context, vars, trial);
+}
+
+long double Minimizer::value(const std::vector<long double> &x)
+{
+	bind_all(context, vars, x);
+	return objective.eval(context, workspace);
+}
+
+long double Minimizer::value_and_gradient(const std::vector<long double> &x)
+{
+	bind_all(context, vars, x);
+	first_order.eval(context, combined.data(), workspace);
+	std::copy(combined.begin() + 1, combined.end(), gradient_values.begin());
+	return combined[0];
+}
+
+bool Minimizer::line_search(std::vector<long double> &x, long double &fx)
+{
+	const std::size_t n = vars.size();
+	const long double slope = dot(gradient_values, step);
+	for (long double t = 1.0L; t >= min_step; t /= 2) {
+		for (std::size_t j = 0; j < n; ++j)
+			trial[j] = x[j] + t * step[j];
+		const long double ft = value(trial);
+		if (ft <= fx + armijo * t * slope) {
+			for (std::size_t j = 0; j < n; ++j)
+				step[j] *= t;
+			std::swap(x, trial);
+			fx = ft;
+			return true;
+		}
+	}
+	return false;
+}
+
+SolverResult Minimizer::newton(std::vector<long double> x, const SolverOptions &options)
+{
+	check_start(vars, x);
+	const std::size_t n = vars.size();
+	if (!hessian) {
+		const auto second = source.hessian(vars);
+		std::vector<Expression<long double>> upper;
+		for (std::size_t j = 0; j < n; ++j)
+			upper.insert(upper.end(), second[j].begin() + j, second[j].end());
+		hessian.emplace(upper);
+		hessian_values.resize(upper.size());
+	}
+
+	SolverResult result{std::move(x), 0.0L, 0, false};
+	long double fx = value_and_gradient(result.x);
+	while (true) {
+		result.residual = norm(gradient_values);
+		if (result.residual <= options.tolerance) {
+			result.converged = true;
+			break;
+		}
+		if (result.iterations == options.max_iterations || !std::isfinite(result.residual))
+			break;
+
+		// H + shift I, with the shift raised until the Cholesky factor
+		// exists, so that the step is always a descent direction. A Hessian
+		// that is not finite, or one no shift up to 1e16 makes positive
+		// definite, is replaced by the identity: a steepest descent step.
+		hessian->eval(context, hessian_values.data(), workspace);
+		bool factored = false;
+		if (std::all_of(hessian_values.begin(), hessian_values.end(), [](long double h) { return std::isfinite(h); })) {
+			for (long double shift = 0.0L; !factored && shift <= 1e16L;
+			     shift = shift == 0.0L ? std::max(1e-8L, 1e-3L * result.residual) : shift * 10) {
+				for (std::size_t j = 0, h = 0; j < n; ++j)
+					for (std::size_t k = j; k < n; ++k, ++h)
+						matrix[j * n + k] = hessian_values[h] + (j == k ? shift : 0.0L);
+				for (std::size_t j = 0; j < n; ++j)
+					step[j] = -gradient_values[j];
+				factored = cholesky_in_place(matrix, step, n);
+			}
+		}
+		if (!factored)
+			for (std::size_t j = 0; j < n; ++j)
+				step[j] = -gradient_values[j];
+
+		if (!line_search(result.x, fx))
+			break;
+		fx = value_and_gradient(result.x);
+		++result.iterations;
+	}
+	return result;
+}
+
+SolverResult Minimizer::bfgs(std::vector<long double> x, const SolverOptions &options)
+{
+	check_start(vars, x);
+	const std::size_t n = vars.size();
+	std::fill(inverse.begin(), inverse.end(), 0.0L);
+	for (std::size_t j = 0; j < n; ++j)
+		inverse[j * n + j] = 1.0L;
+
+	SolverResult result{std::move(x), 0.0L, 0, false};
+	long double fx = value_and_gradient(result.x);
+	while (true) {
+		result.residual = norm(gradient_values);
+		if (result.residual <= options.tolerance) {
+			result.converged = true;
+			break;
+		}
+		if (result.iterations == options.max_iterations || !std::isfinite(result.residual))
+			break;
+
+		for (std::size_t j = 0; j < n; ++j) {
+			long double sum = 0.0L;
+			for (std::size_t k = 0; k < n; ++k)
+				sum -= inverse[j * n + k] * gradient_values[k];
+			step[j] = sum;
+		}
+		if (dot(step, gradient_values) >= 0.0L) {
+			// Lost positive definiteness to rounding: restart from -grad f.
+			std::fill(inverse.begin(), inverse.end(), 0.0L);
+			for (std::size_t j = 0; j < n; ++j) {
+				inverse[j * n + j] = 1.0L;
+				step[j] = -gradient_values[j];
+			}
+		}
+
+		if (!line_search(result.x, fx))
+			break;
+		std::copy(gradient_values.begin(), gradient_values.end(), previous_gradient.begin());
+		fx = value_and_gradient(result.x);
+		++result.iterations;
+
+		// s = step (already scaled by the line search), y = change of grad f.
+		for (std::size_t j = 0; j < n; ++j)
+			previous_gradient[j] = gradient_values[j] - previous_gradient[j];
+		const long double sy = dot(step, previous_gradient);
+		if (!(sy > 0.0L))
+			continue;
+		// H += ((s.y + y.H.y) / (s.y)^2) s s^T - (H y s^T + s y^T H) / s.y
+		for (std::size_t j = 0; j < n; ++j) {
+			long double sum = 0.0L;
+			for (std::size_t k = 0; k < n; ++k)
+				sum += inverse[j * n + k] * previous_gradient[k];
+			scratch[j] = sum;
+		}
+		const long double yhy = dot(previous_gradient, scratch);
+		const long double outer = (sy + yhy) / (sy * sy);
+		for (std::size_t j = 0; j < n; ++j)
+			for (std::size_t k = 0; k < n; ++k)
+				inverse[j * n + k] +=
+					outer * step[j] * step[k] - (scratch[j] * step[k] + step[j] * scratch[k]) / sy;
+	}
+	return result;
+}
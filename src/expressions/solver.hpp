@@ -0,0 +1,89 @@
+#ifndef SOLVER_HPP
+#define SOLVER_HPP
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include "expression.hpp"
+#include "flat_expression.hpp"
+#include "symbol.hpp"
+
+struct SolverOptions {
+	std::size_t max_iterations = 100;
+	// On |F| for systems and on |grad f| for minimization.
+	long double tolerance = 1e-12L;
+};
+
+struct SolverResult {
+	std::vector<long double> x;
+	// |F(x)| for systems, |grad f(x)| for minimization.
+	long double residual;
+	std::size_t iterations;
+	bool converged;
+};
+
+// F(x) = 0 for m equations in n unknowns. F and its Jacobian are derived
+// and compiled to one shared tape once; the iterations reuse storage
+// allocated by the constructor.
+class SystemSolver {
+  public:
+	SystemSolver(const std::vector<Expression<long double>> &equations, std::vector<Symbol> vars_);
+
+	// Square systems.
+	SolverResult newton(std::vector<long double> x, const SolverOptions &options = {});
+	// Newton steps shortened until |F| decreases.
+	SolverResult damped_newton(std::vector<long double> x, const SolverOptions &options = {});
+	// Least squares for m >= n: stops at a zero, or at a minimum of |F| once
+	// the relative decrease of |F|^2 left is below the tolerance.
+	SolverResult levenberg_marquardt(std::vector<long double> x, const SolverOptions &options = {});
+
+  private:
+	// F into `residual` and, when asked, the Jacobian into `jacobian_values`.
+	// Returns |F|.
+	long double evaluate(const std::vector<long double> &x, bool with_jacobian);
+
+	std::vector<Symbol> vars;
+	CompiledBundle<long double> equations;
+	// F and then the row-major m x n Jacobian, sharing subexpressions.
+	CompiledBundle<long double> system;
+
+	Bindings<long double> context;
+	std::vector<long double> workspace, combined, residual, jacobian_values, matrix, step, trial;
+};
+
+// Unconstrained minimization of f. The gradient (and for Newton the
+// Hessian) are compiled once, as in SystemSolver.
+class Minimizer {
+  public:
+	Minimizer(const Expression<long double> &objective_, std::vector<Symbol> vars_);
+
+	// Newton steps with the Hessian shifted towards the identity until it is
+	// positive definite, and a backtracking line search. Where the Hessian
+	// is not finite the step is a gradient step instead.
+	SolverResult newton(std::vector<long double> x, const SolverOptions &options = {});
+	// Inverse Hessian built from gradient differences only.
+	SolverResult bfgs(std::vector<long double> x, const SolverOptions &options = {});
+
+  private:
+	long double value(const std::vector<long double> &x);
+	// f and grad f into `gradient_values`; returns f.
+	long double value_and_gradient(const std::vector<long double> &x);
+	// Armijo backtracking along `step` from x. On success moves x and fx and
+	// scales `step` to the step taken; false when no step decreases f.
+	bool line_search(std::vector<long double> &x, long double &fx);
+
+	std::vector<Symbol> vars;
+	FlatExpression<long double> objective;
+	// f and then grad f.
+	CompiledBundle<long double> first_order;
+	// Upper triangle, row by row; built on first use by newton.
+	std::optional<CompiledBundle<long double>> hessian;
+	Expression<long double> source;
+
+	Bindings<long double> context;
+	std::vector<long double> workspace, combined, gradient_values, hessian_values, matrix, step, trial,
+		previous_gradient, inverse, scratch;
+};
+
+#endif
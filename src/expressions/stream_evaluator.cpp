@@ -0,0 +1,203 @@
+#include "stream_evaluator.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+
+#include "mapped_file.hpp"
+
+namespace {
+
+constexpr std::size_t skip = std::numeric_limits<std::size_t>::max();
+
+std::string_view trim(std::string_view field)
+{
+	const std::size_t first = field.find_first_not_of(" \t");
+	if (first == std::string_view::npos)
+		return {};
+	return field.substr(first, field.find_last_not_of(" \t") - first + 1);
+}
+
+// Line starting at `position` without its line break; `position` moves past it.
+std::string_view next_line(std::string_view text, std::size_t &position)
+{
+	const std::size_t end = std::min(text.find('\n', position), text.size());
+	std::string_view line = text.substr(position, end - position);
+	position = std::min(end + 1, text.size());
+	if (!line.empty() && line.back() == '\r')
+		line.remove_suffix(1);
+	return line;
+}
+
+double parse_number(std::string_view field, std::size_t line, const std::string &path)
+{
+	std::string_view digits = trim(field);
+	// from_chars does not take an explicit plus sign.
+	if (digits.size() > 1 && digits.front() == '+')
+		digits.remove_prefix(1);
+	double value = 0.0;
+	const auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+	if (error != std::errc() || end != digits.data() + digits.size())
+		throw std::runtime_error(
+			"Bad number '" + std::string(trim(field)) + "' on line " + std::to_string(line) + " of " + path
+		);
+	return value;
+}
+
+void check(const std::ostream &out)
+{
+	if (!out)
+		throw std::runtime_error("Cannot write stream results");
+}
+
+} // namespace
+
+StreamEvaluator::StreamEvaluator(const FlatExpression<long double> &expression, Accuracy accuracy, std::size_t chunk_rows_) :
+	batch(expression, accuracy), chunk_rows(chunk_rows_)
+{
+	if (chunk_rows == 0)
+		throw std::invalid_argument("StreamEvaluator needs at least one row per chunk");
+	for (const FlatNode &node : expression.nodes()) {
+		if (node.op != OpCode::Var)
+			continue;
+		const Symbol var(node.lhs);
+		if (std::find(inputs.begin(), inputs.end(), var) == inputs.end())
+			inputs.push_back(var);
+	}
+}
+
+const std::vector<Symbol> &StreamEvaluator::variables() const
+{
+	return inputs;
+}
+
+std::size_t StreamEvaluator::eval_csv(const std::string &path, std::ostream &out, const std::string &result_name) const
+{
+	MappedFile file(path);
+	file.advise_sequential();
+	const std::string_view text = file.view();
+	std::size_t position = 0, line_number = 0;
+
+	// Header: field index -> index into `inputs`, or skip.
+	std::string_view header;
+	while (position < text.size() && trim(header).empty()) {
+		header = next_line(text, position);
+		++line_number;
+	}
+	std::vector<std::size_t> slots;
+	std::vector<bool> found(inputs.size(), false);
+	for (std::size_t begin = 0; begin <= header.size();) {
+		const std::size_t end = std::min(header.find(',', begin), header.size());
+		const std::string_view name = trim(header.substr(begin, end - begin));
+		std::size_t slot = skip;
+		for (std::size_t i = 0; i < inputs.size(); ++i) {
+			if (!found[i] && inputs[i].name() == name) {
+				slot = i;
+				found[i] = true;
+				break;
+			}
+		}
+		slots.push_back(slot);
+		begin = end + 1;
+	}
+	for (std::size_t i = 0; i < inputs.size(); ++i) {
+		if (!found[i])
+			throw std::runtime_error("Column " + inputs[i].name() + " is missing in " + path);
+	}
+	// Fields after the last used one are never looked at.
+	while (!slots.empty() && slots.back() == skip)
+		slots.pop_back();
+
+	std::vector<std::vector<double>> values(inputs.size(), std::vector<double>(chunk_rows));
+	BatchEvaluator::Columns columns;
+	for (std::size_t i = 0; i < inputs.size(); ++i)
+		columns.emplace_back(inputs[i], values[i].data());
+	std::vector<double> results(chunk_rows);
+	std::string buffer;
+	buffer.reserve(chunk_rows * 25);
+
+	out << result_name << '\n';
+	check(out);
+	std::size_t rows = 0, n = 0, released = 0;
+	const auto flush = [&]() {
+		batch.eval(columns, n, results.data());
+		buffer.clear();
+		char number[32];
+		for (std::size_t i = 0; i < n; ++i) {
+			const auto [end, error] = std::to_chars(number, number + sizeof(number), results[i]);
+			buffer.append(number, end);
+			buffer.push_back('\n');
+		}
+		out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		check(out);
+		released = file.release(released, position - released);
+		rows += n;
+		n = 0;
+	};
+
+	while (position < text.size()) {
+		const std::string_view line = next_line(text, position);
+		++line_number;
+		if (trim(line).empty())
+			continue;
+		std::size_t begin = 0;
+		for (std::size_t field = 0; field < slots.size(); ++field) {
+			if (begin > line.size())
+				throw std::runtime_error("Too few fields on line " + std::to_string(line_number) + " of " + path);
+			const std::size_t end = std::min(line.find(',', begin), line.size());
+			if (slots[field] != skip)
+				values[slots[field]][n] = parse_number(line.substr(begin, end - begin), line_number, path);
+			begin = end + 1;
+		}
+		if (++n == chunk_rows)
+			flush();
+	}
+	if (n != 0)
+		flush();
+	return rows;
+}
+
+std::size_t StreamEvaluator::eval_binary(const std::string &path, const std::vector<Symbol> &columns, std::ostream &out) const
+{
+	if (columns.empty())
+		throw std::invalid_argument("eval_binary needs at least one column");
+	MappedFile file(path);
+	file.advise_sequential();
+	const std::size_t width = columns.size() * sizeof(double);
+	if (file.size() % width != 0)
+		throw std::runtime_error(path + " does not hold " + std::to_string(columns.size()) + " columns of doubles");
+	const std::size_t rows = file.size() / width;
+
+	// Index into `columns` of every input.
+	std::vector<std::size_t> slots;
+	for (Symbol var : inputs) {
+		const auto it = std::find(columns.begin(), columns.end(), var);
+		if (it == columns.end())
+			throw std::runtime_error("Column " + var.name() + " is missing in " + path);
+		slots.push_back(static_cast<std::size_t>(it - columns.begin()));
+	}
+	const double *base = reinterpret_cast<const double *>(file.data());
+	std::vector<std::size_t> released;
+	for (std::size_t slot : slots)
+		released.push_back(slot * rows * sizeof(double));
+
+	std::vector<double> results(std::min(chunk_rows, rows));
+	BatchEvaluator::Columns chunk;
+	for (Symbol var : inputs)
+		chunk.emplace_back(var, nullptr);
+	for (std::size_t start = 0; start < rows; start += chunk_rows) {
+		const std::size_t n = std::min(chunk_rows, rows - start);
+		for (std::size_t i = 0; i < chunk.size(); ++i)
+			chunk[i].second = base + slots[i] * rows + start;
+		batch.eval(chunk, n, results.data());
+		out.write(reinterpret_cast<const char *>(results.data()), static_cast<std::streamsize>(n * sizeof(double)));
+		check(out);
+		for (std::size_t i = 0; i < slots.size(); ++i) {
+			const std::size_t consumed = (slots[i] * rows + start + n) * sizeof(double);
+			released[i] = file.release(released[i], consumed - released[i]);
+		}
+	}
+	return rows;
+}
@@ -0,0 +1,48 @@
+#ifndef STREAM_EVALUATOR_HPP
+#define STREAM_EVALUATOR_HPP
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "batch_evaluator.hpp"
+#include "flat_expression.hpp"
+#include "symbol.hpp"
+
+// Evaluates one tape over a data file of any size. The file is mapped, not
+// read, and walked in chunks of `chunk_rows` rows: every chunk goes through
+// BatchEvaluator, its results are written out, and the pages it came from
+// are handed back to the kernel before the next one is touched, so memory
+// use depends on the chunk size and not on the file.
+class StreamEvaluator {
+  public:
+	static constexpr std::size_t default_chunk_rows = 1 << 16;
+
+	explicit StreamEvaluator(
+		const FlatExpression<long double> &expression, Accuracy accuracy = Accuracy::Ulp1,
+		std::size_t chunk_rows_ = default_chunk_rows
+	);
+
+	// Comma-separated values with a header line naming the columns. Only
+	// the columns of variables in the tape are parsed, the rest are skipped.
+	// Writes a header line `result_name`, then one value per row. Returns
+	// the number of rows.
+	std::size_t eval_csv(const std::string &path, std::ostream &out, const std::string &result_name = "result") const;
+	// Raw native-endian doubles stored column after column: with
+	// rows = file size / (8 * columns.size()), `columns[k]` holds values
+	// [k * rows, (k + 1) * rows). The chunks are evaluated in place in the
+	// mapping and the results are written as one more such column. Returns
+	// the number of rows.
+	std::size_t eval_binary(const std::string &path, const std::vector<Symbol> &columns, std::ostream &out) const;
+
+	// Variables the tape reads, each once.
+	const std::vector<Symbol> &variables(void) const;
+
+  private:
+	BatchEvaluator batch;
+	std::vector<Symbol> inputs;
+	std::size_t chunk_rows;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "substitute.hpp"
+
+#include <algorithm>
+#include <complex>
+
+template <typename T>
+void Substitution<T>::bind(Symbol var, Node replacement)
+{
+	replacements[var.id()] = std::move(replacement);
+	memo.clear();
+}
+
+template <typename T>
+typename Substitution<T>::Node Substitution<T>::operator()(const Node &root)
+{
+	std::vector<std::pair<Node, bool>> stack{{root, false}};
+	while (!stack.empty()) {
+		auto [node, expanded] = std::move(stack.back());
+		stack.pop_back();
+		if (memo.contains(node.get()))
+			continue;
+		if (!expanded) {
+			stack.emplace_back(node, true);
+			for (std::size_t i = node->arity(); i-- > 0;) {
+				if (!memo.contains(node->operand(i).get()))
+					stack.emplace_back(node->operand(i), false);
+			}
+			continue;
+		}
+
+		std::vector<Node> operands;
+		operands.reserve(node->arity());
+		for (std::size_t i = 0; i < node->arity(); ++i)
+			operands.push_back(memo.at(node->operand(i).get()).second);
+		Node result = rewrite(node, std::move(operands));
+		memo.emplace(node.get(), std::make_pair(node, std::move(result)));
+	}
+	return memo.at(root.get()).second;
+}
+
+template <typename T>
+typename Substitution<T>::Node Substitution<T>::rewrite(const Node &node, std::vector<Node> operands) const
+{
+	switch (node->kind()) {
+		case NodeKind::Variable: {
+			auto it = replacements.find(static_cast<const Variable<T> *>(node.get())->get_symbol().id());
+			return it == replacements.end() ? node : it->second;
+		}
+		case NodeKind::Polynomial: {
+			const auto &polynomial = static_cast<const Polynomial<T> &>(*node);
+			const auto &variables = polynomial.get_variables();
+			const bool touched = std::any_of(variables.begin(), variables.end(), [&](Symbol var) {
+				return replacements.contains(var.id());
+			});
+			return touched ? expand(polynomial) : node;
+		}
+		default:
+			break;
+	}
+
+	for (std::size_t i = 0; i < operands.size(); ++i) {
+		if (operands[i] != node->operand(i))
+			return node->with_operands(std::move(operands));
+	}
+	return node;
+}
+
+template <typename T>
+typename Substitution<T>::Node Substitution<T>::expand(const Polynomial<T> &polynomial) const
+{
+	std::vector<Node> bases;
+	for (Symbol var : polynomial.get_variables()) {
+		auto it = replacements.find(var.id());
+		bases.push_back(it == replacements.end() ? make_ref<Variable<T>>(var) : it->second);
+	}
+
+	Node sum;
+	for (const auto &[exponents, coefficient] : polynomial.get_terms()) {
+		Node term = make_ref<Value<T>>(coefficient);
+		for (std::size_t i = 0; i < exponents.size(); ++i) {
+			if (exponents[i] == 0)
+				continue;
+			Node factor = exponents[i] == 1 ? bases[i] : make_ref<OperationPow<T>>(
+				bases[i], make_ref<Value<T>>(T(exponents[i]))
+			);
+			term = OperationProduct<T>::build(std::move(term), factor);
+		}
+		sum = sum ? OperationSum<T>::build(std::move(sum), term) : term;
+	}
+	return sum ? sum : make_ref<Value<T>>(T(0));
+}
+
+template class Substitution<long double>;
+template class Substitution<std::complex<long double>>;
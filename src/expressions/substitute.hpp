@@ -0,0 +1,38 @@
+#ifndef SUBSTITUTE_HPP
+#define SUBSTITUTE_HPP
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "expression.hpp"
+#include "polynomial.hpp"
+#include "symbol.hpp"
+
+// Simultaneous replacement of variables by expressions. Every node is
+// rewritten once however many paths reach it, subtrees without a replaced
+// variable are returned as they are, and replacements are linked in
+// rather than copied, so the result is a DAG of at most the size of the
+// source plus the replacements. Results are shared between all calls made
+// through the same instance.
+template <typename T> class Substitution {
+  public:
+	using Node = Ref<ExpressionImpl<T>>;
+
+	// Replacements are not substituted into each other.
+	void bind(Symbol var, Node replacement);
+
+	Node operator()(const Node &root);
+
+  private:
+	Node rewrite(const Node &node, std::vector<Node> operands) const;
+	// Sum of monomials with the replaced variables in place.
+	Node expand(const Polynomial<T> &polynomial) const;
+
+	std::unordered_map<SymbolId, Node> replacements;
+	// The original node is kept alive so its address cannot be reused.
+	std::unordered_map<const ExpressionImpl<T> *, std::pair<Node, Node>> memo;
+};
+
+#endif
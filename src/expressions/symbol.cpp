@@ -0,0 +1,150 @@
+#include "symbol.hpp"
+
+#include <complex>
+#include <mutex>
+#include <stdexcept>
+
+// =============
+// |SymbolTable|
+// =============
+
+SymbolTable &SymbolTable::global()
+{
+	static SymbolTable table;
+	return table;
+}
+
+SymbolId SymbolTable::intern(std::string_view name)
+{
+	{
+		std::shared_lock lock(mutex);
+		if (auto it = ids.find(name); it != ids.end())
+			return it->second;
+	}
+	std::unique_lock lock(mutex);
+	if (auto it = ids.find(name); it != ids.end())
+		return it->second;
+	SymbolId id = static_cast<SymbolId>(names.size());
+	names.emplace_back(name);
+	ids.emplace(names.back(), id);
+	return id;
+}
+
+std::optional<SymbolId> SymbolTable::find(std::string_view name) const
+{
+	std::shared_lock lock(mutex);
+	if (auto it = ids.find(name); it != ids.end())
+		return it->second;
+	return std::nullopt;
+}
+
+const std::string &SymbolTable::name(SymbolId id) const
+{
+	std::shared_lock lock(mutex);
+	if (id >= names.size())
+		throw std::out_of_range("Unknown symbol id -> SymbolTable::name");
+	return names[id];
+}
+
+std::size_t SymbolTable::size() const
+{
+	std::shared_lock lock(mutex);
+	return names.size();
+}
+
+// ========
+// |Symbol|
+// ========
+
+Symbol::Symbol(const std::string &name) :
+    symbol_id(SymbolTable::global().intern(name))
+{}
+
+Symbol::Symbol(const char *name) :
+    symbol_id(SymbolTable::global().intern(name))
+{}
+
+Symbol::Symbol(SymbolId id_) :
+    symbol_id(id_)
+{}
+
+std::optional<Symbol> Symbol::find(std::string_view name)
+{
+	if (auto id = SymbolTable::global().find(name))
+		return Symbol(*id);
+	return std::nullopt;
+}
+
+SymbolId Symbol::id() const
+{
+	return symbol_id;
+}
+
+const std::string &Symbol::name() const
+{
+	return SymbolTable::global().name(symbol_id);
+}
+
+// ==========
+// |Bindings|
+// ==========
+
+template <typename T>
+Bindings<T>::Bindings(const std::unordered_map<std::string, T> &context)
+{
+	for (const auto &[name, value] : context) {
+		if (auto symbol = Symbol::find(name))
+			bind(*symbol, value);
+	}
+}
+
+template <typename T>
+Bindings<T>::Bindings(std::initializer_list<std::pair<Symbol, T>> context)
+{
+	for (const auto &[symbol, value] : context)
+		bind(symbol, value);
+}
+
+template <typename T>
+void Bindings<T>::bind(Symbol symbol, T value)
+{
+	if (symbol.id() >= values.size()) {
+		values.resize(symbol.id() + 1);
+		bound.resize(symbol.id() + 1, false);
+	}
+	if (!bound[symbol.id()])
+		++bound_count;
+	values[symbol.id()] = value;
+	bound[symbol.id()] = true;
+}
+
+template <typename T>
+const T *Bindings<T>::find(Symbol symbol) const
+{
+	if (symbol.id() >= values.size() || !bound[symbol.id()])
+		return nullptr;
+	return &values[symbol.id()];
+}
+
+template <typename T>
+const T *Bindings<T>::find(const std::string &name) const
+{
+	auto symbol = Symbol::find(name);
+	return symbol ? find(*symbol) : nullptr;
+}
+
+template <typename T>
+const T *Bindings<T>::find(const char *name) const
+{
+	auto symbol = Symbol::find(name);
+	return symbol ? find(*symbol) : nullptr;
+}
+
+template <typename T>
+bool Bindings<T>::empty() const
+{
+	return bound_count == 0;
+}
+
+template class Bindings<long double>;
+template class Bindings<std::complex<long double>>;
@@ -0,0 +1,78 @@
+#ifndef SYMBOL_HPP
+#define SYMBOL_HPP
+
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using SymbolId = std::uint32_t;
+
+// Process-wide table that interns variable names to dense integer ids.
+class SymbolTable {
+  public:
+	static SymbolTable &global(void);
+
+	SymbolId intern(std::string_view name);
+	// Id of a name interned before; never adds one.
+	std::optional<SymbolId> find(std::string_view name) const;
+	const std::string &name(SymbolId id) const;
+	std::size_t size(void) const;
+
+  private:
+	SymbolTable() = default;
+
+	mutable std::shared_mutex mutex;
+	std::unordered_map<std::string_view, SymbolId> ids;
+	std::deque<std::string> names;
+};
+
+class Symbol {
+  public:
+	Symbol(const std::string &name);
+	Symbol(const char *name);
+	explicit Symbol(SymbolId id_);
+
+	// The symbol of `name` if one exists, for lookups that must not intern
+	// every name they are asked about.
+	static std::optional<Symbol> find(std::string_view name);
+
+	SymbolId id(void) const;
+	const std::string &name(void) const;
+
+	bool operator==(const Symbol &other) const = default;
+
+  private:
+	SymbolId symbol_id;
+};
+
+// Variable values indexed by SymbolId, so lookups on the hot paths
+// are a bounds check and an array access instead of a string hash.
+template <typename T> class Bindings {
+  public:
+	Bindings() = default;
+	// Names that no symbol exists for are skipped: no expression can
+	// refer to them.
+	Bindings(const std::unordered_map<std::string, T> &context);
+	Bindings(std::initializer_list<std::pair<Symbol, T>> context);
+
+	void bind(Symbol symbol, T value);
+	const T *find(Symbol symbol) const;
+	// By name, without interning it; an unknown name is not bound.
+	const T *find(const std::string &name) const;
+	const T *find(const char *name) const;
+	bool empty(void) const;
+
+  private:
+	std::vector<T> values;
+	std::vector<bool> bound;
+	std::size_t bound_count = 0;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include "vector_math.hpp"
+
+#include <array>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+// The loops are also compiled for AVX2 and picked at load time.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define VECTOR_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define VECTOR_CLONES
+#endif
+
+namespace {
+
+// Adding 1.5 * 2^52 rounds to an integer kept in the low mantissa bits,
+// which gives both the rounded double and its int64 value without any
+// conversion instruction.
+constexpr double shift = 6755399441055744.0;
+constexpr std::int64_t shift_bits = std::bit_cast<std::int64_t>(shift);
+
+constexpr double log2e = std::bit_cast<double>(0x3FF71547652B82FEull);
+constexpr double two_over_pi = std::bit_cast<double>(0x3FE45F306DC9C883ull);
+constexpr double sqrt2 = std::bit_cast<double>(0x3FF6A09E667F3BCDull);
+
+// Cody-Waite splits: the leading parts have few enough bits that their
+// products with the reduction integer are exact.
+constexpr double ln2_hi = std::bit_cast<double>(0x3FE62E42FEE00000ull);
+constexpr double ln2_lo = std::bit_cast<double>(0x3DEA39EF35793C76ull);
+constexpr double pio2_1 = std::bit_cast<double>(0x3FF921FB54400000ull);
+constexpr double pio2_1t = std::bit_cast<double>(0x3DD0B4611A626331ull);
+constexpr double pio2_2 = std::bit_cast<double>(0x3DD0B4611A600000ull);
+constexpr double pio2_2t = std::bit_cast<double>(0x3BA3198A2E037073ull);
+
+// Vectorized ranges; everything else is patched with libm.
+constexpr double exp_min = -708.0;
+constexpr double exp_max = 709.0;
+constexpr double trig_max = 1e5;
+constexpr double pow_min = 0x1p-46;
+constexpr double pow_max = 0x1p46;
+
+constexpr double inverse_factorial(int k)
+{
+	double factorial = 1.0;
+	for (int i = 2; i <= k; ++i)
+		factorial *= i;
+	return 1.0 / factorial;
+}
+
+// exp(r) = 1 + r + r^2 * (1/2! + r/3! + ...)
+template <int Degree> constexpr std::array<double, Degree - 1> exp_coefficients()
+{
+	std::array<double, Degree - 1> c{};
+	for (int k = 2; k <= Degree; ++k)
+		c[k - 2] = inverse_factorial(k);
+	return c;
+}
+
+// sin(r) = r + r * z * (-1/3! + z/5! - ...), z = r^2
+template <int Terms> constexpr std::array<double, Terms> sin_coefficients()
+{
+	std::array<double, Terms> c{};
+	for (int k = 1; k <= Terms; ++k)
+		c[k - 1] = (k % 2 ? -1.0 : 1.0) * inverse_factorial(2 * k + 1);
+	return c;
+}
+
+// cos(r) = 1 - z/2 + z^2 * (1/4! - z/6! + ...)
+template <int Terms> constexpr std::array<double, Terms> cos_coefficients()
+{
+	std::array<double, Terms> c{};
+	for (int k = 2; k <= Terms + 1; ++k)
+		c[k - 2] = (k % 2 ? -1.0 : 1.0) * inverse_factorial(2 * k);
+	return c;
+}
+
+// log(1 + f) = f - f^2/2 + s * (f^2/2 + z * (2/3 + 2z/5 + ...)), s = f / (2 + f)
+template <int Terms> constexpr std::array<double, Terms> log_coefficients()
+{
+	std::array<double, Terms> c{};
+	for (int k = 1; k <= Terms; ++k)
+		c[k - 1] = 2.0 / (2 * k + 1);
+	return c;
+}
+
+template <Accuracy A> struct Tier;
+template <> struct Tier<Accuracy::Ulp1> {
+	static constexpr int exp_degree = 13, log_terms = 10, sin_terms = 8, cos_terms = 8;
+	static constexpr bool exact_reduction = true;
+};
+template <> struct Tier<Accuracy::Ulp4> {
+	static constexpr int exp_degree = 12, log_terms = 9, sin_terms = 7, cos_terms = 7;
+	static constexpr bool exact_reduction = true;
+};
+template <> struct Tier<Accuracy::Fast> {
+	static constexpr int exp_degree = 7, log_terms = 4, sin_terms = 4, cos_terms = 4;
+	static constexpr bool exact_reduction = false;
+};
+
+// c[0] + c[1] x + ... as even and odd halves in x^2, which halves the
+// dependency chain of plain Horner.
+template <std::size_t N> inline double polynomial(double x, const std::array<double, N> &c)
+{
+	if constexpr (N == 1) {
+		return c[0];
+	} else {
+		const double x2 = x * x;
+		double even = c[(N - 1) & ~std::size_t(1)];
+		double odd = c[N % 2 ? N - 2 : N - 1];
+		for (std::size_t i = (N - 1) & ~std::size_t(1); i >= 2; i -= 2)
+			even = even * x2 + c[i - 2];
+		for (std::size_t i = N % 2 ? N - 2 : N - 1; i >= 3; i -= 2)
+			odd = odd * x2 + c[i - 2];
+		return even + x * odd;
+	}
+}
+
+// Exact a * b = product + error (Dekker), without relying on FMA.
+inline double two_prod(double a, double b, double &error)
+{
+	const double product = a * b;
+	const double ca = 134217729.0 * a, cb = 134217729.0 * b;
+	const double a_hi = ca - (ca - a), a_lo = a - a_hi;
+	const double b_hi = cb - (cb - b), b_lo = b - b_hi;
+	error = ((a_hi * b_hi - product) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+	return product;
+}
+
+// exp(x + tail) for x in [exp_min, exp_max].
+template <Accuracy A> inline double exp_kernel(double x, double tail = 0.0)
+{
+	static constexpr auto c = exp_coefficients<Tier<A>::exp_degree>();
+	x = x < exp_min ? exp_min : (x > exp_max ? exp_max : x);
+	const double t = x * log2e + shift;
+	const double k = t - shift;
+	const std::int64_t n = std::bit_cast<std::int64_t>(t) - shift_bits;
+	// x - k * ln2_hi is exact; the rest is added with its rounding error kept
+	const double a = x - k * ln2_hi, b = tail - k * ln2_lo;
+	const double r = a + b;
+	const double bv = r - a;
+	const double r_lo = (a - (r - bv)) + (b - bv);
+	const double p = 1.0 + (r + (r_lo + r * r * polynomial(r, c)));
+	return p * std::bit_cast<double>(static_cast<std::uint64_t>(n + 1023) << 52);
+}
+
+// x = 2^k * (1 + f) with 1 + f in [sqrt(1/2), sqrt(2)), for positive normal x.
+struct LogParts {
+	double k, f, hfsq, s, R;
+};
+
+template <Accuracy A> inline LogParts log_parts(double x)
+{
+	static constexpr auto c = log_coefficients<Tier<A>::log_terms>();
+	const std::uint64_t bits = std::bit_cast<std::uint64_t>(x);
+	std::int64_t e = static_cast<std::int64_t>(bits >> 52) - 1023;
+	double m = std::bit_cast<double>((bits & 0x000FFFFFFFFFFFFFull) | 0x3FF0000000000000ull);
+	const bool big = m > sqrt2;
+	m = big ? 0.5 * m : m;
+	e += big ? 1 : 0;
+
+	LogParts parts;
+	parts.k = std::bit_cast<double>(e + shift_bits) - shift;
+	parts.f = m - 1.0;
+	parts.hfsq = 0.5 * parts.f * parts.f;
+	parts.s = parts.f / (2.0 + parts.f);
+	const double z = parts.s * parts.s;
+	parts.R = z * polynomial(z, c);
+	return parts;
+}
+
+template <Accuracy A> inline double log_kernel(double x)
+{
+	const LogParts p = log_parts<A>(x);
+	return p.k * ln2_hi - ((p.hfsq - (p.s * (p.hfsq + p.R) + p.k * ln2_lo)) - p.f);
+}
+
+// sin(x + quadrant * pi / 2) for |x| <= trig_max.
+template <Accuracy A> inline double sin_kernel(double x, std::int64_t quadrant)
+{
+	static constexpr auto sc = sin_coefficients<Tier<A>::sin_terms>();
+	static constexpr auto cc = cos_coefficients<Tier<A>::cos_terms>();
+	const double t = x * two_over_pi + shift;
+	const double j = t - shift;
+	const std::int64_t q = std::bit_cast<std::int64_t>(t) - shift_bits + quadrant;
+	// x - j * pi / 2 as r + r_lo; the first product and difference are exact.
+	double r, r_lo;
+	if constexpr (Tier<A>::exact_reduction) {
+		const double y = x - j * pio2_1, w = j * pio2_2;
+		r = y - w;
+		const double bv = r - y;
+		r_lo = ((y - (r - bv)) - (w + bv)) - j * pio2_2t;
+	} else {
+		r = (x - j * pio2_1) - j * pio2_1t;
+		r_lo = 0.0;
+	}
+
+	// sin(r + r_lo) ~ sin(r) + r_lo * cos(r), cos(r + r_lo) ~ cos(r) - r_lo * sin(r)
+	const double z = r * r;
+	const double hz = 0.5 * z, w = 1.0 - hz;
+	const double sin_r = r + (r * z * polynomial(z, sc) + r_lo * w);
+	const double cos_r = w + (((1.0 - w) - hz) + (z * z * polynomial(z, cc) - r * r_lo));
+	const double v = (q & 1) ? cos_r : sin_r;
+	return (q & 2) ? -v : v;
+}
+
+// y * log(x) carried in double-double, so that exp does not amplify the
+// rounding of the logarithm by |y * log(x)|.
+inline double pow_kernel(double x, double y)
+{
+	const LogParts p = log_parts<Accuracy::Ulp1>(x);
+	double h_lo;
+	const double h = two_prod(0.5 * p.f, p.f, h_lo);
+	// s = f / (2 + f) and h + R, each with its rounding error
+	const double d = 2.0 + p.f;
+	const double d_lo = (2.0 - d) + p.f;
+	double sd_lo;
+	const double sd = two_prod(p.s, d, sd_lo);
+	const double s_lo = (((p.f - sd) - sd_lo) - p.s * d_lo) / d;
+	const double u = h + p.R;
+	const double u_lo = ((h - u) + p.R) + h_lo;
+	double su_lo;
+	const double su = two_prod(p.s, u, su_lo);
+
+	const double t_hi = p.f - h;
+	const double t_lo = (((p.f - t_hi) - h) - h_lo) + su + (su_lo + p.s * u_lo + s_lo * u);
+
+	const double a = p.k * ln2_hi;
+	const double b = a + t_hi;
+	const double bv = b - a;
+	const double b_lo = ((a - (b - bv)) + (t_hi - bv)) + t_lo + p.k * ln2_lo;
+	const double hi = b + b_lo;
+	const double lo = b_lo - (hi - b);
+
+	double product_lo;
+	const double product = two_prod(y, hi, product_lo);
+	const double tail = product_lo + y * lo;
+	const double exponent = product + tail;
+	return exp_kernel<Accuracy::Ulp1>(exponent, tail - (exponent - product));
+}
+
+template <Accuracy A> VECTOR_CLONES void sin_loop(const double *x, double *out, std::size_t n, std::int64_t quadrant)
+{
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = sin_kernel<A>(x[i], quadrant);
+}
+
+template <Accuracy A> VECTOR_CLONES void exp_loop(const double *x, double *out, std::size_t n)
+{
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = exp_kernel<A>(x[i]);
+}
+
+template <Accuracy A> VECTOR_CLONES void log_loop(const double *x, double *out, std::size_t n)
+{
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = log_kernel<A>(x[i]);
+}
+
+VECTOR_CLONES void pow_loop(const double *x, const double *y, double *out, std::size_t n)
+{
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = pow_kernel(x[i], y[i]);
+}
+
+template <Accuracy A> VECTOR_CLONES void fast_pow_loop(const double *x, const double *y, double *out, std::size_t n)
+{
+	for (std::size_t i = 0; i < n; ++i)
+		out[i] = exp_kernel<A>(y[i] * log_kernel<A>(x[i]));
+}
+
+template <typename Loop> void by_tier(Accuracy accuracy, Loop loop)
+{
+	switch (accuracy) {
+		case Accuracy::Ulp1: loop.template operator()<Accuracy::Ulp1>(); break;
+		case Accuracy::Ulp4: loop.template operator()<Accuracy::Ulp4>(); break;
+		case Accuracy::Fast: loop.template operator()<Accuracy::Fast>(); break;
+	}
+}
+
+bool normal_positive(double x)
+{
+	return x >= DBL_MIN && x <= DBL_MAX;
+}
+
+} // namespace
+
+void vector_sin(const double *x, double *out, std::size_t n, Accuracy accuracy)
+{
+	by_tier(accuracy, [&]<Accuracy A>() { sin_loop<A>(x, out, n, 0); });
+	for (std::size_t i = 0; i < n; ++i) {
+		if (!(std::abs(x[i]) <= trig_max))
+			out[i] = std::sin(x[i]);
+	}
+}
+
+void vector_cos(const double *x, double *out, std::size_t n, Accuracy accuracy)
+{
+	by_tier(accuracy, [&]<Accuracy A>() { sin_loop<A>(x, out, n, 1); });
+	for (std::size_t i = 0; i < n; ++i) {
+		if (!(std::abs(x[i]) <= trig_max))
+			out[i] = std::cos(x[i]);
+	}
+}
+
+void vector_exp(const double *x, double *out, std::size_t n, Accuracy accuracy)
+{
+	by_tier(accuracy, [&]<Accuracy A>() { exp_loop<A>(x, out, n); });
+	for (std::size_t i = 0; i < n; ++i) {
+		if (!(x[i] >= exp_min && x[i] <= exp_max))
+			out[i] = std::exp(x[i]);
+	}
+}
+
+void vector_log(const double *x, double *out, std::size_t n, Accuracy accuracy)
+{
+	by_tier(accuracy, [&]<Accuracy A>() { log_loop<A>(x, out, n); });
+	for (std::size_t i = 0; i < n; ++i) {
+		if (!normal_positive(x[i]))
+			out[i] = std::log(x[i]);
+	}
+}
+
+void vector_pow(const double *x, const double *y, double *out, std::size_t n, Accuracy accuracy)
+{
+	switch (accuracy) {
+		case Accuracy::Ulp1:
+			for (std::size_t i = 0; i < n; ++i)
+				out[i] = std::pow(x[i], y[i]);
+			return;
+		case Accuracy::Ulp4: pow_loop(x, y, out, n); break;
+		case Accuracy::Fast: fast_pow_loop<Accuracy::Fast>(x, y, out, n); break;
+	}
+	// Negative bases, non-finite exponents and |y * log(x)| > 32, where the
+	// rounding of the logarithm would show in the result, go through libm.
+	for (std::size_t i = 0; i < n; ++i) {
+		const double magnitude = std::abs(out[i]);
+		if (!normal_positive(x[i]) || !std::isfinite(y[i]) || !(magnitude > pow_min && magnitude < pow_max))
+			out[i] = std::pow(x[i], y[i]);
+	}
+}
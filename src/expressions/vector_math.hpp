@@ -0,0 +1,25 @@
+#ifndef VECTOR_MATH_HPP
+#define VECTOR_MATH_HPP
+
+#include <cstddef>
+
+// Accuracy tier of the array kernels below, as the worst error against the
+// correctly rounded result over the vectorized range.
+enum class Accuracy {
+    Ulp1,  // within 1 ulp (pow: delegates to libm)
+    Ulp4,  // within 4 ulp, shorter polynomials
+    Fast   // about 1e-8 relative (pow: 1e-7), for plotting and sampling
+};
+
+// Array versions of sin, cos, exp, log and pow over doubles. The common
+// range is handled by branch-free range reduction and polynomials that the
+// compiler vectorizes; the few arguments outside it (huge, subnormal,
+// non-positive, non-finite) are patched afterwards with libm, so every
+// tier agrees with libm on special values.
+void vector_sin(const double *x, double *out, std::size_t n, Accuracy accuracy = Accuracy::Ulp1);
+void vector_cos(const double *x, double *out, std::size_t n, Accuracy accuracy = Accuracy::Ulp1);
+void vector_exp(const double *x, double *out, std::size_t n, Accuracy accuracy = Accuracy::Ulp1);
+void vector_log(const double *x, double *out, std::size_t n, Accuracy accuracy = Accuracy::Ulp1);
+void vector_pow(const double *x, const double *y, double *out, std::size_t n, Accuracy accuracy = Accuracy::Ulp1);
+
+#endif
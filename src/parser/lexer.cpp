@@ -4,44 +4,117 @@
 #include <utility>
 #include <ranges>
 #include <algorithm>
+#include <cctype>
 #include <stdexcept>
 #include <type_traits>
 
-template<typename T>
-Lexer<T>::Lexer(const std::string& input_str, bool ignore_case) {
-    input = input_str;
-    if (!ignore_case) {
-        std::ranges::transform(input, input.begin(), ::tolower);
-    }
-    it = input.begin();
+namespace {
+
+bool is_letter(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool is_digit(char c) {
+    return c >= '0' && c <= '9';
 }
 
+char to_lower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+}
+
+template<typename T>
+Lexer<T>::Lexer(const std::string& input_str, bool ignore_case)
+    : storage(input_str), input(storage), lower_case(!ignore_case) {}
+
+template<typename T>
+Lexer<T>::Lexer(const char* input_str, bool ignore_case)
+    : Lexer(std::string(input_str), ignore_case) {}
+
+template<typename T>
+Lexer<T>::Lexer(std::string_view text, bool ignore_case)
+    : input(text), lower_case(!ignore_case) {}
+
 template<typename T>
-char Lexer<T>::peek() const {
-    return it == input.end() ? '\0' : *it;
+char Lexer<T>::peek(std::size_t offset) const {
+    return position + offset < input.size() ? input[position + offset] : '\0';
 }
 
 template<typename T>
 void Lexer<T>::advance() {
-    if (it != input.end()) {
-        ++it;
+    if (position < input.size()) {
+        ++position;
     }
 }
 
 template<typename T>
-std::optional<std::string> Lexer<T>::get_str_by_pattern(const std::regex& regexp) {
-    std::smatch match_result;
-    if (std::regex_search(it, input.cend(), match_result, regexp, std::regex_constants::match_continuous)) {
-        it = match_result[0].second;
-        return match_result[0].str();
+std::string Lexer<T>::text_from(std::size_t begin) const {
+    std::string text(input.substr(begin, position - begin));
+    if (lower_case) {
+        std::ranges::transform(text, text.begin(), to_lower);
+    }
+    return text;
+}
+
+template<typename T>
+std::optional<Token> Lexer<T>::scan_function() {
+    static constexpr std::string_view names[] = {"sin", "cos", "ln", "exp"};
+    for (std::string_view name : names) {
+        if (peek(name.size()) != '(') {
+            continue;
+        }
+        bool matches = true;
+        for (std::size_t k = 0; k < name.size() && matches; ++k) {
+            matches = to_lower(peek(k)) == name[k];
+        }
+        if (matches) {
+            // Keywords match in any case and are passed on in one.
+            position += name.size() + 1;
+            return Token(Function, std::string(name) + "(");
+        }
     }
     return std::nullopt;
 }
 
+template<typename T>
+Token Lexer<T>::scan_identifier() {
+    const std::size_t begin = position;
+    while (is_letter(peek())) {
+        advance();
+    }
+    std::string name = text_from(begin);
+    if constexpr (std::is_same_v<T, std::complex<long double>>) {
+        if (name == "i") {
+            return Token(ImaginaryUnit, "i");
+        }
+    }
+    return Token(Identifier, std::move(name));
+}
+
+template<typename T>
+Token Lexer<T>::scan_number() {
+    const std::size_t begin = position;
+    if (peek() == '0') {
+        advance();
+    } else {
+        while (is_digit(peek())) {
+            advance();
+        }
+    }
+    if (peek() == '.' && is_digit(peek(1))) {
+        advance();
+        while (is_digit(peek())) {
+            advance();
+        }
+    }
+    return Token(RealNumber, std::string(input.substr(begin, position - begin)));
+}
+
 template<typename T>
 Token Lexer<T>::get_token_from_input() {
     
-    while (std::isspace(peek())) {
+    while (std::isspace(static_cast<unsigned char>(peek()))) {
         advance();
     }
 
@@ -49,15 +122,14 @@ Token Lexer<T>::get_token_from_input() {
         return Token(EOL, "EOL");
     }
 
-    for (const auto& [type, regexp] : PATTERN_MAP) {
-        if (auto str = get_str_by_pattern(regexp); str.has_value()) {
-            if constexpr (std::is_same_v<T, std::complex<long double>>) {
-                if (type == Identifier && str.value() == "i") {
-                    return Token(ImaginaryUnit, "i");
-                }
-            }
-            return Token(type, str.value());
+    if (is_letter(peek())) {
+        if (auto function = scan_function()) {
+            return *function;
         }
+        return scan_identifier();
+    }
+    if (is_digit(peek())) {
+        return scan_number();
     }
 
     const char current_char = peek();
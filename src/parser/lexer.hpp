@@ -2,10 +2,10 @@
 #define LEXER_HPP
 
 #include <complex>
+#include <cstddef>
 #include <string>
-#include <regex>
+#include <string_view>
 #include <optional>
-#include <unordered_map>
 
 enum TokenType {
     RealNumber,
@@ -18,33 +18,44 @@ enum TokenType {
     EOL
 };
 
-const std::unordered_map<TokenType, std::regex> PATTERN_MAP = {
-    {RealNumber, std::regex("(0|[1-9][0-9]*)(\\.[0-9]+)?")},
-    {Identifier, std::regex("[a-zA-Z_]+")},
-    {Function, std::regex("(sin|cos|ln|exp)\\(", std::regex_constants::icase)}
-};
-
 struct Token {
     TokenType type;
     std::string value;
 };
 
+// Tokens are cut straight from the input: numbers (0|[1-9][0-9]*)(\.[0-9]+)?,
+// identifiers [a-zA-Z_]+ and functions sin(, cos(, ln(, exp( in any case.
 template <typename T>
 class Lexer {
     private:
-        std::string input;
-        std::string::const_iterator it;
+        // Copy of the input for the owning constructors, empty otherwise.
+        std::string storage;
+        std::string_view input;
+        std::size_t position = 0;
+        // Letters are lower-cased per token, not in a copy of the input.
+        bool lower_case;
         std::optional<Token> discarded_token = std::nullopt;
         TokenType prev_token_type = EOL;
 
-        char peek(void) const;
+        char peek(std::size_t offset = 0) const;
         void advance(void);
+        std::string text_from(std::size_t begin) const;
 
         Token get_token_from_input(void);
-        std::optional<std::string> get_str_by_pattern(const std::regex& regexp);
+        std::optional<Token> scan_function(void);
+        Token scan_identifier(void);
+        Token scan_number(void);
 
     public:
         Lexer(const std::string& str, bool ignore_case = false);
+        Lexer(const char* str, bool ignore_case = false);
+        // Scans `text` in place; it must outlive the lexer.
+        Lexer(std::string_view text, bool ignore_case = false);
+
+        // `input` may point into `storage`.
+        Lexer(const Lexer&) = delete;
+        Lexer& operator=(const Lexer&) = delete;
+
         Token next_token(void);
 };
 
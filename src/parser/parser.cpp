@@ -5,6 +5,7 @@
 #include <string>
 #include <stdexcept>
 #include <format>
+#include <vector>
 
 
 
@@ -23,13 +24,13 @@ Token Parser<T>::advance() {
 }
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> Parser<T>::create_function(
-	const std::string &func_name, std::shared_ptr<ExpressionImpl<T>> argument
+Ref<ExpressionImpl<T>> Parser<T>::create_function(
+	const std::string &func_name, Ref<ExpressionImpl<T>> argument
 ) {
-	if (func_name == "sin") return std::make_shared<SinFunc<T>>(argument);
-	if (func_name == "cos") return std::make_shared<CosFunc<T>>(argument);
-	if (func_name == "ln") return std::make_shared<LnFunc<T>>(argument);
-	if (func_name == "exp") return std::make_shared<ExpFunc<T>>(argument);
+	if (func_name == "sin") return make_ref<SinFunc<T>>(argument);
+	if (func_name == "cos") return make_ref<CosFunc<T>>(argument);
+	if (func_name == "ln") return make_ref<LnFunc<T>>(argument);
+	if (func_name == "exp") return make_ref<ExpFunc<T>>(argument);
 	throw std::runtime_error("Unknown function: " + func_name);
 }
 
@@ -51,84 +52,62 @@ OpPrecedence Parser<T>::get_precedence_by_name(std::string& name) {
 }
 
 template <typename T>
-std::shared_ptr<ExpressionImpl<T>> Parser<T>::get_op_by_name(std::string& name, 
-    std::shared_ptr<ExpressionImpl<T>> left, std::shared_ptr<ExpressionImpl<T>> right) {
+Ref<ExpressionImpl<T>> Parser<T>::get_op_by_name(std::string& name, 
+    Ref<ExpressionImpl<T>> left, Ref<ExpressionImpl<T>> right) {
         if (name == "+") {
-            return std::make_shared<OperationAdd<T>>(left, right);
+            return OperationSum<T>::build(std::move(left), right);
         }
         if (name == "-") {
-            return std::make_shared<OperationSub<T>>(left, right);
+            return make_ref<OperationSub<T>>(left, right);
         }
         if (name == "*") {
-            return std::make_shared<OperationMult<T>>(left, right);
+            return OperationProduct<T>::build(std::move(left), right);
         }
         if (name == "/") {
-            return std::make_shared<OperationDiv<T>>(left, right);
+            return make_ref<OperationDiv<T>>(left, right);
         }
         if (name == "^") {
-            return std::make_shared<OperationPow<T>>(left, right);
+            return make_ref<OperationPow<T>>(left, right);
         }
         throw std::runtime_error(std::format("Unknown binary operator: \"{}\"", name));
     }
 
 template<>
-std::shared_ptr<ExpressionImpl<long double>> Parser<long double>::parse_real_number() {
+Ref<ExpressionImpl<long double>> Parser<long double>::parse_real_number() {
     auto value = std::stold(cur_token.value); // Преобразуем строку в long double
     advance();
-    return std::make_shared<Value<long double>>(value);
+    return make_ref<Value<long double>>(value);
 }
 
 template<>
-std::shared_ptr<ExpressionImpl<std::complex<long double>>> Parser<std::complex<long double>>::parse_real_number() {
+Ref<ExpressionImpl<std::complex<long double>>> Parser<std::complex<long double>>::parse_real_number() {
     std::complex<long double> value(std::stold(cur_token.value), 0); // Вещественная часть, мнимая = 0
     advance();
-    return std::make_shared<Value<std::complex<long double>>>(value);
+    return make_ref<Value<std::complex<long double>>>(value);
 }
 
 template<>
-std::shared_ptr<ExpressionImpl<long double>> Parser<long double>::parse_imaginary_unit() {
+Ref<ExpressionImpl<long double>> Parser<long double>::parse_imaginary_unit() {
     throw std::runtime_error("Imaginary unit is not supported for RealNumber");
 }
 
 template<>
-std::shared_ptr<ExpressionImpl<std::complex<long double>>> Parser<std::complex<long double>>::parse_imaginary_unit() {
+Ref<ExpressionImpl<std::complex<long double>>> Parser<std::complex<long double>>::parse_imaginary_unit() {
     std::complex<long double> value(0, 1); // Мнимая единица
     advance();
-    return std::make_shared<Value<std::complex<long double>>>(value);
+    return make_ref<Value<std::complex<long double>>>(value);
 }
 
 template<typename T>
-std::shared_ptr<ExpressionImpl<T>> Parser<T>::parse_identifier() {
+Ref<ExpressionImpl<T>> Parser<T>::parse_identifier() {
     std::string name = cur_token.value;
     advance();
-    return std::make_shared<Variable<T>>(name);
+    return make_ref<Variable<T>>(name);
 }
 
 template<typename T>
-std::shared_ptr<ExpressionImpl<T>> Parser<T>::parse_parentheses_expr() {
-    consume(LeftParen);
-    auto expr = parse_expression();
-    consume(RightParen);
-    return expr;
-}
-
-template<typename T>
-std::shared_ptr<ExpressionImpl<T>> Parser<T>::parse_function() {
-    std::string func_name = cur_token.value.substr(0, cur_token.value.length() - 1); // Убираем '('
-    consume(Function);
-    auto expr = parse_expression();
-    consume(RightParen);
-    return create_function(func_name, expr);
-}
-
-
-template<typename T>
-std::shared_ptr<ExpressionImpl<T>> Parser<T>::parse_primary() {
+Ref<ExpressionImpl<T>> Parser<T>::parse_primary() {
     switch (cur_token.type) {
-        case LeftParen:
-            return parse_parentheses_expr();
-        case Function:
-            return parse_function();
         case RealNumber:
             return parse_real_number();
         case ImaginaryUnit:
@@ -140,48 +119,83 @@ std::shared_ptr<ExpressionImpl<T>> Parser<T>::parse_primary() {
     }
 }
 
+// Operator precedence parsing on explicit stacks rather than recursion, so
+// the nesting depth of parentheses and functions is bounded by memory only.
+// Operators of equal precedence group to the left.
 template<typename T>
-std::shared_ptr<ExpressionImpl<T>> Parser<T>::parse_op_right(OpPrecedence expr_precedence, std::shared_ptr<ExpressionImpl<T>> left) {
-    while (cur_token.type != EOL && cur_token.type != RightParen) {
-        if (cur_token.type != Operator) {
-            throw std::runtime_error(std::format("Expected binary operator, got: \"{}\"", cur_token.value));
+Ref<ExpressionImpl<T>> Parser<T>::parse_expression() {
+    struct Pending {
+        std::string name; // binary operator, or the function of an open group
+        bool group;
+    };
+    std::vector<Ref<ExpressionImpl<T>>> operands;
+    std::vector<Pending> pending;
+    std::size_t open_groups = 0;
+
+    // Applies the operators of the innermost group down to `precedence`.
+    auto reduce = [&](OpPrecedence precedence) {
+        while (!pending.empty() && !pending.back().group
+               && get_precedence_by_name(pending.back().name) >= precedence) {
+            auto right = std::move(operands.back());
+            operands.pop_back();
+            auto left = std::move(operands.back());
+            operands.pop_back();
+            operands.push_back(get_op_by_name(pending.back().name, std::move(left), right));
+            pending.pop_back();
         }
+    };
 
-        std::string op = cur_token.value;
-        OpPrecedence op_precedence = get_precedence_by_name(op);
-
-        if (op_precedence < expr_precedence) {
-            break;
+    while (true) {
+        for (; cur_token.type == LeftParen || cur_token.type == Function; ++open_groups) {
+            std::string function;
+            if (cur_token.type == Function) {
+                function = cur_token.value.substr(0, cur_token.value.length() - 1); // Убираем '('
+            }
+            advance();
+            pending.push_back({std::move(function), true});
         }
-
-        advance();
-        auto right = parse_primary();
-
-        // Обработка вложенных операторов с более высоким приоритетом
-        if (cur_token.type == Operator) {
-            std::string next_op = cur_token.value;
-            OpPrecedence next_op_precedence = get_precedence_by_name(next_op);
-
-            if (op_precedence < next_op_precedence) {
-                right = parse_op_right(OpPrecedence(static_cast<int>(op_precedence) + 1), right);
+        operands.push_back(parse_primary());
+
+        for (; cur_token.type == RightParen && open_groups > 0; --open_groups) {
+            reduce(OpPrecedence::AddSub);
+            std::string function = std::move(pending.back().name);
+            pending.pop_back();
+            advance();
+            if (!function.empty()) {
+                operands.back() = create_function(function, std::move(operands.back()));
             }
         }
 
-        left = get_op_by_name(op, left, right);
+        if (cur_token.type == Operator) {
+            std::string op = cur_token.value;
+            reduce(get_precedence_by_name(op));
+            advance();
+            pending.push_back({std::move(op), false});
+            continue;
+        }
+        if (cur_token.type != EOL && cur_token.type != RightParen) {
+            throw std::runtime_error(std::format("Expected binary operator, got: \"{}\"", cur_token.value));
+        }
+        if (open_groups > 0) {
+            consume(RightParen);
+        }
+        reduce(OpPrecedence::AddSub);
+        return operands.back();
     }
-    return left;
 }
 
 template<typename T>
-std::shared_ptr<ExpressionImpl<T>> Parser<T>::parse_expression() {
-    auto left = parse_primary();
-    return parse_op_right(OpPrecedence::AddSub, left);
-}
+Parser<T>::Parser(const std::string& expression_str, bool ignore_case)
+    : lexer(expression_str, ignore_case), cur_token(lexer.next_token()) {}
 
 template<typename T>
-Parser<T>::Parser(const std::string& expression_str, bool ignore_case)
+Parser<T>::Parser(const char* expression_str, bool ignore_case)
     : lexer(expression_str, ignore_case), cur_token(lexer.next_token()) {}
 
+template<typename T>
+Parser<T>::Parser(std::string_view text, bool ignore_case)
+    : lexer(text, ignore_case), cur_token(lexer.next_token()) {}
+
 template<typename T>
 Expression<T> Parser<T>::parse() {
     auto expr = parse_expression();
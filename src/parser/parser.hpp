@@ -1,6 +1,8 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
+#include <string_view>
+
 #include "lexer.hpp"
 #include "../expressions/expression.hpp"
 
@@ -8,6 +10,9 @@ template<typename T = long double>
 class Parser {
 public:
     explicit Parser(const std::string& expression_str, bool ignore_case = false);
+    explicit Parser(const char* expression_str, bool ignore_case = false);
+    // Parses `text` in place, e.g. a mapped file; it must outlive the parser.
+    explicit Parser(std::string_view text, bool ignore_case = false);
     Expression<T> parse();
 
 private:
@@ -16,25 +21,23 @@ private:
 
     Token advance();
     Token consume(TokenType expected_type);
-    std::shared_ptr<ExpressionImpl<T>> create_function(
+    Ref<ExpressionImpl<T>> create_function(
 		const std::string &func_name,
-		std::shared_ptr<ExpressionImpl<T>> argument
+		Ref<ExpressionImpl<T>> argument
 	);
 
     OpPrecedence get_precedence_by_name(std::string& name);
 
-    std::shared_ptr<ExpressionImpl<T>> get_op_by_name(std::string& name, 
-        std::shared_ptr<ExpressionImpl<T>> left, std::shared_ptr<ExpressionImpl<T>> right);
+    Ref<ExpressionImpl<T>> get_op_by_name(std::string& name, 
+        Ref<ExpressionImpl<T>> left, Ref<ExpressionImpl<T>> right);
 
 
-    std::shared_ptr<ExpressionImpl<T>> parse_real_number();
-    std::shared_ptr<ExpressionImpl<T>> parse_imaginary_unit();
-    std::shared_ptr<ExpressionImpl<T>> parse_identifier();
-    std::shared_ptr<ExpressionImpl<T>> parse_parentheses_expr();
-    std::shared_ptr<ExpressionImpl<T>> parse_function();
-    std::shared_ptr<ExpressionImpl<T>> parse_primary();
-    std::shared_ptr<ExpressionImpl<T>> parse_op_right(OpPrecedence expr_precedence, std::shared_ptr<ExpressionImpl<T>> lhs);
-    std::shared_ptr<ExpressionImpl<T>> parse_expression();
+    Ref<ExpressionImpl<T>> parse_real_number();
+    Ref<ExpressionImpl<T>> parse_imaginary_unit();
+    Ref<ExpressionImpl<T>> parse_identifier();
+    // A number, the imaginary unit or a variable.
+    Ref<ExpressionImpl<T>> parse_primary();
+    Ref<ExpressionImpl<T>> parse_expression();
 };
 
 #endif 
\ No newline at end of file
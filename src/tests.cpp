@@ -1,5 +1,21 @@
 #include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <ranges>
+#include <sstream>
 #include "expressions/expression.hpp" 
+#include "expressions/flat_expression.hpp"
+#include "expressions/batch_evaluator.hpp"
+#include "expressions/egraph.hpp"
+#include "expressions/complex_batch_evaluator.hpp"
+#include "expressions/cost_model.hpp"
+#include "expressions/interval.hpp"
+#include "expressions/polynomial.hpp"
+#include "expressions/solver.hpp"
+#include "expressions/stream_evaluator.hpp"
+#include "expressions/vector_math.hpp"
 #include "parser/lexer.hpp"
 #include "parser/parser.hpp"
 
@@ -37,133 +53,133 @@ TEST(VariableTest, ToString) {
 
 // Тесты для класса OperationAdd
 TEST(OperationAddTest, Eval) {
-    auto left = std::make_shared<Value<long double>>(10.5L);
-    auto right = std::make_shared<Value<long double>>(20.3L);
+    auto left = make_ref<Value<long double>>(10.5L);
+    auto right = make_ref<Value<long double>>(20.3L);
     OperationAdd<long double> add(left, right);
     EXPECT_DOUBLE_EQ(add.eval(), 30.8L);
 }
 
 // Тесты для класса OperationMult
 TEST(OperationMultTest, Eval) {
-    auto left = std::make_shared<Value<long double>>(10.0L);
-    auto right = std::make_shared<Value<long double>>(20.0L);
+    auto left = make_ref<Value<long double>>(10.0L);
+    auto right = make_ref<Value<long double>>(20.0L);
     OperationMult<long double> mult(left, right);
     EXPECT_DOUBLE_EQ(mult.eval(), 200.0L);
 }
 
 TEST(OperationSubTest, Eval) {
-    auto left = std::make_shared<Value<long double>>(10.5L);
-    auto right = std::make_shared<Value<long double>>(5.2L);
+    auto left = make_ref<Value<long double>>(10.5L);
+    auto right = make_ref<Value<long double>>(5.2L);
     OperationSub<long double> sub(left, right);
     EXPECT_DOUBLE_EQ(sub.eval(), 5.3L); // 10.5 - 5.2 = 5.3
 }
 
 TEST(OperationSubTest, ToString) {
-    auto left = std::make_shared<Value<long double>>(10.5L);
-    auto right = std::make_shared<Value<long double>>(5.2L);
+    auto left = make_ref<Value<long double>>(10.5L);
+    auto right = make_ref<Value<long double>>(5.2L);
     OperationSub<long double> sub(left, right);
     EXPECT_EQ(sub.to_string(), "(10.5 - 5.2)");
 }
 
 TEST(OperationDivTest, Eval) {
-    auto left = std::make_shared<Value<long double>>(10.0L);
-    auto right = std::make_shared<Value<long double>>(2.0L);
+    auto left = make_ref<Value<long double>>(10.0L);
+    auto right = make_ref<Value<long double>>(2.0L);
     OperationDiv<long double> div(left, right);
     EXPECT_DOUBLE_EQ(div.eval(), 5.0L); // 10 / 2 = 5
 }
 
 TEST(OperationDivTest, EvalDivisionByZero) {
-    auto left = std::make_shared<Value<long double>>(10.0L);
-    auto right = std::make_shared<Value<long double>>(0.0L);
+    auto left = make_ref<Value<long double>>(10.0L);
+    auto right = make_ref<Value<long double>>(0.0L);
     OperationDiv<long double> div(left, right);
     EXPECT_THROW(div.eval(), std::runtime_error); // Деление на ноль вызывает исключение
 }
 
 TEST(OperationDivTest, ToString) {
-    auto left = std::make_shared<Value<long double>>(10.0L);
-    auto right = std::make_shared<Value<long double>>(2.0L);
+    auto left = make_ref<Value<long double>>(10.0L);
+    auto right = make_ref<Value<long double>>(2.0L);
     OperationDiv<long double> div(left, right);
     EXPECT_EQ(div.to_string(), "(10 / 2)");
 }
 
 TEST(OperationPowTest, Eval) {
-    auto left = std::make_shared<Value<long double>>(2.0L);
-    auto right = std::make_shared<Value<long double>>(3.0L);
+    auto left = make_ref<Value<long double>>(2.0L);
+    auto right = make_ref<Value<long double>>(3.0L);
     OperationPow<long double> pow(left, right);
     EXPECT_DOUBLE_EQ(pow.eval(), 8.0L); // 2^3 = 8
 }
 
 TEST(OperationPowTest, ToString) {
-    auto left = std::make_shared<Value<long double>>(2.0L);
-    auto right = std::make_shared<Value<long double>>(3.0L);
+    auto left = make_ref<Value<long double>>(2.0L);
+    auto right = make_ref<Value<long double>>(3.0L);
     OperationPow<long double> pow(left, right);
     EXPECT_EQ(pow.to_string(), "(2) ^ (3)");
 }
 
 // Тесты для класса SinFunc
 TEST(SinFuncTest, Eval) {
-    auto arg = std::make_shared<Value<long double>>(0.0L);
+    auto arg = make_ref<Value<long double>>(0.0L);
     SinFunc<long double> sinFunc(arg);
     EXPECT_DOUBLE_EQ(sinFunc.eval(), 0.0L);
 }
 
 TEST(CosFuncTest, Eval) {
-    auto arg = std::make_shared<Value<long double>>(0.0L);
+    auto arg = make_ref<Value<long double>>(0.0L);
     CosFunc<long double> cosFunc(arg);
     EXPECT_DOUBLE_EQ(cosFunc.eval(), 1.0L); // cos(0) = 1
 }
 
 TEST(CosFuncTest, ToString) {
-    auto arg = std::make_shared<Value<long double>>(0.0L);
+    auto arg = make_ref<Value<long double>>(0.0L);
     CosFunc<long double> cosFunc(arg);
     EXPECT_EQ(cosFunc.to_string(), "cos(0)");
 }
 
 TEST(LnFuncTest, Eval) {
-    auto arg = std::make_shared<Value<long double>>(1.0L);
+    auto arg = make_ref<Value<long double>>(1.0L);
     LnFunc<long double> lnFunc(arg);
     EXPECT_DOUBLE_EQ(lnFunc.eval(), 0.0L); // ln(1) = 0
 }
 
 TEST(LnFuncTest, EvalNegative) {
-    auto arg = std::make_shared<Value<long double>>(-1.0L);
+    auto arg = make_ref<Value<long double>>(-1.0L);
     LnFunc<long double> lnFunc(arg);
     EXPECT_THROW(lnFunc.eval(), std::runtime_error); // Логарифм отрицательного числа вызывает исключение
 }
 
 TEST(LnFuncTest, ToString) {
-    auto arg = std::make_shared<Value<long double>>(1.0L);
+    auto arg = make_ref<Value<long double>>(1.0L);
     LnFunc<long double> lnFunc(arg);
     EXPECT_EQ(lnFunc.to_string(), "ln(1)");
 }
 
 TEST(ExpFuncTest, Eval) {
-    auto arg = std::make_shared<Value<long double>>(0.0L);
+    auto arg = make_ref<Value<long double>>(0.0L);
     ExpFunc<long double> expFunc(arg);
     EXPECT_DOUBLE_EQ(expFunc.eval(), 1.0L); // e^0 = 1
 }
 
 TEST(ExpFuncTest, ToString) {
-    auto arg = std::make_shared<Value<long double>>(1.0L);
+    auto arg = make_ref<Value<long double>>(1.0L);
     ExpFunc<long double> expFunc(arg);
     EXPECT_EQ(expFunc.to_string(), "exp(1)");
 }
 
 TEST(DifferentiationTest, Variable) {
-    auto var = std::make_shared<Variable<long double>>("x");
+    auto var = make_ref<Variable<long double>>("x");
     auto diff = var->diff("x");
     EXPECT_DOUBLE_EQ(diff->eval(), 1.0L); // d/dx(x) = 1
 }
 
 TEST(DifferentiationTest, Constant) {
-    auto val = std::make_shared<Value<long double>>(10.0L);
+    auto val = make_ref<Value<long double>>(10.0L);
     auto diff = val->diff("x");
     EXPECT_DOUBLE_EQ(diff->eval(), 0.0L); // d/dx(10) = 0
 }
 
 TEST(DifferentiationTest, SinFunc) {
-    auto arg = std::make_shared<Variable<long double>>("x");
-    auto sinFunc = std::make_shared<SinFunc<long double>>(arg);
+    auto arg = make_ref<Variable<long double>>("x");
+    auto sinFunc = make_ref<SinFunc<long double>>(arg);
     auto diff = sinFunc->diff("x");
     EXPECT_EQ(diff->to_string(), "(cos(x) * 1)"); // d/dx(sin(x)) = cos(x)
 }
@@ -231,6 +247,1243 @@ TEST(ComplexOperations, ComplexTest) {
 }
 
 
+// Тесты для частичного вычисления
+TEST(SpecializeTest, FoldsConstantSubtrees) {
+    Expression<long double> x("x"), y("y");
+    auto expr = (x * y + Expression<long double>(2.0L) * Expression<long double>(3.0L)) * x.sin();
+    auto special = expr.specialize({{"y", 0.0L}});
+    EXPECT_EQ(special.to_string(), "(6 * sin(x))");
+}
+
+TEST(SpecializeTest, DropsDeadBranches) {
+    Expression<long double> x("x"), a("a"), b("b");
+    auto expr = a * x.sin() + b * x.cos() + (x ^ b);
+    auto special = expr.specialize({{"a", 1.0L}, {"b", 0.0L}});
+    EXPECT_EQ(special.to_string(), "(1 + sin(x))");
+    EXPECT_NEAR(special.eval_with({{"x", 0.5L}}), expr.eval_with({{"x", 0.5L}, {"a", 1.0L}, {"b", 0.0L}}), 1e-12);
+}
+
+TEST(SpecializeTest, SharesUnchangedSubtrees) {
+    auto sin_x = make_ref<SinFunc<long double>>(make_ref<Variable<long double>>("x"));
+    Ref<ExpressionImpl<long double>> expr = make_ref<OperationMult<long double>>(
+        sin_x, make_ref<Variable<long double>>("y"));
+    EXPECT_EQ(expr->specialize({}), expr);
+    EXPECT_EQ(expr->specialize({{"z", 1.0L}}), expr);
+    auto special = expr->specialize({{"y", 2.0L}});
+    EXPECT_EQ(special->to_string(), "(sin(x) * 2)");
+}
+
+// Тесты для подстановки выражений
+TEST(SubstituteTest, ReplacesVariablesSimultaneously) {
+    auto f = Expression<long double>::from_string("x * y + sin(x) + x ^ 2 * y", true);
+    auto g = f.substitute({{"x", Expression<long double>::from_string("y + 1", true)}, {"y", Expression<long double>("x")}});
+    EXPECT_NEAR(g.eval_with({{"x", 0.3L}, {"y", 0.7L}}), f.eval_with({{"x", 1.7L}, {"y", 0.3L}}), 1e-15);
+
+    // Многочлен разворачивается, только если заменяется его переменная
+    auto p = f.detect_polynomials();
+    EXPECT_EQ(p.substitute("z", Expression<long double>(5.0L)).to_string(), p.to_string());
+    auto q = p.substitute("y", Expression<long double>::from_string("sin(z)", true));
+    EXPECT_NEAR(q.eval_with({{"x", 0.3L}, {"z", 0.7L}}), f.eval_with({{"x", 0.3L}, {"y", std::sin(0.7L)}}), 1e-15);
+}
+
+TEST(SubstituteTest, ComposeStaysLinear) {
+    // f(f(...f(x))) в виде дерева имеет 2^60 узлов
+    auto f = Expression<long double>::from_string("x * x + x / 2", true);
+    Expression<long double> g("x");
+    for (int k = 0; k < 60; ++k)
+        g = f.substitute("x", g);
+    FlatExpression<long double> flat(g);
+    EXPECT_LT(flat.size(), 60u * 6);
+    long double x = 0.3L;
+    for (int k = 0; k < 60; ++k)
+        x = x * x + x / 2;
+    EXPECT_NEAR(flat.eval({{"x", 0.3L}}), x, 1e-15);
+
+    auto composed = Expression<long double>::compose(
+        {f, f.sin()}, {"x"}, {Expression<long double>::from_string("ln(y)", true)});
+    EXPECT_NEAR(composed[1].eval_with({{"y", 2.0L}}), std::sin(f.eval_with({{"x", std::log(2.0L)}})), 1e-15);
+    EXPECT_THROW(Expression<long double>::compose({f}, {"x", "y"}, {f}), std::invalid_argument);
+}
+
+
+// Тесты для обходов без рекурсии
+TEST(TraversalTest, DeepChainDoesNotOverflowStack) {
+    // Рекурсивный обход цепочки глубиной 10^6 переполняет стек вызовов
+    Expression<long double> x("x"), y("y");
+    Expression<long double> linear = x, cosines = x;
+    for (int k = 0; k < 1000000; ++k) {
+        linear = linear * y + x;
+        cosines = cosines.cos();
+    }
+    const Bindings<long double> context{{"x", 1.0L}, {"y", 0.5L}};
+    EXPECT_NEAR(linear.eval_with(context), 2.0L, 1e-12);
+    EXPECT_NEAR(linear.diff("x").eval_with(context), 2.0L, 1e-12);
+    EXPECT_NEAR(linear.detect_polynomials().eval_with(context), 2.0L, 1e-12);
+    EXPECT_NEAR(cosines.eval_with(context), 0.7390851332151607L, 1e-12);
+    EXPECT_EQ(cosines.to_string().size(), 5u * 1000000 + 1);
+    EXPECT_NO_THROW(cosines.diff("x").eval_with(context));
+}
+
+TEST(TraversalTest, SharedNodesAreVisitedOnce) {
+    // Дерево из 2^100 листьев, но DAG из 202 узлов: v = 2v - y
+    Expression<long double> v("x"), y("y");
+    for (int k = 0; k < 100; ++k)
+        v = v - (y - v);
+    const Bindings<long double> context{{"x", 3.0L}, {"y", 0.0L}};
+    const long double scale = std::ldexp(1.0L, 100);
+    EXPECT_EQ(v.eval_with(context), 3.0L * scale);
+    EXPECT_EQ(v.diff("x").eval_with(context), scale);
+    EXPECT_EQ(v.diff("y").eval_with(context), 1.0L - scale);
+}
+
+// Тесты для счётчиков ссылок
+TEST(RefCountTest, HandlesShareOneCount) {
+    struct Tracked : RefCounted {
+        explicit Tracked(bool &alive_) : alive(alive_) { alive = true; }
+        ~Tracked() { alive = false; }
+        bool &alive;
+    };
+    bool alive = false;
+    Ref<Tracked> first = make_ref<Tracked>(alive);
+    EXPECT_TRUE(alive);
+    EXPECT_EQ(first.use_count(), 1u);
+
+    Ref<Tracked> copy = first;
+    Ref<const Tracked> moved = std::move(copy);
+    EXPECT_EQ(copy, nullptr);
+    EXPECT_EQ(first.use_count(), 2u);
+    EXPECT_EQ(Ref<Tracked>::try_share(first.get()).use_count(), 3u);
+    EXPECT_EQ(first.use_count(), 2u);
+
+    first.reset();
+    EXPECT_TRUE(alive);
+    moved.reset();
+    EXPECT_FALSE(alive);
+}
+
+TEST(RefCountTest, TemporariesAreMovedAndCachesDoNotOwn) {
+    Expression<long double> x("x"), y("y");
+    // Временные операнды передаются узлам без копирования
+    auto expr = ((x + y) * x - y / x).sin() ^ Expression<long double>(2.0L);
+    const long double inner = (0.5L + 2.0L) * 0.5L - 2.0L / 0.5L;
+    EXPECT_NEAR(expr.eval_with({{"x", 0.5L}, {"y", 2.0L}}), std::sin(inner) * std::sin(inner), 1e-15);
+
+    using Node = Ref<ExpressionImpl<long double>>;
+    Node root = make_ref<OperationMult<long double>>(make_ref<SinFunc<long double>>(make_ref<Variable<long double>>(Symbol("x"))), make_ref<Variable<long double>>(Symbol("x")));
+    auto scope = std::make_shared<LazyDerivative<long double>::Scope>(Symbol("x"));
+    Node derivative = LazyDerivative<long double>::of(root, scope);
+    derivative->operand(0);
+    EXPECT_EQ(scope->derivatives.size(), 2u);
+    derivative.reset();
+    EXPECT_TRUE(scope->derivatives.empty());
+}
+
+// Тесты для построения выражений
+TEST(BuilderTest, SumAndProductMatchOperatorChains) {
+    Expression<long double> x("x"), y("y"), z("z");
+    std::vector<Expression<long double>> terms{
+        z, Expression<long double>(2.0L), x.sin(), x + y, Expression<long double>(3.0L), y * z};
+    Expression<long double> chain = terms.front();
+    for (std::size_t i = 1; i < terms.size(); ++i)
+        chain = chain + terms[i];
+    EXPECT_EQ(Expression<long double>::sum(terms).to_string(), chain.to_string());
+    EXPECT_EQ(Expression<long double>::sum(terms).to_string(), "(5 + x + y + z + sin(x) + (y * z))");
+
+    Expression<long double> factors = terms.front();
+    for (std::size_t i = 1; i < terms.size(); ++i)
+        factors = factors * terms[i];
+    EXPECT_EQ(Expression<long double>::product(terms).to_string(), factors.to_string());
+
+    EXPECT_EQ(Expression<long double>::sum(std::vector<Expression<long double>>{}).eval(), 0.0L);
+    EXPECT_EQ(Expression<long double>::product(std::vector<Expression<long double>>{}).eval(), 1.0L);
+    auto powers = std::views::iota(1, 5) | std::views::transform([&](int k) {
+        return x ^ Expression<long double>(static_cast<long double>(k));
+    });
+    EXPECT_NEAR(Expression<long double>::sum(powers).eval_with({{"x", 2.0L}}), 30.0L, 1e-15);
+    EXPECT_NEAR(Expression<long double>::product(powers).eval_with({{"x", 2.0L}}), 1024.0L, 1e-15);
+}
+
+TEST(BuilderTest, MovedOperandsKeepValues) {
+    Expression<long double> x("x"), y("y");
+    Expression<long double> a = x * y;
+    Expression<long double> b = std::move(a);
+    a = x - y;
+    Expression<long double> sum(1.0L);
+    sum += std::move(b);
+    sum -= a;
+    sum *= x + y;
+    sum /= std::move(a);
+    sum ^= Expression<long double>(2.0L);
+    sum = std::move(sum) + (x / y) * y;
+    const long double x0 = 3.0L, y0 = 2.0L;
+    const long double expected = std::pow((1 + x0 * y0 - (x0 - y0)) * (x0 + y0) / (x0 - y0), 2) + x0;
+    EXPECT_NEAR(sum.eval_with({{"x", x0}, {"y", y0}}), expected, 1e-12);
+    EXPECT_NEAR(x.eval_with({{"x", x0}}), x0, 0);
+}
+
+// Тесты для таблицы символов
+TEST(SymbolTest, InternsNamesOnce) {
+    Symbol x("x"), x_again(std::string("x")), y("y");
+    EXPECT_EQ(x, x_again);
+    EXPECT_NE(x.id(), y.id());
+    EXPECT_EQ(x.name(), "x");
+    EXPECT_EQ(SymbolTable::global().name(y.id()), "y");
+}
+
+TEST(SymbolTest, BindingsLookupById) {
+    Bindings<long double> context({{"x", 2.0L}});
+    context.bind(Symbol("y"), 3.0L);
+    ASSERT_NE(context.find("x"), nullptr);
+    EXPECT_DOUBLE_EQ(*context.find("y"), 3.0L);
+    EXPECT_EQ(context.find("unbound_symbol"), nullptr);
+}
+
+TEST(SymbolTest, LookupsDoNotInternNames) {
+    Bindings<long double> context({{"x", 2.0L}});
+    const std::size_t size = SymbolTable::global().size();
+    EXPECT_EQ(context.find("never_interned_name"), nullptr);
+    EXPECT_EQ(context.find(std::string("never_interned_name")), nullptr);
+    EXPECT_FALSE(Symbol::find("never_interned_name"));
+    const Bindings<long double> from_names(
+        std::unordered_map<std::string, long double>{{"x", 1.0L}, {"never_interned_name", 2.0L}});
+    EXPECT_DOUBLE_EQ(*from_names.find("x"), 1.0L);
+    EXPECT_EQ(SymbolTable::global().size(), size);
+    EXPECT_EQ(Symbol::find("x"), Symbol("x"));
+}
+
+TEST(SymbolTest, DiffAndEvalBySymbol) {
+    Symbol x("x");
+    Expression<long double> expr = Expression<long double>("x") * Expression<long double>("y");
+    Bindings<long double> context;
+    context.bind(x, 2.0L);
+    context.bind(Symbol("y"), 5.0L);
+    EXPECT_DOUBLE_EQ(expr.diff(x).eval_with(context), 5.0L);
+    EXPECT_DOUBLE_EQ(expr.eval_with(std::unordered_map<std::string, long double>{{"x", 2.0L}, {"y", 5.0L}}), 10.0L);
+}
+
+
+// Тесты для плоского представления
+TEST(FlatExpressionTest, MatchesVirtualHierarchy) {
+    auto expr = Expression<long double>::from_string("x ^ 2 * sin(y) / (exp(x) - ln(y))", true);
+    FlatExpression<long double> flat(expr);
+    Bindings<long double> context{{"x", 0.5L}, {"y", 2.0L}};
+    EXPECT_EQ(flat.to_string(), expr.to_string());
+    EXPECT_NEAR(flat.eval(context), expr.eval_with(context), 1e-15);
+    EXPECT_NEAR(flat.with_context({{"x", 0.5L}}).eval({{"y", 2.0L}}), expr.eval_with(context), 1e-15);
+    EXPECT_EQ(flat.to_expression().to_string(), expr.to_string());
+}
+
+TEST(FlatExpressionTest, SharesCommonSubtrees) {
+    Expression<long double> x("x");
+    auto s = x.sin();
+    FlatExpression<long double> flat(s * s + s);
+    EXPECT_EQ(flat.size(), 4u); // x, sin(x), *, +
+}
+
+TEST(FlatExpressionTest, Diff) {
+    auto expr = Expression<long double>::from_string("x * sin(x) + y ^ 3 / x", true);
+    FlatExpression<long double> flat(expr);
+    Bindings<long double> context{{"x", 0.7L}, {"y", 1.3L}};
+    EXPECT_NEAR(flat.diff("x").eval(context), expr.diff("x").eval_with(context), 1e-12);
+    EXPECT_NEAR(flat.diff("y").eval(context), expr.diff("y").eval_with(context), 1e-12);
+    EXPECT_EQ(flat.diff("z").to_string(), "0");
+}
+
+TEST(FlatExpressionTest, EvalErrors) {
+    FlatExpression<long double> flat(Expression<long double>::from_string("1 / x", true));
+    EXPECT_THROW(flat.eval({}), std::runtime_error);
+    EXPECT_THROW(flat.eval({{"x", 0.0L}}), std::runtime_error);
+}
+
+
+TEST(CompiledBundleTest, MatchesSeparateTapes) {
+    auto f = Expression<long double>::from_string("exp(x * y) * sin(x) + (x ^ 2 + y ^ 2) ^ 0.5", true);
+    std::vector<Expression<long double>> outputs{f};
+    for (const auto& partial : f.gradient({"x", "y"}))
+        outputs.push_back(partial);
+    CompiledBundle<long double> bundle(outputs);
+    ASSERT_EQ(bundle.outputs(), 3u);
+
+    // Общие узлы функции и её градиента вычисляются один раз
+    std::size_t separate = 0;
+    for (const auto& output : outputs)
+        separate += FlatExpression<long double>(output).size();
+    EXPECT_LT(bundle.size(), separate);
+
+    Bindings<long double> context{{"x", 0.7L}, {"y", 1.3L}};
+    auto values = bundle.eval(context);
+    for (std::size_t k = 0; k < outputs.size(); ++k)
+        EXPECT_EQ(values[k], FlatExpression<long double>(outputs[k]).eval(context));
+}
+
+TEST(CompiledBundleTest, DeduplicatesStructurally) {
+    // Одинаковые поддеревья из разных выражений, x * y и y * x, общие константы
+    CompiledBundle<long double> bundle({
+        Expression<long double>::from_string("sin(x * y) + 2", true),
+        Expression<long double>::from_string("sin(y * x) * 2", true),
+        Expression<long double>("x") / Expression<long double>(-0.0L) + Expression<long double>("x") / Expression<long double>(0.0L)
+    });
+    EXPECT_EQ(bundle.size(), 12u); // x, y, *, sin, 2, +, *, -0, /, 0, /, +
+    EXPECT_EQ(bundle.constants().size(), 3u);
+    EXPECT_THROW(bundle.eval({{"x", 1.0L}, {"y", 2.0L}}), std::runtime_error);
+
+    CompiledBundle<std::complex<long double>> complex({
+        Expression<std::complex<long double>>::from_string("exp(z) + z", true),
+        Expression<std::complex<long double>>::from_string("exp(z) * z", true)
+    });
+    EXPECT_EQ(complex.size(), 4u);
+    auto values = complex.eval({{"z", {0.5L, 2.0L}}});
+    std::complex<long double> z(0.5L, 2.0L);
+    EXPECT_NEAR(std::abs(values[0] - (std::exp(z) + z)), 0.0L, 1e-15);
+    EXPECT_NEAR(std::abs(values[1] - std::exp(z) * z), 0.0L, 1e-15);
+}
+
+
+// Тесты для оптимизатора на e-графе
+static std::size_t count_calls(const FlatExpression<long double>& flat) {
+    std::size_t calls = 0;
+    for (const auto& node : flat.nodes())
+        calls += node.op == OpCode::Sin || node.op == OpCode::Cos || node.op == OpCode::Ln || node.op == OpCode::Exp;
+    return calls;
+}
+
+TEST(EGraphTest, RewritesIdentities) {
+    auto optimized = [](const std::string& text) {
+        return FlatExpression<long double>(optimize(Expression<long double>::from_string(text, true)));
+    };
+    EXPECT_EQ(optimized("sin(x) ^ 2 + cos(x) ^ 2").to_string(), "1");
+    EXPECT_EQ(optimized("a * b + a * c").size(), 5u);
+    EXPECT_EQ(count_calls(optimized("exp(x) * exp(y)")), 1u);
+    EXPECT_EQ(count_calls(optimized("ln(x) + ln(y) + ln(z)")), 1u);
+    EXPECT_EQ(count_calls(optimized("exp(ln(x)) * ln(exp(y))")), 0u);
+
+    // ln(a) + ln(b) != ln(a * b) для комплексных чисел
+    auto complex = optimize(Expression<std::complex<long double>>::from_string("ln(a) + ln(b)", true));
+    Bindings<std::complex<long double>> context{{"a", {-1.0L, 1.0L}}, {"b", {-1.0L, 1.0L}}};
+    EXPECT_NEAR(std::abs(complex.eval_with(context) - 2.0L * std::log(std::complex<long double>(-1.0L, 1.0L))), 0.0L, 1e-15);
+}
+
+TEST(EGraphTest, CheaperDerivativeSameValue) {
+    auto f = Expression<long double>::from_string("exp(x ^ 2) * sin(x) / (1 + x ^ 2) + sin(x) * cos(x)", true);
+    auto derivative = f.diff("x");
+    EGraph<long double> graph(derivative);
+    auto report = graph.saturate();
+    EXPECT_TRUE(report.saturated);
+    FlatExpression<long double> before(derivative), after = graph.extract();
+    EXPECT_LT(count_calls(after), count_calls(before));
+    EXPECT_LT(after.size(), before.size());
+    for (long double x : {-2.0L, -0.3L, 0.0L, 0.7L, 1.9L})
+        EXPECT_NEAR(after.eval({{"x", x}}), before.eval({{"x", x}}), 1e-15L * (1 + std::fabs(before.eval({{"x", x}}))));
+}
+
+TEST(EGraphTest, RespectsBudget) {
+    std::string names = "abcdefghijkl", text = "sin(a)";
+    for (std::size_t i = 1; i < names.size(); ++i)
+        text += std::string(" + sin(") + names[i] + ") * " + names[i - 1];
+    auto expr = Expression<long double>::from_string(text, true);
+    EGraph<long double> graph(expr);
+    auto report = graph.saturate({.max_iterations = 50, .max_nodes = 1000});
+    EXPECT_FALSE(report.saturated);
+    EXPECT_LT(report.nodes, 2000u);
+    Bindings<long double> context;
+    for (std::size_t i = 0; i < names.size(); ++i)
+        context.bind(std::string(1, names[i]), 0.1L * (i + 1));
+    EXPECT_NEAR(graph.extract().eval(context), expr.eval_with(context), 1e-15);
+}
+
+// Тесты для модели стоимости
+TEST(CostModelTest, CountsTapeOperations) {
+    // Листья не объединяются при компиляции: x, sin, x, 3, x^3 (два умножения),
+    // произведение, x, y, деление, сумма
+    auto expr = Expression<long double>::from_string("sin(x) * x ^ 3 + x / y", true);
+    auto report = CostModel::defaults().estimate(expr);
+    EXPECT_EQ(report.nodes, 10u);
+    EXPECT_EQ(report.flops, 5u);
+    EXPECT_EQ(report.transcendental, 1u);
+    EXPECT_EQ(report.depth, 4u);
+    EXPECT_EQ(report.memory_bytes, 10 * sizeof(FlatNode) + 23 * sizeof(long double));
+
+    auto complex = CostModel::defaults().estimate(Expression<std::complex<long double>>::from_string("sin(x) * x ^ 3 + x / y", true));
+    EXPECT_EQ(complex.memory_bytes, 10 * sizeof(FlatNode) + 23 * sizeof(std::complex<long double>));
+}
+
+TEST(CostModelTest, SaveLoadAndCustomWeights) {
+    CostModel model = CostModel::defaults();
+    model[OpCode::Sin] = 1000.0;
+    model[OpCode::PowInt] = 2.5;
+    std::string path = testing::TempDir() + "cost_model.txt";
+    model.save(path);
+    CostModel loaded = CostModel::load(path);
+    for (std::size_t op = 0; op < CostModel::opcode_count; ++op)
+        EXPECT_DOUBLE_EQ(loaded.cost(OpCode(op), 5), model.cost(OpCode(op), 5));
+    // x^5 = x^4 * x: три умножения, x^-2: одно умножение и деление
+    EXPECT_DOUBLE_EQ(loaded.cost(OpCode::PowInt, 5), 7.5);
+    EXPECT_DOUBLE_EQ(loaded.cost(OpCode::PowInt, static_cast<std::uint32_t>(-2)), 2.5 + loaded.cost(OpCode::Div));
+
+    auto report = loaded.estimate(Expression<long double>::from_string("sin(x) + sin(y)", true));
+    EXPECT_DOUBLE_EQ(report.nanoseconds, 2000.0 + loaded.cost(OpCode::Add) + 2 * loaded.cost(OpCode::Var));
+    EXPECT_THROW(CostModel::load(path + ".missing"), std::runtime_error);
+}
+
+
+// Тесты для n-арных сумм и произведений
+TEST(NaryTest, FlattensAssociativeChains) {
+    auto expr = Expression<long double>::from_string("sin(x) + y + 2 + x + 3", true);
+    EXPECT_EQ(expr.to_string(), "(5 + x + y + sin(x))");
+    auto product = Expression<long double>::from_string("2 * y * x * 3 * cos(x)", true);
+    EXPECT_EQ(product.to_string(), "(6 * x * y * cos(x))");
+}
+
+TEST(NaryTest, LongSumStaysFlat) {
+    Expression<long double> x("x");
+    Expression<long double> sum(0.0L);
+    for (int k = 1; k <= 10000; ++k) {
+        sum += Expression<long double>(static_cast<long double>(k)) * (x ^ Expression<long double>(2.0L));
+    }
+    Bindings<long double> context{{"x", 0.5L}};
+    EXPECT_NEAR(sum.eval_with(context), 50005000.0L * 0.25L, 1e-6);
+    EXPECT_NEAR(sum.diff("x").eval_with(context), 50005000.0L, 1e-6);
+    EXPECT_NEAR(FlatExpression<long double>(sum).eval(context), 50005000.0L * 0.25L, 1e-6);
+}
+
+TEST(NaryTest, InPlaceChainMergesVariables) {
+    Expression<long double> x("x"), y("y"), z("z");
+    // += дописывает в тот же узел; z и x приходят не по порядку имён
+    std::vector<Expression<long double>> terms{
+        y.cos(), z, Expression<long double>(2.0L), x, x * y, y, Expression<long double>(1.0L), x};
+    Expression<long double> sum = terms.front(), product = terms.front();
+    for (std::size_t i = 1; i < terms.size(); ++i) {
+        sum += terms[i];
+        product *= terms[i];
+    }
+    EXPECT_EQ(sum.to_string(), Expression<long double>::sum(terms).to_string());
+    EXPECT_EQ(sum.to_string(), "(3 + x + x + y + z + cos(y) + (x * y))");
+    EXPECT_EQ(product.to_string(), Expression<long double>::product(terms).to_string());
+    EXPECT_EQ(product.to_string(), "(2 * x * x * x * y * y * z * cos(y))");
+    EXPECT_NEAR(sum.eval_with({{"x", 1.0L}, {"y", 2.0L}, {"z", 3.0L}}),
+                3 + 1 + 1 + 2 + 3 + std::cos(2.0L) + 2, 1e-15);
+}
+
+TEST(NaryTest, VariablesOrderedByName) {
+    // Порядок не зависит от того, какой символ создан раньше; числа в
+    // именах сравниваются по значению
+    Symbol later("zz_order");
+    EXPECT_EQ(Expression<long double>::from_string("zz_order + aa_order", false).to_string(), "(aa_order + zz_order)");
+    EXPECT_EQ(Expression<long double>::from_string("zz_order * 2 * aa_order", false).to_string(), "(2 * aa_order * zz_order)");
+    const Expression<long double> x10("x10"), x2("x2"), x01("x01"), x1("x1"), x("x");
+    EXPECT_EQ((x10 + x2 + x01 + x1 + x).to_string(), "(x + x01 + x1 + x2 + x10)");
+
+    Expression<long double> sum(0.0L);
+    for (int k = 12; k-- > 0;) {
+        std::string name = "n";
+        name += std::to_string(k);
+        sum += Expression<long double>(name);
+    }
+    EXPECT_EQ(sum.to_string(), "(0 + n0 + n1 + n2 + n3 + n4 + n5 + n6 + n7 + n8 + n9 + n10 + n11)");
+}
+
+TEST(NaryTest, ProductRuleFanOut) {
+    auto expr = Expression<long double>::from_string("x * sin(x) * y * exp(x)", true);
+    Bindings<long double> context{{"x", 0.3L}, {"y", 1.7L}};
+    long double x = 0.3L, y = 1.7L;
+    long double expected = y * (std::sin(x) * std::exp(x) + x * std::cos(x) * std::exp(x) + x * std::sin(x) * std::exp(x));
+    EXPECT_NEAR(expr.diff("x").eval_with(context), expected, 1e-12);
+    EXPECT_NEAR(expr.diff("y").eval_with(context), x * std::sin(x) * std::exp(x), 1e-12);
+    EXPECT_NEAR(expr.diff("z").eval_with(context), 0.0L, 1e-15);
+}
+
+TEST(NaryTest, DiffOfBinaryProductKeepsForm) {
+    Expression<long double> x("x");
+    EXPECT_EQ((x * x.sin()).diff("x").to_string(), "((1 * sin(x)) + (x * (cos(x) * 1)))");
+}
+
+
+// Тесты для полиномов
+TEST(PolynomialTest, DetectsPolynomialSubtrees) {
+    auto expr = Expression<long double>::from_string("(x + 1) ^ 3 - 3 * x + sin(2 * y * y)", true);
+    auto detected = expr.detect_polynomials();
+    EXPECT_EQ(detected.to_string(), "((x ^ 3 + 3 * x ^ 2 + 1) + sin((2 * y ^ 2)))");
+    Bindings<long double> context{{"x", -1.5L}, {"y", 0.25L}};
+    EXPECT_NEAR(detected.eval_with(context), expr.eval_with(context), 1e-12);
+    EXPECT_NEAR(FlatExpression<long double>(detected).eval(context), expr.eval_with(context), 1e-12);
+    // Отрицательный коэффициент печатается как знак, без "+ -"
+    EXPECT_EQ(Expression<long double>::from_string("x ^ 2 - 3 * x * y - 1", true).detect_polynomials().to_string(),
+              "(x ^ 2 - 3 * x * y - 1)");
+}
+
+TEST(PolynomialTest, ClosedFormDerivatives) {
+    auto poly = Expression<long double>::from_string("x ^ 5 * y + 2 * x * y ^ 2 - 7", true).detect_polynomials();
+    EXPECT_EQ(poly.diff("x").to_string(), "(5 * x ^ 4 * y + 2 * y ^ 2)");
+    auto derivative = poly;
+    for (int order = 0; order < 5; ++order) {
+        derivative = derivative.diff("x");
+    }
+    EXPECT_EQ(derivative.to_string(), "(120 * y)");
+    EXPECT_EQ(derivative.diff("x").to_string(), "0");
+}
+
+TEST(PolynomialTest, PartialBinding) {
+    auto poly = Expression<long double>::from_string("x ^ 2 * y + x * y ^ 3", true).detect_polynomials();
+    EXPECT_EQ(poly.specialize({{"y", 2.0L}}).to_string(), "(2 * x ^ 2 + 8 * x)");
+    EXPECT_NEAR(poly.eval_with({{"x", 3.0L}, {"y", -2.0L}}), -18.0L - 24.0L, 1e-12);
+    EXPECT_THROW(poly.eval(), std::runtime_error);
+}
+
+// Группировка схемы Горнера строится один раз; проверяем её на разреженном
+// полиноме от трёх переменных
+TEST(PolynomialTest, PrecomputedHornerMatchesTree) {
+    auto expr = Expression<long double>::from_string(
+        "3 * x ^ 4 * z + x ^ 4 * y ^ 2 - 2 * x * y * z ^ 3 + 5 * y ^ 7 + z - 11", true
+    );
+    auto poly = expr.detect_polynomials();
+    for (long double x : {-1.5L, 0.0L, 0.75L}) {
+        for (long double z : {-2.0L, 0.5L}) {
+            Bindings<long double> context{{"x", x}, {"y", 1.25L}, {"z", z}};
+            EXPECT_NEAR(poly.eval_with(context), expr.eval_with(context), 1e-12);
+        }
+    }
+}
+
+TEST(PolynomialTest, KeepsNonPolynomialPowers) {
+    auto expr = Expression<long double>::from_string("x ^ y + x ^ 0.5", true);
+    EXPECT_EQ(expr.detect_polynomials().to_string(), expr.to_string());
+}
+
+// Деление на константу округляется один раз, как в исходном дереве
+TEST(PolynomialTest, DivisionByConstantRoundsOnce) {
+    auto expr = Expression<long double>::from_string("(7 * x) / 3", true);
+    EXPECT_EQ(expr.detect_polynomials().eval_with({{"x", 1.0L}}), 7.0L / 3.0L);
+    EXPECT_EQ(expr.detect_polynomials().eval_with({{"x", 1.0L}}), expr.eval_with({{"x", 1.0L}}));
+}
+
+
+// Тесты для быстрых путей возведения в степень
+TEST(PowFastPathTest, IntegerExponentsWithNegativeBase) {
+    Expression<long double> x("x");
+    EXPECT_NEAR((x ^ Expression<long double>(3.0L)).eval_with({{"x", -2.0L}}), -8.0L, 1e-15);
+    EXPECT_NEAR((x ^ Expression<long double>(-2.0L)).eval_with({{"x", -2.0L}}), 0.25L, 1e-15);
+    EXPECT_NEAR((x ^ Expression<long double>(0.0L)).eval_with({{"x", -2.0L}}), 1.0L, 1e-15);
+}
+
+TEST(PowFastPathTest, ConstantExponentDiffHasNoLogarithm) {
+    Expression<long double> x("x");
+    auto derivative = (x ^ Expression<long double>(3.0L)).diff("x");
+    EXPECT_EQ(derivative.to_string().find("ln"), std::string::npos);
+    EXPECT_NEAR(derivative.eval_with({{"x", -2.0L}}), 12.0L, 1e-12);
+    auto root = (x ^ Expression<long double>(0.5L)).diff("x");
+    EXPECT_EQ(root.to_string().find("ln"), std::string::npos);
+    EXPECT_NEAR(root.eval_with({{"x", 4.0L}}), 0.25L, 1e-15);
+    // x ^ 1 даёт производную основания, без (x) ^ (0)
+    auto linear = ((x * x) ^ Expression<long double>(1.0L)).diff("x");
+    EXPECT_EQ(linear.to_string().find("^"), std::string::npos);
+    EXPECT_NEAR(linear.eval_with({{"x", 0.0L}}), 0.0L, 1e-15);
+    EXPECT_NEAR(linear.eval_with({{"x", 3.0L}}), 6.0L, 1e-15);
+}
+
+TEST(PowFastPathTest, FlatTapeMatchesTree) {
+    auto expr = Expression<long double>::from_string("x ^ 3 + x ^ 0.5 / y ^ 2 + x ^ y", true);
+    Bindings<long double> context{{"x", 2.25L}, {"y", 1.5L}};
+    FlatExpression<long double> flat(expr);
+    EXPECT_NEAR(flat.eval(context), expr.eval_with(context), 1e-15);
+    EXPECT_NEAR(flat.diff("x").eval(context), expr.diff("x").eval_with(context), 1e-12);
+    EXPECT_NEAR(flat.diff("y").eval(context), expr.diff("y").eval_with(context), 1e-12);
+    EXPECT_NEAR(flat.to_expression().eval_with(context), expr.eval_with(context), 1e-15);
+}
+
+
+// Тесты для градиента и матрицы Якоби
+TEST(GradientTest, MatchesDirectDerivatives) {
+    auto expr = Expression<long double>::from_string(
+        "x * y * sin(x) + x ^ y / z - cos(z * x) + ln(y) * exp(x * z) + (x + y) ^ 3", true);
+    std::vector<Symbol> vars{"x", "y", "z", "w"};
+    Bindings<long double> context{{"x", 0.7L}, {"y", 1.3L}, {"z", 2.1L}, {"w", 5.0L}};
+    auto gradient = expr.gradient(vars);
+    ASSERT_EQ(gradient.size(), vars.size());
+    for (std::size_t i = 0; i < vars.size(); ++i) {
+        EXPECT_NEAR(gradient[i].eval_with(context), expr.diff(vars[i]).eval_with(context), 1e-12);
+    }
+    EXPECT_EQ(gradient[3].to_string(), "0");
+
+    auto poly = expr.detect_polynomials().gradient(vars);
+    for (std::size_t i = 0; i < vars.size(); ++i) {
+        EXPECT_NEAR(poly[i].eval_with(context), gradient[i].eval_with(context), 1e-12);
+    }
+}
+
+TEST(GradientTest, JacobianOfSeveralOutputs) {
+    Expression<long double> x("x"), y("y");
+    auto shared = (x * y).sin();
+    std::vector<Expression<long double>> outputs{shared * x, shared + y, x / y};
+    auto jacobian = Expression<long double>::jacobian(outputs, {"x", "y"});
+    Bindings<long double> context{{"x", 0.4L}, {"y", 1.9L}};
+    ASSERT_EQ(jacobian.size(), 3u);
+    for (std::size_t row = 0; row < outputs.size(); ++row) {
+        EXPECT_NEAR(jacobian[row][0].eval_with(context), outputs[row].diff("x").eval_with(context), 1e-12);
+        EXPECT_NEAR(jacobian[row][1].eval_with(context), outputs[row].diff("y").eval_with(context), 1e-12);
+    }
+}
+
+TEST(GradientTest, SizeStaysLinear) {
+    const int n = 64;
+    std::vector<Symbol> vars;
+    Expression<long double> product(1.0L);
+    Bindings<long double> context;
+    for (int i = 0; i < n; ++i) {
+        std::string name = "v";
+        name += std::to_string(i);
+        vars.emplace_back(name);
+        product *= Expression<long double>(name).sin();
+        context.bind(name, 1.0L + i / 100.0L);
+    }
+    auto gradient = product.gradient(vars);
+    Expression<long double> all(0.0L);
+    for (const auto &partial : gradient) {
+        all += partial;
+    }
+    EXPECT_LE(FlatExpression<long double>(all).size(), 6 * FlatExpression<long double>(product).size());
+    EXPECT_NEAR(gradient[17].eval_with(context), product.diff(vars[17]).eval_with(context), 1e-12);
+}
+
+
+// Тесты для производных высших порядков и матрицы Гессе
+TEST(HigherOrderTest, DiffWithOrder) {
+    auto expr = Expression<long double>::from_string("x ^ 5 * exp(x) + sin(x * y)", true);
+    Bindings<long double> context{{"x", 0.6L}, {"y", 1.4L}};
+    auto repeated = expr.diff("x").diff("x").diff("x");
+    EXPECT_NEAR(expr.diff("x", 3).eval_with(context), repeated.eval_with(context), 1e-10);
+    EXPECT_EQ(expr.diff("x", 0).to_string(), expr.to_string());
+
+    Expression<long double> x("x");
+    EXPECT_EQ((x ^ Expression<long double>(3.0L)).diff("x", 3).to_string(), "6");
+    EXPECT_EQ((x ^ Expression<long double>(3.0L)).diff("x", 4).to_string(), "0");
+}
+
+TEST(HigherOrderTest, StagesStaySmall) {
+    auto expr = Expression<long double>::from_string("x * sin(x) * exp(x) * ln(x)", true);
+    auto repeated = expr;
+    for (int order = 0; order < 6; ++order) {
+        repeated = repeated.diff("x");
+    }
+    auto staged = expr.diff("x", 6);
+    EXPECT_LT(FlatExpression<long double>(staged).size(), FlatExpression<long double>(repeated).size());
+    Bindings<long double> context{{"x", 1.3L}};
+    EXPECT_NEAR(staged.eval_with(context), repeated.eval_with(context), 1e-8);
+}
+
+TEST(HigherOrderTest, HessianMatchesNestedDiff) {
+    auto expr = Expression<long double>::from_string("x * y ^ 2 * z + sin(x * z) + exp(y) / z + x ^ y", true);
+    std::vector<Symbol> vars{"x", "y", "z"};
+    Bindings<long double> context{{"x", 1.2L}, {"y", 0.8L}, {"z", 1.7L}};
+    auto hessian = expr.hessian(vars);
+    for (std::size_t i = 0; i < vars.size(); ++i) {
+        for (std::size_t j = 0; j < vars.size(); ++j) {
+            EXPECT_NEAR(hessian[i][j].eval_with(context),
+                        expr.diff(vars[i]).diff(vars[j]).eval_with(context), 1e-10);
+        }
+    }
+    EXPECT_EQ(hessian[2][0].to_string(), hessian[0][2].to_string());
+    EXPECT_EQ(Expression<long double>::from_string("x * y + 3", true).hessian({"x", "y"})[0][0].to_string(), "0");
+}
+
+TEST(HigherOrderTest, HessianVectorProduct) {
+    auto expr = Expression<long double>::from_string(
+        "x * y ^ 2 * z + cos(x * z) + ln(y) / z + x ^ y + x ^ 3 * z ^ 0.5 + exp(z - y)", true);
+    std::vector<Symbol> vars{"x", "y", "z"};
+    std::vector<long double> direction{0.3L, -1.1L, 2.0L};
+    Bindings<long double> context{{"x", 1.2L}, {"y", 0.8L}, {"z", 1.7L}};
+    auto hessian = expr.hessian(vars);
+    auto product = FlatExpression<long double>(expr).hessian_vector_product(context, vars, direction);
+    ASSERT_EQ(product.size(), vars.size());
+    for (std::size_t i = 0; i < vars.size(); ++i) {
+        long double expected = 0.0L;
+        for (std::size_t j = 0; j < vars.size(); ++j) {
+            expected += hessian[i][j].eval_with(context) * direction[j];
+        }
+        EXPECT_NEAR(product[i], expected, 1e-10);
+    }
+    EXPECT_THROW(FlatExpression<long double>(expr).hessian_vector_product(context, vars, {1.0L}), std::invalid_argument);
+
+    // Лента из одной переменной: номер символа больше длины ленты
+    FlatExpression<long double> leaf(Expression<long double>("hvp_leaf"));
+    auto zero = leaf.hessian_vector_product({{"hvp_leaf", 2.0L}}, {"hvp_leaf"}, {1.0L});
+    ASSERT_EQ(zero.size(), 1u);
+    EXPECT_EQ(zero[0], 0.0L);
+}
+
+
+// Тесты для арифметики рядов Тейлора
+TEST(TaylorTest, KnownSeries) {
+    FlatExpression<long double> exp(Expression<long double>::from_string("exp(x)", true));
+    auto coefficients = exp.taylor_coefficients({{"x", 0.0L}}, "x", 10);
+    ASSERT_EQ(coefficients.size(), 11u);
+    long double factorial = 1.0L;
+    for (std::size_t k = 0; k <= 10; ++k) {
+        if (k > 0) factorial *= k;
+        EXPECT_NEAR(coefficients[k], 1.0L / factorial, 1e-15);
+    }
+
+    FlatExpression<long double> cube(Expression<long double>::from_string("x ^ 3 * y", true));
+    auto cubic = cube.taylor_coefficients({{"x", 0.0L}, {"y", 2.0L}}, "x", 4);
+    std::vector<long double> expected{0.0L, 0.0L, 0.0L, 2.0L, 0.0L};
+    for (std::size_t k = 0; k < expected.size(); ++k) {
+        EXPECT_NEAR(cubic[k], expected[k], 1e-15);
+    }
+}
+
+TEST(TaylorTest, MatchesSymbolicDerivatives) {
+    auto expr = Expression<long double>::from_string(
+        "exp(x) * sin(x) / (1 + x ^ 2) + ln(x) * x ^ 0.5 - cos(x * y) + x ^ x + x ^ 1.5", true)
+        + (Expression<long double>("x") ^ Expression<long double>(-2.0L));
+    Bindings<long double> context{{"x", 0.8L}, {"y", 1.3L}};
+    auto coefficients = FlatExpression<long double>(expr).taylor_coefficients(context, "x", 5);
+    long double factorial = 1.0L;
+    for (std::size_t k = 0; k <= 5; ++k) {
+        if (k > 0) factorial *= k;
+        long double expected = expr.diff("x", k).eval_with(context);
+        EXPECT_NEAR(coefficients[k] * factorial, expected, 1e-9 * (1.0L + std::abs(expected)));
+    }
+}
+
+
+// Тесты для ленивых производных
+TEST(LazyDerivativeTest, MatchesEagerDiff) {
+    auto expr = Expression<long double>::from_string(
+        "x * sin(x * y) + exp(x) / (1 + y ^ 2) + x ^ y + ln(x) * (x + 3) ^ 3", true);
+    Bindings<long double> context{{"x", 0.9L}, {"y", 1.6L}};
+    auto lazy = expr.lazy_diff("x");
+    EXPECT_NEAR(lazy.eval_with(context), expr.diff("x").eval_with(context), 1e-12);
+    EXPECT_NEAR(lazy.lazy_diff("y").eval_with(context), expr.diff("x").diff("y").eval_with(context), 1e-12);
+    EXPECT_NEAR(lazy.diff("y").eval_with(context), expr.diff("x").diff("y").eval_with(context), 1e-12);
+    EXPECT_NEAR(FlatExpression<long double>(lazy).eval(context), expr.diff("x").eval_with(context), 1e-12);
+    EXPECT_NEAR(lazy.simplify().eval_with(context), expr.diff("x").eval_with(context), 1e-12);
+    EXPECT_EQ(Expression<long double>("y").lazy_diff("x").to_string(), "0");
+}
+
+TEST(LazyDerivativeTest, ExpandsOnlyWhatIsReached) {
+    using Node = Ref<ExpressionImpl<long double>>;
+    Node x = make_ref<Variable<long double>>(Symbol("x"));
+    Node left = make_ref<SinFunc<long double>>(x);
+    Node right = make_ref<ExpFunc<long double>>(x);
+    Node root = make_ref<OperationMult<long double>>(left, right);
+
+    auto scope = std::make_shared<LazyDerivative<long double>::Scope>(Symbol("x"));
+    auto derivative = LazyDerivative<long double>::of(root, scope);
+    const auto *lazy = dynamic_cast<const LazyDerivative<long double> *>(derivative.get());
+    ASSERT_NE(lazy, nullptr);
+    EXPECT_FALSE(lazy->is_expanded());
+
+    derivative->operand(0);
+    EXPECT_TRUE(lazy->is_expanded());
+    auto left_derivative = Ref<LazyDerivative<long double>>::try_share(scope->derivatives.at(left.get()));
+    ASSERT_NE(left_derivative, nullptr);
+    EXPECT_FALSE(static_cast<const LazyDerivative<long double> &>(*left_derivative).is_expanded());
+
+    EXPECT_NEAR(derivative->with_context({{"x", 0.5L}})->eval(), std::exp(0.5L) * (std::cos(0.5L) + std::sin(0.5L)), 1e-15);
+    EXPECT_TRUE(static_cast<const LazyDerivative<long double> &>(*left_derivative).is_expanded());
+}
+
+TEST(LazyDerivativeTest, SharedSubtreesExpandOnce) {
+    Expression<long double> x("x");
+    auto shared = (x * x).sin();
+    auto expr = shared * shared + shared.exp();
+    auto lazy = expr.lazy_diff("x");
+    Bindings<long double> context{{"x", 0.7L}};
+    EXPECT_NEAR(lazy.eval_with(context), expr.diff("x").eval_with(context), 1e-12);
+    EXPECT_LT(FlatExpression<long double>(lazy).size(), FlatExpression<long double>(expr.diff("x")).size());
+}
+
+// Тесты для векторных трансцендентных функций
+// Наибольшая ошибка в ulp относительно эталона в long double
+static double max_ulp_error(const std::vector<double>& got, const std::vector<long double>& expected) {
+    double worst = 0;
+    for (std::size_t i = 0; i < got.size(); ++i) {
+        double rounded = static_cast<double>(expected[i]);
+        double ulp = std::nextafter(std::abs(rounded), INFINITY) - std::abs(rounded);
+        worst = std::max(worst, static_cast<double>(std::abs(got[i] - expected[i]) / ulp));
+    }
+    return worst;
+}
+
+static double tier_bound(Accuracy accuracy) {
+    switch (accuracy) {
+        case Accuracy::Ulp1: return 1.0;
+        case Accuracy::Ulp4: return 4.0;
+        case Accuracy::Fast: return 1e9;  // около 1e-7 относительной ошибки
+    }
+    return 0;
+}
+
+TEST(VectorMathTest, UnaryKernelsWithinTier) {
+    const std::size_t n = 100000;
+    std::mt19937_64 generator(7);
+    std::vector<double> trig(n), exponent(n), positive(n), out(n);
+    std::vector<long double> expected(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        trig[i] = std::uniform_real_distribution<double>(-100, 100)(generator);
+        exponent[i] = std::uniform_real_distribution<double>(-700, 700)(generator);
+        positive[i] = std::exp(std::uniform_real_distribution<double>(-300, 300)(generator));
+    }
+    for (Accuracy accuracy : {Accuracy::Ulp1, Accuracy::Ulp4, Accuracy::Fast}) {
+        vector_sin(trig.data(), out.data(), n, accuracy);
+        std::transform(trig.begin(), trig.end(), expected.begin(), [](double x) { return std::sin(static_cast<long double>(x)); });
+        EXPECT_LE(max_ulp_error(out, expected), tier_bound(accuracy));
+        vector_cos(trig.data(), out.data(), n, accuracy);
+        std::transform(trig.begin(), trig.end(), expected.begin(), [](double x) { return std::cos(static_cast<long double>(x)); });
+        EXPECT_LE(max_ulp_error(out, expected), tier_bound(accuracy));
+        vector_exp(exponent.data(), out.data(), n, accuracy);
+        std::transform(exponent.begin(), exponent.end(), expected.begin(), [](double x) { return std::exp(static_cast<long double>(x)); });
+        EXPECT_LE(max_ulp_error(out, expected), tier_bound(accuracy));
+        vector_log(positive.data(), out.data(), n, accuracy);
+        std::transform(positive.begin(), positive.end(), expected.begin(), [](double x) { return std::log(static_cast<long double>(x)); });
+        EXPECT_LE(max_ulp_error(out, expected), tier_bound(accuracy));
+    }
+}
+
+TEST(VectorMathTest, PowWithinTier) {
+    const std::size_t n = 100000;
+    std::mt19937_64 generator(11);
+    std::vector<double> x(n), y(n), out(n);
+    std::vector<long double> expected(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        x[i] = std::exp(std::uniform_real_distribution<double>(-20, 20)(generator));
+        y[i] = std::uniform_real_distribution<double>(-50, 50)(generator);
+        expected[i] = std::pow(static_cast<long double>(x[i]), static_cast<long double>(y[i]));
+    }
+    for (Accuracy accuracy : {Accuracy::Ulp1, Accuracy::Ulp4, Accuracy::Fast}) {
+        vector_pow(x.data(), y.data(), out.data(), n, accuracy);
+        EXPECT_LE(max_ulp_error(out, expected), tier_bound(accuracy));
+    }
+}
+
+TEST(VectorMathTest, SpecialValuesMatchLibm) {
+    const double inf = std::numeric_limits<double>::infinity(), nan = std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> x{0.0, -0.0, 1e-310, -1.0, inf, -inf, nan, 1e300, -800.0, 800.0};
+    std::vector<double> y{2.0, 0.5, -3.0, 3.0, -1.0, 2.0, 1.0, 0.5, 2.0, inf};
+    std::vector<double> out(x.size());
+    auto same = [](double a, double b) { return (std::isnan(a) && std::isnan(b)) || a == b; };
+    for (Accuracy accuracy : {Accuracy::Ulp1, Accuracy::Ulp4, Accuracy::Fast}) {
+        vector_sin(x.data(), out.data(), x.size(), accuracy);
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            if (!std::isfinite(x[i]) || std::abs(x[i]) > 1e5) {
+                EXPECT_TRUE(same(out[i], std::sin(x[i]))) << x[i];
+            }
+        }
+        vector_exp(x.data(), out.data(), x.size(), accuracy);
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            if (!(std::abs(x[i]) < 700)) {
+                EXPECT_TRUE(same(out[i], std::exp(x[i]))) << x[i];
+            }
+        }
+        vector_log(x.data(), out.data(), x.size(), accuracy);
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            if (!(x[i] >= 1e-300)) {
+                EXPECT_TRUE(same(out[i], std::log(x[i]))) << x[i];
+            }
+        }
+        vector_pow(x.data(), y.data(), out.data(), x.size(), accuracy);
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            if (!(x[i] >= 1e-300)) {
+                EXPECT_TRUE(same(out[i], std::pow(x[i], y[i]))) << x[i] << " ^ " << y[i];
+            }
+        }
+    }
+}
+
+// Тесты для пакетного вычисления
+TEST(BatchEvaluatorTest, MatchesScalarEval) {
+    auto expr = Expression<long double>::from_string(
+        "x * sin(x * y) + exp(x) / (1 + y ^ 2) + x ^ y + ln(x) * (x + 3) ^ 3 - cos(y) ^ 0.5", true);
+    FlatExpression<long double> flat(expr);
+    const std::size_t n = 1000;  // не кратно размеру блока
+    std::vector<double> xs(n), ys(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        xs[i] = 0.1 + 2.0 * i / n;
+        ys[i] = 1.3 - 1.0 * i / n;
+    }
+    for (Accuracy accuracy : {Accuracy::Ulp1, Accuracy::Ulp4, Accuracy::Fast}) {
+        BatchEvaluator batch(flat, accuracy);
+        auto out = batch.eval({{"x", xs.data()}, {"y", ys.data()}}, n);
+        ASSERT_EQ(out.size(), n);
+        for (std::size_t i = 0; i < n; ++i) {
+            long double expected = flat.eval({{"x", xs[i]}, {"y", ys[i]}});
+            EXPECT_NEAR(out[i], expected, 1e-6 * std::abs(expected)) << i;
+        }
+    }
+}
+
+TEST(BatchEvaluatorTest, IeeeResultsAndUnboundVariable) {
+    BatchEvaluator batch(FlatExpression<long double>(Expression<long double>::from_string("1 / x + ln(x + 2)", true)));
+    std::vector<double> xs{0.0, -3.0, 1.0};
+    auto out = batch.eval({{"x", xs.data()}}, xs.size());
+    EXPECT_TRUE(std::isinf(out[0]));
+    EXPECT_TRUE(std::isnan(out[1]));
+    EXPECT_DOUBLE_EQ(out[2], 1.0 + std::log(3.0));
+    EXPECT_THROW(batch.eval({{"y", xs.data()}}, xs.size()), std::runtime_error);
+    EXPECT_TRUE(batch.eval({{"x", xs.data()}}, 0).empty());
+}
+
+TEST(BatchEvaluatorTest, CheckedEvalReportsBadPoints) {
+    BatchEvaluator batch(FlatExpression<long double>(
+        Expression<long double>::from_string("1 / x + ln(x + 2) + (x + 3) ^ 0.5", true)));
+    std::vector<double> xs(1000, 1.0);
+    xs[3] = 0.0;     // деление на ноль
+    xs[300] = -2.5;  // ln от отрицательного
+    xs[700] = -5.0;  // ln и корень от отрицательного
+    std::vector<double> out(xs.size());
+    std::vector<std::uint8_t> status(xs.size());
+    EXPECT_EQ(batch.eval_checked({{"x", xs.data()}}, xs.size(), out.data(), status.data()), 3u);
+    EXPECT_EQ(status[3], BatchEvaluator::DivisionByZero);
+    EXPECT_EQ(status[300], BatchEvaluator::DomainError);
+    EXPECT_EQ(status[700], BatchEvaluator::DomainError);
+    EXPECT_TRUE(std::isnan(out[3]) && std::isnan(out[300]) && std::isnan(out[700]));
+    EXPECT_EQ(status[0], BatchEvaluator::Ok);
+    EXPECT_DOUBLE_EQ(out[0], 1.0 + std::log(3.0) + 2.0);
+
+    EXPECT_EQ(batch.eval_checked({{"y", xs.data()}}, xs.size(), out.data(), status.data()), xs.size());
+    EXPECT_EQ(status[0], BatchEvaluator::UnboundVariable);
+    EXPECT_TRUE(std::isnan(out[0]));
+}
+
+TEST(BatchEvaluatorTest, MixedPrecisionRefinesCancellation) {
+    auto expr = Expression<long double>::from_string("(1 - cos(x)) / x ^ 2 + exp(x) * y", true);
+    FlatExpression<long double> flat(expr);
+    BatchEvaluator batch(flat);
+    const std::size_t n = 1000;
+    std::vector<double> xs(n), ys(n, 0.5);
+    for (std::size_t i = 0; i < n; ++i)
+        xs[i] = i % 10 == 0 ? 1e-5 * (1 + i) : 0.5 + 1e-3 * i;  // каждая десятая точка близка к нулю
+    std::vector<double> plain(n), mixed(n);
+    batch.eval({{"x", xs.data()}, {"y", ys.data()}}, n, plain.data());
+    std::size_t refined = batch.eval_mixed({{"x", xs.data()}, {"y", ys.data()}}, n, mixed.data(), 1e-12);
+    EXPECT_GE(refined, n / 10);
+    EXPECT_LT(refined, n / 5);
+
+    double plain_worst = 0, mixed_worst = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        long double expected = flat.eval({{"x", xs[i]}, {"y", ys[i]}});
+        plain_worst = std::max(plain_worst, static_cast<double>(std::abs((plain[i] - expected) / expected)));
+        mixed_worst = std::max(mixed_worst, static_cast<double>(std::abs((mixed[i] - expected) / expected)));
+    }
+    EXPECT_GT(plain_worst, 1e-8);
+    EXPECT_LT(mixed_worst, 1e-12);
+}
+
+// Тесты для комплексного пакетного вычисления
+TEST(ComplexBatchEvaluatorTest, MatchesScalarEvalOnGrid) {
+    using C = std::complex<long double>;
+    auto expr = Expression<C>::from_string(
+        "(z ^ 3 - 1) / (3 * z ^ 2) + sin(z) * exp(z) - ln(z) * cos(z) + z ^ (0.5 + 2i) + 1 / (z - (0.25 - 0.5i)) ^ 2", true);
+    FlatExpression<C> flat(expr);
+    std::vector<double> re, im;
+    for (int row = 0; row < 40; ++row) {
+        for (int column = 0; column < 40; ++column) {
+            re.push_back(-2.0 + 4.0 * (column + 0.5) / 40);
+            im.push_back(-2.0 + 4.0 * (row + 0.5) / 40);
+        }
+    }
+    std::vector<double> out_re(re.size()), out_im(re.size());
+    for (auto mode : {ComplexBatchEvaluator::NanMode::Strict, ComplexBatchEvaluator::NanMode::Relaxed}) {
+        ComplexBatchEvaluator batch(flat, mode);
+        batch.eval({{"z", {re.data(), im.data()}}}, re.size(), out_re.data(), out_im.data());
+        for (std::size_t i = 0; i < re.size(); ++i) {
+            C expected = flat.eval({{"z", C(re[i], im[i])}});
+            EXPECT_NEAR(out_re[i], expected.real(), 1e-12 * std::abs(expected)) << i;
+            EXPECT_NEAR(out_im[i], expected.imag(), 1e-12 * std::abs(expected)) << i;
+        }
+    }
+}
+
+TEST(ComplexBatchEvaluatorTest, StrictModeRecoversInfinities) {
+    using C = std::complex<long double>;
+    FlatExpression<C> product(Expression<C>::from_string("z * w", true));
+    FlatExpression<C> quotient(Expression<C>::from_string("z / w", true));
+    const double inf = std::numeric_limits<double>::infinity(), nan = std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> z_re{inf, 1e300}, z_im{nan, 1e300}, w_re{1.0, 1e300}, w_im{1.0, 1e300};
+    ComplexBatchEvaluator::Columns columns{{"z", {z_re.data(), z_im.data()}}, {"w", {w_re.data(), w_im.data()}}};
+    double re[2], im[2];
+
+    ComplexBatchEvaluator(product, ComplexBatchEvaluator::NanMode::Strict).eval(columns, 2, re, im);
+    EXPECT_TRUE(std::isinf(re[0]) || std::isinf(im[0]));
+    ComplexBatchEvaluator(product, ComplexBatchEvaluator::NanMode::Relaxed).eval(columns, 2, re, im);
+    EXPECT_TRUE(std::isnan(re[0]) && std::isnan(im[0]));
+
+    ComplexBatchEvaluator(quotient, ComplexBatchEvaluator::NanMode::Strict).eval(columns, 2, re, im);
+    EXPECT_DOUBLE_EQ(re[1], 1.0);
+    EXPECT_DOUBLE_EQ(im[1], 0.0);
+    ComplexBatchEvaluator(quotient, ComplexBatchEvaluator::NanMode::Relaxed).eval(columns, 2, re, im);
+    EXPECT_FALSE(re[1] == 1.0);
+}
+
+TEST(ComplexBatchEvaluatorTest, PrincipalBranchLogarithm) {
+    using C = std::complex<long double>;
+    auto ln = Expression<C>::from_string("ln(z)", true);
+    C value = ln.eval_with({{"z", C(-1.0L, 0.0L)}});
+    EXPECT_NEAR(value.real(), 0.0L, 1e-15);
+    EXPECT_NEAR(value.imag(), std::acos(-1.0L), 1e-15);
+    // ln 0 = -inf + 0i на всех путях, как у std::log
+    for (C zero : {ln.eval_with({{"z", C(0.0L)}}), FlatExpression<C>(ln).eval({{"z", C(0.0L)}})}) {
+        EXPECT_EQ(zero.real(), -std::numeric_limits<long double>::infinity());
+        EXPECT_EQ(zero.imag(), 0.0L);
+    }
+    EXPECT_NEAR(FlatExpression<C>(ln).eval({{"z", C(0.0L, -2.0L)}}).imag(), -std::acos(-1.0L) / 2, 1e-15);
+
+    std::vector<double> re{-1.0, 0.0, 3.0, 0.0}, im{-0.0, -2.0, 4.0, 0.0};
+    std::vector<double> out_re(4), out_im(4);
+    ComplexBatchEvaluator(FlatExpression<C>(ln)).eval({{"z", {re.data(), im.data()}}}, 4, out_re.data(), out_im.data());
+    for (std::size_t i = 0; i < 3; ++i) {
+        std::complex<double> expected = std::log(std::complex<double>(re[i], im[i]));
+        EXPECT_NEAR(out_re[i], expected.real(), 1e-15);
+        EXPECT_NEAR(out_im[i], expected.imag(), 1e-15);
+    }
+    EXPECT_EQ(out_re[3], -std::numeric_limits<double>::infinity());
+    EXPECT_EQ(out_im[3], 0.0);
+}
+
+TEST(ComplexBatchEvaluatorTest, PrincipalBranchSquareRoot) {
+    using C = std::complex<long double>;
+    FlatExpression<C> root(Expression<C>::from_string("z ^ 0.5", true));
+    const double inf = std::numeric_limits<double>::infinity();
+    // Разрез по отрицательной полуоси, ноль, крайние модули и бесконечность
+    std::vector<double> re{3.0, -3.0, -3.0, -1.0, -1.0, 0.0, 1e-200, -1e300, 2.5, inf, 0.0},
+        im{4.0, 4.0, -4.0, 0.0, -0.0, 0.0, -1e-200, 1e300, 0.0, 1.0, -inf};
+    std::vector<double> out_re(re.size()), out_im(re.size());
+    for (auto mode : {ComplexBatchEvaluator::NanMode::Strict, ComplexBatchEvaluator::NanMode::Relaxed}) {
+        ComplexBatchEvaluator(root, mode).eval({{"z", {re.data(), im.data()}}}, re.size(), out_re.data(), out_im.data());
+        for (std::size_t i = 0; i < re.size(); ++i) {
+            std::complex<double> expected = std::sqrt(std::complex<double>(re[i], im[i]));
+            EXPECT_DOUBLE_EQ(out_re[i], expected.real()) << i;
+            EXPECT_DOUBLE_EQ(out_im[i], expected.imag()) << i;
+            EXPECT_EQ(std::signbit(out_im[i]), std::signbit(expected.imag())) << i;
+        }
+    }
+}
+
+
+// Потоковое вычисление: куски меньше файла, поэтому проверяются и границы кусков
+TEST(StreamEvaluatorTest, CsvSkipsUnusedColumns) {
+    const std::string path = ::testing::TempDir() + "stream.csv";
+    {
+        std::ofstream out(path);
+        out << "y, label ,x\r\n";
+        for (int i = 0; i < 10; ++i)
+            out << 0.5 * i << "," << "row" << i << "," << (i % 2 ? "+" : "") << i + 1 << "\r\n";
+        out << "\n";
+    }
+    auto expr = Expression<long double>::from_string("x * y + sin(x)", true);
+    StreamEvaluator stream(FlatExpression<long double>(expr.diff("x")), Accuracy::Ulp1, 3);
+    std::stringstream out;
+    EXPECT_EQ(stream.eval_csv(path, out, "d"), 10u);
+
+    std::string line;
+    std::getline(out, line);
+    EXPECT_EQ(line, "d");
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(std::getline(out, line));
+        EXPECT_NEAR(std::stod(line), 0.5 * i + std::cos(i + 1.0), 1e-15) << i;
+    }
+    EXPECT_FALSE(std::getline(out, line));
+
+    std::stringstream ignored;
+    StreamEvaluator missing(FlatExpression<long double>(Expression<long double>::from_string("z", true)));
+    EXPECT_THROW(missing.eval_csv(path, ignored), std::runtime_error);
+    std::ofstream(path, std::ios::app) << "1,2,x\n";
+    EXPECT_THROW(stream.eval_csv(path, ignored), std::runtime_error);
+    std::remove(path.c_str());
+}
+
+TEST(StreamEvaluatorTest, BinaryColumnsAreReadInPlace) {
+    const std::string path = ::testing::TempDir() + "stream.bin";
+    const std::size_t rows = 1001;
+    std::vector<double> data(3 * rows);
+    for (std::size_t i = 0; i < rows; ++i) {
+        data[i] = 1.0 + i;
+        data[rows + i] = -1.0;
+        data[2 * rows + i] = 0.001 * i;
+    }
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char *>(data.data()), data.size() * sizeof(double));
+
+    auto expr = Expression<long double>::from_string("exp(t) / n", true);
+    StreamEvaluator stream(FlatExpression<long double>(expr), Accuracy::Ulp1, 300);
+    EXPECT_EQ(stream.variables().size(), 2u);
+    std::stringstream out;
+    EXPECT_EQ(stream.eval_binary(path, {"n", "unused", "t"}, out), rows);
+    const std::string bytes = out.str();
+    ASSERT_EQ(bytes.size(), rows * sizeof(double));
+    std::vector<double> results(rows);
+    std::memcpy(results.data(), bytes.data(), bytes.size());
+    for (std::size_t i = 0; i < rows; ++i)
+        EXPECT_NEAR(results[i], std::exp(0.001 * i) / (1.0 + i), 1e-15) << i;
+
+    std::stringstream ignored;
+    EXPECT_THROW(stream.eval_binary(path, {"n", "t"}, ignored), std::runtime_error);
+    EXPECT_THROW(stream.eval_binary(path, {"n", "x", "y"}, ignored), std::runtime_error);
+    std::remove(path.c_str());
+}
+
+// Тесты для интервальной арифметики
+TEST(IntervalTest, EnclosesSampledRange) {
+    auto expr = Expression<long double>::from_string(
+        "sin(3 * x) * cos(y) + exp(x) / (2 + y ^ 2) - ln(x + 3) * x ^ 0.5 + (x - y) ^ 3", true);
+    FlatExpression<long double> flat(expr);
+    IntervalEvaluator evaluator(flat);
+    Box box{{"x", {0.2L, 1.7L}}, {"y", {-1.0L, 0.5L}}};
+    Interval range = evaluator.eval(box);
+    ASSERT_FALSE(range.is_empty());
+    for (int i = 0; i <= 50; ++i) {
+        for (int j = 0; j <= 50; ++j) {
+            long double x = 0.2L + 1.5L * i / 50, y = -1.0L + 1.5L * j / 50;
+            EXPECT_TRUE(range.contains(flat.eval({{"x", x}, {"y", y}})));
+        }
+    }
+}
+
+TEST(IntervalTest, MonotonicPiecesAndDomains) {
+    auto range = [](const std::string& text, Interval x) {
+        return IntervalEvaluator(FlatExpression<long double>(Expression<long double>::from_string(text, true))).eval({{"x", x}});
+    };
+    Interval sine = range("sin(x)", {0.0L, 2.0L});
+    EXPECT_EQ(sine.hi, 1.0L);
+    EXPECT_NEAR(sine.lo, 0.0L, 1e-18);
+    Interval cosine = range("cos(x)", {3.0L, 3.5L});
+    EXPECT_EQ(cosine.lo, -1.0L);
+    EXPECT_LT(cosine.hi, -0.93L);
+    Interval square = range("x ^ 2", {-1.0L, 2.0L});
+    EXPECT_EQ(square.lo, 0.0L);
+    EXPECT_NEAR(square.hi, 4.0L, 1e-15);
+    EXPECT_TRUE(range("ln(x)", {-2.0L, -1.0L}).is_empty());
+    EXPECT_EQ(range("ln(x)", {-2.0L, 1.0L}).lo, -std::numeric_limits<long double>::infinity());
+    EXPECT_TRUE(std::isinf(range("1 / x", {-1.0L, 1.0L}).hi));
+    Interval exponent = range("exp(x)", {0.0L, 1.0L});
+    EXPECT_LE(exponent.lo, 1.0L);
+    EXPECT_GE(exponent.hi, std::exp(1.0L));
+}
+
+TEST(IntervalTest, GlobalMinimumAndRoots) {
+    auto f = Expression<long double>::from_string("sin(3 * x) * cos(2 * y) + (x ^ 2 + y ^ 2) / 10", true);
+    auto minimum = global_minimum(f, {{"x", {-5.0L, 5.0L}}, {"y", {-5.0L, 5.0L}}}, 1e-9L);
+    EXPECT_LE(minimum.lower, minimum.upper);
+    EXPECT_LE(minimum.upper - minimum.lower, 1e-9L);
+    ASSERT_EQ(minimum.argument.size(), 2u);
+    EXPECT_NEAR(f.eval_with({{"x", minimum.argument[0]}, {"y", minimum.argument[1]}}), minimum.upper, 1e-15);
+    for (int i = 0; i <= 100; ++i) {
+        for (int j = 0; j <= 100; ++j) {
+            long double x = -5.0L + i / 10.0L, y = -5.0L + j / 10.0L;
+            EXPECT_GE(f.eval_with({{"x", x}, {"y", y}}), minimum.lower);
+        }
+    }
+
+    auto g = Expression<long double>::from_string("sin(x) - x / 3", true);
+    auto roots = isolate_roots(g, {{"x", {-10.0L, 10.0L}}}, 1e-10L);
+    std::vector<long double> centres;
+    for (const auto& box : roots) {
+        if (centres.empty() || box[0].second.lo - centres.back() > 1e-6L)
+            centres.push_back(box[0].second.midpoint());
+    }
+    ASSERT_EQ(centres.size(), 3u);
+    EXPECT_NEAR(centres[0], -2.278862660075828L, 1e-9);
+    EXPECT_NEAR(centres[1], 0.0L, 1e-9);
+    EXPECT_NEAR(centres[2], 2.278862660075828L, 1e-9);
+}
+
+// При исчерпании max_boxes неисследованные области возвращаются целиком,
+// поэтому результат по-прежнему содержит все корни
+TEST(IntervalTest, RootBudgetKeepsUnexploredBoxes) {
+    auto f = Expression<long double>::from_string("sin(x)", true);
+    const Box domain{{"x", {0.5L, 100.0L}}};
+    auto contains_all_zeros = [](const std::vector<Box>& boxes) {
+        for (int k = 1; k <= 31; ++k) {
+            const long double zero = k * std::acos(-1.0L);
+            bool found = false;
+            for (const auto& box : boxes)
+                found |= box[0].second.contains(zero);
+            if (!found)
+                return false;
+        }
+        return true;
+    };
+
+    auto all = isolate_roots(f, domain, 1e-6L);
+    EXPECT_TRUE(contains_all_zeros(all));
+    for (const auto& box : all)
+        EXPECT_LE(box[0].second.width(), 1e-6L);
+
+    auto cut = isolate_roots(f, domain, 1e-6L, 50);
+    EXPECT_TRUE(contains_all_zeros(cut));
+    EXPECT_TRUE(std::any_of(cut.begin(), cut.end(), [](const Box& box) { return box[0].second.width() > 1e-6L; }));
+    for (std::size_t i = 1; i < cut.size(); ++i)
+        EXPECT_LE(cut[i - 1][0].second.hi, cut[i][0].second.lo);
+}
+
+
+TEST(SolverTest, NewtonAndDampedNewton) {
+    SystemSolver circle({
+        Expression<long double>::from_string("x ^ 2 + y ^ 2 - 4", true),
+        Expression<long double>::from_string("x - y", true)
+    }, {"x", "y"});
+    auto result = circle.newton({1.0L, 0.5L});
+    ASSERT_TRUE(result.converged);
+    EXPECT_NEAR(result.x[0], std::sqrt(2.0L), 1e-15);
+    EXPECT_NEAR(result.x[1], std::sqrt(2.0L), 1e-15);
+    EXPECT_LE(result.iterations, 8u);
+
+    // Шаг Ньютона для x / sqrt(1 + x^2) равен -x (1 + x^2) и при |x| > 1 уводит от корня
+    SystemSolver saturating({Expression<long double>::from_string("x / (1 + x ^ 2) ^ 0.5", true)}, {"x"});
+    EXPECT_FALSE(saturating.newton({2.0L}).converged);
+    auto damped = saturating.damped_newton({2.0L});
+    ASSERT_TRUE(damped.converged);
+    EXPECT_NEAR(damped.x[0], 0.0L, 1e-12);
+}
+
+TEST(SolverTest, LevenbergMarquardtLeastSquares) {
+    // a * exp(b t) по точкам, снятым с a = 2, b = 0.3
+    std::vector<Expression<long double>> residuals;
+    for (int i = 0; i < 10; ++i) {
+        long double t = i / 2.0L;
+        residuals.push_back(
+            Expression<long double>("a") * (Expression<long double>("b") * Expression<long double>(t)).exp()
+            - Expression<long double>(2.0L * std::exp(0.3L * t))
+        );
+    }
+    SystemSolver fit(residuals, {"a", "b"});
+    auto result = fit.levenberg_marquardt({1.0L, 0.0L});
+    ASSERT_TRUE(result.converged);
+    EXPECT_NEAR(result.x[0], 2.0L, 1e-10);
+    EXPECT_NEAR(result.x[1], 0.3L, 1e-10);
+
+    // Несовместная система: минимум |F| в x = y
+    SystemSolver inconsistent({
+        Expression<long double>::from_string("x ^ 2 + y ^ 2 - 4", true),
+        Expression<long double>::from_string("x - y", true),
+        Expression<long double>::from_string("x + y - 2.8", true)
+    }, {"x", "y"});
+    auto least = inconsistent.levenberg_marquardt({1.0L, 0.5L});
+    ASSERT_TRUE(least.converged);
+    EXPECT_GT(least.residual, 0.02L);
+    EXPECT_NEAR(least.x[0], least.x[1], 1e-9);
+    EXPECT_THROW(inconsistent.newton({1.0L, 0.5L}), std::invalid_argument);
+}
+
+TEST(SolverTest, MinimizesRosenbrock) {
+    Minimizer rosenbrock(
+        Expression<long double>::from_string("(1 - x) ^ 2 + 100 * (y - x ^ 2) ^ 2", true), {"x", "y"}
+    );
+    for (auto result : {rosenbrock.bfgs({-1.2L, 1.0L}), rosenbrock.newton({-1.2L, 1.0L})}) {
+        ASSERT_TRUE(result.converged);
+        EXPECT_NEAR(result.x[0], 1.0L, 1e-10);
+        EXPECT_NEAR(result.x[1], 1.0L, 1e-10);
+    }
+}
+
+// В точке старта y = 0 вторая производная x * y ^ 1.5 по y равна -inf:
+// Ньютон делает шаг по градиенту вместо бесконечного сдвига гессиана
+TEST(SolverTest, NewtonWithNonFiniteHessian) {
+    Minimizer minimizer(Expression<long double>::from_string("x ^ 2 + y ^ 2 + x * y ^ 1.5", true), {"x", "y"});
+    auto result = minimizer.newton({-1.0L, 0.0L});
+    ASSERT_TRUE(result.converged);
+    EXPECT_NEAR(result.x[0], 0.0L, 1e-10);
+    EXPECT_NEAR(result.x[1], 0.0L, 1e-10);
+}
+
 
 // Тест для чисел
 TEST(LexerTest, HandlesNumbers) {
@@ -340,6 +1593,38 @@ TEST(LexerTest, ThrowsOnUnexpectedSymbol) {
     }, std::runtime_error);
 }
 
+// Лексер читает входную строку на месте и приводит регистр по ходу
+TEST(LexerTest, ScansViewInPlace) {
+    const std::string text = "SIN(Xy) + Exp(0.25)*ln(sinx)";
+    Lexer<long double> lexer{std::string_view(text)};
+    std::vector<Token> expected_tokens = {
+        {Function, "sin("}, {Identifier, "xy"}, {RightParen, ")"}, {Operator, "+"},
+        {Function, "exp("}, {RealNumber, "0.25"}, {RightParen, ")"}, {Operator, "*"},
+        {Function, "ln("}, {Identifier, "sinx"}, {RightParen, ")"}, {EOL, "EOL"}
+    };
+    check_tokens(lexer, expected_tokens);
+    EXPECT_EQ(text, "SIN(Xy) + Exp(0.25)*ln(sinx)");
+
+    Lexer<long double> keep_case(std::string_view("Xy COS( 007"), true);
+    check_tokens(keep_case, {{Identifier, "Xy"}, {Function, "cos("}, {RealNumber, "0"}, {RealNumber, "0"}, {RealNumber, "7"}});
+}
+
+TEST(ParserTest, ParseFromMappedFile) {
+    const std::string path = ::testing::TempDir() + "expression_from_file.txt";
+    {
+        std::ofstream out(path);
+        out << "x ^ 2 * sin(y)\n+ 3 * x\n";
+    }
+    auto expr = Expression<long double>::from_file(path, true);
+    EXPECT_NEAR(expr.eval_with({{"x", 2.0L}, {"y", 0.5L}}), 4.0L * std::sin(0.5L) + 6.0L, 1e-15);
+    std::remove(path.c_str());
+    EXPECT_THROW(Expression<long double>::from_file(path, true), std::runtime_error);
+
+    std::ofstream(path).close();
+    EXPECT_THROW(Expression<long double>::from_file(path, true), std::runtime_error);
+    std::remove(path.c_str());
+}
+
 
 
 // Тесты для разбора простых выражений
@@ -361,6 +1646,21 @@ TEST(ParserTest, ParseParentheses) {
     EXPECT_NEAR(expr.eval(), 20.0, 1e-9); // Проверяем, что (2 + 3) * 4 = 20
 }
 
+TEST(ParserTest, DeeplyNestedParentheses) {
+    // Рекурсивный разбор переполнял стек на такой глубине
+    const std::size_t depth = 100000;
+    std::string text;
+    for (std::size_t k = 0; k < depth; ++k)
+        text += k % 2 == 0 ? "(" : "cos(";
+    text += "x * 1";
+    text += std::string(depth, ')');
+    auto expr = Expression<long double>::from_string(text, false);
+    EXPECT_NEAR(expr.eval_with({{"x", 1.0L}}), 0.7390851332151607L, 1e-12);
+    EXPECT_THROW(Expression<long double>::from_string(text + ")", false), std::runtime_error);
+    text.pop_back();
+    EXPECT_THROW(Expression<long double>::from_string(text, false), std::runtime_error);
+}
+
 // Тесты для функций
 TEST(ParserTest, ParseSinFunction) {
     Parser<long double> parser("sin(0)");